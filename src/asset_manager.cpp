@@ -0,0 +1,168 @@
+// Implement the class in asset_manager.h
+#include "asset_manager.h"
+#include "graphics_utility.h"
+#include "thread_placement.h"
+
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+namespace {
+
+// Parse an obj file, it runs on a worker thread
+std::shared_ptr<const MeshData> parseModel(
+	const std::string& input_filename,
+	VertexFormat format) {
+	// Not on the CPU or at the priority of the render thread
+	unplaceCurrentThread("model-loader");
+	std::shared_ptr<MeshData> mesh_data = std::make_shared<MeshData>();
+	if (!loadObj(input_filename, mesh_data->vertices, mesh_data->normals)) {
+		std::fprintf(stderr, "Failed to load %s.\n", input_filename.c_str());
+		return nullptr;
+	}
+
+	// Compress the vertices here, so the render thread only uploads them
+	if (format != VertexFormat::Float32) {
+		compressMesh(mesh_data->vertices, mesh_data->normals,
+			format, mesh_data->compact);
+		mesh_data->is_compact = true;
+		std::vector<glm::vec3>().swap(mesh_data->vertices);
+		std::vector<glm::vec3>().swap(mesh_data->normals);
+	}
+	return mesh_data;
+}
+
+// A small cube (0.1 in model space) shown while a model is loading
+void buildPlaceholderCube(
+	std::vector<glm::vec3>& output_vertices,
+	std::vector<glm::vec3>& output_normals) {
+	const float half = 0.05f;
+	// Each face: normal axis, sign
+	for (int axis = 0; axis < 3; axis++) {
+		for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f) {
+			glm::vec3 normal(0.0f, 0.0f, 0.0f);
+			normal[axis] = sign;
+
+			// The other two axes of the face, ordered counter-clockwise
+			int u_axis = (axis + 1) % 3;
+			int v_axis = (axis + 2) % 3;
+			if (sign < 0.0f) {
+				std::swap(u_axis, v_axis);
+			}
+
+			glm::vec3 corners[4];
+			const float u_signs[4] = { -1.0f, 1.0f, 1.0f, -1.0f };
+			const float v_signs[4] = { -1.0f, -1.0f, 1.0f, 1.0f };
+			for (int i = 0; i < 4; i++) {
+				corners[i][axis] = sign * half;
+				corners[i][u_axis] = u_signs[i] * half;
+				corners[i][v_axis] = v_signs[i] * half;
+			}
+
+			const int indices[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int index : indices) {
+				output_vertices.push_back(corners[index]);
+				output_normals.push_back(normal);
+			}
+		}
+	}
+}
+
+} // namespace
+
+AssetManager::~AssetManager() {
+	for (auto& model : models_) {
+		deleteMesh(model.second.mesh);
+	}
+	deleteMesh(placeholder_mesh_);
+}
+
+// Start parsing an obj file on a worker thread and return at once
+std::shared_future<std::shared_ptr<const MeshData>>
+AssetManager::loadModelAsync(
+	const std::string& model_name,
+	const std::string& input_filename) {
+	Model& model = models_[model_name];
+	deleteMesh(model.mesh);
+	model.is_uploaded = false;
+	model.data = std::async(std::launch::async, parseModel,
+		input_filename, vertex_format_);
+	return model.data;
+}
+
+// The vertex layout of the models loaded after this call
+void AssetManager::setVertexFormat(VertexFormat format) {
+	vertex_format_ = format;
+}
+
+// Put the models into the shared buffers of the renderer
+void AssetManager::setSceneRenderer(SceneRenderer* scene_renderer) {
+	scene_renderer_ = scene_renderer;
+}
+
+// Draw the model on the marker with this id
+void AssetManager::assignModel(int marker_id, const std::string& model_name) {
+	marker_models_[marker_id] = model_name;
+}
+
+// Draw the model on markers which have no assigned model
+void AssetManager::setDefaultModel(const std::string& model_name) {
+	default_model_ = model_name;
+}
+
+// Upload the models which have finished loading
+void AssetManager::uploadReadyModels() {
+	for (auto& named_model : models_) {
+		Model& model = named_model.second;
+		if (model.is_uploaded || !model.data.valid() ||
+			model.data.wait_for(std::chrono::seconds(0)) !=
+			std::future_status::ready) {
+			continue;
+		}
+
+		std::shared_ptr<const MeshData> mesh_data = model.data.get();
+		if (mesh_data && scene_renderer_ != nullptr) {
+			if (mesh_data->is_compact) {
+				scene_renderer_->addMesh(mesh_data->compact, model.mesh);
+			} else {
+				scene_renderer_->addMesh(
+					mesh_data->vertices, mesh_data->normals, model.mesh);
+			}
+		} else if (mesh_data && mesh_data->is_compact) {
+			uploadCompactMesh(mesh_data->compact, model.mesh);
+		} else if (mesh_data) {
+			uploadMesh(mesh_data->vertices, mesh_data->normals, model.mesh);
+		}
+		// A model which has failed keeps the placeholder
+		model.is_uploaded = true;
+	}
+}
+
+// The mesh to draw on a marker, or the placeholder if it is not ready
+const GpuMesh& AssetManager::meshForMarker(int marker_id) {
+	auto marker_model = marker_models_.find(marker_id);
+	const std::string& model_name = marker_model != marker_models_.end() ?
+		marker_model->second : default_model_;
+
+	auto model = models_.find(model_name);
+	if (model != models_.end() && model->second.mesh.vertex_count > 0) {
+		return model->second.mesh;
+	}
+
+	return placeholderMesh();
+}
+
+// The cube drawn for models which are not ready or too small to see
+const GpuMesh& AssetManager::placeholderMesh() {
+	// Build the placeholder the first time it is needed
+	if (placeholder_mesh_.vertex_count == 0) {
+		std::vector<glm::vec3> vertices, normals;
+		buildPlaceholderCube(vertices, normals);
+		if (scene_renderer_ != nullptr) {
+			scene_renderer_->addMesh(vertices, normals, placeholder_mesh_);
+		} else {
+			uploadMesh(vertices, normals, placeholder_mesh_);
+		}
+	}
+	return placeholder_mesh_;
+}
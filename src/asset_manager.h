@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef ASSET_MANAGER
+#define ASSET_MANAGER
+
+#include "draw_graphics.h"
+#include "graphics_utility.h"
+#include "scene_renderer.h"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// The vertices and normals of a mesh, parsed on a worker thread
+// With a compact vertex format, only "compact" is filled
+struct MeshData {
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	bool is_compact = false;
+	CompactMeshData compact;
+};
+
+// Load models on worker threads, and upload them on the render thread
+// Until a model is ready, a small placeholder cube is drawn instead
+class AssetManager {
+public:
+	AssetManager() = default;
+	~AssetManager();
+
+	AssetManager(const AssetManager&) = delete;
+	AssetManager& operator=(const AssetManager&) = delete;
+
+	// Start parsing an obj file on a worker thread and return at once
+	// The future gives nullptr if the file cannot be loaded
+	std::shared_future<std::shared_ptr<const MeshData>> loadModelAsync(
+		const std::string& model_name,
+		const std::string& input_filename);
+
+	// The vertex layout of the models loaded after this call
+	// A compact layout is produced on the worker thread
+	void setVertexFormat(VertexFormat format);
+
+	// Put the models into the shared buffers of the renderer instead of
+	// buffers of their own, so they are drawn with "addDraw"
+	// Call it before any model is uploaded
+	void setSceneRenderer(SceneRenderer* scene_renderer);
+
+	// Draw the model on the marker with this id
+	void assignModel(int marker_id, const std::string& model_name);
+
+	// Draw the model on markers which have no assigned model
+	void setDefaultModel(const std::string& model_name);
+
+	// Upload the models which have finished loading
+	// It must be called on the thread which owns the OpenGL context,
+	// and it never waits for a worker
+	void uploadReadyModels();
+
+	// The mesh to draw on a marker, or the placeholder if it is not ready
+	const GpuMesh& meshForMarker(int marker_id);
+
+	// A cube of 12 triangles with a half size of 0.05,
+	// drawn for models which are not ready or too small to see
+	const GpuMesh& placeholderMesh();
+
+private:
+	struct Model {
+		std::shared_future<std::shared_ptr<const MeshData>> data;
+		GpuMesh mesh;
+		bool is_uploaded = false;
+	};
+
+	std::map<std::string, Model> models_;
+	std::map<int, std::string> marker_models_;
+	std::string default_model_;
+	VertexFormat vertex_format_ = VertexFormat::Float32;
+	SceneRenderer* scene_renderer_ = nullptr;
+	GpuMesh placeholder_mesh_;
+};
+
+#endif // !ASSET_MANAGER
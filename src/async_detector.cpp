@@ -0,0 +1,191 @@
+// Implement the functions in async_detector.h
+#include "async_detector.h"
+#include "marker_detection.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+
+AsyncMarkerDetector::AsyncMarkerDetector(const AsyncDetectorSettings& settings)
+	: settings_(settings) {
+	settings_.num_of_worker = std::max(settings_.num_of_worker, 1u);
+	settings_.max_in_flight = std::max<size_t>(settings_.max_in_flight, 1);
+	for (unsigned int i = 0; i < settings_.num_of_worker; i++) {
+		workers_.emplace_back(&AsyncMarkerDetector::workerLoop, this);
+	}
+}
+
+AsyncMarkerDetector::~AsyncMarkerDetector() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = true;
+	}
+	job_queued_.notify_all();
+	for (std::thread& worker : workers_) {
+		worker.join();
+	}
+}
+
+// Copy the frame into a free buffer and queue it
+std::uint64_t AsyncMarkerDetector::submit(const cv::Mat& input_frame) {
+	if (input_frame.empty()) {
+		return INVALID_DETECTION_TICKET;
+	}
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (is_stopping_ || tickets_.size() >= settings_.max_in_flight) {
+		return INVALID_DETECTION_TICKET;
+	}
+	Job job;
+	job.ticket = next_ticket_++;
+	job.submit_time = std::chrono::steady_clock::now();
+	if (!free_frames_.empty()) {
+		job.frame = std::move(free_frames_.back());
+		free_frames_.pop_back();
+	}
+	tickets_[job.ticket];
+
+	// The copy is done outside the lock, the buffer is not shared yet
+	lock.unlock();
+	input_frame.copyTo(job.frame);
+	std::uint64_t ticket = job.ticket;
+	lock.lock();
+	queued_jobs_.push_back(std::move(job));
+	lock.unlock();
+	job_queued_.notify_one();
+	return ticket;
+}
+
+bool AsyncMarkerDetector::poll(
+	std::uint64_t ticket,
+	DetectionResult& output_result) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto found = tickets_.find(ticket);
+	if (found == tickets_.end() || !found->second.is_ready) {
+		return false;
+	}
+	collect(found, output_result);
+	return true;
+}
+
+// The oldest ticket is the first one in the map
+bool AsyncMarkerDetector::pollNext(DetectionResult& output_result) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (tickets_.empty() || !tickets_.begin()->second.is_ready) {
+		return false;
+	}
+	collect(tickets_.begin(), output_result);
+	return true;
+}
+
+bool AsyncMarkerDetector::pollAny(DetectionResult& output_result) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (ready_tickets_.empty()) {
+		return false;
+	}
+	collect(tickets_.find(ready_tickets_.front()), output_result);
+	return true;
+}
+
+bool AsyncMarkerDetector::wait(
+	std::uint64_t ticket,
+	DetectionResult& output_result) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	auto found = tickets_.find(ticket);
+	// Find it again after every wake up, in case another thread took it
+	result_ready_.wait(lock, [this, ticket, &found]() {
+		found = tickets_.find(ticket);
+		return found == tickets_.end() || found->second.is_ready;
+	});
+	if (found == tickets_.end()) {
+		return false;
+	}
+	collect(found, output_result);
+	return true;
+}
+
+bool AsyncMarkerDetector::notifyWhenReady(
+	std::uint64_t ticket,
+	std::function<void()> continuation) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto found = tickets_.find(ticket);
+	if (found == tickets_.end() || found->second.is_ready) {
+		return false;
+	}
+	found->second.continuation = std::move(continuation);
+	return true;
+}
+
+size_t AsyncMarkerDetector::numInFlight() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return tickets_.size();
+}
+
+void AsyncMarkerDetector::collect(
+	std::map<std::uint64_t, Ticket>::iterator ticket,
+	DetectionResult& output_result) {
+	// At most "max_in_flight" tickets are ready, so the search is short
+	ready_tickets_.erase(std::find(
+		ready_tickets_.begin(), ready_tickets_.end(), ticket->first));
+	output_result = std::move(ticket->second.result);
+	tickets_.erase(ticket);
+}
+
+// Detect the queued frames until the detector is destroyed
+void AsyncMarkerDetector::workerLoop() {
+	placeCurrentThread(PipelineStage::Detection, "async-detect");
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		job_queued_.wait(lock, [this]() {
+			return is_stopping_ || !queued_jobs_.empty();
+		});
+		if (queued_jobs_.empty()) {
+			// Stopping, and every frame is detected
+			return;
+		}
+		Job job = std::move(queued_jobs_.front());
+		queued_jobs_.pop_front();
+
+		lock.unlock();
+		DetectionResult result;
+		result.ticket = job.ticket;
+		detectFrame(job.frame, result);
+		lock.lock();
+		// Taken under the lock, so the ready times follow "ready_tickets_"
+		result.ready_time = std::chrono::steady_clock::now();
+		result.latency_ms = std::chrono::duration<double, std::milli>(
+			result.ready_time - job.submit_time).count();
+
+		free_frames_.push_back(std::move(job.frame));
+		Ticket& ticket = tickets_[job.ticket];
+		ticket.is_ready = true;
+		ticket.result = std::move(result);
+		ready_tickets_.push_back(job.ticket);
+		std::function<void()> continuation = std::move(ticket.continuation);
+		result_ready_.notify_all();
+
+		// The awaiter collects the result itself, which takes the lock
+		if (continuation) {
+			lock.unlock();
+			continuation();
+			lock.lock();
+		}
+	}
+}
+
+// Detect with the configuration of this detector, not the global one
+void AsyncMarkerDetector::detectFrame(
+	const cv::Mat& frame,
+	DetectionResult& output_result) const {
+	if (settings_.use_chessboard) {
+		detctChessboardAndEstimatePose(frame, settings_.calibration,
+			output_result.marker_poses);
+		return;
+	}
+	DetectionOptions options;
+	options.scale = settings_.scale;
+	options.corner_refinement_iterations =
+		settings_.corner_refinement_iterations;
+	options.calibration = &settings_.calibration;
+	options.marker_set = &settings_.marker_set;
+	detectMarkersAndEstimatePose(frame, options,
+		output_result.marker_poses, output_result.marker_ids);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#ifndef ASYNC_DETECTOR
+#define ASYNC_DETECTOR
+
+#include "camera_calibration.h"
+#include "marker_set.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define ASYNC_DETECTOR_COROUTINE
+#endif
+
+// A ticket which is never given out, "submit" returns it on failure
+#define INVALID_DETECTION_TICKET 0ULL
+
+// Everything a detector needs, copied into the detector,
+// so several detectors with other cameras or markers can run in one process
+struct AsyncDetectorSettings {
+	// The camera of the frames
+	CameraCalibration calibration = defaultCameraCalibration();
+	// The markers to detect and their lengths (the ones in parameters.h
+	// unless "setActiveMarkerSet" was called)
+	// The dictionary is always DICT_6X6_250, its hash table is built
+	// at compile time (see marker_decoder.h)
+	MarkerSet marker_set = activeMarkerSet();
+	// Detect the chessboard instead of the markers
+	bool use_chessboard = false;
+	// See DetectionOptions in marker_detection.h
+	double scale = 1.0;
+	int corner_refinement_iterations = 0;
+	// Frames which are detected at the same time
+	unsigned int num_of_worker = 2;
+	// Tickets which are submitted and not collected yet,
+	// "submit" fails when there are this many
+	size_t max_in_flight = 8;
+};
+
+// The markers of one submitted frame
+struct DetectionResult {
+	std::uint64_t ticket = INVALID_DETECTION_TICKET;
+	// 4x4 poses for OpenGL, as "detectMarkersAndEstimatePose" gives them
+	std::vector<cv::Mat> marker_poses;
+	// Empty for the chessboard
+	std::vector<int> marker_ids;
+	// Time from the submission until the result was ready
+	double latency_ms = 0.0;
+	// When the result was ready, "pollAny" gives results in this order
+	std::chrono::steady_clock::time_point ready_time;
+};
+
+// A detector which owns its configuration and detects on its own threads
+// "submit" copies the frame and returns at once with a ticket, and the
+// result is collected later by the ticket, in the order of submission,
+// or whichever is ready first, so a service thread never waits for
+// detection unless it asks to
+// Every method can be called from any thread
+// Each ticket is collected once, by exactly one of "poll", "pollNext",
+// "pollAny", "wait" or an awaiter
+class AsyncMarkerDetector {
+public:
+	explicit AsyncMarkerDetector(
+		const AsyncDetectorSettings& settings = AsyncDetectorSettings());
+	// The frames which are submitted are still detected
+	// (and their awaiters resumed) before the workers stop
+	~AsyncMarkerDetector();
+
+	AsyncMarkerDetector(const AsyncMarkerDetector&) = delete;
+	AsyncMarkerDetector& operator=(const AsyncMarkerDetector&) = delete;
+
+	// Queue a frame (BGR or grayscale), which can be reused as soon as
+	// this returns
+	// If "max_in_flight" tickets are not collected yet or the frame is
+	// empty, return INVALID_DETECTION_TICKET
+	std::uint64_t submit(const cv::Mat& input_frame);
+
+	// If the result of "ticket" is ready, give it and return true
+	bool poll(std::uint64_t ticket, DetectionResult& output_result);
+
+	// If the oldest ticket which is not collected is ready, give it and
+	// return true, so results come out in the order of submission
+	bool pollNext(DetectionResult& output_result);
+
+	// If any result is ready, give the one which was ready first and
+	// return true
+	bool pollAny(DetectionResult& output_result);
+
+	// Block until the result of "ticket" is ready
+	// If the ticket is not in flight, return false
+	bool wait(std::uint64_t ticket, DetectionResult& output_result);
+
+	// Call "continuation" once the result of "ticket" is ready, on the
+	// worker which detected it (see the hazards at "Awaiter")
+	// If the result is ready already or the ticket is not in flight,
+	// it is not called, and return false
+	bool notifyWhenReady(
+		std::uint64_t ticket,
+		std::function<void()> continuation);
+
+	// Tickets which are submitted and not collected yet
+	size_t numInFlight() const;
+
+	const AsyncDetectorSettings& settings() const { return settings_; }
+
+#ifdef ASYNC_DETECTOR_COROUTINE
+	// Resume a coroutine with the result of a ticket, e.g.
+	//   DetectionResult result = co_await detector.detect(ticket, post);
+	// "executor" is given the resumption, and should run it on a thread
+	// of the caller (e.g. post it to an event loop), an invalid ticket
+	// gives a result with INVALID_DETECTION_TICKET
+	// Without an executor the coroutine is resumed on the detection
+	// worker, and until it suspends again:
+	// - the worker detects nothing, so a coroutine which calls "wait"
+	//   there blocks it, and "num_of_worker" of them deadlock the detector
+	// - it must not destroy the detector, whose destructor would join
+	//   the worker it runs on
+	class Awaiter {
+	public:
+		Awaiter(
+			AsyncMarkerDetector& detector,
+			std::uint64_t ticket,
+			std::function<void(std::function<void()>)> executor)
+			: detector_(detector), ticket_(ticket),
+			executor_(std::move(executor)) {}
+
+		bool await_ready() {
+			return detector_.poll(ticket_, result_);
+		}
+		bool await_suspend(std::coroutine_handle<> handle) {
+			return detector_.notifyWhenReady(ticket_,
+				[handle, executor = executor_]() {
+					if (executor) {
+						executor([handle]() { handle.resume(); });
+					} else {
+						handle.resume();
+					}
+				});
+		}
+		DetectionResult await_resume() {
+			if (result_.ticket == INVALID_DETECTION_TICKET) {
+				detector_.poll(ticket_, result_);
+			}
+			return std::move(result_);
+		}
+
+	private:
+		AsyncMarkerDetector& detector_;
+		std::uint64_t ticket_;
+		std::function<void(std::function<void()>)> executor_;
+		DetectionResult result_;
+	};
+
+	Awaiter detect(
+		std::uint64_t ticket,
+		std::function<void(std::function<void()>)> executor = nullptr) {
+		return Awaiter(*this, ticket, std::move(executor));
+	}
+#endif
+
+private:
+	struct Job {
+		std::uint64_t ticket;
+		cv::Mat frame;
+		std::chrono::steady_clock::time_point submit_time;
+	};
+	struct Ticket {
+		bool is_ready = false;
+		DetectionResult result;
+		std::function<void()> continuation;
+	};
+
+	void workerLoop();
+	void detectFrame(const cv::Mat& frame, DetectionResult& output_result) const;
+	// Move the result of a ready ticket out, the mutex must be held
+	void collect(
+		std::map<std::uint64_t, Ticket>::iterator ticket,
+		DetectionResult& output_result);
+
+	AsyncDetectorSettings settings_;
+
+	std::deque<Job> queued_jobs_;
+	// Frames whose detection is done, to be reused by "submit"
+	std::vector<cv::Mat> free_frames_;
+	// Every ticket in flight, by the order of submission
+	std::map<std::uint64_t, Ticket> tickets_;
+	// Tickets which are ready and not collected, in the order they were ready
+	std::deque<std::uint64_t> ready_tickets_;
+	std::uint64_t next_ticket_ = INVALID_DETECTION_TICKET + 1;
+	bool is_stopping_ = false;
+
+	mutable std::mutex mutex_;
+	std::condition_variable job_queued_;
+	std::condition_variable result_ready_;
+	std::vector<std::thread> workers_;
+};
+
+#endif // !ASYNC_DETECTOR
@@ -0,0 +1,202 @@
+// Implement the functions in batch_processing.h
+#include "batch_processing.h"
+#include "marker_detection.h"
+#include "pose_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+// Each segment has at least this many frames,
+// since every segment needs to open and seek the video
+const int min_frames_per_segment = 64;
+
+struct Segment {
+	int first_frame;
+	// One past the last frame, or -1 for the end of the video
+	int last_frame;
+	std::vector<PoseRecord> records;
+	// False if the video could not be opened, seeked or read to the end
+	// of the segment
+	bool is_complete;
+};
+
+// Decode and detect all frames of one segment
+// If a frame of the segment cannot be read, return false
+bool processSegment(
+	const std::string& input_video_filename,
+	bool use_chessboard,
+	double frames_per_second,
+	Segment& segment) {
+	cv::VideoCapture capture(input_video_filename);
+	if (!capture.isOpened()) {
+		std::fprintf(stderr, "Failed to open %s.\n",
+			input_video_filename.c_str());
+		return false;
+	}
+	if (segment.first_frame > 0 &&
+		!capture.set(cv::CAP_PROP_POS_FRAMES, segment.first_frame)) {
+		std::fprintf(stderr, "Failed to seek %s to frame %d.\n",
+			input_video_filename.c_str(), segment.first_frame);
+		return false;
+	}
+
+	cv::Mat frame;
+	std::vector<cv::Mat> marker_poses;
+	std::vector<int> marker_ids;
+	for (int frame_index = segment.first_frame;
+		segment.last_frame < 0 || frame_index < segment.last_frame;
+		frame_index++) {
+		if (!capture.read(frame)) {
+			// Only the last segment reads until the end of the video
+			if (segment.last_frame < 0) {
+				break;
+			}
+			std::fprintf(stderr, "Failed to read frame %d of %s.\n",
+				frame_index, input_video_filename.c_str());
+			return false;
+		}
+		// The same conversion as the interactive loop
+		cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
+
+		if (use_chessboard) {
+			detctChessboardAndEstimatePose(frame, marker_poses);
+			marker_ids.assign(marker_poses.size(), -1);
+		} else {
+			detectMarkersAndEstimatePose(frame, marker_poses, marker_ids);
+		}
+
+		double timestamp_ms = frames_per_second > 0.0 ?
+			frame_index * 1000.0 / frames_per_second :
+			capture.get(cv::CAP_PROP_POS_MSEC);
+
+		for (size_t i = 0; i < marker_poses.size(); i++) {
+			PoseRecord record;
+			std::memset(&record, 0, sizeof(record));
+			record.frame_index = static_cast<std::uint64_t>(frame_index);
+			record.timestamp_ms = timestamp_ms;
+			record.marker_id = marker_ids[i];
+			// The poses are 4x4 continuous float matrices
+			std::memcpy(record.pose, marker_poses[i].ptr<float>(0),
+				sizeof(record.pose));
+			segment.records.push_back(record);
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+// Detect markers in every frame of a recorded video on all cores
+bool processVideoToPoseLog(
+	const std::string& input_video_filename,
+	const std::string& output_log_filename,
+	bool use_chessboard,
+	unsigned int num_of_worker) {
+	cv::VideoCapture capture(input_video_filename);
+	if (!capture.isOpened()) {
+		std::fprintf(stderr, "Failed to open %s.\n",
+			input_video_filename.c_str());
+		return false;
+	}
+	int num_of_frame =
+		static_cast<int>(capture.get(cv::CAP_PROP_FRAME_COUNT));
+	double frames_per_second = capture.get(cv::CAP_PROP_FPS);
+	capture.release();
+
+	if (num_of_worker == 0) {
+		num_of_worker = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Several segments per worker, so a slow segment does not
+	// leave the other workers idle at the end
+	std::vector<Segment> segments;
+	if (num_of_frame <= 0) {
+		// The length is unknown, so the video cannot be split
+		segments.push_back(Segment{ 0, -1, {}, false });
+	} else {
+		int num_of_segment = std::max(1, std::min(
+			static_cast<int>(num_of_worker) * 4,
+			num_of_frame / min_frames_per_segment));
+		for (int i = 0; i < num_of_segment; i++) {
+			int first_frame = static_cast<int>(
+				static_cast<long long>(num_of_frame) * i / num_of_segment);
+			int last_frame = static_cast<int>(
+				static_cast<long long>(num_of_frame) * (i + 1) /
+				num_of_segment);
+			// The last segment reads until the end, in case
+			// the frame count of the container is not exact
+			if (i == num_of_segment - 1) {
+				last_frame = -1;
+			}
+			segments.push_back(Segment{ first_frame, last_frame, {}, false });
+		}
+	}
+
+	// Every worker decodes its own segments, so OpenCV's own threads
+	// would only oversubscribe the cores
+	int previous_num_of_thread = cv::getNumThreads();
+	cv::setNumThreads(1);
+
+	std::chrono::steady_clock::time_point start_time =
+		std::chrono::steady_clock::now();
+
+	std::atomic<size_t> next_segment(0);
+	std::vector<std::thread> workers;
+	unsigned int num_of_thread = std::min(num_of_worker,
+		static_cast<unsigned int>(segments.size()));
+	for (unsigned int i = 0; i < num_of_thread; i++) {
+		workers.emplace_back([&]() {
+			for (size_t index = next_segment++; index < segments.size();
+				index = next_segment++) {
+				segments[index].is_complete = processSegment(
+					input_video_filename, use_chessboard,
+					frames_per_second, segments[index]);
+			}
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	cv::setNumThreads(previous_num_of_thread);
+
+	// A log with a gap would look complete to its readers
+	size_t num_of_failed_segment = std::count_if(
+		segments.begin(), segments.end(),
+		[](const Segment& segment) { return !segment.is_complete; });
+	if (num_of_failed_segment > 0) {
+		std::fprintf(stderr, "Failed to process %zu of %zu segments, "
+			"%s is not written.\n", num_of_failed_segment, segments.size(),
+			output_log_filename.c_str());
+		return false;
+	}
+
+	// Segments are in the order of frames, so the log is sorted
+	std::vector<PoseRecord> records;
+	for (const Segment& segment : segments) {
+		records.insert(records.end(),
+			segment.records.begin(), segment.records.end());
+	}
+
+	double duration = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start_time).count();
+	std::printf("Processed %d frames in %zu segments on %u threads "
+		"in %.2f s, %zu poses\n", num_of_frame, segments.size(),
+		num_of_thread, duration, records.size());
+
+	if (!writePoseLog(output_log_filename, records)) {
+		std::fprintf(stderr, "Failed to write %s.\n",
+			output_log_filename.c_str());
+		return false;
+	}
+	return true;
+}
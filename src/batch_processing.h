@@ -0,0 +1,20 @@
+#pragma once
+
+#ifndef BATCH_PROCESSING
+#define BATCH_PROCESSING
+
+#include <string>
+
+// Detect markers (or the chessboard) in every frame of a recorded video,
+// and write all poses into a pose log (see pose_log.h)
+// The video is split into segments which are decoded and detected by
+// independent workers, one per core if "num_of_worker" is 0
+// If any segment cannot be opened, seeked or read, no log is written
+// If fail, return false
+bool processVideoToPoseLog(
+	const std::string& input_video_filename,
+	const std::string& output_log_filename,
+	bool use_chessboard,
+	unsigned int num_of_worker = 0);
+
+#endif // !BATCH_PROCESSING
@@ -0,0 +1,105 @@
+// Implement the functions in camera_calibration.h
+#include "camera_calibration.h"
+#include "parameters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <opencv2/opencv.hpp>
+
+// The calibration of my PC's internal camera (see parameters.h)
+const CameraCalibration& defaultCameraCalibration() {
+	static const CameraCalibration calibration = []() {
+		CameraCalibration default_calibration;
+		std::copy(intrinsic_parameters, intrinsic_parameters + 9,
+			default_calibration.intrinsic_parameters);
+		std::copy(distortion_coefficients, distortion_coefficients + 5,
+			default_calibration.distortion_coefficients);
+		// It is calibrated for 1280x720
+		default_calibration.image_width = 1280;
+		default_calibration.image_height = 720;
+		return default_calibration;
+	}();
+	return calibration;
+}
+
+// Read the camera matrix and the distortion coefficients
+bool loadCameraCalibration(
+	const std::string& input_filename,
+	CameraCalibration& output_calibration) {
+	cv::FileStorage file(input_filename, cv::FileStorage::READ);
+	if (!file.isOpened()) {
+		std::fprintf(stderr, "Failed to open %s.\n", input_filename.c_str());
+		return false;
+	}
+	cv::Mat camera_matrix, distortion;
+	file["camera_matrix"] >> camera_matrix;
+	file["distortion_coefficients"] >> distortion;
+	if (camera_matrix.total() != 9) {
+		std::fprintf(stderr, "%s is not a valid calibration.\n",
+			input_filename.c_str());
+		return false;
+	}
+	// The other models would be cut down to k1..k3 and give wrong poses
+	if (distortion.total() != 4 && distortion.total() != 5) {
+		std::fprintf(stderr, "%s has %zu distortion coefficients, "
+			"only 4 or 5 are supported.\n",
+			input_filename.c_str(), distortion.total());
+		return false;
+	}
+
+	camera_matrix.convertTo(camera_matrix, CV_32F);
+	distortion.convertTo(distortion, CV_32F);
+	std::copy(camera_matrix.ptr<float>(), camera_matrix.ptr<float>() + 9,
+		output_calibration.intrinsic_parameters);
+	// Models without k3 have 4 coefficients
+	std::fill(output_calibration.distortion_coefficients,
+		output_calibration.distortion_coefficients + 5, 0.0f);
+	std::copy(distortion.ptr<float>(),
+		distortion.ptr<float>() + distortion.total(),
+		output_calibration.distortion_coefficients);
+
+	// Unknown if the file does not have them
+	output_calibration.image_width = 0;
+	output_calibration.image_height = 0;
+	if (!file["image_width"].empty() && !file["image_height"].empty()) {
+		file["image_width"] >> output_calibration.image_width;
+		file["image_height"] >> output_calibration.image_height;
+	}
+	return true;
+}
+
+// Scale the focal lengths and the principal point to the frame size
+bool fitCameraCalibration(
+	int frame_width,
+	int frame_height,
+	CameraCalibration& calibration) {
+	// Nothing to fit if a size is unknown
+	if (frame_width <= 0 || frame_height <= 0 ||
+		calibration.image_width <= 0 || calibration.image_height <= 0 ||
+		(calibration.image_width == frame_width &&
+			calibration.image_height == frame_height)) {
+		return true;
+	}
+	double scale_x = static_cast<double>(frame_width) /
+		calibration.image_width;
+	double scale_y = static_cast<double>(frame_height) /
+		calibration.image_height;
+	if (std::abs(scale_x - scale_y) > 0.01 * scale_x) {
+		std::fprintf(stderr, "The frames of %dx%d do not have the aspect "
+			"ratio of the calibration (%dx%d).\n", frame_width, frame_height,
+			calibration.image_width, calibration.image_height);
+		return false;
+	}
+	// fx, cx and fy, cy (the matrix is row by row), the principal point
+	// is mapped by the pixel centers
+	float* parameters = calibration.intrinsic_parameters;
+	parameters[0] *= static_cast<float>(scale_x);
+	parameters[2] = static_cast<float>((parameters[2] + 0.5) * scale_x - 0.5);
+	parameters[4] *= static_cast<float>(scale_y);
+	parameters[5] = static_cast<float>((parameters[5] + 0.5) * scale_y - 0.5);
+	calibration.image_width = frame_width;
+	calibration.image_height = frame_height;
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef CAMERA_CALIBRATION
+#define CAMERA_CALIBRATION
+
+#include <string>
+
+// The calibration of one camera
+struct CameraCalibration {
+	// 3x3 matrix, row by row
+	float intrinsic_parameters[9];
+	// k1, k2, p1, p2, k3
+	float distortion_coefficients[5];
+	// The size of the images it was calibrated with, 0 if unknown
+	int image_width = 0;
+	int image_height = 0;
+};
+
+// The calibration of my PC's internal camera (see parameters.h)
+const CameraCalibration& defaultCameraCalibration();
+
+// Read "camera_matrix", "distortion_coefficients", "image_width" and
+// "image_height" from a file written by "cv::FileStorage" (e.g. by the
+// calibration sample of OpenCV)
+// Only the models with 4 or 5 coefficients are supported, the rational,
+// thin-prism and tilted models (8, 12 or 14) are rejected
+// If fail, return false
+bool loadCameraCalibration(
+	const std::string& input_filename,
+	CameraCalibration& output_calibration);
+
+// Fit a calibration to frames of another size: the intrinsic parameters
+// are scaled if the frames have the aspect ratio of the calibration
+// If the aspect ratio differs (the frames are cropped), return false
+bool fitCameraCalibration(
+	int frame_width,
+	int frame_height,
+	CameraCalibration& calibration);
+
+#endif // !CAMERA_CALIBRATION
@@ -1,8 +1,11 @@
 #include "draw_graphics.h"
 #include "graphics_utility.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -12,11 +15,13 @@
 #include <glm/gtc/type_ptr.hpp>
 
 // Initialize GLFW, GLEW
-bool initializeGL(GLFWwindow*& window) {
+bool initializeGL(GLFWwindow*& window, bool is_visible) {
 	// Initialise GLFW
 	if (!glfwInit()) {
 		std::fprintf(stderr, "Failed to initialize GLFW.\n");
-		std::getchar();
+		if (is_visible) {
+			std::getchar();
+		}
 		// Fail
 		return false;
 	}
@@ -24,13 +29,16 @@ bool initializeGL(GLFWwindow*& window) {
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, is_visible ? GLFW_TRUE : GLFW_FALSE);
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow(1280, 720,
 		"Marker Based Augmented Reality", NULL, NULL);
 	if (window == NULL) {
 		std::fprintf(stderr, "Failed to open GLFW window.\n");
-		std::getchar();
+		if (is_visible) {
+			std::getchar();
+		}
 		glfwTerminate();
 		// Fail
 		return false;
@@ -41,7 +49,9 @@ bool initializeGL(GLFWwindow*& window) {
 	glewExperimental = true; // Needed for core profile
 	if (glewInit() != GLEW_OK) {
 		std::fprintf(stderr, "Failed to initialize GLEW.\n");
-		std::getchar();
+		if (is_visible) {
+			std::getchar();
+		}
 		glfwTerminate();
 		// Fail
 		return false;
@@ -65,8 +75,23 @@ bool initializeGL(GLFWwindow*& window) {
 void buildProjection(
 	const cv::Mat& input_frame,
 	glm::mat4& output_projection) {
-	GLint frame_width = input_frame.cols;
-	GLint frame_height = input_frame.rows;
+	buildProjection(input_frame.size(), output_projection);
+}
+
+// The same as the previous one, for a frame of the given size
+void buildProjection(
+	cv::Size frame_size,
+	glm::mat4& output_projection) {
+	buildProjection(defaultCameraCalibration(), frame_size, output_projection);
+}
+
+// The same as the previous one, for another camera
+void buildProjection(
+	const CameraCalibration& calibration,
+	cv::Size frame_size,
+	glm::mat4& output_projection) {
+	GLint frame_width = frame_size.width;
+	GLint frame_height = frame_size.height;
 
 	// 4x4 Projection matrix of current frame
 	float projection_matrix[16];
@@ -77,13 +102,13 @@ void buildProjection(
 	float clipping_far = 100.0f;
 
 	// (Camera parameters) Focal length in x axis
-	float focal_length_x = 9.4721585489646418e+02f;
+	float focal_length_x = calibration.intrinsic_parameters[0];
 	// (Camera parameters) Focal length in y axis
-	float focal_length_y = 9.4984601436177400e+02f;
+	float focal_length_y = calibration.intrinsic_parameters[4];
 	// (Camera parameters) Principle point in x axis
-	float principle_point_x = 6.5256929713596503e+02f;
+	float principle_point_x = calibration.intrinsic_parameters[2];
 	// (Camera parameters) Principle point in y axis
-	float principle_point_y = 3.6638013113209280e+02f;
+	float principle_point_y = calibration.intrinsic_parameters[5];
 
 	projection_matrix[0] = 2.0f * focal_length_x / frame_width;
 	projection_matrix[1] = 0.0f;
@@ -140,93 +165,124 @@ GLuint mat2texture(const cv::Mat& input_image) {
 	return texture_id;
 }
 
-// Draw the frame (background) captured by my PC's internal camera
-void drawBackground(const cv::Mat& input_image, const GLuint& program_id) {
-	GLuint background_vertex_array_id;
-	glGenVertexArrays(1, &background_vertex_array_id);
-	glBindVertexArray(background_vertex_array_id);
-
-	const GLfloat background_vertex_buffer_data[] = {
-		-1.0f, -1.0f, 0.0f,
-		1.0f, -1.0f, 0.0f,
-		-1.0f, 1.0f, 0.0f,
-
-		1.0f, 1.0f, 0.0f,
-		-1.0f, 1.0f, 0.0f,
-		1.0f, -1.0f, 0.0f
-	};
-	
-	const GLfloat background_uv_buffer_data[] = {
-		0.0f, 0.0f,
-		1.0f, 0.0f,
-		0.0f, 1.0f,
-
-		1.0f, 1.0f,
-		0.0f, 1.0f,
-		1.0f, 0.0f
-	};
-
-	GLuint background_vertex_buffer;
-	glGenBuffers(1, &background_vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, background_vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(background_vertex_buffer_data),
-		background_vertex_buffer_data, GL_STATIC_DRAW);
-
-	GLuint background_uv_buffer;
-	glGenBuffers(1, &background_uv_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, background_uv_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(background_uv_buffer_data),
-		background_uv_buffer_data, GL_STATIC_DRAW);
+// Draw the frame (background) captured by a camera
+// The quad and the texture are created only once,
+// then only the pixels of the texture are replaced for each frame
+void drawBackground(
+	const cv::Mat& input_image,
+	const GLuint& program_id,
+	BackgroundTexture& texture) {
+	if (texture.vertex_array_id == 0) {
+		glGenVertexArrays(1, &texture.vertex_array_id);
+		glBindVertexArray(texture.vertex_array_id);
+
+		const GLfloat background_vertex_buffer_data[] = {
+			-1.0f, -1.0f, 0.0f,
+			1.0f, -1.0f, 0.0f,
+			-1.0f, 1.0f, 0.0f,
+
+			1.0f, 1.0f, 0.0f,
+			-1.0f, 1.0f, 0.0f,
+			1.0f, -1.0f, 0.0f
+		};
+
+		// The first row of the image is the top of the screen,
+		// so v is flipped instead of the image
+		const GLfloat background_uv_buffer_data[] = {
+			0.0f, 1.0f,
+			1.0f, 1.0f,
+			0.0f, 0.0f,
+
+			1.0f, 0.0f,
+			0.0f, 0.0f,
+			1.0f, 1.0f
+		};
+
+		// 1st attribute buffer : vertices
+		glGenBuffers(1, &texture.vertex_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, texture.vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(background_vertex_buffer_data),
+			background_vertex_buffer_data, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+		// 2nd attribute buffer : UVs
+		glGenBuffers(1, &texture.uv_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, texture.uv_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(background_uv_buffer_data),
+			background_uv_buffer_data, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	}
+
+	if (texture.texture_id == 0) {
+		glGenTextures(1, &texture.texture_id);
+		glBindTexture(GL_TEXTURE_2D, texture.texture_id);
+		// The frame is drawn at its own size, so mipmaps are not needed
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture.texture_id);
+
+	// Rows of a pooled frame may be padded, which ROW_LENGTH can only
+	// describe if the step is a whole number of pixels
+	bool is_step_in_pixels = input_image.step % input_image.elemSize() == 0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, is_step_in_pixels ?
+		static_cast<GLint>(input_image.step / input_image.elemSize()) : 0);
+
+	// Only allocate the texture again if the size of frame has changed
+	if (input_image.cols != texture.width ||
+		input_image.rows != texture.height) {
+		texture.width = input_image.cols;
+		texture.height = input_image.rows;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
+			texture.width, texture.height, 0,
+			GL_RGB, GL_UNSIGNED_BYTE,
+			is_step_in_pixels ? input_image.data : NULL);
+	} else if (is_step_in_pixels) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+			texture.width, texture.height,
+			GL_RGB, GL_UNSIGNED_BYTE, input_image.data);
+	}
+	if (!is_step_in_pixels) {
+		// Otherwise the rows are uploaded one by one
+		for (int row = 0; row < input_image.rows; row++) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row,
+				texture.width, 1,
+				GL_RGB, GL_UNSIGNED_BYTE, input_image.ptr(row));
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
 	// Use the shaders
 	glUseProgram(program_id);
-
-	GLuint texture = mat2texture(input_image);
 	GLuint texture_id = glGetUniformLocation(program_id,
 		"background_texture_sampler");
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture);
 	glUniform1i(texture_id, 0);
 
-	// 1st attribute buffer : vertices
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, background_vertex_buffer);
-	glVertexAttribPointer(
-		0,
-		3,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-		);
-
-	// 2nd attribute buffer : UVs
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, background_uv_buffer);
-	glVertexAttribPointer(
-		1,
-		2,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-		);
-
 	// Draw the triangle !
+	glBindVertexArray(texture.vertex_array_id);
 	glDrawArrays(GL_TRIANGLES, 0, 2 * 3);
+	glBindVertexArray(0);
+}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-
-	glDeleteTextures(1, &texture);
-
-	/** If they are deleted here, graphics cannot be drawn on background
-	glDeleteProgram(program_id);
-	glDeleteBuffers(1, &background_uv_buffer);
-	glDeleteBuffers(1, &background_vertex_buffer);
-	glDeleteVertexArrays(1, &background_vertex_array_id);
-	*/
+// Delete the texture and the quad
+void deleteBackgroundTexture(BackgroundTexture& texture) {
+	if (texture.texture_id != 0) {
+		glDeleteTextures(1, &texture.texture_id);
+	}
+	if (texture.vertex_array_id != 0) {
+		glDeleteVertexArrays(1, &texture.vertex_array_id);
+		glDeleteBuffers(1, &texture.vertex_buffer);
+		glDeleteBuffers(1, &texture.uv_buffer);
+	}
+	texture = BackgroundTexture();
 }
 
 // Draw the bunny in ply file with random color
@@ -346,6 +402,14 @@ void drawShadingBunny(
 	glm::vec3 lightPos = glm::vec3(-3, -4, 1);
 	glUniform3f(light_id, lightPos.x, lightPos.y, lightPos.z);
 
+	// Float vertices do not need to be decoded
+	glUniform3f(glGetUniformLocation(program_id, "PositionOffset"),
+		0.0f, 0.0f, 0.0f);
+	glUniform3f(glGetUniformLocation(program_id, "PositionScale"),
+		1.0f, 1.0f, 1.0f);
+	glUniform1i(glGetUniformLocation(program_id, "CompactNormals"), 0);
+	glUniform1i(glGetUniformLocation(program_id, "MarkerIndex"), -1);
+
 	// 1st attribute buffer : vertices
 	glEnableVertexAttribArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
@@ -381,3 +445,290 @@ void drawShadingBunny(
 	glDeleteVertexArrays(1, &vertex_array_id);
 	*/
 }
+
+// Upload the vertices and normals of a mesh once
+void uploadMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<glm::vec3>& normals,
+	GpuMesh& output_mesh) {
+	deleteMesh(output_mesh);
+
+	glGenVertexArrays(1, &output_mesh.vertex_array_id);
+	glBindVertexArray(output_mesh.vertex_array_id);
+
+	// 1st attribute buffer : vertices
+	glGenBuffers(1, &output_mesh.vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, output_mesh.vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3),
+		vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	// 2nd attribute buffer : normals
+	glGenBuffers(1, &output_mesh.normal_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, output_mesh.normal_buffer);
+	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3),
+		normals.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	glBindVertexArray(0);
+
+	output_mesh.vertex_count = static_cast<GLsizei>(vertices.size());
+	output_mesh.bounds_min = glm::vec3(0.0f, 0.0f, 0.0f);
+	output_mesh.bounds_max = glm::vec3(0.0f, 0.0f, 0.0f);
+	if (!vertices.empty()) {
+		output_mesh.bounds_min = vertices[0];
+		output_mesh.bounds_max = vertices[0];
+		for (const glm::vec3& vertex : vertices) {
+			output_mesh.bounds_min = glm::min(output_mesh.bounds_min, vertex);
+			output_mesh.bounds_max = glm::max(output_mesh.bounds_max, vertex);
+		}
+	}
+}
+
+// Upload a mesh in a compact vertex layout
+void uploadCompactMesh(
+	const CompactMeshData& compact_mesh,
+	GpuMesh& output_mesh) {
+	deleteMesh(output_mesh);
+
+	glGenVertexArrays(1, &output_mesh.vertex_array_id);
+	glBindVertexArray(output_mesh.vertex_array_id);
+
+	// Positions and normals are interleaved in one buffer
+	glGenBuffers(1, &output_mesh.vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, output_mesh.vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, compact_mesh.vertex_data.size(),
+		compact_mesh.vertex_data.data(), GL_STATIC_DRAW);
+
+	// 1st attribute : 16-bit unsigned normalized positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+		compact_mesh.stride, (void*)0);
+
+	// 3rd attribute : octahedral normals in 8 or 16 bits
+	GLenum normal_type = compact_mesh.format == VertexFormat::Compact8 ?
+		GL_BYTE : GL_SHORT;
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, normal_type, GL_TRUE,
+		compact_mesh.stride, (void*)6);
+
+	glBindVertexArray(0);
+
+	output_mesh.vertex_count =
+		static_cast<GLsizei>(compact_mesh.vertex_count);
+	output_mesh.has_compact_normals = true;
+	output_mesh.position_offset = compact_mesh.bounds_min;
+	output_mesh.position_scale = compact_mesh.bounds_extent;
+	output_mesh.bounds_min = compact_mesh.bounds_min;
+	output_mesh.bounds_max =
+		compact_mesh.bounds_min + compact_mesh.bounds_extent;
+}
+
+// Delete the buffers of an uploaded mesh
+void deleteMesh(GpuMesh& mesh) {
+	if (mesh.normal_buffer != 0) {
+		glDeleteBuffers(1, &mesh.normal_buffer);
+	}
+	if (mesh.vertex_buffer != 0) {
+		glDeleteBuffers(1, &mesh.vertex_buffer);
+	}
+	if (mesh.vertex_array_id != 0) {
+		glDeleteVertexArrays(1, &mesh.vertex_array_id);
+	}
+	mesh = GpuMesh();
+}
+
+// Draw an uploaded mesh with specular shading
+void drawShadingMesh(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	const glm::mat4& view_matrix,
+	const glm::mat4& projection_matrix,
+	const GLuint& program_id) {
+	if (mesh.vertex_count == 0 || mesh.vertex_array_id == 0) {
+		return;
+	}
+
+	glUseProgram(program_id);
+
+	GLuint matrix_id = glGetUniformLocation(program_id, "MVP");
+	GLuint view_matrix_id = glGetUniformLocation(program_id, "V");
+	GLuint model_matrix_id = glGetUniformLocation(program_id, "M");
+	GLuint light_id =
+		glGetUniformLocation(program_id, "LightPosition_worldspace");
+
+	glm::mat4 mvp = projection_matrix * view_matrix * model_matrix;
+	glUniformMatrix4fv(matrix_id, 1, GL_FALSE, &mvp[0][0]);
+	glUniformMatrix4fv(model_matrix_id, 1, GL_FALSE, &model_matrix[0][0]);
+	glUniformMatrix4fv(view_matrix_id, 1, GL_FALSE, &view_matrix[0][0]);
+
+	glm::vec3 lightPos = glm::vec3(-3, -4, 1);
+	glUniform3f(light_id, lightPos.x, lightPos.y, lightPos.z);
+
+	// How to decode the vertices
+	glUniform3f(glGetUniformLocation(program_id, "PositionOffset"),
+		mesh.position_offset.x, mesh.position_offset.y,
+		mesh.position_offset.z);
+	glUniform3f(glGetUniformLocation(program_id, "PositionScale"),
+		mesh.position_scale.x, mesh.position_scale.y,
+		mesh.position_scale.z);
+	glUniform1i(glGetUniformLocation(program_id, "CompactNormals"),
+		mesh.has_compact_normals ? 1 : 0);
+	// Use "V" and "MVP" instead of a latched pose
+	glUniform1i(glGetUniformLocation(program_id, "MarkerIndex"), -1);
+
+	glBindVertexArray(mesh.vertex_array_id);
+	glDrawArrays(GL_TRIANGLES, 0, mesh.vertex_count);
+	glBindVertexArray(0);
+}
+
+// The arrays of the shaders hold exactly the poses of the buffer
+std::string shadingShaderDefines() {
+	return "#define MAX_DRAWN_MARKERS " +
+		std::to_string(MAX_DRAWN_MARKERS) + "\n";
+}
+
+// Create the buffer, and bind the "MarkerPoses" block of the programs
+void createPoseUniformBuffer(
+	const std::vector<GLuint>& program_ids,
+	PoseUniformBuffer& output_buffer) {
+	deletePoseUniformBuffer(output_buffer);
+
+	const GLsizeiptr region_size = MAX_DRAWN_MARKERS * sizeof(glm::mat4);
+	glGenBuffers(1, &output_buffer.buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, output_buffer.buffer);
+	if (GLEW_ARB_buffer_storage) {
+		// Coherent mapping: writes are seen by the GPU without flushing
+		GLbitfield flags =
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, 3 * region_size, NULL, flags);
+		output_buffer.mapped_data = static_cast<unsigned char*>(
+			glMapBufferRange(GL_UNIFORM_BUFFER, 0, 3 * region_size, flags));
+	} else {
+		glBufferData(GL_UNIFORM_BUFFER, 3 * region_size, NULL,
+			GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	for (GLuint program_id : program_ids) {
+		GLuint block_index =
+			glGetUniformBlockIndex(program_id, "MarkerPoses");
+		if (block_index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program_id, block_index,
+				MARKER_POSES_BINDING);
+		}
+	}
+}
+
+// Write the poses of this frame into the next free region, and bind it
+void latchMarkerPoses(
+	const std::vector<cv::Mat>& marker_poses,
+	PoseUniformBuffer& pose_buffer) {
+	const GLsizeiptr region_size = MAX_DRAWN_MARKERS * sizeof(glm::mat4);
+	pose_buffer.current_region = (pose_buffer.current_region + 1) % 3;
+	int region = pose_buffer.current_region;
+	GLintptr region_offset = region * region_size;
+
+	size_t num_of_pose = std::min(marker_poses.size(),
+		static_cast<size_t>(MAX_DRAWN_MARKERS));
+	glm::mat4 views[MAX_DRAWN_MARKERS];
+	for (size_t i = 0; i < num_of_pose; i++) {
+		// The poses are already column-major for OpenGL
+		views[i] = glm::make_mat4(
+			reinterpret_cast<const GLfloat*>(marker_poses[i].data));
+	}
+
+	if (pose_buffer.mapped_data != nullptr) {
+		// Wait until the GPU has finished reading this region,
+		// which is normally already true two frames later
+		if (pose_buffer.fences[region] != 0) {
+			glClientWaitSync(pose_buffer.fences[region],
+				GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(pose_buffer.fences[region]);
+			pose_buffer.fences[region] = 0;
+		}
+		std::memcpy(pose_buffer.mapped_data + region_offset, views,
+			num_of_pose * sizeof(glm::mat4));
+	} else {
+		glBindBuffer(GL_UNIFORM_BUFFER, pose_buffer.buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, region_offset,
+			num_of_pose * sizeof(glm::mat4), views);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, MARKER_POSES_BINDING,
+		pose_buffer.buffer, region_offset, region_size);
+}
+
+// Mark the region as used by the GPU, call it after the markers are drawn
+void finishMarkerPoses(PoseUniformBuffer& pose_buffer) {
+	if (pose_buffer.mapped_data == nullptr) {
+		return;
+	}
+	int region = pose_buffer.current_region;
+	if (pose_buffer.fences[region] != 0) {
+		glDeleteSync(pose_buffer.fences[region]);
+	}
+	pose_buffer.fences[region] =
+		glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void deletePoseUniformBuffer(PoseUniformBuffer& pose_buffer) {
+	for (GLsync& fence : pose_buffer.fences) {
+		if (fence != 0) {
+			glDeleteSync(fence);
+		}
+	}
+	if (pose_buffer.buffer != 0) {
+		if (pose_buffer.mapped_data != nullptr) {
+			glBindBuffer(GL_UNIFORM_BUFFER, pose_buffer.buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &pose_buffer.buffer);
+	}
+	pose_buffer = PoseUniformBuffer();
+}
+
+// Draw an uploaded mesh on the marker with the latched pose "marker_index"
+void drawShadingMeshOnMarker(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	size_t marker_index,
+	const glm::mat4& projection_matrix,
+	const GLuint& program_id) {
+	if (mesh.vertex_count == 0 || mesh.vertex_array_id == 0 ||
+		marker_index >= MAX_DRAWN_MARKERS) {
+		return;
+	}
+
+	glUseProgram(program_id);
+
+	// The view matrix is read from the "MarkerPoses" block
+	glUniform1i(glGetUniformLocation(program_id, "MarkerIndex"),
+		static_cast<GLint>(marker_index));
+	glUniformMatrix4fv(glGetUniformLocation(program_id, "P"), 1, GL_FALSE,
+		&projection_matrix[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(program_id, "M"), 1, GL_FALSE,
+		&model_matrix[0][0]);
+
+	glm::vec3 lightPos = glm::vec3(-3, -4, 1);
+	glUniform3f(glGetUniformLocation(program_id, "LightPosition_worldspace"),
+		lightPos.x, lightPos.y, lightPos.z);
+
+	// How to decode the vertices
+	glUniform3f(glGetUniformLocation(program_id, "PositionOffset"),
+		mesh.position_offset.x, mesh.position_offset.y,
+		mesh.position_offset.z);
+	glUniform3f(glGetUniformLocation(program_id, "PositionScale"),
+		mesh.position_scale.x, mesh.position_scale.y,
+		mesh.position_scale.z);
+	glUniform1i(glGetUniformLocation(program_id, "CompactNormals"),
+		mesh.has_compact_normals ? 1 : 0);
+
+	glBindVertexArray(mesh.vertex_array_id);
+	glDrawArrays(GL_TRIANGLES, 0, mesh.vertex_count);
+	glBindVertexArray(0);
+}
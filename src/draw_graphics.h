@@ -3,6 +3,7 @@
 #ifndef DRAW_GRAPHICS
 #define DRAW_GRAPHICS
 
+#include <string>
 #include <vector>
 
 #define GLEW_STATIC
@@ -12,20 +13,56 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "graphics_utility.h"
+#include "camera_calibration.h"
+
 // Initialize OpenGL
-bool initializeGL(GLFWwindow*& window);
+// A hidden window only gives the context for offscreen rendering
+bool initializeGL(GLFWwindow*& window, bool is_visible = true);
 
 // Build the projection matrix for rendering on current frame
 void buildProjection(
 	const cv::Mat& input_frame,
 	glm::mat4& output_projection);
 
+// The same as the previous one, for a frame of the given size
+// (the size the poses are estimated in, if the frame is shown smaller)
+void buildProjection(
+	cv::Size frame_size,
+	glm::mat4& output_projection);
+
+// The same as the previous one, for another camera
+void buildProjection(
+	const CameraCalibration& calibration,
+	cv::Size frame_size,
+	glm::mat4& output_projection);
+
 // Turn a cv::Mat into a texture, and return the texture ID as a GLuint
 // It's for OpenGL to draw the frame captured by camera
 GLuint mat2texture(const cv::Mat& input_image);
 
-// Draw the frame captured by my PC's internal camera
-void drawBackground(const cv::Mat& input_image, const GLuint& program_id);
+// The texture a camera frame is drawn from, and the quad it is drawn on
+// Created by the first "drawBackground" in the current context,
+// and freed by "deleteBackgroundTexture" before the context is destroyed
+struct BackgroundTexture {
+	GLuint texture_id = 0;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLuint vertex_array_id = 0;
+	GLuint vertex_buffer = 0;
+	GLuint uv_buffer = 0;
+};
+
+// Draw the frame captured by a camera into the texture of that camera,
+// so the frames of several cameras do not overwrite each other
+// The image keeps the top-left origin of OpenCV,
+// it is flipped by the texture coordinates instead of "cv::flip"
+void drawBackground(
+	const cv::Mat& input_image,
+	const GLuint& program_id,
+	BackgroundTexture& texture);
+
+void deleteBackgroundTexture(BackgroundTexture& texture);
 
 // Draw the bunny in ply file with random colors
 void drawColorBunny(
@@ -44,4 +81,90 @@ void drawShadingBunny(
 	const glm::mat4& projection_matrix,
 	const GLuint& program_id);
 
+// The buffers of a mesh which has been uploaded to the GPU
+struct GpuMesh {
+	GLuint vertex_array_id = 0;
+	GLuint vertex_buffer = 0;
+	GLuint normal_buffer = 0;
+	GLsizei vertex_count = 0;
+	// Compact vertices are decoded in the vertex shader
+	bool has_compact_normals = false;
+	glm::vec3 position_offset = glm::vec3(0.0f, 0.0f, 0.0f);
+	glm::vec3 position_scale = glm::vec3(1.0f, 1.0f, 1.0f);
+	// The bounding box of the vertices, in model coordinates
+	glm::vec3 bounds_min = glm::vec3(0.0f, 0.0f, 0.0f);
+	glm::vec3 bounds_max = glm::vec3(0.0f, 0.0f, 0.0f);
+	// The index of the mesh in the shared buffers of a SceneRenderer,
+	// such a mesh has no buffers of its own (see scene_renderer.h)
+	int scene_mesh = -1;
+};
+
+// Upload the vertices and normals of a mesh once,
+// so they do not need to be sent again for every draw
+// It must be called on the thread which owns the OpenGL context
+void uploadMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<glm::vec3>& normals,
+	GpuMesh& output_mesh);
+
+// Upload a mesh in a compact vertex layout
+void uploadCompactMesh(
+	const CompactMeshData& compact_mesh,
+	GpuMesh& output_mesh);
+
+// Delete the buffers of an uploaded mesh
+void deleteMesh(GpuMesh& mesh);
+
+// Draw an uploaded mesh with specular shading
+void drawShadingMesh(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	const glm::mat4& view_matrix,
+	const glm::mat4& projection_matrix,
+	const GLuint& program_id);
+
+// The number of marker poses a uniform buffer holds
+#define MAX_DRAWN_MARKERS 64
+// The binding point of the "MarkerPoses" uniform block
+#define MARKER_POSES_BINDING 0
+
+// The defines of the shading shaders, which size their uniform blocks
+// by MAX_DRAWN_MARKERS (see ShaderProgramSource)
+std::string shadingShaderDefines();
+
+// The view matrices of all markers, written right before drawing
+// With GL_ARB_buffer_storage, the buffer is persistently mapped and
+// split into 3 regions, so the CPU writes one region while the GPU
+// still reads the others (each region is protected by a fence)
+struct PoseUniformBuffer {
+	GLuint buffer = 0;
+	unsigned char* mapped_data = nullptr;
+	GLsync fences[3] = { 0, 0, 0 };
+	int current_region = 0;
+};
+
+// Create the buffer, and bind the "MarkerPoses" block of the programs
+void createPoseUniformBuffer(
+	const std::vector<GLuint>& program_ids,
+	PoseUniformBuffer& output_buffer);
+
+// Write the poses of this frame into the next free region, and bind it
+// Call it as late as possible, right before the markers are drawn
+void latchMarkerPoses(
+	const std::vector<cv::Mat>& marker_poses,
+	PoseUniformBuffer& pose_buffer);
+
+// Mark the region as used by the GPU, call it after the markers are drawn
+void finishMarkerPoses(PoseUniformBuffer& pose_buffer);
+
+void deletePoseUniformBuffer(PoseUniformBuffer& pose_buffer);
+
+// Draw an uploaded mesh on the marker with the latched pose "marker_index"
+void drawShadingMeshOnMarker(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	size_t marker_index,
+	const glm::mat4& projection_matrix,
+	const GLuint& program_id);
+
 #endif // !DRAW_GRAPHICS
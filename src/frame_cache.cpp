@@ -0,0 +1,219 @@
+// Implement the functions in frame_cache.h
+#include "frame_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const size_t page_size = 4096;
+const size_t row_alignment = 64;
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+// Decode every frame of a video into a frame cache
+bool buildFrameCache(
+	const std::string& input_video_filename,
+	const std::string& output_cache_filename,
+	bool keep_color,
+	size_t max_num_of_frame) {
+	cv::VideoCapture capture(input_video_filename);
+	if (!capture.isOpened()) {
+		std::fprintf(stderr, "Failed to open %s.\n",
+			input_video_filename.c_str());
+		return false;
+	}
+	cv::Mat frame;
+	if (!capture.read(frame) || frame.empty()) {
+		std::fprintf(stderr, "%s has no frame.\n",
+			input_video_filename.c_str());
+		return false;
+	}
+
+	// The layout of a frame, the size of the first frame is kept
+	FrameCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = FRAME_CACHE_MAGIC;
+	header.version = FRAME_CACHE_VERSION;
+	header.header_size = static_cast<std::uint32_t>(
+		alignUp(sizeof(FrameCacheHeader), page_size));
+	header.width = static_cast<std::uint32_t>(frame.cols);
+	header.height = static_cast<std::uint32_t>(frame.rows);
+	header.grayscale_row_stride = static_cast<std::uint32_t>(
+		alignUp(frame.cols, row_alignment));
+	header.color_row_stride = keep_color ? static_cast<std::uint32_t>(
+		alignUp(frame.cols * 3, row_alignment)) : 0;
+	header.grayscale_offset = alignUp(sizeof(FrameCacheFrame), row_alignment);
+	size_t grayscale_end = header.grayscale_offset +
+		static_cast<size_t>(header.grayscale_row_stride) * frame.rows;
+	header.color_offset = keep_color ? alignUp(grayscale_end, row_alignment) : 0;
+	size_t frame_end = keep_color ? header.color_offset +
+		static_cast<size_t>(header.color_row_stride) * frame.rows :
+		grayscale_end;
+	header.frame_stride = alignUp(frame_end, page_size);
+	header.frames_per_second = capture.get(cv::CAP_PROP_FPS);
+
+	std::ofstream write_file(output_cache_filename,
+		std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!write_file.is_open()) {
+		std::fprintf(stderr, "Failed to open %s.\n",
+			output_cache_filename.c_str());
+		return false;
+	}
+	// The frame count is written again at the end
+	std::vector<unsigned char> header_page(header.header_size, 0);
+	std::memcpy(header_page.data(), &header, sizeof(header));
+	write_file.write(reinterpret_cast<const char*>(header_page.data()),
+		header_page.size());
+
+	// The planes are written in place in the frame buffer
+	cv::Size frame_size(frame.cols, frame.rows);
+	std::vector<unsigned char> frame_data(header.frame_stride, 0);
+	cv::Mat grayscale_plane(frame_size, CV_8UC1,
+		frame_data.data() + header.grayscale_offset,
+		header.grayscale_row_stride);
+	cv::Mat color_plane;
+	if (keep_color) {
+		color_plane = cv::Mat(frame_size, CV_8UC3,
+			frame_data.data() + header.color_offset, header.color_row_stride);
+	}
+
+	// The live loop converts each frame to RGB, then the detector
+	// converts it with COLOR_RGB2GRAY, so the cache does the same
+	cv::Mat rgb_frame;
+	std::uint64_t frame_index = 0;
+	do {
+		if (frame.size() != frame_size) {
+			cv::resize(frame, frame, frame_size);
+		}
+		FrameCacheFrame frame_info;
+		frame_info.frame_index = frame_index;
+		frame_info.timestamp_ms = header.frames_per_second > 0.0 ?
+			frame_index * 1000.0 / header.frames_per_second :
+			capture.get(cv::CAP_PROP_POS_MSEC);
+		std::memcpy(frame_data.data(), &frame_info, sizeof(frame_info));
+
+		// The planes have the size and type already,
+		// so they are written without reallocation
+		cv::cvtColor(frame, rgb_frame, cv::COLOR_BGR2RGB);
+		cv::cvtColor(rgb_frame, grayscale_plane, cv::COLOR_RGB2GRAY);
+		if (keep_color) {
+			frame.copyTo(color_plane);
+		}
+		write_file.write(reinterpret_cast<const char*>(frame_data.data()),
+			frame_data.size());
+		frame_index++;
+	} while ((max_num_of_frame == 0 || frame_index < max_num_of_frame) &&
+		capture.read(frame) && !frame.empty());
+
+	header.frame_count = frame_index;
+	write_file.seekp(0);
+	write_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!write_file) {
+		std::fprintf(stderr, "Failed to write %s.\n",
+			output_cache_filename.c_str());
+		return false;
+	}
+	std::printf("Cached %llu frames of %dx%d (%.1f MB)\n",
+		static_cast<unsigned long long>(frame_index),
+		frame_size.width, frame_size.height,
+		(header.header_size + frame_index * header.frame_stride) / 1e6);
+	return true;
+}
+
+FrameCacheReader::~FrameCacheReader() {
+	close();
+}
+
+// If the file is not a valid frame cache, return false
+bool FrameCacheReader::open(const std::string& input_filename) {
+	close();
+	if (!file_.open(input_filename)) {
+		return false;
+	}
+
+	// Check the header before trusting any frame
+	size_t file_size = file_.size();
+	if (file_size < sizeof(FrameCacheHeader)) {
+		close();
+		return false;
+	}
+	const FrameCacheHeader* header =
+		static_cast<const FrameCacheHeader*>(file_.data());
+	bool is_valid = header->magic == FRAME_CACHE_MAGIC &&
+		header->version == FRAME_CACHE_VERSION &&
+		header->header_size >= sizeof(FrameCacheHeader) &&
+		header->header_size <= file_size &&
+		header->width > 0 && header->height > 0 &&
+		header->grayscale_row_stride >= header->width &&
+		(header->color_row_stride == 0 ||
+			header->color_row_stride >= 3 * header->width) &&
+		header->frame_stride > 0 &&
+		header->grayscale_offset >= sizeof(FrameCacheFrame) &&
+		header->grayscale_offset + static_cast<std::uint64_t>(
+			header->grayscale_row_stride) * header->height <=
+			header->frame_stride &&
+		header->color_offset + static_cast<std::uint64_t>(
+			header->color_row_stride) * header->height <=
+			header->frame_stride &&
+		header->frame_count <= (file_size - header->header_size) /
+			header->frame_stride;
+	if (!is_valid) {
+		std::fprintf(stderr, "%s is not a valid frame cache.\n",
+			input_filename.c_str());
+		close();
+		return false;
+	}
+
+	frames_ = static_cast<const unsigned char*>(file_.data()) +
+		header->header_size;
+	frame_count_ = static_cast<size_t>(header->frame_count);
+	frame_stride_ = static_cast<size_t>(header->frame_stride);
+	grayscale_offset_ = static_cast<size_t>(header->grayscale_offset);
+	color_offset_ = static_cast<size_t>(header->color_offset);
+	grayscale_row_stride_ = header->grayscale_row_stride;
+	color_row_stride_ = header->color_row_stride;
+	frame_size_ = cv::Size(header->width, header->height);
+	has_color_ = header->color_row_stride > 0;
+	frames_per_second_ = header->frames_per_second;
+	return true;
+}
+
+void FrameCacheReader::close() {
+	file_.close();
+	frames_ = nullptr;
+	frame_count_ = 0;
+	has_color_ = false;
+}
+
+// Point the images of the view at the planes of the frame
+void FrameCacheReader::frame(size_t index, FrameCacheView& output_view) const {
+	const unsigned char* frame_data = frames_ + index * frame_stride_;
+	FrameCacheFrame frame_info;
+	std::memcpy(&frame_info, frame_data, sizeof(frame_info));
+	output_view.frame_index = frame_info.frame_index;
+	output_view.timestamp_ms = frame_info.timestamp_ms;
+
+	// cv::Mat has no read-only header, the mapping is PROT_READ anyway
+	output_view.grayscale = cv::Mat(frame_size_, CV_8UC1,
+		const_cast<unsigned char*>(frame_data + grayscale_offset_),
+		grayscale_row_stride_);
+	if (has_color_) {
+		output_view.color = cv::Mat(frame_size_, CV_8UC3,
+			const_cast<unsigned char*>(frame_data + color_offset_),
+			color_row_stride_);
+	} else {
+		output_view.color = cv::Mat();
+	}
+}
+
+// Touch every page of the mapping
+void FrameCacheReader::prefault() const {
+	file_.prefault();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef FRAME_CACHE
+#define FRAME_CACHE
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+// A frame cache is a clip decoded once into raw frames, so it can be
+// replayed without decoding (see replay_benchmark.h)
+// It is a header followed by fixed-size frames, each a FrameCacheFrame,
+// the grayscale plane and the BGR plane (if it was kept)
+// Frames start on 4096-byte boundaries, and planes and rows on 64-byte
+// boundaries, so the planes are used in place from the mapping
+// All values are little-endian, like the pose log
+
+// "MBARFRMS" in the first 8 bytes of a frame cache
+#define FRAME_CACHE_MAGIC 0x534D52465241424DULL
+#define FRAME_CACHE_VERSION 1u
+
+struct FrameCacheHeader {
+	std::uint64_t magic;
+	std::uint32_t version;
+	// Bytes before the first frame (the header padded to 4096)
+	std::uint32_t header_size;
+	std::uint32_t width;
+	std::uint32_t height;
+	// Bytes per row of each plane, 0 for a plane which is not kept
+	std::uint32_t grayscale_row_stride;
+	std::uint32_t color_row_stride;
+	// Bytes from one frame to the next, and to the planes of a frame
+	std::uint64_t frame_stride;
+	std::uint64_t grayscale_offset;
+	std::uint64_t color_offset;
+	std::uint64_t frame_count;
+	double frames_per_second;
+};
+
+// The start of every frame
+struct FrameCacheFrame {
+	std::uint64_t frame_index;
+	// Position of the frame in the clip, in milliseconds
+	double timestamp_ms;
+};
+
+static_assert(sizeof(FrameCacheHeader) == 72,
+	"unexpected frame cache header size");
+static_assert(sizeof(FrameCacheFrame) == 16,
+	"unexpected frame cache frame size");
+
+// Decode every frame of a video (at most "max_num_of_frame" if it is
+// not 0) into a frame cache, with the color planes if "keep_color"
+// If fail, return false
+bool buildFrameCache(
+	const std::string& input_video_filename,
+	const std::string& output_cache_filename,
+	bool keep_color = true,
+	size_t max_num_of_frame = 0);
+
+// One frame of a mapped cache
+// The images point into the mapping, which is read-only: they must not
+// be written, and they are only valid while the reader is open
+struct FrameCacheView {
+	std::uint64_t frame_index = 0;
+	double timestamp_ms = 0.0;
+	cv::Mat grayscale;
+	// Empty if the cache has no color
+	cv::Mat color;
+};
+
+// Map a frame cache into memory and read its frames without copying
+class FrameCacheReader {
+public:
+	FrameCacheReader() = default;
+	~FrameCacheReader();
+
+	FrameCacheReader(const FrameCacheReader&) = delete;
+	FrameCacheReader& operator=(const FrameCacheReader&) = delete;
+
+	// If the file is not a valid frame cache, return false
+	bool open(const std::string& input_filename);
+	void close();
+
+	size_t size() const { return frame_count_; }
+	cv::Size frameSize() const { return frame_size_; }
+	bool hasColor() const { return has_color_; }
+	double framesPerSecond() const { return frames_per_second_; }
+	// The bytes of the mapping
+	size_t mappedSize() const { return file_.size(); }
+
+	// The frame "index" (0 to size() - 1)
+	void frame(size_t index, FrameCacheView& output_view) const;
+
+	// Read every page of the mapping once, so a replay after this
+	// does not wait for the disk
+	void prefault() const;
+
+private:
+	MappedFile file_;
+	const unsigned char* frames_ = nullptr;
+	size_t frame_count_ = 0;
+	size_t frame_stride_ = 0;
+	size_t grayscale_offset_ = 0;
+	size_t color_offset_ = 0;
+	size_t grayscale_row_stride_ = 0;
+	size_t color_row_stride_ = 0;
+	cv::Size frame_size_;
+	bool has_color_ = false;
+	double frames_per_second_ = 0.0;
+};
+
+#endif // !FRAME_CACHE
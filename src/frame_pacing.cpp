@@ -0,0 +1,102 @@
+// Implement the classes in frame_pacing.h
+#include "frame_pacing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace {
+
+// Weight of a new sample in the moving averages
+const double average_weight = 0.1;
+
+double millisecondsBetween(
+	std::chrono::steady_clock::time_point from,
+	std::chrono::steady_clock::time_point to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+} // namespace
+
+FramePacer::FramePacer(double safety_margin_ms)
+	: safety_margin_ms_(safety_margin_ms) {
+}
+
+// Sleep until the render of the next frame should start
+void FramePacer::waitForRenderStart() {
+	if (has_presented_ && num_of_interval_sample_ >= 8) {
+		// Start so the render ends a margin before the next vsync
+		// The deviation keeps most frames from missing it
+		double start_offset_ms = refresh_interval_ms_ - render_cost_ms_ -
+			2.0 * render_cost_deviation_ms_ - safety_margin_ms_;
+		if (start_offset_ms > 0.0) {
+			Clock::time_point start_time = last_present_time_ +
+				std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double, std::milli>(
+						start_offset_ms));
+			std::this_thread::sleep_until(start_time);
+		}
+	}
+	render_start_time_ = Clock::now();
+}
+
+// Call when the GPU has finished the frame, right before swapping
+void FramePacer::onRenderFinished() {
+	double cost_ms = millisecondsBetween(render_start_time_, Clock::now());
+	if (render_cost_ms_ == 0.0) {
+		render_cost_ms_ = cost_ms;
+		return;
+	}
+	double difference = cost_ms - render_cost_ms_;
+	render_cost_ms_ += average_weight * difference;
+	render_cost_deviation_ms_ += average_weight *
+		(std::fabs(difference) - render_cost_deviation_ms_);
+}
+
+// Call when the swap has returned (the frame is presented)
+void FramePacer::onFramePresented() {
+	Clock::time_point now = Clock::now();
+	if (has_presented_) {
+		double interval_ms = millisecondsBetween(last_present_time_, now);
+		if (refresh_interval_ms_ == 0.0) {
+			refresh_interval_ms_ = interval_ms;
+		} else {
+			// A missed vsync gives a multiple of the refresh interval
+			double num_of_refresh =
+				std::max(1.0, std::round(interval_ms / refresh_interval_ms_));
+			refresh_interval_ms_ += average_weight *
+				(interval_ms / num_of_refresh - refresh_interval_ms_);
+		}
+		num_of_interval_sample_++;
+	}
+	last_present_time_ = now;
+	has_presented_ = true;
+}
+
+void LatestDetection::publish(
+	const FrameRef& frame,
+	const std::vector<cv::Mat>& marker_poses,
+	const std::vector<int>& marker_ids) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	frame_ = frame;
+	marker_poses_ = marker_poses;
+	marker_ids_ = marker_ids;
+	sequence_++;
+}
+
+// Copy the newest result if it is newer than "last_sequence"
+bool LatestDetection::takeNewer(
+	std::uint64_t& last_sequence,
+	FrameRef& output_frame,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (sequence_ == last_sequence) {
+		return false;
+	}
+	last_sequence = sequence_;
+	output_frame = frame_;
+	output_marker_poses = marker_poses_;
+	output_marker_ids = marker_ids_;
+	return true;
+}
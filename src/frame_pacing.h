@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef FRAME_PACING
+#define FRAME_PACING
+
+#include "frame_pool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Schedule the render of each frame, so it finishes just before vsync
+// The refresh interval is measured from the times frames are presented,
+// and the render cost from the time between starting and finishing
+class FramePacer {
+public:
+	// "safety_margin_ms" is kept free before the predicted vsync
+	explicit FramePacer(double safety_margin_ms = 2.0);
+
+	// Sleep until the render of the next frame should start
+	// (returns at once until the refresh interval is known)
+	void waitForRenderStart();
+
+	// Call when the GPU has finished the frame, right before swapping
+	void onRenderFinished();
+
+	// Call when the swap has returned (the frame is presented)
+	void onFramePresented();
+
+	double refreshIntervalMs() const { return refresh_interval_ms_; }
+	double renderCostMs() const { return render_cost_ms_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	double safety_margin_ms_;
+	double refresh_interval_ms_ = 0.0;
+	// Moving average and deviation of the render cost
+	double render_cost_ms_ = 0.0;
+	double render_cost_deviation_ms_ = 0.0;
+	int num_of_interval_sample_ = 0;
+
+	Clock::time_point last_present_time_;
+	Clock::time_point render_start_time_;
+	bool has_presented_ = false;
+};
+
+// The newest frame and its poses, handed from the detection thread
+// to the render thread
+// The render thread takes it as late as possible (late latching),
+// older results are simply replaced
+class LatestDetection {
+public:
+	void publish(
+		const FrameRef& frame,
+		const std::vector<cv::Mat>& marker_poses,
+		const std::vector<int>& marker_ids);
+
+	// Copy the newest result if it is newer than "last_sequence"
+	// and return true, otherwise return false
+	bool takeNewer(
+		std::uint64_t& last_sequence,
+		FrameRef& output_frame,
+		std::vector<cv::Mat>& output_marker_poses,
+		std::vector<int>& output_marker_ids);
+
+private:
+	std::mutex mutex_;
+	std::uint64_t sequence_ = 0;
+	FrameRef frame_;
+	std::vector<cv::Mat> marker_poses_;
+	std::vector<int> marker_ids_;
+};
+
+#endif // !FRAME_PACING
@@ -0,0 +1,100 @@
+// Implement the classes in frame_pool.h
+#include "frame_pool.h"
+
+#include <new>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+// Rows start at a multiple of this many bytes (a cache line)
+const size_t frame_alignment = 64;
+
+} // namespace
+
+FrameRef::FrameRef(FrameSlot* slot) : slot_(slot) {
+	if (slot_ != nullptr) {
+		slot_->reference_count.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+FrameRef::FrameRef(const FrameRef& other) : FrameRef(other.slot_) {
+}
+
+FrameRef::FrameRef(FrameRef&& other) noexcept : slot_(other.slot_) {
+	other.slot_ = nullptr;
+}
+
+FrameRef& FrameRef::operator=(FrameRef other) noexcept {
+	std::swap(slot_, other.slot_);
+	return *this;
+}
+
+FrameRef::~FrameRef() {
+	reset();
+}
+
+void FrameRef::reset() {
+	if (slot_ != nullptr &&
+		slot_->reference_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		slot_->pool->release(slot_);
+	}
+	slot_ = nullptr;
+}
+
+FramePool::FramePool(size_t num_of_slot, cv::Size frame_size, int frame_type)
+	: frame_size_(frame_size), frame_type_(frame_type), slots_(num_of_slot) {
+	// The step is also a whole number of pixels (192 bytes for CV_8UC3),
+	// so a row can be given to OpenGL as GL_UNPACK_ROW_LENGTH pixels
+	size_t element_size = CV_ELEM_SIZE(frame_type);
+	size_t row_alignment = std::lcm(frame_alignment, element_size);
+	size_t row_bytes = frame_size.width * element_size;
+	size_t step = (row_bytes + row_alignment - 1) /
+		row_alignment * row_alignment;
+
+	free_slots_.reserve(num_of_slot);
+	for (FrameSlot& slot : slots_) {
+		slot.pool = this;
+		slot.buffer = ::operator new(step * frame_size.height,
+			std::align_val_t(frame_alignment));
+		slot.image = cv::Mat(frame_size, frame_type, slot.buffer, step);
+		free_slots_.push_back(&slot);
+	}
+}
+
+FramePool::~FramePool() {
+	for (FrameSlot& slot : slots_) {
+		slot.image.release();
+		::operator delete(slot.buffer, std::align_val_t(frame_alignment));
+	}
+}
+
+// Take a free frame, or an empty FrameRef if all frames are in use
+FrameRef FramePool::acquire() {
+	FrameSlot* slot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (free_slots_.empty()) {
+			return FrameRef();
+		}
+		slot = free_slots_.back();
+		free_slots_.pop_back();
+	}
+	return FrameRef(slot);
+}
+
+size_t FramePool::available() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return free_slots_.size();
+}
+
+void FramePool::release(FrameSlot* slot) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	free_slots_.push_back(slot);
+}
+
+// The scratch buffers of the calling thread
+DetectionScratch& detectionScratch() {
+	thread_local DetectionScratch scratch;
+	return scratch;
+}
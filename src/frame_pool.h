@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef FRAME_POOL
+#define FRAME_POOL
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+class FramePool;
+
+// One pre-allocated image of a frame pool
+struct FrameSlot {
+	// Wraps the aligned buffer of the slot, it never reallocates
+	cv::Mat image;
+	std::uint64_t frame_index = 0;
+	// std::chrono::steady_clock time of capture, in nanoseconds
+	std::int64_t capture_time_ns = 0;
+
+	std::atomic<int> reference_count{ 0 };
+	FramePool* pool = nullptr;
+	void* buffer = nullptr;
+};
+
+// A reference-counted handle to a frame slot
+// The slot goes back to its pool when the last handle is released
+class FrameRef {
+public:
+	FrameRef() = default;
+	explicit FrameRef(FrameSlot* slot);
+	FrameRef(const FrameRef& other);
+	FrameRef(FrameRef&& other) noexcept;
+	FrameRef& operator=(FrameRef other) noexcept;
+	~FrameRef();
+
+	void reset();
+	explicit operator bool() const { return slot_ != nullptr; }
+	FrameSlot* operator->() const { return slot_; }
+	FrameSlot& operator*() const { return *slot_; }
+
+private:
+	FrameSlot* slot_ = nullptr;
+};
+
+// A fixed number of frames allocated once, with rows aligned to 64 bytes
+// and a step which is a whole number of pixels
+// Capture, detection and rendering pass the frames around by FrameRef,
+// so no image buffer is allocated in the loop
+class FramePool {
+public:
+	FramePool(size_t num_of_slot, cv::Size frame_size, int frame_type);
+	~FramePool();
+
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	// Take a free frame, or an empty FrameRef if all frames are in use
+	FrameRef acquire();
+
+	size_t size() const { return slots_.size(); }
+	cv::Size frameSize() const { return frame_size_; }
+	int frameType() const { return frame_type_; }
+	size_t available() const;
+
+private:
+	friend class FrameRef;
+	void release(FrameSlot* slot);
+
+	cv::Size frame_size_;
+	int frame_type_;
+	std::vector<FrameSlot> slots_;
+	// Indices of the free slots, its capacity is reserved at construction
+	std::vector<FrameSlot*> free_slots_;
+	mutable std::mutex mutex_;
+};
+
+// Working buffers of the detectors, reused by every call on the same thread
+// cv::Mat and std::vector keep their memory when the size does not change,
+// so after the first frame the detectors do not allocate these again
+struct DetectionScratch {
+	cv::Mat grayscale;
+	cv::Mat scaled_grayscale;
+	cv::Mat thresholded;
+	cv::Mat warped;
+	std::vector<std::vector<cv::Point>> contours;
+	std::vector<cv::Point> polygon;
+	std::vector<std::vector<cv::Point2f>> candidates;
+	std::vector<std::vector<cv::Point2f>> marker_corners;
+	std::vector<cv::Point2f> chessboard_corners;
+	// Tiled detection (see "detectMarkersInTiles")
+	std::vector<cv::Rect> tiles;
+	std::vector<std::vector<std::vector<cv::Point2f>>> tile_marker_corners;
+	std::vector<std::vector<int>> tile_marker_ids;
+};
+
+// The scratch buffers of the calling thread
+DetectionScratch& detectionScratch();
+
+#endif // !FRAME_POOL
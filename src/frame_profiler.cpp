@@ -0,0 +1,236 @@
+// Implement the classes in frame_profiler.h
+#include "frame_profiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "metrics_exporter.h"
+
+namespace {
+
+// Weight of a new sample in the moving averages
+const double average_weight = 0.05;
+
+} // namespace
+
+GpuTimerRing::~GpuTimerRing() {
+	destroy();
+}
+
+// Create the queries for "num_of_pass" passes
+bool GpuTimerRing::create(size_t num_of_pass) {
+	destroy();
+	// Timer queries are core since OpenGL 3.3
+	if (!GLEW_ARB_timer_query) {
+		std::fprintf(stderr, "GPU timer queries are not supported.\n");
+		return false;
+	}
+
+	num_of_pass_ = num_of_pass;
+	for (FrameQueries& frame : frames_) {
+		frame.queries.assign(2 * num_of_pass + 2, 0);
+		glGenQueries(static_cast<GLsizei>(frame.queries.size()),
+			frame.queries.data());
+		frame.is_pass_used.assign(num_of_pass, false);
+		frame.is_pending = false;
+	}
+	latest_pass_ms_.assign(num_of_pass, 0.0);
+	current_frame_ = 0;
+	is_enabled_ = true;
+	return true;
+}
+
+void GpuTimerRing::destroy() {
+	if (!is_enabled_) {
+		return;
+	}
+	for (FrameQueries& frame : frames_) {
+		glDeleteQueries(static_cast<GLsizei>(frame.queries.size()),
+			frame.queries.data());
+		frame.queries.clear();
+	}
+	is_enabled_ = false;
+}
+
+// Read the results of the frame which used the queries last
+void GpuTimerRing::collect(FrameQueries& frame) {
+	if (!frame.is_pending) {
+		return;
+	}
+	frame.is_pending = false;
+
+	// The timestamps finish in order, so if the last one is ready,
+	// all of them are
+	GLint is_available = 0;
+	glGetQueryObjectiv(frame.queries.back(),
+		GL_QUERY_RESULT_AVAILABLE, &is_available);
+	if (!is_available) {
+		num_of_dropped_frame_++;
+		return;
+	}
+
+	auto elapsedMs = [&](size_t begin_index) {
+		GLuint64 begin_time = 0, end_time = 0;
+		glGetQueryObjectui64v(frame.queries[begin_index],
+			GL_QUERY_RESULT, &begin_time);
+		glGetQueryObjectui64v(frame.queries[begin_index + 1],
+			GL_QUERY_RESULT, &end_time);
+		return (end_time - begin_time) / 1.0e6;
+	};
+	for (size_t pass = 0; pass < num_of_pass_; pass++) {
+		latest_pass_ms_[pass] =
+			frame.is_pass_used[pass] ? elapsedMs(2 * pass) : 0.0;
+	}
+	latest_frame_ms_ = elapsedMs(2 * num_of_pass_);
+	has_new_result_ = true;
+}
+
+// Start a new frame
+void GpuTimerRing::beginFrame() {
+	if (!is_enabled_) {
+		return;
+	}
+	current_frame_ = (current_frame_ + 1) % GPU_TIMER_FRAME_LATENCY;
+	FrameQueries& frame = frames_[current_frame_];
+	collect(frame);
+
+	frame.is_pass_used.assign(num_of_pass_, false);
+	glQueryCounter(frame.queries[2 * num_of_pass_], GL_TIMESTAMP);
+}
+
+void GpuTimerRing::beginPass(size_t pass) {
+	if (!is_enabled_ || pass >= num_of_pass_) {
+		return;
+	}
+	FrameQueries& frame = frames_[current_frame_];
+	glQueryCounter(frame.queries[2 * pass], GL_TIMESTAMP);
+	frame.is_pass_used[pass] = true;
+}
+
+void GpuTimerRing::endPass(size_t pass) {
+	if (!is_enabled_ || pass >= num_of_pass_) {
+		return;
+	}
+	glQueryCounter(frames_[current_frame_].queries[2 * pass + 1],
+		GL_TIMESTAMP);
+}
+
+void GpuTimerRing::endFrame() {
+	if (!is_enabled_) {
+		return;
+	}
+	FrameQueries& frame = frames_[current_frame_];
+	glQueryCounter(frame.queries[2 * num_of_pass_ + 1], GL_TIMESTAMP);
+	frame.is_pending = true;
+}
+
+// The newest results in milliseconds
+bool GpuTimerRing::takeResults(
+	std::vector<double>& output_pass_ms,
+	double& output_frame_ms) {
+	if (!has_new_result_) {
+		return false;
+	}
+	output_pass_ms = latest_pass_ms_;
+	output_frame_ms = latest_frame_ms_;
+	has_new_result_ = false;
+	return true;
+}
+
+void StageTimings::record(const char* stage_name, double milliseconds) {
+	Stage* stage = findStage(stage_name);
+	if (stage == nullptr) {
+		// The first record of the stage
+		std::lock_guard<std::mutex> lock(mutex_);
+		stage = findStage(stage_name);
+		if (stage == nullptr) {
+			size_t index = num_of_stage_.load(std::memory_order_relaxed);
+			if (index == MAX_NUM_OF_TIMED_STAGE) {
+				return;
+			}
+			stage = &stages_[index];
+			stage->name = stage_name;
+			stage->average_ms.store(milliseconds, std::memory_order_relaxed);
+			stage->histogram.store(stageHistogram(stage_name),
+				std::memory_order_relaxed);
+			num_of_stage_.store(index + 1, std::memory_order_release);
+			MetricHistogram* histogram =
+				stage->histogram.load(std::memory_order_relaxed);
+			if (histogram != nullptr) {
+				histogram->observe(milliseconds);
+			}
+			return;
+		}
+	}
+
+	// A stage is usually recorded by one thread, the loop is for the others
+	double average_ms = stage->average_ms.load(std::memory_order_relaxed);
+	while (!stage->average_ms.compare_exchange_weak(average_ms,
+		average_ms + average_weight * (milliseconds - average_ms),
+		std::memory_order_relaxed)) {
+	}
+	MetricHistogram* histogram =
+		stage->histogram.load(std::memory_order_acquire);
+	if (histogram != nullptr) {
+		histogram->observe(milliseconds);
+	}
+}
+
+// The average of a stage, 0 if it has not been recorded
+double StageTimings::average(const char* stage_name) {
+	const Stage* stage = findStage(stage_name);
+	return stage == nullptr ?
+		0.0 : stage->average_ms.load(std::memory_order_relaxed);
+}
+
+// Only the published stages are searched, so no lock is needed
+StageTimings::Stage* StageTimings::findStage(const char* stage_name) {
+	size_t num_of_stage = num_of_stage_.load(std::memory_order_acquire);
+	for (size_t i = 0; i < num_of_stage; i++) {
+		if (std::strcmp(stages_[i].name, stage_name) == 0) {
+			return &stages_[i];
+		}
+	}
+	return nullptr;
+}
+
+// Observe the records in histograms of the registry
+void StageTimings::exportTo(
+	MetricsRegistry* registry,
+	const char* metric_name,
+	const char* label_name) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	registry_ = registry;
+	metric_name_ = metric_name;
+	label_name_ = label_name;
+	size_t num_of_stage = num_of_stage_.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < num_of_stage; i++) {
+		stages_[i].histogram.store(stageHistogram(stages_[i].name),
+			std::memory_order_release);
+	}
+}
+
+// The histogram of a stage, registered once when the stage is first seen
+MetricHistogram* StageTimings::stageHistogram(const char* stage_name) {
+	if (registry_ == nullptr) {
+		return nullptr;
+	}
+	// From 0.25 ms to about 1 s
+	static const std::vector<double> upper_bounds = {
+		0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0, 33.0, 66.0, 125.0, 250.0, 1000.0 };
+	return &registry_->histogram(metric_name_,
+		"The durations in milliseconds", upper_bounds,
+		std::string(label_name_) + "=\"" + stage_name + "\"");
+}
+
+// Print all stages in the order they were first recorded, in one line
+void StageTimings::print(const char* label) {
+	std::printf("%s:", label);
+	size_t num_of_stage = num_of_stage_.load(std::memory_order_acquire);
+	for (size_t i = 0; i < num_of_stage; i++) {
+		std::printf(" %s %.2f", stages_[i].name,
+			stages_[i].average_ms.load(std::memory_order_relaxed));
+	}
+	std::printf(" ms\n");
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef FRAME_PROFILER
+#define FRAME_PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// The number of frames a GPU timer result is read after it is issued
+// The queries of a frame are only reused after this many frames,
+// so reading them never waits for the GPU
+#define GPU_TIMER_FRAME_LATENCY 4
+
+// GL_TIMESTAMP queries around the render passes of each frame,
+// in a ring of GPU_TIMER_FRAME_LATENCY frames
+// Timestamps (instead of GL_TIME_ELAPSED) let passes nest or overlap
+class GpuTimerRing {
+public:
+	GpuTimerRing() = default;
+	~GpuTimerRing();
+
+	GpuTimerRing(const GpuTimerRing&) = delete;
+	GpuTimerRing& operator=(const GpuTimerRing&) = delete;
+
+	// Create the queries for "num_of_pass" passes
+	// If timer queries are not supported, return false (and do nothing)
+	bool create(size_t num_of_pass);
+	void destroy();
+
+	// Read the results of the frame which used the queries last,
+	// if they are ready, and start a new frame
+	void beginFrame();
+	void beginPass(size_t pass);
+	void endPass(size_t pass);
+	void endFrame();
+
+	// The newest results in milliseconds, the GPU time of each pass
+	// (0 if it was not run) and of the whole frame
+	// If there is no new result since the last call, return false
+	bool takeResults(
+		std::vector<double>& output_pass_ms,
+		double& output_frame_ms);
+
+	// Frames whose results were not ready when their queries were reused
+	size_t numOfDroppedFrame() const { return num_of_dropped_frame_; }
+
+private:
+	struct FrameQueries {
+		// The begin and end of every pass, and then of the frame
+		std::vector<GLuint> queries;
+		std::vector<bool> is_pass_used;
+		bool is_pending = false;
+	};
+
+	void collect(FrameQueries& frame);
+
+	FrameQueries frames_[GPU_TIMER_FRAME_LATENCY];
+	size_t current_frame_ = 0;
+	size_t num_of_pass_ = 0;
+	bool is_enabled_ = false;
+
+	std::vector<double> latest_pass_ms_;
+	double latest_frame_ms_ = 0.0;
+	bool has_new_result_ = false;
+	size_t num_of_dropped_frame_ = 0;
+};
+
+class MetricsRegistry;
+class MetricHistogram;
+
+// The stages a StageTimings keeps, the records of any more are dropped
+#define MAX_NUM_OF_TIMED_STAGE 32
+
+// Moving averages of named stages (in milliseconds)
+// Stages can be recorded from any thread, e.g. detection on its own thread
+// The names must be string literals, since only the pointers are kept
+// Only the first record of a stage takes a lock (and the registry lock
+// when exported), the later ones only update atomics
+class StageTimings {
+public:
+	void record(const char* stage_name, double milliseconds);
+
+	// The average of a stage, 0 if it has not been recorded
+	double average(const char* stage_name);
+
+	// Print all stages in the order they were first recorded, in one line
+	void print(const char* label);
+
+	// Also observe every record in a histogram "metric_name{label_name=
+	// "<stage>"}" of the registry, which must outlive the timings
+	void exportTo(
+		MetricsRegistry* registry,
+		const char* metric_name,
+		const char* label_name);
+
+private:
+	struct Stage {
+		const char* name = nullptr;
+		std::atomic<double> average_ms{ 0.0 };
+		std::atomic<MetricHistogram*> histogram{ nullptr };
+	};
+
+	// The stage of the name, nullptr if it has not been recorded
+	Stage* findStage(const char* stage_name);
+	MetricHistogram* stageHistogram(const char* stage_name);
+
+	// Only taken to add a stage and to export, a stage is published by
+	// incrementing the count after it is filled in
+	std::mutex mutex_;
+	Stage stages_[MAX_NUM_OF_TIMED_STAGE];
+	std::atomic<size_t> num_of_stage_{ 0 };
+	MetricsRegistry* registry_ = nullptr;
+	const char* metric_name_ = nullptr;
+	const char* label_name_ = nullptr;
+};
+
+// Record the time from construction to destruction as a stage
+class ScopedStageTimer {
+public:
+	ScopedStageTimer(StageTimings& timings, const char* stage_name)
+		: timings_(timings), stage_name_(stage_name),
+		start_time_(std::chrono::steady_clock::now()) {
+	}
+
+	~ScopedStageTimer() {
+		timings_.record(stage_name_,
+			std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start_time_).count());
+	}
+
+private:
+	StageTimings& timings_;
+	const char* stage_name_;
+	std::chrono::steady_clock::time_point start_time_;
+};
+
+#endif // !FRAME_PROFILER
@@ -0,0 +1,261 @@
+// Implement the class in frame_recorder.h
+#include "frame_recorder.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+bool hasExtension(const std::string& filename, const std::string& extension) {
+	return filename.size() >= extension.size() &&
+		filename.compare(filename.size() - extension.size(),
+			extension.size(), extension) == 0;
+}
+
+} // namespace
+
+FrameRecorder::FrameRecorder(const FrameRecorderSettings& settings) :
+	settings_(settings) {
+}
+
+FrameRecorder::~FrameRecorder() {
+	close();
+}
+
+// Create the pixel buffers, open the file and start the encoder
+bool FrameRecorder::open(const std::string& filename, cv::Size frame_size) {
+	close();
+	if (!GLEW_ARB_sync) {
+		std::fprintf(stderr, "Recording needs GL_ARB_sync.\n");
+		return false;
+	}
+
+	if (hasExtension(filename, ".y4m")) {
+		// 4:2:0 halves the chroma in both directions
+		if (frame_size.width % 2 != 0 || frame_size.height % 2 != 0) {
+			std::fprintf(stderr, "A YUV4MPEG2 frame must have an even size, "
+				"not %dx%d.\n", frame_size.width, frame_size.height);
+			return false;
+		}
+		y4m_file_.open(filename, std::ios::binary);
+		if (!y4m_file_) {
+			std::fprintf(stderr, "Failed to open %s.\n", filename.c_str());
+			return false;
+		}
+		char header[128];
+		std::snprintf(header, sizeof(header),
+			"YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n",
+			frame_size.width, frame_size.height,
+			static_cast<int>(settings_.fps * 1000.0 + 0.5));
+		y4m_file_ << header;
+	} else if (!video_writer_.open(filename,
+		cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), settings_.fps,
+		frame_size)) {
+		std::fprintf(stderr, "Failed to open %s.\n", filename.c_str());
+		return false;
+	}
+
+	frame_size_ = frame_size;
+	const GLsizeiptr frame_bytes =
+		static_cast<GLsizeiptr>(frame_size.area()) * 4;
+	pixel_buffers_.resize(std::max<size_t>(settings_.num_of_pixel_buffer, 1));
+	for (PixelBuffer& pixel_buffer : pixel_buffers_) {
+		glGenBuffers(1, &pixel_buffer.buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer.buffer);
+		// Written by the GPU and read by the CPU once
+		glBufferData(GL_PIXEL_PACK_BUFFER, frame_bytes, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	current_pixel_buffer_ = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = false;
+		num_of_recorded_frame_ = 0;
+		num_of_dropped_frame_ = 0;
+	}
+	encoder_ = std::thread(&FrameRecorder::encoderLoop, this);
+	is_open_ = true;
+	return true;
+}
+
+// Read back the back buffer into the oldest pixel buffer
+void FrameRecorder::captureFrame() {
+	if (!is_open_) {
+		return;
+	}
+	PixelBuffer& pixel_buffer = pixel_buffers_[current_pixel_buffer_];
+	if (pixel_buffer.fence != 0) {
+		collect(pixel_buffer, false);
+		// The GPU has not copied a frame from several frames ago,
+		// so skip this one rather than wait
+		if (pixel_buffer.fence != 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			num_of_dropped_frame_++;
+			return;
+		}
+	}
+
+	// BGRA is the layout of the framebuffer on most drivers,
+	// so the copy needs no conversion
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer.buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, frame_size_.width, frame_size_.height,
+		GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	pixel_buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	current_pixel_buffer_ =
+		(current_pixel_buffer_ + 1) % pixel_buffers_.size();
+}
+
+// Queue the pixels of a pixel buffer whose read-back is done
+void FrameRecorder::collect(PixelBuffer& pixel_buffer, bool should_wait) {
+	GLenum result = glClientWaitSync(pixel_buffer.fence,
+		GL_SYNC_FLUSH_COMMANDS_BIT, should_wait ? 1000000000 : 0);
+	bool is_done =
+		result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+	if (!is_done && !should_wait) {
+		return;
+	}
+	glDeleteSync(pixel_buffer.fence);
+	pixel_buffer.fence = 0;
+	if (!is_done) {
+		// Give up on this frame
+		std::fprintf(stderr, "A recorded frame was not read back.\n");
+		std::lock_guard<std::mutex> lock(mutex_);
+		num_of_dropped_frame_++;
+		return;
+	}
+
+	// Take a buffer, unless the encoder is too far behind
+	cv::Mat frame;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (queued_frames_.size() >= settings_.max_queued_frame) {
+			num_of_dropped_frame_++;
+			return;
+		}
+		if (!free_frames_.empty()) {
+			frame = std::move(free_frames_.back());
+			free_frames_.pop_back();
+		}
+	}
+	frame.create(frame_size_, CV_8UC4);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer.buffer);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+		static_cast<GLsizeiptr>(frame.total() * frame.elemSize()),
+		GL_MAP_READ_BIT);
+	if (pixels != nullptr) {
+		std::memcpy(frame.data, pixels, frame.total() * frame.elemSize());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (pixels == nullptr) {
+		num_of_dropped_frame_++;
+		free_frames_.push_back(std::move(frame));
+		return;
+	}
+	queued_frames_.push_back(std::move(frame));
+	frame_queued_.notify_one();
+}
+
+// Write the frames in the order they were queued
+void FrameRecorder::encoderLoop() {
+	unplaceCurrentThread("recorder");
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		frame_queued_.wait(lock, [this]() {
+			return is_stopping_ || !queued_frames_.empty();
+		});
+		if (queued_frames_.empty()) {
+			// Stopping, and everything is written
+			return;
+		}
+		cv::Mat frame = std::move(queued_frames_.front());
+		queued_frames_.pop_front();
+
+		lock.unlock();
+		bool is_written = writeFrame(frame);
+		lock.lock();
+
+		if (is_written) {
+			num_of_recorded_frame_++;
+		} else {
+			num_of_dropped_frame_++;
+		}
+		free_frames_.push_back(std::move(frame));
+	}
+}
+
+// Write one frame, which is bottom-up BGRA as OpenGL reads it
+bool FrameRecorder::writeFrame(const cv::Mat& bgra_frame) {
+	cv::Mat top_down_frame;
+	cv::flip(bgra_frame, top_down_frame, 0);
+	if (y4m_file_.is_open()) {
+		// I420 is the planes Y, U and V one after another,
+		// which is the frame layout of YUV4MPEG2 4:2:0
+		cv::cvtColor(top_down_frame, converted_frame_,
+			cv::COLOR_BGRA2YUV_I420);
+		y4m_file_ << "FRAME\n";
+		y4m_file_.write(reinterpret_cast<const char*>(converted_frame_.data),
+			converted_frame_.total() * converted_frame_.elemSize());
+		return static_cast<bool>(y4m_file_);
+	}
+	cv::cvtColor(top_down_frame, converted_frame_, cv::COLOR_BGRA2BGR);
+	video_writer_.write(converted_frame_);
+	return true;
+}
+
+// Take the last frames, write the queue and close the file
+void FrameRecorder::close() {
+	if (!is_open_) {
+		return;
+	}
+	// The read-backs in flight, oldest first
+	for (size_t i = 0; i < pixel_buffers_.size(); i++) {
+		PixelBuffer& pixel_buffer = pixel_buffers_[
+			(current_pixel_buffer_ + i) % pixel_buffers_.size()];
+		if (pixel_buffer.fence != 0) {
+			collect(pixel_buffer, true);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = true;
+	}
+	frame_queued_.notify_one();
+	if (encoder_.joinable()) {
+		encoder_.join();
+	}
+
+	for (PixelBuffer& pixel_buffer : pixel_buffers_) {
+		glDeleteBuffers(1, &pixel_buffer.buffer);
+	}
+	pixel_buffers_.clear();
+	free_frames_.clear();
+	if (y4m_file_.is_open()) {
+		y4m_file_.close();
+	}
+	if (video_writer_.isOpened()) {
+		video_writer_.release();
+	}
+	is_open_ = false;
+}
+
+size_t FrameRecorder::numOfRecordedFrame() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return num_of_recorded_frame_;
+}
+
+size_t FrameRecorder::numOfDroppedFrame() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return num_of_dropped_frame_;
+}
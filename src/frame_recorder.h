@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef FRAME_RECORDER
+#define FRAME_RECORDER
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+struct FrameRecorderSettings {
+	// Pixel buffers in the ring, so a frame is mapped this many frames
+	// after its read-back was issued, when the copy is long done
+	size_t num_of_pixel_buffer = 3;
+	// Frames waiting for the encoder, a frame which finds the queue full
+	// is dropped
+	size_t max_queued_frame = 8;
+	// The rate written into the file
+	double fps = 30.0;
+};
+
+// Record the composited frames (the camera image with the models)
+// The back buffer is copied into a pixel buffer object before the swap,
+// which the GPU does in the background, and the pixels are taken out
+// a few frames later, after a fence says the copy is done
+// An encoder thread writes them, either raw into a YUV4MPEG2 file
+// (".y4m", 4:2:0) or through cv::VideoWriter (MJPG for other names)
+// The render thread never waits for the GPU or the encoder: if the copy
+// is not done or the queue is full, the frame is dropped and counted
+class FrameRecorder {
+public:
+	explicit FrameRecorder(
+		const FrameRecorderSettings& settings = FrameRecorderSettings());
+	~FrameRecorder();
+
+	FrameRecorder(const FrameRecorder&) = delete;
+	FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+	// Create the pixel buffers for frames of "frame_size" (the size of
+	// the framebuffer), and open the file
+	// It needs the OpenGL context on the calling thread
+	// If fences are not supported or the file cannot be opened,
+	// return false
+	bool open(const std::string& filename, cv::Size frame_size);
+
+	// Read back the back buffer, call it after the frame is drawn and
+	// before it is swapped
+	// The frames whose read-back is done go to the encoder
+	void captureFrame();
+
+	// Take the frames which are still read back, write all queued
+	// frames and close the file
+	void close();
+
+	size_t numOfRecordedFrame() const;
+	size_t numOfDroppedFrame() const;
+
+private:
+	struct PixelBuffer {
+		GLuint buffer = 0;
+		GLsync fence = 0;
+	};
+
+	// Map a pixel buffer whose read-back is done and queue its pixels
+	// If "should_wait", wait for the read-back (only when closing)
+	void collect(PixelBuffer& pixel_buffer, bool should_wait);
+	void encoderLoop();
+	bool writeFrame(const cv::Mat& bgra_frame);
+
+	FrameRecorderSettings settings_;
+	cv::Size frame_size_;
+	std::vector<PixelBuffer> pixel_buffers_;
+	size_t current_pixel_buffer_ = 0;
+	bool is_open_ = false;
+
+	// Only one of them is open
+	std::ofstream y4m_file_;
+	cv::VideoWriter video_writer_;
+	cv::Mat converted_frame_;
+
+	// Frames waiting for the encoder (bottom-up BGRA), and the buffers
+	// which have been written, to be reused
+	std::deque<cv::Mat> queued_frames_;
+	std::vector<cv::Mat> free_frames_;
+	bool is_stopping_ = false;
+	size_t num_of_recorded_frame_ = 0;
+	size_t num_of_dropped_frame_ = 0;
+
+	mutable std::mutex mutex_;
+	std::condition_variable frame_queued_;
+	std::thread encoder_;
+};
+
+#endif // !FRAME_RECORDER
@@ -1,11 +1,18 @@
 #include "graphics_utility.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <iterator>
+#include <filesystem>
+#include <system_error>
 
 // Load ply file
 // If succeed, give all the vertices and face indices, and return true
@@ -358,3 +365,370 @@ GLuint loadShaders(
 
 	return ProgramID;
 }
+
+namespace {
+
+// Read a whole text file, return false if it cannot be opened
+bool readTextFile(const char* file_path, std::string& output_text) {
+	std::ifstream read_file(file_path, std::ios::in);
+	if (!read_file.is_open()) {
+		return false;
+	}
+	std::stringstream sstr;
+	sstr << read_file.rdbuf();
+	output_text = sstr.str();
+	return true;
+}
+
+// Insert "defines" after the "#version" line, which must come first,
+// and restore the line numbers of the file for the info logs
+void insertDefines(const std::string& defines, std::string& code) {
+	if (defines.empty()) {
+		return;
+	}
+	size_t line_end = code.compare(0, 8, "#version") == 0 ?
+		code.find('\n') : std::string::npos;
+	if (line_end == std::string::npos) {
+		code.insert(0, defines + "#line 1\n");
+		return;
+	}
+	code.insert(line_end + 1, defines + "#line 2\n");
+}
+
+// 64-bit FNV-1a hash, used to name the cached binaries
+std::uint64_t hashText(const std::string& text, std::uint64_t hash) {
+	for (unsigned char character : text) {
+		hash ^= character;
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+// A binary is only valid for the driver which has created it
+std::string driverString() {
+	std::string driver;
+	const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : names) {
+		const GLubyte* value = glGetString(name);
+		if (value != NULL) {
+			driver += reinterpret_cast<const char*>(value);
+		}
+		driver += '\n';
+	}
+	return driver;
+}
+
+bool supportsProgramBinary() {
+	if (!GLEW_ARB_get_program_binary) {
+		return false;
+	}
+	GLint num_of_formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_of_formats);
+	return num_of_formats > 0;
+}
+
+// Create a program from a cached binary
+// If there is no binary, or the driver rejects it, return 0
+GLuint loadProgramBinary(const std::string& cache_file_path) {
+	std::ifstream read_file(cache_file_path, std::ios::in | std::ios::binary);
+	if (!read_file.is_open()) {
+		return 0;
+	}
+
+	GLenum binary_format = 0;
+	if (!read_file.read(reinterpret_cast<char*>(&binary_format),
+		sizeof(binary_format))) {
+		return 0;
+	}
+	std::vector<char> binary((std::istreambuf_iterator<char>(read_file)),
+		std::istreambuf_iterator<char>());
+	if (binary.empty()) {
+		return 0;
+	}
+
+	GLuint program_id = glCreateProgram();
+	glProgramBinary(program_id, binary_format,
+		binary.data(), static_cast<GLsizei>(binary.size()));
+
+	GLint result = GL_FALSE;
+	glGetProgramiv(program_id, GL_LINK_STATUS, &result);
+	if (result != GL_TRUE) {
+		glDeleteProgram(program_id);
+		return 0;
+	}
+	return program_id;
+}
+
+// Store the binary of a linked program, failures are only reported
+void saveProgramBinary(GLuint program_id, const std::string& cache_file_path) {
+	GLint binary_length = 0;
+	glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+	if (binary_length <= 0) {
+		return;
+	}
+
+	std::vector<char> binary(binary_length);
+	GLenum binary_format = 0;
+	glGetProgramBinary(program_id, binary_length, NULL,
+		&binary_format, binary.data());
+
+	std::ofstream write_file(cache_file_path,
+		std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!write_file.is_open()) {
+		std::printf("Impossible to write %s.\n", cache_file_path.c_str());
+		return;
+	}
+	write_file.write(reinterpret_cast<const char*>(&binary_format),
+		sizeof(binary_format));
+	write_file.write(binary.data(), binary.size());
+}
+
+// Print the info log of a shader, return true if it is compiled
+bool checkShader(GLuint shader_id, const char* file_path) {
+	GLint result = GL_FALSE;
+	int info_log_length = 0;
+	glGetShaderiv(shader_id, GL_COMPILE_STATUS, &result);
+	glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &info_log_length);
+	if (info_log_length > 0) {
+		std::vector<char> error_message(info_log_length + 1);
+		glGetShaderInfoLog(shader_id, info_log_length,
+			NULL, &error_message[0]);
+		std::printf("%s: %s\n", file_path, &error_message[0]);
+	}
+	return result == GL_TRUE;
+}
+
+// Print the info log of a program, return true if it is linked
+bool checkProgram(GLuint program_id) {
+	GLint result = GL_FALSE;
+	int info_log_length = 0;
+	glGetProgramiv(program_id, GL_LINK_STATUS, &result);
+	glGetProgramiv(program_id, GL_INFO_LOG_LENGTH, &info_log_length);
+	if (info_log_length > 0) {
+		std::vector<char> error_message(info_log_length + 1);
+		glGetProgramInfoLog(program_id, info_log_length,
+			NULL, &error_message[0]);
+		std::printf("%s\n", &error_message[0]);
+	}
+	return result == GL_TRUE;
+}
+
+} // namespace
+
+// Load several programs in one batch, with a cache of linked binaries
+void loadShaderPrograms(
+	const std::vector<ShaderProgramSource>& sources,
+	const std::string& cache_directory,
+	std::vector<GLuint>& output_program_ids) {
+	size_t num_of_program = sources.size();
+	output_program_ids.assign(num_of_program, 0);
+
+	bool use_cache = supportsProgramBinary() && !cache_directory.empty();
+	if (use_cache) {
+		std::error_code error;
+		std::filesystem::create_directories(cache_directory, error);
+		use_cache = !error;
+	}
+	std::string driver = driverString();
+
+	std::vector<std::string> vertex_codes(num_of_program);
+	std::vector<std::string> fragment_codes(num_of_program);
+	std::vector<std::string> cache_file_paths(num_of_program);
+	// The programs which must be compiled from the sources
+	std::vector<size_t> programs_to_build;
+
+	for (size_t i = 0; i < num_of_program; i++) {
+		if (!readTextFile(sources[i].vertex_file_path, vertex_codes[i])) {
+			std::printf("Impossible to open %s.\n",
+				sources[i].vertex_file_path);
+			continue;
+		}
+		if (!readTextFile(sources[i].fragment_file_path, fragment_codes[i])) {
+			std::printf("Impossible to open %s.\n",
+				sources[i].fragment_file_path);
+			continue;
+		}
+		insertDefines(sources[i].defines, vertex_codes[i]);
+		insertDefines(sources[i].defines, fragment_codes[i]);
+
+		if (use_cache) {
+			// The key covers both sources (with the defines) and the driver
+			std::uint64_t key = 0xCBF29CE484222325ULL;
+			key = hashText(vertex_codes[i], key);
+			key = hashText(std::string(1, '\0'), key);
+			key = hashText(fragment_codes[i], key);
+			key = hashText(driver, key);
+
+			char file_name[32];
+			std::snprintf(file_name, sizeof(file_name), "%016llx.bin",
+				static_cast<unsigned long long>(key));
+			cache_file_paths[i] =
+				(std::filesystem::path(cache_directory) / file_name).string();
+
+			output_program_ids[i] = loadProgramBinary(cache_file_paths[i]);
+			if (output_program_ids[i] != 0) {
+				std::printf("Loaded cached program : %s, %s\n",
+					sources[i].vertex_file_path,
+					sources[i].fragment_file_path);
+				continue;
+			}
+		}
+		programs_to_build.push_back(i);
+	}
+
+	if (programs_to_build.empty()) {
+		return;
+	}
+
+#ifdef GL_KHR_parallel_shader_compile
+	// Let the driver use as many compiler threads as it likes
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+#endif
+
+	// Submit every shader and every link before asking for any result,
+	// since asking for a status waits for that compilation to finish
+	std::vector<GLuint> vertex_shader_ids(num_of_program, 0);
+	std::vector<GLuint> fragment_shader_ids(num_of_program, 0);
+	for (size_t i : programs_to_build) {
+		std::printf("Compiling shader : %s\n", sources[i].vertex_file_path);
+		vertex_shader_ids[i] = glCreateShader(GL_VERTEX_SHADER);
+		char const* vertex_source_pointer = vertex_codes[i].c_str();
+		glShaderSource(vertex_shader_ids[i], 1, &vertex_source_pointer, NULL);
+		glCompileShader(vertex_shader_ids[i]);
+
+		std::printf("Compiling shader : %s\n", sources[i].fragment_file_path);
+		fragment_shader_ids[i] = glCreateShader(GL_FRAGMENT_SHADER);
+		char const* fragment_source_pointer = fragment_codes[i].c_str();
+		glShaderSource(fragment_shader_ids[i], 1,
+			&fragment_source_pointer, NULL);
+		glCompileShader(fragment_shader_ids[i]);
+	}
+
+	for (size_t i : programs_to_build) {
+		GLuint program_id = glCreateProgram();
+		glAttachShader(program_id, vertex_shader_ids[i]);
+		glAttachShader(program_id, fragment_shader_ids[i]);
+		if (use_cache) {
+			glProgramParameteri(program_id,
+				GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glLinkProgram(program_id);
+		output_program_ids[i] = program_id;
+	}
+
+	std::printf("Linking programs\n");
+	for (size_t i : programs_to_build) {
+		GLuint program_id = output_program_ids[i];
+		bool vertex_compiled =
+			checkShader(vertex_shader_ids[i], sources[i].vertex_file_path);
+		bool fragment_compiled =
+			checkShader(fragment_shader_ids[i], sources[i].fragment_file_path);
+		bool linked = checkProgram(program_id);
+
+		glDetachShader(program_id, vertex_shader_ids[i]);
+		glDetachShader(program_id, fragment_shader_ids[i]);
+		glDeleteShader(vertex_shader_ids[i]);
+		glDeleteShader(fragment_shader_ids[i]);
+
+		if (!vertex_compiled || !fragment_compiled || !linked) {
+			glDeleteProgram(program_id);
+			output_program_ids[i] = 0;
+			continue;
+		}
+
+		if (use_cache) {
+			saveProgramBinary(program_id, cache_file_paths[i]);
+		}
+	}
+}
+
+namespace {
+
+// Map a unit normal onto the octahedron, and unfold it to [-1, 1]^2
+glm::vec2 encodeOctahedral(const glm::vec3& normal) {
+	float l1_norm =
+		std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+	if (l1_norm == 0.0f) {
+		return glm::vec2(0.0f, 0.0f);
+	}
+	glm::vec2 encoded(normal.x / l1_norm, normal.y / l1_norm);
+	if (normal.z < 0.0f) {
+		float x = encoded.x, y = encoded.y;
+		encoded.x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		encoded.y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+// Store a value in [-1, 1] as a normalized signed integer
+template <typename T>
+T toSignedNormalized(float value, float max_value) {
+	value = std::min(std::max(value, -1.0f), 1.0f);
+	return static_cast<T>(std::lround(value * max_value));
+}
+
+} // namespace
+
+// Quantize positions to the bounds of the mesh,
+// and encode normals by octahedral mapping
+void compressMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<glm::vec3>& normals,
+	VertexFormat format,
+	CompactMeshData& output_mesh) {
+	output_mesh = CompactMeshData();
+	output_mesh.format = format;
+	output_mesh.stride = format == VertexFormat::Compact8 ? 8 : 12;
+	output_mesh.vertex_count = vertices.size();
+	if (vertices.empty()) {
+		return;
+	}
+
+	// Bounds of the mesh
+	glm::vec3 bounds_min = vertices[0], bounds_max = vertices[0];
+	for (const glm::vec3& vertex : vertices) {
+		for (int axis = 0; axis < 3; axis++) {
+			bounds_min[axis] = std::min(bounds_min[axis], vertex[axis]);
+			bounds_max[axis] = std::max(bounds_max[axis], vertex[axis]);
+		}
+	}
+	output_mesh.bounds_min = bounds_min;
+	output_mesh.bounds_extent = bounds_max - bounds_min;
+
+	output_mesh.vertex_data.resize(vertices.size() * output_mesh.stride);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		unsigned char* vertex_data =
+			&output_mesh.vertex_data[i * output_mesh.stride];
+
+		// 16-bit unsigned normalized position in the bounds
+		std::uint16_t position[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = output_mesh.bounds_extent[axis];
+			float normalized = extent > 0.0f ?
+				(vertices[i][axis] - bounds_min[axis]) / extent : 0.0f;
+			position[axis] = static_cast<std::uint16_t>(
+				std::lround(normalized * 65535.0f));
+		}
+		std::memcpy(vertex_data, position, sizeof(position));
+
+		// Octahedral normal right after the position
+		glm::vec3 normal =
+			i < normals.size() ? normals[i] : glm::vec3(0.0f, 0.0f, 1.0f);
+		glm::vec2 encoded = encodeOctahedral(normal);
+		if (format == VertexFormat::Compact8) {
+			std::int8_t packed[2] = {
+				toSignedNormalized<std::int8_t>(encoded.x, 127.0f),
+				toSignedNormalized<std::int8_t>(encoded.y, 127.0f)
+			};
+			std::memcpy(vertex_data + 6, packed, sizeof(packed));
+		} else {
+			std::int16_t packed[2] = {
+				toSignedNormalized<std::int16_t>(encoded.x, 32767.0f),
+				toSignedNormalized<std::int16_t>(encoded.y, 32767.0f)
+			};
+			std::memcpy(vertex_data + 6, packed, sizeof(packed));
+		}
+	}
+}
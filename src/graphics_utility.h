@@ -25,9 +25,55 @@ bool loadObj(
 	std::vector<glm::vec3>& output_vertices,
 	std::vector<glm::vec3>& output_normals);
 
+// The layout of the vertices of a mesh on the GPU
+// Float32: 3 floats for position and 3 floats for normal (24 bytes)
+// Compact8: 3x16-bit position and octahedral 2x8-bit normal (8 bytes)
+// Compact16: 3x16-bit position and octahedral 2x16-bit normal (12 bytes)
+enum class VertexFormat { Float32, Compact8, Compact16 };
+
+// The interleaved vertices of a mesh in a compact layout
+// Positions are stored relative to the bounds of the mesh:
+// position = bounds_min + bounds_extent * stored_position
+struct CompactMeshData {
+	VertexFormat format = VertexFormat::Compact16;
+	std::vector<unsigned char> vertex_data;
+	GLsizei stride = 0;
+	size_t vertex_count = 0;
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_extent;
+};
+
+// Quantize positions to the bounds of the mesh,
+// and encode normals by octahedral mapping
+void compressMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<glm::vec3>& normals,
+	VertexFormat format,
+	CompactMeshData& output_mesh);
+
 // Load shaders
 GLuint loadShaders(
 	const char* vertex_file_path,
 	const char* fragment_file_path);
 
+// The shader files of one program
+struct ShaderProgramSource {
+	const char* vertex_file_path;
+	const char* fragment_file_path;
+	// Lines such as "#define MAX_DRAWN_MARKERS 64\n", inserted after the
+	// "#version" line of both shaders
+	std::string defines = "";
+};
+
+// Load several programs in one batch
+// A linked program is read from "cache_directory" if the sources and
+// the driver are the same as the last time, otherwise all shaders are
+// compiled before any of them is checked, so the driver can compile
+// them in parallel, and the linked binaries are stored in the cache
+// A program that fails gives 0 and does not stop the others
+void loadShaderPrograms(
+	const std::vector<ShaderProgramSource>& sources,
+	const std::string& cache_directory,
+	std::vector<GLuint>& output_program_ids);
+
 #endif // !GRAPHICS_UTILITY
@@ -0,0 +1,446 @@
+// Implement the functions in latency_harness.h
+#include "latency_harness.h"
+#include "asset_manager.h"
+#include "draw_graphics.h"
+#include "frame_pacing.h"
+#include "frame_pool.h"
+#include "graphics_utility.h"
+#include "marker_detection.h"
+#include "synthetic_camera.h"
+#include "visibility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <thread>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+std::uint32_t microsecondsOf(Clock::time_point time) {
+	return static_cast<std::uint32_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(
+			time.time_since_epoch()).count());
+}
+
+const char* modeName(PipelineMode mode) {
+	switch (mode) {
+	case PipelineMode::Synchronous:
+		return "synchronous";
+	case PipelineMode::Pipelined:
+		return "pipelined";
+	default:
+		return "paced";
+	}
+}
+
+// Stands in for "glfwSwapBuffers" with vsync on:
+// it blocks until the next refresh of a display at a fixed rate
+class SimulatedDisplay {
+public:
+	explicit SimulatedDisplay(double refresh_rate)
+		: refresh_interval_(std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(1.0 / refresh_rate))),
+		first_vsync_time_(Clock::now()) {
+	}
+
+	// Return the time the frame is shown
+	Clock::time_point swap() {
+		Clock::duration elapsed = Clock::now() - first_vsync_time_;
+		Clock::time_point vsync_time = first_vsync_time_ +
+			(elapsed / refresh_interval_ + 1) * refresh_interval_;
+		std::this_thread::sleep_until(vsync_time);
+		return vsync_time;
+	}
+
+private:
+	Clock::duration refresh_interval_;
+	Clock::time_point first_vsync_time_;
+};
+
+// Draw the frames like the AR loop, but into a framebuffer object,
+// and read the stamp back from the result
+class OffscreenRenderer {
+public:
+	bool create(cv::Size frame_size, const std::string& model_filename) {
+		frame_size_ = frame_size;
+
+		std::vector<GLuint> program_ids;
+		loadShaderPrograms({
+			{ "background_vertex_shader.vert",
+				"background_fragment_shader.frag" },
+			{ "shading_vertex_shader.vert",
+				"shading_fragment_shader.frag",
+				shadingShaderDefines() } },
+			"shader_cache", program_ids);
+		if (program_ids.size() != 2 || !program_ids[0] || !program_ids[1]) {
+			std::fprintf(stderr, "Failed to load the shaders.\n");
+			return false;
+		}
+		background_shader_id_ = program_ids[0];
+		shading_shader_id_ = program_ids[1];
+		createPoseUniformBuffer({ shading_shader_id_ }, pose_buffer_);
+
+		glGenFramebuffers(1, &framebuffer_);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+		glGenRenderbuffers(2, renderbuffers_);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8,
+			frame_size.width, frame_size.height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, renderbuffers_[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+			frame_size.width, frame_size.height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			GL_RENDERBUFFER, renderbuffers_[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+			GL_FRAMEBUFFER_COMPLETE) {
+			std::fprintf(stderr, "Failed to create the framebuffer.\n");
+			return false;
+		}
+		glViewport(0, 0, frame_size.width, frame_size.height);
+
+		// Render the real model, so the cost is the same as the AR loop
+		asset_manager_.setVertexFormat(VertexFormat::Compact16);
+		auto model_data =
+			asset_manager_.loadModelAsync("bunny", model_filename);
+		asset_manager_.setDefaultModel("bunny");
+		model_data.wait();
+		asset_manager_.uploadReadyModels();
+
+		stamp_image_.create(2 * FRAME_STAMP_CELL_SIZE,
+			FRAME_STAMP_NUM_OF_CELL * FRAME_STAMP_CELL_SIZE, CV_8UC3);
+		return true;
+	}
+
+	void destroy() {
+		deletePoseUniformBuffer(pose_buffer_);
+		deleteBackgroundTexture(background_texture_);
+		glDeleteRenderbuffers(2, renderbuffers_);
+		glDeleteFramebuffers(1, &framebuffer_);
+		glDeleteProgram(background_shader_id_);
+		glDeleteProgram(shading_shader_id_);
+	}
+
+	// Draw a frame, wait for the GPU and read the stamp of the output
+	// If the stamp cannot be read, return false
+	bool render(
+		const FrameRef& frame,
+		const std::vector<cv::Mat>& marker_poses,
+		const std::vector<int>& marker_ids,
+		std::uint32_t& output_frame_index,
+		std::uint32_t& output_capture_time_us) {
+		const cv::Mat& current_frame = frame->image;
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		drawBackground(current_frame, background_shader_id_,
+			background_texture_);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		glm::mat4 projection;
+		buildProjection(current_frame, projection);
+		// The same model matrix as the AR loop
+		glm::mat4 model =
+			glm::rotate(glm::mat4(),
+				glm::radians(89.0f), glm::vec3(1.0f, 0.0f, 0.0f)) *
+			glm::scale(glm::mat4(),
+				glm::vec3(0.5f, 0.5f, 0.5f));
+
+		latchMarkerPoses(marker_poses, pose_buffer_);
+		drawVisibleMarkerModels(
+			asset_manager_, model,
+			marker_poses, marker_ids,
+			projection, current_frame.rows,
+			CullingSettings(),
+			shading_shader_id_);
+		finishMarkerPoses(pose_buffer_);
+
+		// Reading the pixels waits until the frame is done
+		// OpenGL has the bottom-left origin, so the stamp is the top rows
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, frame_size_.height - stamp_image_.rows,
+			stamp_image_.cols, stamp_image_.rows,
+			GL_RGB, GL_UNSIGNED_BYTE, stamp_image_.data);
+		cv::flip(stamp_image_, stamp_image_, 0);
+		return readFrameStamp(
+			stamp_image_, output_frame_index, output_capture_time_us);
+	}
+
+private:
+	cv::Size frame_size_;
+	GLuint background_shader_id_ = 0;
+	GLuint shading_shader_id_ = 0;
+	GLuint framebuffer_ = 0;
+	GLuint renderbuffers_[2] = { 0, 0 };
+	PoseUniformBuffer pose_buffer_;
+	BackgroundTexture background_texture_;
+	AssetManager asset_manager_;
+	cv::Mat stamp_image_;
+};
+
+// Capture a frame into the pool and detect the markers in it
+// If no frame is free, return false
+bool captureAndDetect(
+	SyntheticCamera& camera,
+	cv::Mat& camera_frame,
+	FramePool& frame_pool,
+	FrameRef& output_frame,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids) {
+	std::uint32_t frame_index = 0;
+	std::int64_t capture_time_ns = 0;
+	camera.read(camera_frame, frame_index, capture_time_ns);
+
+	output_frame = frame_pool.acquire();
+	if (!output_frame) {
+		return false;
+	}
+	output_frame->frame_index = frame_index;
+	output_frame->capture_time_ns = capture_time_ns;
+	cv::cvtColor(camera_frame, output_frame->image, cv::COLOR_BGR2RGB);
+
+	output_marker_poses.clear();
+	output_marker_ids.clear();
+	detectMarkersAndEstimatePose(
+		output_frame->image, output_marker_poses, output_marker_ids);
+	return true;
+}
+
+// Run one mode until enough frames are presented
+void measureLatency(
+	PipelineMode mode,
+	const LatencyHarnessSettings& settings,
+	OffscreenRenderer& renderer,
+	std::vector<std::uint32_t>& output_frame_indices,
+	std::vector<double>& output_latencies_ms,
+	LatencyStatistics& output_statistics) {
+	SyntheticCamera camera(cv::Size(1280, 720),
+		settings.camera_frame_rate, settings.marker_id);
+	FramePool frame_pool(4, camera.frameSize(), CV_8UC3);
+	SimulatedDisplay display(settings.display_refresh_rate);
+	FramePacer frame_pacer;
+	LatestDetection latest_detection;
+	std::atomic<bool> is_running(true);
+
+	// Capture and detection run on their own thread,
+	// except in the synchronous mode
+	std::thread detection_thread;
+	if (mode != PipelineMode::Synchronous) {
+		detection_thread = std::thread([&]() {
+			cv::Mat camera_frame;
+			FrameRef frame;
+			std::vector<cv::Mat> marker_poses;
+			std::vector<int> marker_ids;
+			while (is_running.load()) {
+				if (captureAndDetect(camera, camera_frame, frame_pool,
+					frame, marker_poses, marker_ids)) {
+					latest_detection.publish(frame, marker_poses, marker_ids);
+				}
+				frame.reset();
+			}
+		});
+	}
+
+	cv::Mat camera_frame;
+	std::uint64_t last_sequence = 0;
+	FrameRef shown_frame;
+	std::vector<cv::Mat> marker_poses;
+	std::vector<int> marker_ids;
+	std::set<std::uint32_t> distinct_frames;
+	size_t num_of_presented = 0;
+	size_t num_of_unreadable = 0;
+	output_frame_indices.clear();
+	output_latencies_ms.clear();
+
+	size_t num_of_frame =
+		settings.num_of_warmup_frame + settings.num_of_measured_frame;
+	while (num_of_presented < num_of_frame) {
+		if (mode == PipelineMode::Synchronous) {
+			shown_frame.reset();
+			captureAndDetect(camera, camera_frame, frame_pool,
+				shown_frame, marker_poses, marker_ids);
+		} else {
+			if (mode == PipelineMode::Paced) {
+				frame_pacer.waitForRenderStart();
+			}
+			latest_detection.takeNewer(
+				last_sequence, shown_frame, marker_poses, marker_ids);
+		}
+
+		bool is_readable = false;
+		std::uint32_t frame_index = 0;
+		std::uint32_t capture_time_us = 0;
+		if (shown_frame) {
+			is_readable = renderer.render(shown_frame,
+				marker_poses, marker_ids, frame_index, capture_time_us);
+			// The stamp in the pixels has to agree with the frame
+			// which was carried through detection and rendering
+			is_readable = is_readable &&
+				frame_index == static_cast<std::uint32_t>(
+					shown_frame->frame_index);
+		}
+		if (mode == PipelineMode::Paced) {
+			frame_pacer.onRenderFinished();
+		}
+		Clock::time_point present_time = display.swap();
+		if (mode == PipelineMode::Paced) {
+			frame_pacer.onFramePresented();
+		}
+
+		// Nothing has been detected yet
+		if (!shown_frame) {
+			continue;
+		}
+		num_of_presented++;
+		if (num_of_presented <= settings.num_of_warmup_frame) {
+			continue;
+		}
+		if (!is_readable) {
+			num_of_unreadable++;
+			continue;
+		}
+		// The times wrap around every 71 minutes, the difference does not
+		std::uint32_t latency_us =
+			microsecondsOf(present_time) - capture_time_us;
+		output_frame_indices.push_back(frame_index);
+		output_latencies_ms.push_back(latency_us / 1000.0);
+		distinct_frames.insert(frame_index);
+	}
+
+	is_running.store(false);
+	if (detection_thread.joinable()) {
+		detection_thread.join();
+	}
+
+	// Keep the latencies in the order of presentation
+	std::vector<double> sorted_latencies_ms = output_latencies_ms;
+	computeLatencyStatistics(sorted_latencies_ms, output_statistics);
+	output_statistics.num_of_presented_frame = settings.num_of_measured_frame;
+	output_statistics.num_of_distinct_frame = distinct_frames.size();
+	output_statistics.num_of_unreadable_frame = num_of_unreadable;
+}
+
+} // namespace
+
+// Sort the latencies and give their distribution
+void computeLatencyStatistics(
+	std::vector<double>& latencies_ms,
+	LatencyStatistics& output_statistics) {
+	output_statistics = LatencyStatistics();
+	if (latencies_ms.empty()) {
+		return;
+	}
+	std::sort(latencies_ms.begin(), latencies_ms.end());
+
+	// Nearest rank
+	auto percentile = [&](double p) {
+		size_t rank = static_cast<size_t>(p * latencies_ms.size());
+		return latencies_ms[std::min(rank, latencies_ms.size() - 1)];
+	};
+	double sum = 0.0;
+	for (double latency : latencies_ms) {
+		sum += latency;
+	}
+	output_statistics.mean_ms = sum / latencies_ms.size();
+	output_statistics.p50_ms = percentile(0.50);
+	output_statistics.p90_ms = percentile(0.90);
+	output_statistics.p99_ms = percentile(0.99);
+	output_statistics.max_ms = latencies_ms.back();
+}
+
+// Measure the motion-to-photon latency of every pipeline mode, headless
+bool runLatencyHarness(
+	const LatencyHarnessSettings& settings,
+	double max_p99_ms,
+	const std::string& csv_filename) {
+	// A hidden window only gives the OpenGL context,
+	// everything is drawn into a framebuffer object
+	GLFWwindow* window = nullptr;
+	if (!initializeGL(window, false)) {
+		return false;
+	}
+	// The simulated display does the waiting, not the driver
+	glfwSwapInterval(0);
+
+	// Released before the context is destroyed
+	std::unique_ptr<OffscreenRenderer> renderer(new OffscreenRenderer());
+	if (!renderer->create(cv::Size(1280, 720), settings.model_filename)) {
+		renderer.reset();
+		glfwTerminate();
+		return false;
+	}
+
+	std::ofstream csv_file;
+	if (!csv_filename.empty()) {
+		csv_file.open(csv_filename);
+		if (!csv_file.is_open()) {
+			std::fprintf(stderr, "Failed to open %s.\n", csv_filename.c_str());
+			renderer->destroy();
+			renderer.reset();
+			glfwTerminate();
+			return false;
+		}
+		csv_file << "mode,frame_index,latency_ms\n";
+	}
+
+	std::printf("camera %.1f fps, display %.1f Hz, %zu frames per mode\n",
+		settings.camera_frame_rate, settings.display_refresh_rate,
+		settings.num_of_measured_frame);
+	std::printf("%-12s %8s %8s %10s %8s %8s %8s %8s %8s\n",
+		"mode", "frames", "distinct", "unreadable",
+		"mean", "p50", "p90", "p99", "max");
+
+	bool is_passed = true;
+	std::vector<std::uint32_t> frame_indices;
+	std::vector<double> latencies_ms;
+	for (PipelineMode mode : { PipelineMode::Synchronous,
+		PipelineMode::Pipelined, PipelineMode::Paced }) {
+		LatencyStatistics statistics;
+		measureLatency(mode, settings, *renderer,
+			frame_indices, latencies_ms, statistics);
+
+		std::printf("%-12s %8zu %8zu %10zu %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+			modeName(mode),
+			statistics.num_of_presented_frame,
+			statistics.num_of_distinct_frame,
+			statistics.num_of_unreadable_frame,
+			statistics.mean_ms, statistics.p50_ms, statistics.p90_ms,
+			statistics.p99_ms, statistics.max_ms);
+		if (csv_file.is_open()) {
+			for (size_t i = 0; i < latencies_ms.size(); i++) {
+				csv_file << modeName(mode) << "," << frame_indices[i] <<
+					"," << latencies_ms[i] << "\n";
+			}
+		}
+
+		// Unreadable stamps mean the output is not the frame we think
+		if (statistics.num_of_unreadable_frame > 0 || latencies_ms.empty()) {
+			std::fprintf(stderr, "%s: the stamps cannot be read back.\n",
+				modeName(mode));
+			is_passed = false;
+		}
+		if (max_p99_ms > 0.0 && statistics.p99_ms > max_p99_ms) {
+			std::fprintf(stderr, "%s: p99 %.2f ms is over %.2f ms.\n",
+				modeName(mode), statistics.p99_ms, max_p99_ms);
+			is_passed = false;
+		}
+	}
+
+	renderer->destroy();
+	renderer.reset();
+	glfwTerminate();
+	return is_passed;
+}
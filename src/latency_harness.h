@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef LATENCY_HARNESS
+#define LATENCY_HARNESS
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The ways capture, detection and rendering are scheduled
+enum class PipelineMode {
+	// Capture, detect and render one after another on one thread
+	Synchronous,
+	// Detect on a worker thread, render the newest result at every vsync
+	Pipelined,
+	// The same as Pipelined, but start the render just before vsync
+	// with late latching (see frame_pacing.h)
+	Paced
+};
+
+struct LatencyHarnessSettings {
+	// The number of presented frames measured for each mode
+	size_t num_of_measured_frame = 300;
+	// Presented frames before measuring (model upload, pacer warm-up)
+	size_t num_of_warmup_frame = 30;
+	double camera_frame_rate = 30.0;
+	double display_refresh_rate = 60.0;
+	int marker_id = 0;
+	std::string model_filename = "../model/bun_zipper.obj";
+};
+
+// The distribution of the motion-to-photon latency of a mode, in ms
+struct LatencyStatistics {
+	size_t num_of_presented_frame = 0;
+	// Different camera frames among the presented ones
+	size_t num_of_distinct_frame = 0;
+	// Presented frames whose stamp could not be read back
+	size_t num_of_unreadable_frame = 0;
+	double mean_ms = 0.0;
+	double p50_ms = 0.0;
+	double p90_ms = 0.0;
+	double p99_ms = 0.0;
+	double max_ms = 0.0;
+};
+
+// Sort the latencies and give their distribution
+void computeLatencyStatistics(
+	std::vector<double>& latencies_ms,
+	LatencyStatistics& output_statistics);
+
+// Measure the motion-to-photon latency of every pipeline mode, headless
+// Frames come from a synthetic camera which writes the frame index and
+// capture time into each image (see synthetic_camera.h)
+// They are detected and rendered into an offscreen framebuffer, and the
+// stamp is read back from the composited output, so the latency of a
+// frame is the time of its (simulated) vsync minus its capture time
+// The latency of every frame is written to "csv_filename" if not empty
+// If the 99th percentile of a mode is over "max_p99_ms" (if > 0)
+// or the harness fails, return false
+bool runLatencyHarness(
+	const LatencyHarnessSettings& settings,
+	double max_p99_ms,
+	const std::string& csv_filename);
+
+#endif // !LATENCY_HARNESS
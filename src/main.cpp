@@ -2,10 +2,38 @@
 #include "draw_graphics.h"
 #include "marker_detection.h"
 #include "graphics_utility.h"
+#include "asset_manager.h"
+#include "batch_processing.h"
+#include "pose_publisher.h"
+#include "frame_pool.h"
+#include "frame_pacing.h"
+#include "latency_harness.h"
+#include "visibility.h"
+#include "work_stealing_pool.h"
+#include "scene_change.h"
+#include "frame_profiler.h"
+#include "quality_controller.h"
+#include "mjpeg_capture.h"
+#include "multi_camera.h"
+#include "pose_accuracy.h"
+#include "marker_set.h"
+#include "marker_map.h"
+#include "marker_decoder.h"
+#include "camera_calibration.h"
+#include "thread_placement.h"
+#include "metrics_exporter.h"
+#include "frame_recorder.h"
+#include "frame_cache.h"
+#include "replay_benchmark.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
@@ -22,128 +50,738 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-int main() {
+int main(int argc, char** argv) {
+	// Offline batch mode without window or camera:
+	// <program> --batch <video file> <pose log file> [A|B]
+	if (argc >= 4 && std::string(argv[1]) == "--batch") {
+		bool use_chessboard = argc >= 5 && std::string(argv[4]) == "B";
+		return processVideoToPoseLog(argv[2], argv[3], use_chessboard) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Decode a video once into a frame cache for replays:
+	// <program> --build-cache <video file> <cache file> [gray]
+	// With "gray", only the grayscale planes are kept
+	if (argc >= 4 && std::string(argv[1]) == "--build-cache") {
+		bool keep_color = !(argc >= 5 && std::string(argv[4]) == "gray");
+		return buildFrameCache(argv[2], argv[3], keep_color) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Detection benchmark on a frame cache, without decoding or I/O:
+	// <program> --replay <cache file> [A|B] [passes] [csv file]
+	if (argc >= 3 && std::string(argv[1]) == "--replay") {
+		ReplayBenchmarkSettings settings;
+		settings.use_chessboard = argc >= 4 && std::string(argv[3]) == "B";
+		if (argc >= 5) {
+			settings.num_of_pass = std::strtoul(argv[4], nullptr, 10);
+		}
+		std::string csv_filename = argc >= 6 ? argv[5] : "";
+		return runReplayBenchmark(argv[2], settings, csv_filename) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// The async detector against the synchronous one on a frame cache:
+	// <program> --replay-async <cache file> [A|B]
+	if (argc >= 3 && std::string(argv[1]) == "--replay-async") {
+		bool use_chessboard = argc >= 4 && std::string(argv[3]) == "B";
+		return runAsyncDetectorCheck(argv[2], use_chessboard) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Headless latency measurement of the pipeline modes:
+	// <program> --latency [frames per mode] [max p99 ms] [csv file]
+	// It fails if the 99th percentile of a mode is over the limit
+	if (argc >= 2 && std::string(argv[1]) == "--latency") {
+		LatencyHarnessSettings settings;
+		if (argc >= 3) {
+			settings.num_of_measured_frame = std::strtoul(argv[2], nullptr, 10);
+		}
+		double max_p99_ms = argc >= 4 ? std::atof(argv[3]) : 0.0;
+		std::string csv_filename = argc >= 5 ? argv[4] : "";
+		return runLatencyHarness(settings, max_p99_ms, csv_filename) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Pose accuracy of the detectors against synthetic ground truth:
+	// <program> --accuracy [max p95 rotation deg] [max p95 translation mm]
+	//                      [csv file]
+	// It fails if a detector is over a threshold or misses too many targets
+	if (argc >= 2 && std::string(argv[1]) == "--accuracy") {
+		PoseAccuracySettings settings;
+		if (argc >= 3) {
+			settings.max_rotation_error_deg = std::atof(argv[2]);
+		}
+		if (argc >= 4) {
+			settings.max_translation_error_mm = std::atof(argv[3]);
+		}
+		std::string csv_filename = argc >= 5 ? argv[4] : "";
+		return runPoseAccuracySuite(settings, csv_filename) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// The metrics server against a scrape of known values:
+	// <program> --metrics-check [port]
+	if (argc >= 2 && std::string(argv[1]) == "--metrics-check") {
+		int port = argc >= 3 ? std::atoi(argv[2]) : 9464;
+		return runMetricsSelfCheck(port) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// "--pacing" schedules the render against vsync with late latching
+	// "--parallel" detects markers in tiles on all cores
+	// "--scene-gating" skips detection while the scene does not change
+	// "--adaptive" lowers the quality to hold a frame time of 16.6 ms
+	// "--mjpeg" captures compressed frames and decodes them in parallel
+	// "--mjpeg-file <file>" plays a recorded MJPEG stream instead
+	// "--camera <index or video>[@<calibration file>]" once per camera
+	// shows several cameras tiled in one window
+	// "--markers <file>" detects only the markers listed in the file
+	// instead of the ones in parameters.h (see marker_set.h)
+	// "--marker-map" keeps drawing occluded markers from a learned map
+	// "--pin <capture|detect|render|opencv>=<CPU list>" runs the threads
+	// of a stage only on these CPUs, e.g. "--pin detect=2-5"
+	// "--fifo <capture|render>" runs a stage with SCHED_FIFO
+	// "--opencv-threads <n>" caps the threads of OpenCV's parallel_for
+	// "--metrics <port>" serves the metrics on 127.0.0.1:<port>/metrics
+	// instead of printing the timings
+	// "--record <file>" records the shown frames (".y4m" for raw video)
+	bool use_frame_pacing = false;
+	bool use_parallel_detection = false;
+	bool use_scene_gating = false;
+	bool use_marker_map = false;
+	ThreadPlacement thread_placement;
+	bool use_thread_placement = false;
+	bool use_adaptive_quality = false;
+	int metrics_port = 0;
+	std::string record_filename;
+	bool use_mjpeg = false;
+	std::string mjpeg_filename;
+	std::vector<CameraStreamSettings> camera_streams;
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--camera" && i + 1 < argc) {
+			camera_streams.push_back(parseCameraStream(argv[++i]));
+		}
+		use_mjpeg |= std::string(argv[i]) == "--mjpeg";
+		if (std::string(argv[i]) == "--mjpeg-file" && i + 1 < argc) {
+			use_mjpeg = true;
+			mjpeg_filename = argv[++i];
+		}
+		use_adaptive_quality |= std::string(argv[i]) == "--adaptive";
+		use_frame_pacing |= std::string(argv[i]) == "--pacing";
+		use_parallel_detection |= std::string(argv[i]) == "--parallel";
+		use_scene_gating |= std::string(argv[i]) == "--scene-gating";
+		use_marker_map |= std::string(argv[i]) == "--marker-map";
+		if (std::string(argv[i]) == "--pin" && i + 1 < argc) {
+			if (!parseStagePin(argv[++i], thread_placement)) {
+				std::fprintf(stderr, "%s is not a valid placement.\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			use_thread_placement = true;
+		}
+		if (std::string(argv[i]) == "--fifo" && i + 1 < argc) {
+			std::string stage = argv[++i];
+			if (stage != "capture" && stage != "render") {
+				std::fprintf(stderr, "Only capture and render can use "
+					"SCHED_FIFO.\n");
+				return EXIT_FAILURE;
+			}
+			thread_placement.stage(stage == "capture" ?
+				PipelineStage::Capture : PipelineStage::Render).use_fifo = true;
+			use_thread_placement = true;
+		}
+		if (std::string(argv[i]) == "--opencv-threads" && i + 1 < argc) {
+			thread_placement.num_of_opencv_thread = std::atoi(argv[++i]);
+			use_thread_placement = true;
+		}
+		if (std::string(argv[i]) == "--metrics" && i + 1 < argc) {
+			metrics_port = std::atoi(argv[++i]);
+		}
+		if (std::string(argv[i]) == "--record" && i + 1 < argc) {
+			record_filename = argv[++i];
+		}
+		if (std::string(argv[i]) == "--markers" && i + 1 < argc) {
+			MarkerSet marker_set;
+			if (!loadMarkerSet(argv[++i], marker_set)) {
+				return EXIT_FAILURE;
+			}
+			setActiveMarkerSet(marker_set);
+		}
+	}
+
+	// Place the threads before any of them starts, this one renders
+	if (use_thread_placement) {
+		setThreadPlacement(thread_placement);
+		printThreadPlacement();
+		placeCurrentThread(PipelineStage::Render, "render");
+	}
+
 	std::string selection;
 	std::cout << "Select to use a kind of marker" << std::endl;
 	std::cout << "A: ArUco Marker" << std::endl;
 	std::cout << "B: Chessboard" << std::endl;
 	std::cin >> selection;
 
+	// Every camera has its own capture thread and calibration,
+	// and all of them share one pool of detection workers
+	if (!camera_streams.empty()) {
+		return runMultiCamera(camera_streams, selection == "B") ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	// Use my PC's internal camera
-	// Open the internal camera
-	cv::VideoCapture internal_camera(0);
-	// Set width as 1280 pixels
-	internal_camera.set(3, 1280);
-	// Set height as 720 pixels
-	internal_camera.set(4, 720);
+	cv::VideoCapture internal_camera;
+	// Or decode its MJPEG frames on worker threads, with the grayscale
+	// image for detection and the color image at half size for display
+	std::unique_ptr<MjpegCapture> mjpeg_capture;
+	MjpegFrame mjpeg_frame;
+	if (use_mjpeg) {
+		MjpegCaptureSettings mjpeg_settings;
+		// A recording is played at the rate of the camera
+		mjpeg_settings.playback_fps = 30.0;
+		mjpeg_capture.reset(new MjpegCapture(mjpeg_settings));
+		// The intrinsic parameters are calibrated for 1280x720
+		bool is_opened = mjpeg_filename.empty() ?
+			mjpeg_capture->openCamera(0, cv::Size(1280, 720), 30.0) :
+			mjpeg_capture->openFile(mjpeg_filename);
+		if (!is_opened) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		// Open the internal camera
+		internal_camera.open(0);
+		// Set width as 1280 pixels
+		internal_camera.set(3, 1280);
+		// Set height as 720 pixels
+		internal_camera.set(4, 720);
+	}
+	// The displayed frames are this many times smaller than
+	// the frames the poses are estimated in
+	const int display_reduction =
+		mjpeg_capture ? mjpeg_capture->settings().color_reduction : 1;
 
-	// Current frame from the internal camera
-	cv::Mat current_frame;
+	// Current frame from the internal camera (BGR)
+	// VideoCapture reuses its buffer as long as the size does not change
+	cv::Mat camera_frame;
+	// RGB frames which flow through detection and rendering
+	// The pool is created when the size of the first frame is known
+	std::unique_ptr<FramePool> frame_pool;
 
 	GLFWwindow* window = nullptr;
 	initializeGL(window);
 
-	// Load the shaders for drawing background
-	GLuint background_shader_id = loadShaders(
-		"background_vertex_shader.vert",
-		"background_fragment_shader.frag");
+	// The frames are read back a few frames late and encoded on
+	// another thread, so recording never waits
+	std::unique_ptr<FrameRecorder> frame_recorder;
+	if (!record_filename.empty()) {
+		int framebuffer_width = 0;
+		int framebuffer_height = 0;
+		glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+		frame_recorder.reset(new FrameRecorder());
+		if (!frame_recorder->open(record_filename,
+			cv::Size(framebuffer_width, framebuffer_height))) {
+			frame_recorder.reset();
+			glfwTerminate();
+			return EXIT_FAILURE;
+		}
+	}
 
-	// Load the shaders for drawing the bunny with specular shading
-	GLuint shading_shader_id = loadShaders(
-		"shading_vertex_shader.vert",
-		"shading_fragment_shader.frag");
+	// Load all the shaders in one batch
+	// Linked programs are cached in "shader_cache" for the next launch
+	std::vector<GLuint> program_ids;
+	loadShaderPrograms({
+		// The shaders for drawing background
+		{ "background_vertex_shader.vert",
+			"background_fragment_shader.frag" },
+		// The shaders for drawing the bunny with specular shading
+		{ "shading_vertex_shader.vert",
+			"shading_fragment_shader.frag",
+			shadingShaderDefines() },
+		// The shaders for drawing the bunny with color of red-blue
+		{ "color_vertex_shader.vert",
+			"color_fragment_shader.frag" } },
+		"shader_cache", program_ids);
+	GLuint background_shader_id = program_ids[0];
+	GLuint shading_shader_id = program_ids[1];
+	GLuint color_shader_id = program_ids[2];
 
 	/** ply file only contains the information about vertices
 	  * so the following code only create a bunny with color of red-blue
-	GLuint color_shader_id = loadShaders(
-		"color_vertex_shader.vert",
-		"color_fragment_shader.frag");
 	std::vector<glm::vec3> color_bunny_vertices;
 	loadPly("../model/bun_zipper_res4.ply", color_bunny_vertices);
 	*/
 
-	std::vector<glm::vec3> shading_bunny_vertices, shading_bunny_normals;
-	loadObj("../model/bun_zipper.obj",
-		shading_bunny_vertices, shading_bunny_normals);
-
-	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-		!glfwWindowShouldClose(window)) {
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		std::clock_t start_time, finish_time;
-		start_time = std::clock();
-		if (internal_camera.read(current_frame)) {
-			// Convert BGR to RGB
-			cv::cvtColor(current_frame, current_frame, cv::COLOR_BGR2RGB);
-
-			// Record the poses of the markers
-			std::vector<cv::Mat> all_marker_poses;
-			if (selection == "A") {
-				detectMarkersAndEstimatePose(
-					current_frame,
-					all_marker_poses);
-			}
-			if (selection == "B") {
-				detctChessboardAndEstimatePose(
-					current_frame,
-					all_marker_poses);
+	// Parse the models on worker threads, so the camera feed is shown
+	// at once, and a placeholder is drawn until they are ready
+	// Other markers can show other models by "assignModel"
+	// Released before the context is destroyed
+	std::unique_ptr<AssetManager> asset_manager(new AssetManager());
+	// 12 bytes per vertex instead of 24
+	asset_manager->setVertexFormat(VertexFormat::Compact16);
+	asset_manager->loadModelAsync("bunny", "../model/bun_zipper.obj");
+	asset_manager->setDefaultModel("bunny");
+
+	// Publish the poses of each frame to other local processes
+	// (see pose_publisher.h), the AR loop never waits for them
+	PosePublisher pose_publisher;
+	pose_publisher.open();
+	std::uint64_t num_of_processed_frame = 0;
+
+	// The view matrices of the markers are written into this buffer
+	// right before the markers are drawn
+	PoseUniformBuffer pose_buffer;
+	createPoseUniformBuffer({ shading_shader_id }, pose_buffer);
+
+	// The texture and the quad of the camera frames
+	BackgroundTexture background_texture;
+
+	// All models share one vertex and index buffer, and the models of
+	// all markers are drawn by one multi-draw call
+	SceneRenderer scene_renderer;
+	if (scene_renderer.create({ shading_shader_id })) {
+		asset_manager->setSceneRenderer(&scene_renderer);
+		std::printf("Scene renderer: %s\n",
+			scene_renderer.usesMultiDrawIndirect() ?
+			"glMultiDrawElementsIndirect" : "one draw per model");
+	}
+
+	// The workers of the parallel detection, shared by tiles and poses
+	std::unique_ptr<WorkStealingPool> detection_pool;
+	if (use_parallel_detection) {
+		detection_pool.reset(new WorkStealingPool());
+	}
+
+	// The CPU time of each stage, and the GPU time of each render pass
+	// The GPU times are read a few frames later, so nothing waits for them
+	StageTimings cpu_timings;
+	StageTimings gpu_timings;
+	const size_t background_pass = 0;
+	const size_t marker_pass = 1;
+	GpuTimerRing gpu_timer;
+	gpu_timer.create(2);
+	size_t num_of_rendered_frame = 0;
+
+	// Delete every OpenGL object while the context is still alive,
+	// and terminate GLFW
+	auto releaseGraphics = [&]() {
+		if (frame_recorder) {
+			frame_recorder->close();
+		}
+		gpu_timer.destroy();
+		deletePoseUniformBuffer(pose_buffer);
+		deleteBackgroundTexture(background_texture);
+		asset_manager.reset();
+		scene_renderer.destroy();
+
+		glDeleteProgram(background_shader_id);
+		glDeleteProgram(shading_shader_id);
+		glDeleteProgram(color_shader_id);
+
+		// Close OpenGL window and terminate GLFW
+		glfwTerminate();
+	};
+
+	// The metrics are always counted (one relaxed atomic each),
+	// and with "--metrics" they are served to a scraper
+	MetricsRegistry metrics;
+	MetricCounter& frames_captured = metrics.counter(
+		"ar_frames_captured_total", "Frames read from the camera");
+	MetricCounter& frames_dropped = metrics.counter(
+		"ar_frames_dropped_total", "Frames dropped before detection",
+		"reason=\"pool_full\"");
+	MetricCounter& frames_dropped_by_decoder = metrics.counter(
+		"ar_frames_dropped_total", "Frames dropped before detection",
+		"reason=\"mjpeg_decoder\"");
+	MetricCounter& frames_skipped = metrics.counter(
+		"ar_frames_skipped_total", "Frames whose detection was skipped",
+		"reason=\"scene_unchanged\"");
+	MetricHistogram& markers_detected = metrics.histogram(
+		"ar_markers_detected", "Markers detected in a frame",
+		{ 0.0, 1.0, 2.0, 4.0, 8.0, 16.0, 32.0 });
+	MetricGauge& frames_in_use = metrics.gauge(
+		"ar_frame_pool_in_use", "Frames which are queued or shown");
+#ifdef COUNT_OPERATOR_NEW
+	MetricCounter& operator_new_calls = metrics.counter(
+		"ar_operator_new_calls_total",
+		"Calls of the global operator new (not cv::Mat buffers)");
+#endif
+	MetricCounter& gpu_timer_dropped = metrics.counter(
+		"ar_gpu_timer_dropped_total",
+		"Frames whose GPU times were not ready in time");
+	cpu_timings.exportTo(&metrics, "ar_stage_duration_ms", "stage");
+	gpu_timings.exportTo(&metrics, "ar_gpu_pass_duration_ms", "pass");
+	MetricCounter& recorder_dropped = metrics.counter(
+		"ar_recorder_frames_dropped_total",
+		"Shown frames which the recorder could not keep");
+	MetricsServer metrics_server;
+	if (metrics_port > 0) {
+		if (!metrics_server.start(metrics, metrics_port)) {
+			releaseGraphics();
+			return EXIT_FAILURE;
+		}
+		std::printf("Serving metrics on 127.0.0.1:%d/metrics\n",
+			metrics_port);
+	}
+
+	// With "--scene-gating", a frame which looks the same as the last
+	// detected one reuses its poses, so a static scene costs almost nothing
+	SceneChangeDetector scene_change_detector;
+	std::vector<cv::Mat> reused_marker_poses;
+	std::vector<int> reused_marker_ids;
+
+	// The knobs of detection and rendering, stepped by the controller
+	// The default is the full quality without corner refinement
+	std::unique_ptr<QualityController> quality_controller;
+	if (use_adaptive_quality) {
+		quality_controller.reset(new QualityController());
+	}
+	auto currentQuality = [&]() {
+		return quality_controller ?
+			quality_controller->level() : QualityLevel{ 1.0, 1, 0, 0 };
+	};
+	int num_of_frame_since_detection = 0;
+
+	// With "--marker-map", the markers seen together are placed in a map,
+	// and the ones which are not detected get their poses from the camera
+	std::unique_ptr<MarkerMap> marker_map;
+	std::vector<std::vector<cv::Point2f>> map_marker_corners;
+	if (use_marker_map) {
+		marker_map.reset(new MarkerMap());
+	}
+
+	// Capture a frame, and detect markers in it
+	// If no frame can be read, or the scene has not changed, return false
+	auto captureAndDetect = [&](
+		FrameRef& output_frame,
+		std::vector<cv::Mat>& output_marker_poses,
+		std::vector<int>& output_marker_ids) -> bool {
+		{
+			ScopedStageTimer timer(cpu_timings, "capture");
+			if (mjpeg_capture) {
+				if (!mjpeg_capture->read(mjpeg_frame)) {
+					return false;
+				}
+				// The buffers go back to the capture with the next read
+				std::swap(camera_frame, mjpeg_frame.color);
+			} else if (!internal_camera.read(camera_frame)) {
+				return false;
 			}
-			// Switch the image origin from top-left to bottom-left image
-			// in order to draw in OpenGL
-			cv::flip(current_frame, current_frame, 0);
-
-			// Draw the current frame as background
-			drawBackground(current_frame, background_shader_id);
-			glClear(GL_DEPTH_BUFFER_BIT);
-
-			glm::mat4 projection;
-			buildProjection(current_frame, projection);
-			// Rotate around x-axis
-			glm::vec3 rotation_axis(1.0f, 0.0f, 0.0f);
-			// Rotation is to make the bunny sit on the marker
-			// If translation is not applied,
-			// the bunny will sit on top of the marker
-			// Scaling is to shrink the size of the bunny
-			glm::mat4 model =
-				glm::rotate(glm::mat4(),
-					glm::radians(89.0f), rotation_axis) *
-				glm::scale(glm::mat4(),
-					glm::vec3(0.5f, 0.5f, 0.5f));
-			size_t num_of_marker = all_marker_poses.size();
-			for (size_t i = 0; i < num_of_marker; i++) {
-				cv::Mat current_marker_pose = all_marker_poses[i];
-				glm::mat4 view = glm::make_mat4(
-					reinterpret_cast<GLfloat*>(
-						current_marker_pose.data));
-
-				/** This is the code for drawing color bunny
-				drawColorBunny(
-					color_bunny_vertices,
-					model, view, projection,
-					color_shader_id);
-				*/
-
-				drawShadingBunny(
-					shading_bunny_vertices, shading_bunny_normals,
-					model, view, projection,
-					shading_shader_id);
+		}
+		frames_captured.add();
+		std::int64_t capture_time_ns = mjpeg_capture ?
+			mjpeg_frame.capture_time_ns :
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		if (!frame_pool) {
+			frame_pool.reset(new FramePool(4, camera_frame.size(), CV_8UC3));
+		}
+		// The pool keeps the size of the first frame
+		if (camera_frame.size() != frame_pool->frameSize()) {
+			cv::resize(camera_frame, camera_frame, frame_pool->frameSize());
+		}
+
+		// The last frame stays on screen, and its poses are published
+		// again for this frame
+		if (use_scene_gating &&
+			!scene_change_detector.hasChanged(camera_frame)) {
+			frames_skipped.add();
+			pose_publisher.publish(num_of_processed_frame++, capture_time_ns,
+				reused_marker_ids, reused_marker_poses);
+			return false;
+		}
+
+		// Frames which are still shown or queued are not overwritten,
+		// so if all of them are in use, drop this one
+		output_frame = frame_pool->acquire();
+		frames_in_use.set(static_cast<double>(
+			frame_pool->size() - frame_pool->available()));
+		if (!output_frame) {
+			frames_dropped.add();
+			return false;
+		}
+		output_frame->frame_index = num_of_processed_frame;
+		output_frame->capture_time_ns = capture_time_ns;
+		cv::Mat& current_frame = output_frame->image;
+
+		// Convert BGR to RGB
+		// (into another buffer, since in-place conversion copies)
+		{
+			ScopedStageTimer timer(cpu_timings, "convert");
+			cv::cvtColor(camera_frame, current_frame, cv::COLOR_BGR2RGB);
+		}
+
+		// At the lowest qualities only every n-th frame is detected,
+		// the others show the last poses
+		QualityLevel quality = currentQuality();
+		if (++num_of_frame_since_detection < quality.detection_interval) {
+			output_marker_poses = reused_marker_poses;
+			output_marker_ids = reused_marker_ids;
+			pose_publisher.publish(num_of_processed_frame++, capture_time_ns,
+				output_marker_ids, output_marker_poses);
+			return true;
+		}
+		num_of_frame_since_detection = 0;
+
+		ScopedStageTimer detect_timer(cpu_timings, "detect");
+		output_marker_poses.clear();
+		output_marker_ids.clear();
+		// The decoder gives the full-size grayscale image for detection
+		const cv::Mat& detection_image =
+			mjpeg_capture ? mjpeg_frame.grayscale : current_frame;
+		DetectionOptions detection_options;
+		detection_options.scale = quality.detection_scale;
+		detection_options.corner_refinement_iterations =
+			quality.corner_refinement_iterations;
+		// The chessboard has no id, so it is not put into the map
+		const bool use_map = selection == "A" && marker_map;
+		if (use_map) {
+			// Only the corners are found, the map estimates the camera
+			// pose once and gives the poses of the markers from it
+			if (detection_pool) {
+				detectMarkersInTiles(detection_image, *detection_pool, 0,
+					map_marker_corners, output_marker_ids);
+			} else {
+				detectMarkers(detection_image, detection_options,
+					map_marker_corners, output_marker_ids);
 			}
+			markers_detected.observe(
+				static_cast<double>(output_marker_ids.size()));
+			marker_map->update(map_marker_corners, activeMarkerSet(),
+				defaultCameraCalibration(), output_marker_ids,
+				output_marker_poses);
+		} else if (selection == "A" && detection_pool) {
+			detectMarkersAndEstimatePoseParallel(
+				detection_image,
+				*detection_pool,
+				output_marker_poses,
+				output_marker_ids);
+		} else if (selection == "A") {
+			detectMarkersAndEstimatePose(
+				detection_image,
+				detection_options,
+				output_marker_poses,
+				output_marker_ids);
+		}
+		if (selection == "B") {
+			detctChessboardAndEstimatePose(
+				detection_image,
+				output_marker_poses);
+			// The chessboard has no id, so it shows the default model
+			output_marker_ids.assign(output_marker_poses.size(), -1);
+		}
+		if (!use_map) {
+			markers_detected.observe(
+				static_cast<double>(output_marker_ids.size()));
+		}
+		pose_publisher.publish(num_of_processed_frame++, capture_time_ns,
+			output_marker_ids, output_marker_poses);
+		reused_marker_poses = output_marker_poses;
+		reused_marker_ids = output_marker_ids;
+		// Only a detected frame becomes the reference of the gating
+		scene_change_detector.commitReference();
+		return true;
+	};
+
+	// The pixel sizes under which models are dropped or drawn as boxes
+	CullingSettings culling_settings;
+
+	// Draw a frame as background and the models on its markers
+	auto renderFrame = [&](
+		const FrameRef& frame,
+		const std::vector<cv::Mat>& marker_poses,
+		const std::vector<int>& marker_ids) {
+		const cv::Mat& current_frame = frame->image;
+
+		ScopedStageTimer timer(cpu_timings, "render");
 
-			finish_time = std::clock();
+		// Draw the current frame as background
+		// (the image origin is switched by the texture coordinates)
+		gpu_timer.beginPass(background_pass);
+		drawBackground(current_frame, background_shader_id,
+			background_texture);
+		gpu_timer.endPass(background_pass);
+		glClear(GL_DEPTH_BUFFER_BIT);
 
-			double duration = static_cast<double>(finish_time - start_time);
-			std::cout << "time: " << duration << " ms" << std::endl;
+		// Upload the models which have been loaded since last frame
+		asset_manager->uploadReadyModels();
 
+		glm::mat4 projection;
+		buildProjection(cv::Size(current_frame.cols * display_reduction,
+			current_frame.rows * display_reduction), projection);
+		// Rotate around x-axis
+		glm::vec3 rotation_axis(1.0f, 0.0f, 0.0f);
+		// Rotation is to make the bunny sit on the marker
+		// If translation is not applied,
+		// the bunny will sit on top of the marker
+		// Scaling is to shrink the size of the bunny
+		glm::mat4 model =
+			glm::rotate(glm::mat4(),
+				glm::radians(89.0f), rotation_axis) *
+			glm::scale(glm::mat4(),
+				glm::vec3(0.5f, 0.5f, 0.5f));
+
+		// Everything else of the frame is done,
+		// so write the poses as late as possible
+		gpu_timer.beginPass(marker_pass);
+		latchMarkerPoses(marker_poses, pose_buffer);
+
+		/** This is the code for drawing color bunny
+		for (size_t i = 0; i < marker_poses.size(); i++) {
+			glm::mat4 view = glm::make_mat4(
+				reinterpret_cast<GLfloat*>(marker_poses[i].data));
+			drawColorBunny(
+				color_bunny_vertices,
+				model, view, projection,
+				color_shader_id);
+		}
+		*/
+
+		// Models outside the frame or too small to see are skipped
+		// (the sizes are doubled for every step of the level-of-detail bias)
+		CullingSettings lod_culling_settings = culling_settings;
+		float lod_factor =
+			static_cast<float>(1 << currentQuality().lod_bias);
+		lod_culling_settings.min_pixel_radius *= lod_factor;
+		lod_culling_settings.impostor_pixel_radius *= lod_factor;
+		drawVisibleMarkerModels(
+			*asset_manager, model,
+			marker_poses, marker_ids,
+			projection, current_frame.rows,
+			lod_culling_settings,
+			shading_shader_id,
+			nullptr, &scene_renderer);
+
+		finishMarkerPoses(pose_buffer);
+		gpu_timer.endPass(marker_pass);
+	};
+
+	// Swap, and update the metrics or print the timings every 60 frames
+	auto presentFrame = [&]() {
+		if (frame_recorder) {
+			ScopedStageTimer timer(cpu_timings, "record");
+			frame_recorder->captureFrame();
+			recorder_dropped.store(frame_recorder->numOfDroppedFrame());
+		}
+		{
+			ScopedStageTimer timer(cpu_timings, "swap");
 			glfwSwapBuffers(window);
 		}
-	}
 
-	glDeleteProgram(background_shader_id);
-	glDeleteProgram(shading_shader_id);
-	// glDeleteProgram(color_shader_id);
+		std::vector<double> pass_ms;
+		double frame_ms = 0.0;
+		if (gpu_timer.takeResults(pass_ms, frame_ms)) {
+			gpu_timings.record("background", pass_ms[background_pass]);
+			gpu_timings.record("markers", pass_ms[marker_pass]);
+			gpu_timings.record("frame", frame_ms);
+		}
+		// The detection time is spread over the frames between detections,
+		// and the render time is the longer one of the CPU and the GPU
+		if (quality_controller) {
+			quality_controller->update(
+				cpu_timings.average("detect") /
+					currentQuality().detection_interval,
+				std::max(cpu_timings.average("render"),
+					gpu_timings.average("frame")));
+		}
+		if (++num_of_rendered_frame % 60 == 0 && metrics_port <= 0) {
+			cpu_timings.print("cpu");
+			gpu_timings.print("gpu");
+		}
+		if (mjpeg_capture) {
+			frames_dropped_by_decoder.store(mjpeg_capture->numOfDroppedFrame());
+		}
+#ifdef COUNT_OPERATOR_NEW
+		operator_new_calls.store(numOfOperatorNewCall());
+#endif
+		gpu_timer_dropped.store(gpu_timer.numOfDroppedFrame());
+	};
+
+	// Record the poses and ids of the markers
+	// (outside the loop, so the vectors keep their memory)
+	std::vector<cv::Mat> all_marker_poses;
+	std::vector<int> all_marker_ids;
+
+	if (!use_frame_pacing) {
+		while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
+			!glfwWindowShouldClose(window)) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+			FrameRef frame;
+			if (captureAndDetect(frame, all_marker_poses, all_marker_ids)) {
+				gpu_timer.beginFrame();
+				renderFrame(frame, all_marker_poses, all_marker_ids);
+				gpu_timer.endFrame();
+
+				presentFrame();
+			}
+			glfwPollEvents();
+		}
+	} else {
+		// Frame pacing mode:
+		// Capture and detection run on their own thread, and the render
+		// starts just early enough to finish before vsync, with the
+		// newest frame and poses taken right before drawing
+		glfwSwapInterval(1);
+
+		LatestDetection latest_detection;
+		std::atomic<bool> is_running(true);
+		std::thread detection_thread([&]() {
+			placeCurrentThread(PipelineStage::Detection, "detection");
+			FrameRef frame;
+			std::vector<cv::Mat> marker_poses;
+			std::vector<int> marker_ids;
+			while (is_running.load()) {
+				if (captureAndDetect(frame, marker_poses, marker_ids)) {
+					latest_detection.publish(frame, marker_poses, marker_ids);
+				}
+				frame.reset();
+			}
+		});
+
+		FramePacer frame_pacer;
+		std::uint64_t last_sequence = 0;
+		FrameRef shown_frame;
+		while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
+			!glfwWindowShouldClose(window)) {
+			frame_pacer.waitForRenderStart();
+
+			// Late latching: the newest frame and its poses
+			// (the last frame is shown again if there is no newer one)
+			latest_detection.takeNewer(last_sequence,
+				shown_frame, all_marker_poses, all_marker_ids);
+
+			gpu_timer.beginFrame();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			if (shown_frame) {
+				renderFrame(shown_frame, all_marker_poses, all_marker_ids);
+			}
+			gpu_timer.endFrame();
+
+			// Wait for the GPU, so no frame is queued behind this one
+			glFinish();
+			frame_pacer.onRenderFinished();
+			presentFrame();
+			frame_pacer.onFramePresented();
+			glfwPollEvents();
+		}
+
+		is_running.store(false);
+		detection_thread.join();
+	}
+
+	if (mjpeg_capture) {
+		std::printf("mjpeg: %zu frames dropped\n",
+			mjpeg_capture->numOfDroppedFrame());
+		mjpeg_capture->close();
+	}
+	if (frame_recorder) {
+		frame_recorder->close();
+		std::printf("record: %zu frames written, %zu dropped\n",
+			frame_recorder->numOfRecordedFrame(),
+			frame_recorder->numOfDroppedFrame());
+	}
+	metrics_server.stop();
+	releaseGraphics();
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+// Implement the class in mapped_file.h
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t page_size = 4096;
+
+} // namespace
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+// Map the whole file
+bool MappedFile::open(const std::string& input_filename) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(input_filename.c_str(), GENERIC_READ,
+		FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+	file_handle_ = file;
+	mapping_handle_ = mapping;
+	data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+	int file = ::open(input_filename.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat file_status;
+	if (fstat(file, &file_status) != 0 || file_status.st_size == 0) {
+		::close(file);
+		return false;
+	}
+	size_ = static_cast<size_t>(file_status.st_size);
+	data_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, file, 0);
+	// The mapping stays valid after the file is closed
+	::close(file);
+	if (data_ == MAP_FAILED) {
+		data_ = nullptr;
+	}
+#endif
+	if (data_ == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (data_ != nullptr) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_handle_ != nullptr) {
+		CloseHandle(mapping_handle_);
+	}
+	if (file_handle_ != nullptr) {
+		CloseHandle(file_handle_);
+	}
+	mapping_handle_ = nullptr;
+	file_handle_ = nullptr;
+#else
+	if (data_ != nullptr) {
+		munmap(data_, size_);
+	}
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
+
+// Touch one byte of every page
+void MappedFile::prefault() const {
+	if (data_ == nullptr) {
+		return;
+	}
+#ifndef _WIN32
+	madvise(data_, size_, MADV_WILLNEED);
+#endif
+	const volatile unsigned char* bytes =
+		static_cast<const volatile unsigned char*>(data_);
+	unsigned char sum = 0;
+	for (size_t offset = 0; offset < size_; offset += page_size) {
+		sum ^= bytes[offset];
+	}
+	(void)sum;
+}
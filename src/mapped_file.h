@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read-only into memory
+// The readers of the binary files (pose logs, frame caches) check their
+// own headers on top of it
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// If the file cannot be opened, is empty or cannot be mapped,
+	// return false
+	bool open(const std::string& input_filename);
+	void close();
+
+	bool isOpen() const { return data_ != nullptr; }
+	const void* data() const { return data_; }
+	size_t size() const { return size_; }
+
+	// Read every page once, so later reads do not wait for the disk
+	void prefault() const;
+
+private:
+	void* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void* file_handle_ = nullptr;
+	void* mapping_handle_ = nullptr;
+#endif
+};
+
+#endif // !MAPPED_FILE
@@ -0,0 +1,770 @@
+// Implement the functions in marker_decoder.h
+#include "marker_decoder.h"
+#include "parameters.h"
+#include "marker_set.h"
+#include "frame_pool.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+// The bits of the 250 markers in DICT_6X6_250 (rotation 0)
+// Each marker is 6x6 bits stored row by row, the first bit is the highest one
+constexpr std::uint64_t dictionary_6x6_250_bits[250] = {
+	0x1E3DD82A6ULL, 0x0EFBA3891ULL, 0x15907EACDULL, 0xC91B3069EULL,
+	0xD607D6E15ULL, 0xD8E8E0E68ULL, 0x4268B41F5ULL, 0x88A50F29AULL,
+	0x307D524FDULL, 0x3C2F34B3CULL, 0x45DFC74E3ULL, 0x48D85B257ULL,
+	0x710558FC6ULL, 0x86DCFAD07ULL, 0x8D72A93F6ULL, 0xA2B89DCDEULL,
+	0x09FD1E9C4ULL, 0x154DBD18FULL, 0x300A310E2ULL, 0x4807EFAFDULL,
+	0x56DF11DB6ULL, 0x66883274CULL, 0x76E8CB781ULL, 0x9A53D9CF3ULL,
+	0xA9CB84024ULL, 0xC67549490ULL, 0xC1D288941ULL, 0xE7480852BULL,
+	0xEA2FCA848ULL, 0xE963B77B1ULL, 0xFA36652AFULL, 0x065BFF7BDULL,
+	0x0541D72D6ULL, 0x0CF7246A2ULL, 0x1338A39EBULL, 0x15A893E74ULL,
+	0x3A417EE9EULL, 0x4F11E26C0ULL, 0x530DB6D20ULL, 0x589BFAE34ULL,
+	0x6409E8A0BULL, 0x60537A891ULL, 0x6159069BAULL, 0x6BFF78D7BULL,
+	0x70AD96A4FULL, 0x75846F71AULL, 0x7A95192FCULL, 0x8609760AAULL,
+	0x8A2D44C3FULL, 0x93EB78B14ULL, 0x988DA84D4ULL, 0x9EDE2B3C8ULL,
+	0xA529E07B8ULL, 0xB593B855FULL, 0xB7F8E426FULL, 0xBC205225EULL,
+	0xC04487765ULL, 0xC4C324259ULL, 0xC5A91BD8DULL, 0xCE73E6B2CULL,
+	0xCD0CA6272ULL, 0xC9435D44DULL, 0xCFBE80F34ULL, 0xE57D15877ULL,
+	0xEFC6858E9ULL, 0xF77EF3772ULL, 0x2CE43F254ULL, 0x2BDCFF4B3ULL,
+	0x37C7DDBDAULL, 0xA1A254E0FULL, 0xA982C1BB5ULL, 0xD81B49B08ULL,
+	0x035829F86ULL, 0x07C4095FCULL, 0x0FE26617BULL, 0x144836441ULL,
+	0x10AD5FFB7ULL, 0x12829553FULL, 0x16E13184CULL, 0x187A496B0ULL,
+	0x1AE886112ULL, 0x1913AE0A1ULL, 0x1B67B5A17ULL, 0x25DC95F0BULL,
+	0x288961F76ULL, 0x3354146AAULL, 0x31C16C1F7ULL, 0x33CB18C66ULL,
+	0x3ECFE490FULL, 0x464518A3FULL, 0x44BA70B67ULL, 0x419C623E8ULL,
+	0x48D1914A1ULL, 0x54F499F6DULL, 0x575A9C813ULL, 0x558355B2CULL,
+	0x57B77610FULL, 0x5C3436FE4ULL, 0x5C48FC77EULL, 0x5E6EEF402ULL,
+	0x5F233B6FFULL, 0x5B742A632ULL, 0x650FA33AEULL, 0x65D3175CCULL,
+	0x6A9C245AEULL, 0x69C5F3042ULL, 0x69D2484EAULL, 0x7479E2DE6ULL,
+	0x72CF23EABULL, 0x77B1DC414ULL, 0x7E0C07217ULL, 0x7A6970647ULL,
+	0x78B2D8707ULL, 0x79C585794ULL, 0x866F59FC6ULL, 0x82F6727F5ULL,
+	0x854E2F414ULL, 0x9A1185934ULL, 0x9C7160C97ULL, 0x9DD194FD8ULL,
+	0xA21E12E38ULL, 0xAE701C82CULL, 0xAD01219C1ULL, 0xB0351F9EEULL,
+	0xB64AD80D4ULL, 0xB537314B4ULL, 0xBEAAC7E3BULL, 0xBB683DBCFULL,
+	0xC672F72C1ULL, 0xC1E74DBABULL, 0xCB55EE59DULL, 0xCBA053724ULL,
+	0xD0090FCF1ULL, 0xD06C3AD54ULL, 0xD3F120574ULL, 0xE6E33B1A7ULL,
+	0xE3533EA4AULL, 0xE8068EB14ULL, 0xEC07C0597ULL, 0xEAF3803DAULL,
+	0xF63B27D88ULL, 0xF30798379ULL, 0xFE4BBA9B9ULL, 0xABA57D86BULL,
+	0xC0D1625ABULL, 0x13CE7BAE7ULL, 0x4E81FD617ULL, 0x56E076320ULL,
+	0x6A708A540ULL, 0x72A898A18ULL, 0x815D42F80ULL, 0xCF4CC3D5FULL,
+	0xD6BB65864ULL, 0xECD313A31ULL, 0xF521F5207ULL, 0xF91FA5DF7ULL,
+	0x0024F47A7ULL, 0x00084D882ULL, 0x043CC2F29ULL, 0x047B50211ULL,
+	0x067AE4C1DULL, 0x00AA968A3ULL, 0x04D138E94ULL, 0x0510A80DAULL,
+	0x0140B0007ULL, 0x019D9CEE1ULL, 0x081057E3BULL, 0x086B97B66ULL,
+	0x0EE8B860AULL, 0x0B6C76B9BULL, 0x0FDCB98CBULL, 0x0FCACF3A0ULL,
+	0x14249FD98ULL, 0x1407201FDULL, 0x150910D57ULL, 0x135CD7307ULL,
+	0x11479ABB6ULL, 0x1CB9A9238ULL, 0x1CDD07766ULL, 0x1F2E7C24BULL,
+	0x196642477ULL, 0x1957D4C84ULL, 0x1FA8F4F04ULL, 0x1B8246ED8ULL,
+	0x1BAEE10FEULL, 0x22A4B63CAULL, 0x22BF9012FULL, 0x232C15B40ULL,
+	0x255AA966CULL, 0x27A5AFA97ULL, 0x25F40E425ULL, 0x286655CDEULL,
+	0x2C427E0E0ULL, 0x2AB97CBD0ULL, 0x2946E1D23ULL, 0x2DA628410ULL,
+	0x2BFB209A6ULL, 0x368CD66BCULL, 0x3487777C7ULL, 0x34DDEB840ULL,
+	0x3791F76F1ULL, 0x3A228E175ULL, 0x3E13BD408ULL, 0x3C9843CA2ULL,
+	0x39589D179ULL, 0x3974DAEEBULL, 0x3F6DBC731ULL, 0x3D6BC050CULL,
+	0x39AB27497ULL, 0x46024E25EULL, 0x4682BA0BCULL, 0x42E9CD5AEULL,
+	0x44C9B7B3FULL, 0x40C7D41E9ULL, 0x46D2B4CCEULL, 0x43195356BULL,
+	0x4122E6DD9ULL, 0x4753A59ABULL, 0x4E1EF1E08ULL, 0x4E4AC0960ULL,
+	0x4E5FAA06FULL, 0x4A8D32943ULL, 0x491594B39ULL, 0x4D4DDB621ULL,
+	0x4BA761E81ULL, 0x49D483D8EULL, 0x56290EF6CULL, 0x537ED5FFCULL,
+	0x55F5A7AFAULL, 0x55D5EA64FULL, 0x581BAB1DAULL, 0x5EBE926DDULL,
+	0x5F10F99B5ULL, 0x5D1EDFA5CULL, 0x5F718DF02ULL, 0x5DE11E468ULL,
+	0x6033BB247ULL, 0x64581AFE1ULL, 0x63C8DDA76ULL, 0x61DA3D8FDULL,
+	0x6E3A22AFAULL, 0x6E6105B71ULL, 0x6A89A9E8CULL, 0x6A97224F5ULL,
+	0x6B12C3801ULL, 0x6B684B22AULL, 0x6F94C1579ULL, 0x6DA6FEA0DULL,
+	0x6FEACA457ULL, 0x703D38A60ULL
+};
+
+// The number of bits in one side of a marker (without border)
+constexpr int marker_size = 6;
+// The number of bits inside a marker
+constexpr int marker_bit_count = marker_size * marker_size;
+constexpr std::uint64_t marker_bit_mask = (1ULL << marker_bit_count) - 1;
+
+// Layout of one entry in the hash table
+// [0, 36): marker bits, [36, 44): id, [44, 46): rotation,
+// [46, 48): bit errors, 48: ambiguous, 49: used
+constexpr int entry_id_shift = 36;
+constexpr int entry_rotation_shift = 44;
+constexpr int entry_error_shift = 46;
+constexpr std::uint64_t entry_ambiguous = 1ULL << 48;
+constexpr std::uint64_t entry_used = 1ULL << 49;
+
+// Keep the load factor of the hash table below 0.6
+// so most lookups finish with a single probe
+constexpr int decode_table_log2 =
+	MAX_DECODE_ERROR_BITS == 0 ? 12 : (MAX_DECODE_ERROR_BITS == 1 ? 16 : 21);
+constexpr std::size_t decode_table_size = std::size_t(1) << decode_table_log2;
+constexpr std::size_t decode_table_mask = decode_table_size - 1;
+
+static_assert(MAX_DECODE_ERROR_BITS >= 0 && MAX_DECODE_ERROR_BITS <= 2,
+	"MAX_DECODE_ERROR_BITS must be 0, 1 or 2");
+
+struct MarkerHashTable {
+	std::uint64_t entries[decode_table_size];
+};
+
+// Rotate the bits of a marker by 90 degrees
+// It is the same rotation as OpenCV uses to build the byte list
+// of a dictionary, so the rotation found here can be used
+// to reorder the corners in the same way as "detectMarkers"
+constexpr std::uint64_t rotateMarkerBits(std::uint64_t marker_bits) {
+	std::uint64_t rotated_bits = 0;
+	for (int row = 0; row < marker_size; row++) {
+		for (int column = 0; column < marker_size; column++) {
+			int source_index = column * marker_size + (marker_size - 1 - row);
+			std::uint64_t bit =
+				(marker_bits >> (marker_bit_count - 1 - source_index)) & 1ULL;
+			rotated_bits |=
+				bit << (marker_bit_count - 1 - (row * marker_size + column));
+		}
+	}
+	return rotated_bits;
+}
+
+constexpr std::size_t hashMarkerBits(std::uint64_t marker_bits) {
+	return static_cast<std::size_t>(
+		(marker_bits * 0x9E3779B97F4A7C15ULL) >> (64 - decode_table_log2));
+}
+
+// Put one code into the table
+// A code which is already reachable with fewer bit errors is kept,
+// and a code reachable from two markers with the same bit errors is
+// marked as ambiguous, so it will never be decoded
+constexpr void insertMarkerCode(
+	MarkerHashTable& table,
+	std::uint64_t code, int id, int rotation, int bit_errors) {
+	std::uint64_t entry = code |
+		(static_cast<std::uint64_t>(id) << entry_id_shift) |
+		(static_cast<std::uint64_t>(rotation) << entry_rotation_shift) |
+		(static_cast<std::uint64_t>(bit_errors) << entry_error_shift) |
+		entry_used;
+
+	std::size_t slot = hashMarkerBits(code);
+	while (table.entries[slot] & entry_used) {
+		std::uint64_t existing = table.entries[slot];
+		if ((existing & marker_bit_mask) == code) {
+			int existing_errors =
+				static_cast<int>((existing >> entry_error_shift) & 3ULL);
+			if (existing_errors == bit_errors) {
+				table.entries[slot] = existing | entry_ambiguous;
+			}
+			return;
+		}
+		slot = (slot + 1) & decode_table_mask;
+	}
+	table.entries[slot] = entry;
+}
+
+// Insert every code which has exactly "remaining_errors" more flipped bits
+// Only bits from "first_bit" are flipped, so each neighbour is visited once
+constexpr void insertMarkerNeighbours(
+	MarkerHashTable& table,
+	std::uint64_t code, int id, int rotation,
+	int first_bit, int remaining_errors, int bit_errors) {
+	if (remaining_errors == 0) {
+		insertMarkerCode(table, code, id, rotation, bit_errors);
+		return;
+	}
+	for (int bit = first_bit; bit < marker_bit_count; bit++) {
+		insertMarkerNeighbours(table, code ^ (1ULL << bit), id, rotation,
+			bit + 1, remaining_errors - 1, bit_errors);
+	}
+}
+
+// Build the table at compile time
+// Codes are inserted in the order of bit errors,
+// so an exact match always wins against a corrected one
+constexpr MarkerHashTable buildMarkerHashTable() {
+	MarkerHashTable table{};
+	for (int bit_errors = 0; bit_errors <= MAX_DECODE_ERROR_BITS;
+		bit_errors++) {
+		for (int id = 0; id < 250; id++) {
+			std::uint64_t code = dictionary_6x6_250_bits[id];
+			for (int rotation = 0; rotation < 4; rotation++) {
+				insertMarkerNeighbours(table, code, id, rotation,
+					0, bit_errors, bit_errors);
+				code = rotateMarkerBits(code);
+			}
+		}
+	}
+	return table;
+}
+
+constexpr MarkerHashTable marker_hash_table = buildMarkerHashTable();
+
+// Find the entry of a code, return 0 if it is not in the table
+constexpr std::uint64_t findMarkerEntry(std::uint64_t marker_bits) {
+	std::size_t slot = hashMarkerBits(marker_bits);
+	while (marker_hash_table.entries[slot] & entry_used) {
+		std::uint64_t entry = marker_hash_table.entries[slot];
+		if ((entry & marker_bit_mask) == marker_bits) {
+			return entry;
+		}
+		slot = (slot + 1) & decode_table_mask;
+	}
+	return 0;
+}
+
+// Check the table when compiling:
+// marker 0 must be found in rotation 0 and rotation 1
+static_assert(
+	((findMarkerEntry(dictionary_6x6_250_bits[0]) >> entry_id_shift) &
+		0xFFULL) == 0,
+	"marker 0 is not in the decode table");
+static_assert(
+	((findMarkerEntry(rotateMarkerBits(dictionary_6x6_250_bits[0])) >>
+		entry_rotation_shift) & 3ULL) == 1,
+	"rotated marker 0 is not in the decode table");
+
+// The bits of a code which are read before the prefix filter is checked
+constexpr int prefix_rows = 2;
+constexpr int prefix_bit_count = prefix_rows * marker_size;
+
+static_assert((1 << prefix_bit_count) == MarkerPrefixFilter().size(),
+	"MarkerPrefixFilter must hold every prefix");
+
+// Set the prefix and every prefix with up to "remaining_errors" more
+// flipped bits from "first_bit"
+void insertPrefixNeighbours(
+	MarkerPrefixFilter& filter,
+	std::uint64_t prefix, int first_bit, int remaining_errors) {
+	filter.set(static_cast<size_t>(prefix));
+	if (remaining_errors == 0) {
+		return;
+	}
+	for (int bit = first_bit; bit < prefix_bit_count; bit++) {
+		insertPrefixNeighbours(filter, prefix ^ (1ULL << bit),
+			bit + 1, remaining_errors - 1);
+	}
+}
+
+// The (marker_size + 2 border bits) x 4 pixels image used to read the bits
+// (the same values as the default DetectorParameters)
+constexpr int pixels_per_cell = 4;
+constexpr int border_bits = 1;
+constexpr int warped_size = (marker_size + 2 * border_bits) * pixels_per_cell;
+// At most 12 white border bits, the limit of OpenCV, which takes 35%
+// of the marker bits (maxErroneousBitsInBorderRate of 6 x 6 bits)
+constexpr int max_border_errors =
+	static_cast<int>(marker_size * marker_size * 0.35);
+
+// Sort the 4 corners of a candidate in clockwise order
+void reorderCandidateCorners(std::vector<cv::Point2f>& corners) {
+	cv::Point2f vector_1 = corners[1] - corners[0];
+	cv::Point2f vector_2 = corners[2] - corners[0];
+	float cross_product = vector_1.x * vector_2.y - vector_1.y * vector_2.x;
+	if (cross_product < 0.0f) {
+		std::swap(corners[1], corners[3]);
+	}
+}
+
+// The smallest mean squared distance between the corners of two candidates
+// among the 4 possible orders
+float candidateDistance(
+	const std::vector<cv::Point2f>& corners_a,
+	const std::vector<cv::Point2f>& corners_b) {
+	float min_distance = std::numeric_limits<float>::max();
+	for (int shift = 0; shift < 4; shift++) {
+		float distance = 0.0f;
+		for (int i = 0; i < 4; i++) {
+			cv::Point2f difference = corners_a[i] - corners_b[(i + shift) % 4];
+			distance += difference.dot(difference);
+		}
+		min_distance = std::min(min_distance, distance / 4.0f);
+	}
+	return min_distance;
+}
+
+// Decode the candidates, and add the markers to the output
+// The outer and inner contour of the same border can both be decoded,
+// and a marker on a seam is found in two tiles, so the markers of the
+// same id at the same place are merged and only the larger one is kept
+void addDecodedMarker(
+	const std::vector<cv::Point2f>& corners,
+	int id,
+	std::vector<std::vector<cv::Point2f>>& marker_corners,
+	std::vector<int>& marker_ids) {
+	for (size_t i = 0; i < marker_ids.size(); i++) {
+		if (marker_ids[i] != id) {
+			continue;
+		}
+		cv::Point2f center_a = (corners[0] + corners[2]) * 0.5f;
+		cv::Point2f center_b =
+			(marker_corners[i][0] + marker_corners[i][2]) * 0.5f;
+		if (cv::norm(center_a - center_b) <
+			0.5 * cv::arcLength(corners, true) / 4.0) {
+			if (cv::arcLength(corners, true) >
+				cv::arcLength(marker_corners[i], true)) {
+				marker_corners[i] = corners;
+			}
+			return;
+		}
+	}
+	marker_corners.push_back(corners);
+	marker_ids.push_back(id);
+}
+
+// Read the first rows of bits from the top of a warped candidate, which
+// holds the top border and "prefix_rows" rows of cells below it
+// If the cells are almost flat, Otsu is meaningless, so return false
+bool readPrefixBits(cv::Mat& warped, std::uint64_t& output_bits) {
+	const int cells = marker_size + 2 * border_bits;
+	cv::Rect bit_area(pixels_per_cell, pixels_per_cell,
+		warped.cols - 2 * pixels_per_cell, prefix_rows * pixels_per_cell);
+	cv::Scalar mean, standard_deviation;
+	cv::meanStdDev(warped(bit_area), mean, standard_deviation);
+	if (standard_deviation[0] < 5.0) {
+		return false;
+	}
+	cv::threshold(warped, warped, 125, 255,
+		cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+	std::uint64_t prefix_bits = 0;
+	for (int row = border_bits; row < border_bits + prefix_rows; row++) {
+		for (int column = border_bits; column < cells - border_bits;
+			column++) {
+			cv::Rect cell(column * pixels_per_cell, row * pixels_per_cell,
+				pixels_per_cell, pixels_per_cell);
+			bool is_white = cv::countNonZero(warped(cell)) >
+				pixels_per_cell * pixels_per_cell / 2;
+			prefix_bits = (prefix_bits << 1) | (is_white ? 1ULL : 0ULL);
+		}
+	}
+	output_bits = prefix_bits;
+	return true;
+}
+
+// Remove the perspective of a candidate and read its bits
+// If "prefix_filter" is not nullptr, only the top of the candidate is
+// warped first, and it is rejected if its first two rows are not in
+// the filter, before the whole candidate is warped and thresholded
+bool readMarkerBits(
+	const cv::Mat& grayscale,
+	const std::vector<cv::Point2f>& corners,
+	const MarkerPrefixFilter* prefix_filter,
+	std::uint64_t& output_bits) {
+	const std::vector<cv::Point2f> warped_corners = {
+		cv::Point2f(0.0f, 0.0f),
+		cv::Point2f(warped_size - 1.0f, 0.0f),
+		cv::Point2f(warped_size - 1.0f, warped_size - 1.0f),
+		cv::Point2f(0.0f, warped_size - 1.0f)
+	};
+	cv::Mat transformation =
+		cv::getPerspectiveTransform(corners, warped_corners);
+
+	// The same transformation, but only the rows of the prefix,
+	// which is 3/8 of the pixels
+	cv::Mat& warped = detectionScratch().warped;
+	if (prefix_filter != nullptr) {
+		std::uint64_t prefix_bits;
+		cv::warpPerspective(grayscale, warped, transformation,
+			cv::Size(warped_size, (border_bits + prefix_rows) * pixels_per_cell),
+			cv::INTER_NEAREST);
+		if (readPrefixBits(warped, prefix_bits) &&
+			!prefix_filter->test(static_cast<size_t>(prefix_bits))) {
+			return false;
+		}
+	}
+
+	cv::warpPerspective(grayscale, warped, transformation,
+		cv::Size(warped_size, warped_size), cv::INTER_NEAREST);
+
+	// If the inner area has almost the same intensity,
+	// the marker is all white or all black, and Otsu is meaningless
+	cv::Scalar mean, standard_deviation;
+	cv::Rect inner_area(pixels_per_cell, pixels_per_cell,
+		warped_size - 2 * pixels_per_cell, warped_size - 2 * pixels_per_cell);
+	cv::meanStdDev(warped(inner_area), mean, standard_deviation);
+	if (standard_deviation[0] < 5.0) {
+		return false;
+	}
+	cv::threshold(warped, warped, 125, 255,
+		cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+	const int cells = marker_size + 2 * border_bits;
+	int border_errors = 0;
+	std::uint64_t marker_bits = 0;
+	for (int row = 0; row < cells; row++) {
+		for (int column = 0; column < cells; column++) {
+			cv::Rect cell(column * pixels_per_cell, row * pixels_per_cell,
+				pixels_per_cell, pixels_per_cell);
+			bool is_white = cv::countNonZero(warped(cell)) >
+				pixels_per_cell * pixels_per_cell / 2;
+
+			bool is_border = row < border_bits || column < border_bits ||
+				row >= cells - border_bits || column >= cells - border_bits;
+			if (is_border) {
+				if (is_white && ++border_errors > max_border_errors) {
+					return false;
+				}
+				continue;
+			}
+			marker_bits = (marker_bits << 1) | (is_white ? 1ULL : 0ULL);
+		}
+		// The threshold of the whole candidate may differ from the one
+		// of its top, so the prefix is checked again
+		if (prefix_filter != nullptr &&
+			row == border_bits + prefix_rows - 1 &&
+			!prefix_filter->test(static_cast<size_t>(marker_bits))) {
+			return false;
+		}
+	}
+
+	output_bits = marker_bits;
+	return true;
+}
+
+// Only the markers of "marker_set" are kept, the others are rejected
+// as soon as their first rows are read, or at the latest after the lookup
+void decodeCandidates(
+	const cv::Mat& grayscale,
+	const MarkerSet& marker_set,
+	std::vector<std::vector<cv::Point2f>>& candidates,
+	std::vector<std::vector<cv::Point2f>>& marker_corners,
+	std::vector<int>& marker_ids) {
+	for (std::vector<cv::Point2f>& candidate : candidates) {
+		std::uint64_t marker_bits;
+		int id, rotation;
+		if (!readMarkerBits(grayscale, candidate,
+				&marker_set.prefixFilter(), marker_bits) ||
+			!decodeMarkerBits(marker_bits, id, rotation) ||
+			!marker_set.contains(id)) {
+			continue;
+		}
+
+		// Shift the corners, so the first one is the top-left of the marker
+		std::rotate(candidate.begin(),
+			candidate.begin() + (4 - rotation) % 4, candidate.end());
+		addDecodedMarker(candidate, id, marker_corners, marker_ids);
+	}
+}
+
+// Find the candidates inside a region of a grayscale image
+// If "min_clipped_size" is positive, "output_is_clipped" tells whether
+// a contour at least that wide or tall is cut by an edge of the region
+// which is not an edge of the image, so a marker may be cut as well
+void findCandidatesInRegion(
+	const cv::Mat& grayscale,
+	const cv::Rect& region,
+	int min_clipped_size,
+	std::vector<std::vector<cv::Point2f>>& output_candidates,
+	bool& output_is_clipped) {
+	if (!output_candidates.empty()) {
+		output_candidates.clear();
+	}
+	output_is_clipped = false;
+
+	// The limits come from the whole image, so a region finds
+	// the same candidates as the whole image
+	int max_dimension = std::max(grayscale.cols, grayscale.rows);
+	double min_perimeter = 0.03 * max_dimension;
+	double max_perimeter = 4.0 * max_dimension;
+	const int min_border_distance = 3;
+
+	DetectionScratch& scratch = detectionScratch();
+	cv::Mat& thresholded = scratch.thresholded;
+	std::vector<std::vector<cv::Point>>& contours = scratch.contours;
+	std::vector<cv::Point>& polygon = scratch.polygon;
+	cv::Mat region_image = grayscale(region);
+	// Threshold with several window sizes (3, 13, 23)
+	for (int window_size = 3; window_size <= 23; window_size += 10) {
+		cv::adaptiveThreshold(region_image, thresholded, 255,
+			cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV,
+			window_size, 7);
+		// The contours are given in the coordinates of the whole image
+		cv::findContours(thresholded, contours,
+			cv::RETR_LIST, cv::CHAIN_APPROX_NONE, region.tl());
+
+		for (const std::vector<cv::Point>& contour : contours) {
+			if (contour.size() < min_perimeter ||
+				contour.size() > max_perimeter) {
+				continue;
+			}
+
+			if (min_clipped_size > 0 && !output_is_clipped) {
+				cv::Rect bounds = cv::boundingRect(contour);
+				bool is_cut =
+					(bounds.x <= region.x && region.x > 0) ||
+					(bounds.y <= region.y && region.y > 0) ||
+					(bounds.br().x >= region.br().x &&
+						region.br().x < grayscale.cols) ||
+					(bounds.br().y >= region.br().y &&
+						region.br().y < grayscale.rows);
+				output_is_clipped = is_cut &&
+					std::max(bounds.width, bounds.height) >= min_clipped_size;
+			}
+
+			cv::approxPolyDP(contour, polygon, contour.size() * 0.03, true);
+			if (polygon.size() != 4 || !cv::isContourConvex(polygon)) {
+				continue;
+			}
+
+			// Corners must not be too close to each other
+			double min_corner_distance = contour.size() * 0.05;
+			bool is_too_small = false;
+			bool is_near_border = false;
+			for (int i = 0; i < 4; i++) {
+				cv::Point side = polygon[i] - polygon[(i + 1) % 4];
+				if (side.dot(side) <
+					min_corner_distance * min_corner_distance) {
+					is_too_small = true;
+				}
+				if (polygon[i].x < region.x + min_border_distance ||
+					polygon[i].y < region.y + min_border_distance ||
+					polygon[i].x > region.x + region.width - 1 -
+						min_border_distance ||
+					polygon[i].y > region.y + region.height - 1 -
+						min_border_distance) {
+					is_near_border = true;
+				}
+			}
+			if (is_too_small || is_near_border) {
+				continue;
+			}
+
+			std::vector<cv::Point2f> candidate(polygon.begin(), polygon.end());
+			reorderCandidateCorners(candidate);
+
+			// The same quad is found again with another window size,
+			// or as the inner contour of the same border,
+			// so keep only the larger one
+			float perimeter = static_cast<float>(cv::arcLength(candidate, true));
+			float tolerance = 0.05f * perimeter;
+			bool is_duplicate = false;
+			for (std::vector<cv::Point2f>& existing : output_candidates) {
+				if (candidateDistance(existing, candidate) <
+					tolerance * tolerance) {
+					if (perimeter > cv::arcLength(existing, true)) {
+						existing = candidate;
+					}
+					is_duplicate = true;
+					break;
+				}
+			}
+			if (!is_duplicate) {
+				output_candidates.push_back(candidate);
+			}
+		}
+	}
+}
+
+} // namespace
+
+// Look up the 36 bits of a marker in the compile-time hash table
+// If it matches a marker in any rotation (with bit errors allowed),
+// give out the id and rotation, and return true
+bool decodeMarkerBits(
+	std::uint64_t marker_bits,
+	int& output_id,
+	int& output_rotation) {
+	std::uint64_t entry = findMarkerEntry(marker_bits & marker_bit_mask);
+	if (!(entry & entry_used) || (entry & entry_ambiguous)) {
+		return false;
+	}
+	output_id = static_cast<int>((entry >> entry_id_shift) & 0xFFULL);
+	output_rotation = static_cast<int>((entry >> entry_rotation_shift) & 3ULL);
+	return true;
+}
+
+// Set the first two rows of the markers in every rotation,
+// and of their codes with up to MAX_DECODE_ERROR_BITS wrong bits
+void buildMarkerPrefixFilter(
+	const std::vector<int>& ids,
+	MarkerPrefixFilter& output_filter) {
+	output_filter.reset();
+	for (int id : ids) {
+		if (id < 0 || id >= 250) {
+			continue;
+		}
+		std::uint64_t code = dictionary_6x6_250_bits[id];
+		for (int rotation = 0; rotation < 4; rotation++) {
+			insertPrefixNeighbours(output_filter,
+				code >> (marker_bit_count - prefix_bit_count),
+				0, MAX_DECODE_ERROR_BITS);
+			code = rotateMarkerBits(code);
+		}
+	}
+}
+
+// Remove the perspective of a candidate and read its bits
+// If the border of the candidate is not black, return false
+bool extractMarkerBits(
+	const cv::Mat& grayscale,
+	const std::vector<cv::Point2f>& corners,
+	std::uint64_t& output_bits) {
+	return readMarkerBits(grayscale, corners, nullptr, output_bits);
+}
+
+// Read the bits, but stop after the first two rows
+// if they cannot be one of the markers of the filter
+bool extractMarkerBits(
+	const cv::Mat& grayscale,
+	const std::vector<cv::Point2f>& corners,
+	const MarkerPrefixFilter& prefix_filter,
+	std::uint64_t& output_bits) {
+	return readMarkerBits(grayscale, corners, &prefix_filter, output_bits);
+}
+
+// Find the quads which may be markers in a grayscale image
+// It follows the candidate search of "detectMarkers"
+// with the default DetectorParameters
+void findMarkerCandidates(
+	const cv::Mat& grayscale,
+	std::vector<std::vector<cv::Point2f>>& output_candidates) {
+	findMarkerCandidatesInRegion(grayscale,
+		cv::Rect(0, 0, grayscale.cols, grayscale.rows), output_candidates);
+}
+
+// Find the candidates inside a region of a grayscale image
+void findMarkerCandidatesInRegion(
+	const cv::Mat& grayscale,
+	const cv::Rect& region,
+	std::vector<std::vector<cv::Point2f>>& output_candidates) {
+	bool is_clipped = false;
+	findCandidatesInRegion(grayscale, region, 0, output_candidates,
+		is_clipped);
+}
+
+// Detect markers of DICT_6X6_250 and decode them with the hash table
+// (see marker_decoder.h for how it differs from "cv::aruco::detectMarkers")
+void detectMarkersWithHashTable(
+	const cv::Mat& input_image,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids) {
+	detectMarkersWithHashTable(input_image, activeMarkerSet(),
+		output_marker_corners, output_marker_ids);
+}
+
+// The same as the previous one, but only for the markers in "marker_set"
+void detectMarkersWithHashTable(
+	const cv::Mat& input_image,
+	const MarkerSet& marker_set,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids) {
+	if (!output_marker_corners.empty()) {
+		output_marker_corners.clear();
+	}
+	if (!output_marker_ids.empty()) {
+		output_marker_ids.clear();
+	}
+
+	// Only the header is copied for a grayscale input,
+	// otherwise convert into the scratch buffer of this thread
+	DetectionScratch& scratch = detectionScratch();
+	cv::Mat grayscale = input_image;
+	if (input_image.channels() != 1) {
+		cv::cvtColor(input_image, scratch.grayscale, cv::COLOR_RGB2GRAY);
+		grayscale = scratch.grayscale;
+	}
+
+	std::vector<std::vector<cv::Point2f>>& candidates = scratch.candidates;
+	findMarkerCandidates(grayscale, candidates);
+
+	decodeCandidates(grayscale, marker_set, candidates,
+		output_marker_corners, output_marker_ids);
+}
+
+// Detect markers in overlapping tiles of the image on a work-stealing pool
+void detectMarkersInTiles(
+	const cv::Mat& input_image,
+	WorkStealingPool& pool,
+	int max_marker_size,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids) {
+	if (!output_marker_corners.empty()) {
+		output_marker_corners.clear();
+	}
+	if (!output_marker_ids.empty()) {
+		output_marker_ids.clear();
+	}
+
+	// Convert to grayscale in strips on the pool
+	DetectionScratch& scratch = detectionScratch();
+	cv::Mat grayscale = input_image;
+	if (input_image.channels() != 1) {
+		scratch.grayscale.create(input_image.size(), CV_8UC1);
+		grayscale = scratch.grayscale;
+		const int num_of_strip = 8;
+		pool.parallelFor(num_of_strip, [&](size_t i) {
+			cv::Range rows(
+				static_cast<int>(i * input_image.rows / num_of_strip),
+				static_cast<int>((i + 1) * input_image.rows / num_of_strip));
+			cv::Mat gray_strip = grayscale.rowRange(rows);
+			cv::cvtColor(input_image.rowRange(rows), gray_strip,
+				cv::COLOR_RGB2GRAY);
+		});
+	}
+
+	// The tiles have a fixed size, so a frame has enough of them for all
+	// workers, however large the markers are
+	// A marker belongs to the tile whose core has its top-left corner
+	// The tile reaches past the core by "max_marker_size" on the right and
+	// bottom, and by a margin for the threshold windows on all sides
+	const int core_size = 256;
+	const int margin = 16;
+	if (max_marker_size <= 0) {
+		max_marker_size = 128;
+	}
+	cv::Rect image_rect(0, 0, grayscale.cols, grayscale.rows);
+	std::vector<cv::Rect>& tiles = scratch.tiles;
+	tiles.clear();
+	for (int y = 0; y < grayscale.rows; y += core_size) {
+		for (int x = 0; x < grayscale.cols; x += core_size) {
+			tiles.push_back(image_rect & cv::Rect(x - margin, y - margin,
+				core_size + max_marker_size + 2 * margin,
+				core_size + max_marker_size + 2 * margin));
+		}
+	}
+
+	// Each tile gives its own markers, they are merged afterwards
+	// A contour which is cut by a tile and wider than the overlap may be
+	// a marker which is not whole in any tile
+	const MarkerSet& marker_set = activeMarkerSet();
+	std::vector<std::vector<std::vector<cv::Point2f>>>& tile_corners =
+		scratch.tile_marker_corners;
+	std::vector<std::vector<int>>& tile_ids = scratch.tile_marker_ids;
+	tile_corners.resize(tiles.size());
+	tile_ids.resize(tiles.size());
+	std::atomic<bool> has_clipped_contour(false);
+	pool.parallelFor(tiles.size(), [&](size_t i) {
+		// The scratch buffers of the thread which runs the tile
+		std::vector<std::vector<cv::Point2f>>& candidates =
+			detectionScratch().candidates;
+		bool is_clipped = false;
+		findCandidatesInRegion(grayscale, tiles[i], max_marker_size,
+			candidates, is_clipped);
+		if (is_clipped) {
+			has_clipped_contour.store(true, std::memory_order_relaxed);
+		}
+		tile_corners[i].clear();
+		tile_ids[i].clear();
+		decodeCandidates(grayscale, marker_set, candidates,
+			tile_corners[i], tile_ids[i]);
+	});
+
+	// Then the whole frame is searched as well, so large markers are
+	// found as they are without tiles
+	if (has_clipped_contour.load()) {
+		std::vector<std::vector<cv::Point2f>>& candidates = scratch.candidates;
+		findMarkerCandidates(grayscale, candidates);
+		decodeCandidates(grayscale, marker_set, candidates,
+			output_marker_corners, output_marker_ids);
+	}
+
+	for (size_t i = 0; i < tiles.size(); i++) {
+		for (size_t j = 0; j < tile_ids[i].size(); j++) {
+			addDecodedMarker(tile_corners[i][j], tile_ids[i][j],
+				output_marker_corners, output_marker_ids);
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#ifndef MARKER_DECODER
+#define MARKER_DECODER
+
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+class WorkStealingPool;
+class MarkerSet;
+
+// The first two rows (12 bits) of every code which can be decoded
+// as one of some markers, in any rotation and with up to
+// MAX_DECODE_ERROR_BITS wrong bits
+// A candidate whose first two rows are not in it cannot be one of
+// the markers, so it is rejected before the rest of its bits are read
+typedef std::bitset<4096> MarkerPrefixFilter;
+
+// Build the filter of the markers "ids"
+void buildMarkerPrefixFilter(
+	const std::vector<int>& ids,
+	MarkerPrefixFilter& output_filter);
+
+// Look up the 36 bits of a 6x6 marker (row by row, first bit is the highest)
+// in a hash table built at compile time from DICT_6X6_250
+// If it matches a marker in any rotation, give the id and rotation,
+// and return true
+// The cost is a single probe, no matter how many markers are in dictionary
+bool decodeMarkerBits(
+	std::uint64_t marker_bits,
+	int& output_id,
+	int& output_rotation);
+
+// Remove the perspective of a candidate and read its 6x6 bits
+// If the border of the candidate is not black, return false
+bool extractMarkerBits(
+	const cv::Mat& grayscale,
+	const std::vector<cv::Point2f>& corners,
+	std::uint64_t& output_bits);
+
+// The same as the previous one, but give up as soon as the first two
+// rows are not in "prefix_filter"
+bool extractMarkerBits(
+	const cv::Mat& grayscale,
+	const std::vector<cv::Point2f>& corners,
+	const MarkerPrefixFilter& prefix_filter,
+	std::uint64_t& output_bits);
+
+// Find the quads which may be markers in a grayscale image
+void findMarkerCandidates(
+	const cv::Mat& grayscale,
+	std::vector<std::vector<cv::Point2f>>& output_candidates);
+
+// The same as the previous one, but only inside a region of the image
+// The candidates are in the coordinates of the whole image
+void findMarkerCandidatesInRegion(
+	const cv::Mat& grayscale,
+	const cv::Rect& region,
+	std::vector<std::vector<cv::Point2f>>& output_candidates);
+
+// Detect markers of DICT_6X6_250 and decode them with the hash table,
+// only the markers in "activeMarkerSet" (see marker_set.h)
+// The candidates and the border limit are those of the default
+// DetectorParameters of "cv::aruco::detectMarkers", but only
+// MAX_DECODE_ERROR_BITS wrong bits are corrected where OpenCV corrects 3,
+// so a marker with more wrong bits is rejected here, and the bits are
+// read from the whole cell instead of its center
+void detectMarkersWithHashTable(
+	const cv::Mat& input_image,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids);
+
+// The same as the previous one, but only for the markers in "marker_set"
+void detectMarkersWithHashTable(
+	const cv::Mat& input_image,
+	const MarkerSet& marker_set,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids);
+
+// The same as the previous one, but the image is split into overlapping
+// tiles of 256 pixels which are detected in parallel on a work-stealing pool
+// A marker up to "max_marker_size" pixels wide (128 if it is 0) is whole
+// in at least one tile, the markers which are found in two tiles are
+// merged by id and position
+// If a tile cuts a contour wider than that, the whole image is searched
+// as well, so a larger marker is not lost
+void detectMarkersInTiles(
+	const cv::Mat& input_image,
+	WorkStealingPool& pool,
+	int max_marker_size,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids);
+
+#endif // !MARKER_DECODER
@@ -1,89 +1,220 @@
 // Implement the functions in marker_detection.h
 #include "marker_detection.h"
 #include "parameters.h"
+#include "camera_calibration.h"
+#include "marker_decoder.h"
+#include "marker_set.h"
+#include "frame_pool.h"
+#include "work_stealing_pool.h"
 
 #include <vector>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
 
+// Estimate the pose of a marker from its corners by using solvePnP,
+// and give it as a 4x4 matrix for OpenGL
+void estimateMarkerPose(
+	const std::vector<cv::Point2f>& marker_corners,
+	float marker_length,
+	const CameraCalibration& calibration,
+	cv::Mat& output_marker_pose) {
+	cv::Mat mat_intrinsic_parameters(3, 3, CV_32F,
+		const_cast<float*>(calibration.intrinsic_parameters));
+	cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
+		const_cast<float*>(calibration.distortion_coefficients));
+
+	cv::Vec3d rotation_vector, translation_vector;
+
+	// Estimate pose of a marker
+	cv::solvePnP(canonical_marker_corners_3d, marker_corners,
+		mat_intrinsic_parameters, mat_distortion_coefficients,
+		rotation_vector, translation_vector);
+
+	// Transform a rotation vector to a rotation matrix
+	cv::Mat rotation_matrix;
+	cv::Rodrigues(rotation_vector, rotation_matrix);
+	// Use marker length to standardize translation
+	translation_vector = marker_length * translation_vector;
+
+	// Invert y-axis and z-axis to
+	// make the camera rotation become marker rotation
+	cv::Mat camera2marker = cv::Mat::zeros(3, 3, CV_64F);
+	camera2marker.at<double>(0, 0) = 1.0;
+	camera2marker.at<double>(1, 1) = -1.0;
+	camera2marker.at<double>(2, 2) = -1.0;
+	rotation_matrix = rotation_matrix * camera2marker;
+
+	// Store the poses
+	cv::Mat marker_pose = cv::Mat::zeros(4, 4, CV_32F);
+	for (uchar row = 0; row < 3; row++) {
+		for (uchar column = 0; column < 3; column++) {
+			// Since "solvePnP" gives the rotation that is used in OpenGL,
+			// then directly store it
+			marker_pose.at<float>(row, column) =
+				static_cast<float>(
+					rotation_matrix.at<double>(row, column));
+		}
+		// Invert the y-axis and z-axis in order to use in OpenGL
+		marker_pose.at<float>(row, 3) =
+			static_cast<float>(translation_vector(row));
+	}
+	marker_pose.at<float>(3, 3) = 1.0f;
+
+	// Convert the poses for the use of OpenGL
+	cv::Mat cv2gl = cv::Mat::zeros(4, 4, CV_32F);
+	cv2gl.at<float>(0, 0) = 1.0f;
+	// Invert the y-axis
+	cv2gl.at<float>(1, 1) = -1.0f;
+	// Invert the z-axis
+	cv2gl.at<float>(2, 2) = -1.0f;
+	cv2gl.at<float>(3, 3) = 1.0f;
+	marker_pose = cv2gl * marker_pose;
+
+	// Column is the priority in OpenGL, so transpose it
+	cv::transpose(marker_pose, marker_pose);
+
+	output_marker_pose = marker_pose;
+}
+
 // Give out a list of 4x4 transformation matrices (rotation + translation)
 void detectMarkersAndEstimatePose(
 	const cv::Mat& input_image,
 	std::vector<cv::Mat>& output_marker_poses) {
+	std::vector<int> marker_ids;
+	detectMarkersAndEstimatePose(input_image, output_marker_poses, marker_ids);
+}
+
+// The same as the previous one, but also give the id of each marker
+void detectMarkersAndEstimatePose(
+	const cv::Mat& input_image,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids) {
 	if (!output_marker_poses.empty()) {
 		output_marker_poses.clear();
 	}
 
-	// A list of Marker corners in 2D
-	std::vector<std::vector<cv::Point2f>> marker_corners;
-	std::vector<int> marker_ids;
+	// A list of Marker corners in 2D (reused by every frame)
+	std::vector<std::vector<cv::Point2f>>& marker_corners =
+		detectionScratch().marker_corners;
+	std::vector<int>& marker_ids = output_marker_ids;
 	// Detect markers in the image, and store their conrners and ids
-	cv::aruco::detectMarkers(input_image, marker_dictionary,
-		marker_corners, marker_ids);
-
-	cv::Mat mat_intrinsic_parameters(3, 3, CV_32F,
-		const_cast<float*>(intrinsic_parameters));
-	cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
-		const_cast<float*>(distortion_coefficients));
+	// The ids are decoded by the hash table instead of the dictionary
+	detectMarkersWithHashTable(input_image, marker_corners, marker_ids);
 
+	// Only the markers in use are decoded, each has its own length
+	const MarkerSet& marker_set = activeMarkerSet();
 	size_t num_of_detected_markers = marker_ids.size();
 	// For each marker, estimate their pose by using solvePnP
 	for (size_t i = 0; i < num_of_detected_markers; i++) {
-		cv::Vec3d rotation_vector, translation_vector;
-
-		// Estimate pose of a marker
-		cv::solvePnP(canonical_marker_corners_3d, marker_corners[i],
-			mat_intrinsic_parameters, mat_distortion_coefficients,
-			rotation_vector, translation_vector);
-
-		// Transform a rotation vector to a rotation matrix
-		cv::Mat rotation_matrix;
-		cv::Rodrigues(rotation_vector, rotation_matrix);
-		// Use marker length to standardize translation
-		translation_vector = MARKER_LENGTH * translation_vector;
+		cv::Mat marker_pose;
+		estimateMarkerPose(marker_corners[i],
+			marker_set.markerLength(marker_ids[i]),
+			defaultCameraCalibration(), marker_pose);
+		output_marker_poses.push_back(marker_pose);
+	}
+}
 
-		// Invert y-axis and z-axis to
-		// make the camera rotation become marker rotation
-		cv::Mat camera2marker = cv::Mat::zeros(3, 3, CV_64F);
-		camera2marker.at<double>(0, 0) = 1.0;
-		camera2marker.at<double>(1, 1) = -1.0;
-		camera2marker.at<double>(2, 2) = -1.0;
-		rotation_matrix = rotation_matrix * camera2marker;
+// Find the markers and their corners in the input image with options
+void detectMarkers(
+	const cv::Mat& input_image,
+	const DetectionOptions& options,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids) {
+	DetectionScratch& scratch = detectionScratch();
+	cv::Mat grayscale = input_image;
+	if (input_image.channels() != 1) {
+		cv::cvtColor(input_image, scratch.grayscale, cv::COLOR_RGB2GRAY);
+		grayscale = scratch.grayscale;
+	}
+	// Search in a smaller image
+	cv::Mat search_image = grayscale;
+	if (options.scale < 1.0) {
+		cv::resize(grayscale, scratch.scaled_grayscale, cv::Size(),
+			options.scale, options.scale, cv::INTER_AREA);
+		search_image = scratch.scaled_grayscale;
+	}
 
-		// Store the poses
-		cv::Mat marker_pose = cv::Mat::zeros(4, 4, CV_32F);
-		for (uchar row = 0; row < 3; row++) {
-			for (uchar column = 0; column < 3; column++) {
-				// Since "solvePnP" gives the rotation that is used in OpenGL,
-				// then directly store it
-				marker_pose.at<float>(row, column) =
-					static_cast<float>(
-						rotation_matrix.at<double>(row, column));
+	const MarkerSet& marker_set = options.marker_set != nullptr ?
+		*options.marker_set : activeMarkerSet();
+	detectMarkersWithHashTable(search_image, marker_set,
+		output_marker_corners, output_marker_ids);
+
+	float inverse_scale = static_cast<float>(1.0 / options.scale);
+	for (std::vector<cv::Point2f>& corners : output_marker_corners) {
+		if (options.scale < 1.0) {
+			// Map the pixel centers back to the input image
+			for (cv::Point2f& corner : corners) {
+				corner.x = (corner.x + 0.5f) * inverse_scale - 0.5f;
+				corner.y = (corner.y + 0.5f) * inverse_scale - 0.5f;
 			}
-			// Invert the y-axis and z-axis in order to use in OpenGL
-			marker_pose.at<float>(row, 3) =
-				static_cast<float>(translation_vector(row));
 		}
-		marker_pose.at<float>(3, 3) = 1.0f;
-
-		// Convert the poses for the use of OpenGL
-		cv::Mat cv2gl = cv::Mat::zeros(4, 4, CV_32F);
-		cv2gl.at<float>(0, 0) = 1.0f;
-		// Invert the y-axis
-		cv2gl.at<float>(1, 1) = -1.0f;
-		// Invert the z-axis
-		cv2gl.at<float>(2, 2) = -1.0f;
-		cv2gl.at<float>(3, 3) = 1.0f;
-		marker_pose = cv2gl * marker_pose;
+		if (options.corner_refinement_iterations > 0) {
+			cv::cornerSubPix(grayscale, corners, cv::Size(5, 5),
+				cv::Size(-1, -1), cv::TermCriteria(
+					cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
+					options.corner_refinement_iterations, 0.01));
+		}
+	}
+}
 
-		// Column is the priority in OpenGL, so transpose it
-		cv::transpose(marker_pose, marker_pose);
+// The same as the previous one, but with options
+void detectMarkersAndEstimatePose(
+	const cv::Mat& input_image,
+	const DetectionOptions& options,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids) {
+	if (options.scale >= 1.0 && options.corner_refinement_iterations <= 0 &&
+		options.calibration == nullptr && options.marker_set == nullptr) {
+		detectMarkersAndEstimatePose(
+			input_image, output_marker_poses, output_marker_ids);
+		return;
+	}
+	if (!output_marker_poses.empty()) {
+		output_marker_poses.clear();
+	}
 
+	std::vector<std::vector<cv::Point2f>>& marker_corners =
+		detectionScratch().marker_corners;
+	detectMarkers(input_image, options, marker_corners, output_marker_ids);
+
+	const MarkerSet& marker_set = options.marker_set != nullptr ?
+		*options.marker_set : activeMarkerSet();
+	for (size_t i = 0; i < marker_corners.size(); i++) {
+		cv::Mat marker_pose;
+		estimateMarkerPose(marker_corners[i],
+			marker_set.markerLength(output_marker_ids[i]),
+			options.calibration != nullptr ?
+				*options.calibration : defaultCameraCalibration(),
+			marker_pose);
 		output_marker_poses.push_back(marker_pose);
 	}
 }
 
+// The same as the previous one, but the markers are detected in tiles
+// and their poses are estimated on a work-stealing pool
+void detectMarkersAndEstimatePoseParallel(
+	const cv::Mat& input_image,
+	WorkStealingPool& pool,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids,
+	int max_marker_size) {
+	std::vector<std::vector<cv::Point2f>>& marker_corners =
+		detectionScratch().marker_corners;
+	detectMarkersInTiles(input_image, pool, max_marker_size,
+		marker_corners, output_marker_ids);
+
+	// Every pose is a new matrix, since the previous ones may still be
+	// shared with the render thread
+	output_marker_poses.assign(output_marker_ids.size(), cv::Mat());
+	const MarkerSet& marker_set = activeMarkerSet();
+	pool.parallelFor(output_marker_ids.size(), [&](size_t i) {
+		estimateMarkerPose(marker_corners[i],
+			marker_set.markerLength(output_marker_ids[i]),
+			defaultCameraCalibration(), output_marker_poses[i]);
+	});
+}
+
 // This function has the same functionality as the previous one
 // but it is implemented without "solvePnP"
 // So, it is only used for testing
@@ -106,19 +237,21 @@ void detectArucoMarkers(
 	cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
 		const_cast<float*>(distortion_coefficients));
 
-	// If any marker is detected, estimate pose
-	std::vector<cv::Vec3d> rvecs, tvecs;
-	if (!marker_ids.empty()) {
-		cv::aruco::estimatePoseSingleMarkers(marker_corners, 0.05f,
-			mat_intrinsic_parameters, mat_distortion_coefficients,
-			rvecs, tvecs);
-	}
-
+	const MarkerSet& marker_set = activeMarkerSet();
 	size_t num_of_detected_markers = marker_ids.size();
-	// For each marker, estimate their pose by using solvePnP
+	// For each marker in use, estimate its pose with its own length
 	for (size_t i = 0; i < num_of_detected_markers; i++) {
-		cv::Vec3d rotation_vector = rvecs[i];
-		cv::Vec3d translation_vector = tvecs[i];
+		if (!marker_set.contains(marker_ids[i])) {
+			continue;
+		}
+		std::vector<cv::Vec3d> rvecs, tvecs;
+		cv::aruco::estimatePoseSingleMarkers(
+			std::vector<std::vector<cv::Point2f>>(1, marker_corners[i]),
+			marker_set.markerLength(marker_ids[i]),
+			mat_intrinsic_parameters, mat_distortion_coefficients,
+			rvecs, tvecs);
+		cv::Vec3d rotation_vector = rvecs[0];
+		cv::Vec3d translation_vector = tvecs[0];
 
 		// Transform a rotation vector to a rotation matrix
 		cv::Mat rotation_matrix;
@@ -160,32 +293,48 @@ void detctChessboardAndEstimatePose(
 	const cv::Mat& input_image,
 	std::vector<cv::Mat>& output_marker_poses
 	) {
+	detctChessboardAndEstimatePose(
+		input_image, defaultCameraCalibration(), output_marker_poses);
+}
+
+// The same as the previous one, with the calibration of another camera
+void detctChessboardAndEstimatePose(
+	const cv::Mat& input_image,
+	const CameraCalibration& calibration,
+	std::vector<cv::Mat>& output_marker_poses) {
 	if (!output_marker_poses.empty()) {
 		output_marker_poses.clear();
 	}
 
-	cv::Size pattern_size(6, 4);
+	const cv::Size pattern_size(6, 4);
 	// The 3D position of each corner on the chessboard
-	std::vector<cv::Point3f> corners_3d;
-	// Simply set those corners in 3D
-	for (int i = 0; i < pattern_size.height; i++) {
-		for (int j = 0; j < pattern_size.width; j++) {
-			corners_3d.push_back(cv::Point3f(i, j, 0.0f));
+	// Simply set those corners in 3D (only once)
+	static const std::vector<cv::Point3f> corners_3d = [&pattern_size]() {
+		std::vector<cv::Point3f> corners;
+		for (int i = 0; i < pattern_size.height; i++) {
+			for (int j = 0; j < pattern_size.width; j++) {
+				corners.push_back(cv::Point3f(i, j, 0.0f));
+			}
 		}
-	}
+		return corners;
+	}();
 
-	cv::Mat grayscale;
+	DetectionScratch& scratch = detectionScratch();
+	cv::Mat grayscale = input_image;
 	// Convert to grayscale image for detection
-	cv::cvtColor(input_image, grayscale, cv::COLOR_RGB2GRAY);
+	if (input_image.channels() != 1) {
+		cv::cvtColor(input_image, scratch.grayscale, cv::COLOR_RGB2GRAY);
+		grayscale = scratch.grayscale;
+	}
 
-	std::vector<cv::Point2f> corners_2d;
+	std::vector<cv::Point2f>& corners_2d = scratch.chessboard_corners;
 	bool pattern_was_found =
 		cv::findChessboardCorners(grayscale, pattern_size, corners_2d);
 
 	cv::Mat mat_intrinsic_parameters(3, 3, CV_32F,
-		const_cast<float*>(intrinsic_parameters));
+		const_cast<float*>(calibration.intrinsic_parameters));
 	cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
-		const_cast<float*>(distortion_coefficients));
+		const_cast<float*>(calibration.distortion_coefficients));
 
 	cv::Vec3d rotation_vector, translation_vector;
 
@@ -198,7 +347,7 @@ void detctChessboardAndEstimatePose(
 		cv::Mat rotation_matrix;
 		cv::Rodrigues(rotation_vector, rotation_matrix);
 		// Use length of one square of the chessboard to standardize translation
-		translation_vector = 0.026 * translation_vector;
+		translation_vector = CHESSBOARD_SQUARE_LENGTH * translation_vector;
 
 		// Store the poses
 		cv::Mat marker_pose = cv::Mat::zeros(4, 4, CV_32F);
@@ -8,11 +8,21 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
 
+class WorkStealingPool;
+class MarkerSet;
+struct CameraCalibration;
+
 // Give out a list of 4x4 transformation matrices (rotation + translation)
 void detectMarkersAndEstimatePose(
 	const cv::Mat& input_image,
 	std::vector<cv::Mat>& output_marker_poses);
 
+// The same as the previous one, but also give the id of each marker
+void detectMarkersAndEstimatePose(
+	const cv::Mat& input_image,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids);
+
 // This function has the same functionality as the previous one
 // but it is implemented without "solvePnP"
 // So, it is only used for testing
@@ -20,6 +30,53 @@ void detectArucoMarkers(
 	const cv::Mat& input_image,
 	std::vector<cv::Mat>& output_marker_poses);
 
+// The options which trade accuracy for time (see quality_controller.h)
+struct DetectionOptions {
+	// The markers are searched in the image scaled by this,
+	// and their corners are mapped back to the input image
+	double scale = 1.0;
+	// Iterations of "cv::cornerSubPix" on the input image (0 is none)
+	int corner_refinement_iterations = 0;
+	// The camera of the image, nullptr for the one in parameters.h
+	const CameraCalibration* calibration = nullptr;
+	// The markers to detect, nullptr for "activeMarkerSet"
+	const MarkerSet* marker_set = nullptr;
+};
+
+// Only find the markers, and give the 4 corners and the id of each
+// (the corners are in the input image, even if it is scaled)
+void detectMarkers(
+	const cv::Mat& input_image,
+	const DetectionOptions& options,
+	std::vector<std::vector<cv::Point2f>>& output_marker_corners,
+	std::vector<int>& output_marker_ids);
+
+// Estimate the pose of one marker from its corners by using solvePnP,
+// and give it as a 4x4 matrix for OpenGL
+void estimateMarkerPose(
+	const std::vector<cv::Point2f>& marker_corners,
+	float marker_length,
+	const CameraCalibration& calibration,
+	cv::Mat& output_marker_pose);
+
+// The same as "detectMarkersAndEstimatePose" with ids, but with options
+void detectMarkersAndEstimatePose(
+	const cv::Mat& input_image,
+	const DetectionOptions& options,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids);
+
+// The same as "detectMarkersAndEstimatePose", but for full-frame detection
+// on many cores
+// The frame is split into overlapping tiles (see "detectMarkersInTiles"),
+// and the tiles and then the poses are run on the pool
+void detectMarkersAndEstimatePoseParallel(
+	const cv::Mat& input_image,
+	WorkStealingPool& pool,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids,
+	int max_marker_size = 0);
+
 // Use the chessborad with width 6 and height 4 as marker
 // Return a list of 4x4 transformation matrices (rotation + translation)
 void detctChessboardAndEstimatePose(
@@ -27,4 +84,10 @@ void detctChessboardAndEstimatePose(
 	std::vector<cv::Mat>& output_marker_poses
 	);
 
+// The same as the previous one, with the calibration of another camera
+void detctChessboardAndEstimatePose(
+	const cv::Mat& input_image,
+	const CameraCalibration& calibration,
+	std::vector<cv::Mat>& output_marker_poses);
+
 #endif // !MARKER_DETECTION
@@ -0,0 +1,341 @@
+// Implement the functions in marker_map.h
+#include "marker_map.h"
+#include "parameters.h"
+#include "camera_calibration.h"
+#include "marker_detection.h"
+#include "marker_set.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+cv::Mat rotationOf(const cv::Mat& transformation) {
+	return transformation(cv::Rect(0, 0, 3, 3));
+}
+
+cv::Mat translationOf(const cv::Mat& transformation) {
+	return transformation(cv::Rect(3, 0, 1, 3));
+}
+
+// The nearest rotation to a 3x3 matrix, e.g. to a sum of rotations
+cv::Mat orthonormalize(const cv::Mat& matrix) {
+	cv::Mat w, u, vt;
+	cv::SVD::compute(matrix, w, u, vt);
+	cv::Mat rotation = u * vt;
+	if (cv::determinant(rotation) < 0.0) {
+		u.col(2) *= -1.0;
+		rotation = u * vt;
+	}
+	return rotation;
+}
+
+// A rigid transformation between "a" (weight 0) and "b" (weight 1)
+cv::Mat blendTransformations(
+	const cv::Mat& a, const cv::Mat& b, double weight) {
+	cv::Mat blended = cv::Mat::eye(4, 4, CV_64F);
+	orthonormalize((1.0 - weight) * rotationOf(a) + weight * rotationOf(b))
+		.copyTo(blended(cv::Rect(0, 0, 3, 3)));
+	cv::Mat translation =
+		(1.0 - weight) * translationOf(a) + weight * translationOf(b);
+	translation.copyTo(blended(cv::Rect(3, 0, 1, 3)));
+	return blended;
+}
+
+// The view matrix of a pose, which is stored transposed for OpenGL
+cv::Mat viewOfPose(const cv::Mat& marker_pose) {
+	cv::Mat view;
+	marker_pose.t().convertTo(view, CV_64F);
+	return view;
+}
+
+// The pose of a view matrix, in the same layout as the detectors give
+cv::Mat poseOfView(const cv::Mat& view) {
+	cv::Mat marker_pose;
+	view.t().convertTo(marker_pose, CV_32F);
+	return marker_pose;
+}
+
+// From the camera of OpenCV (y down, z forward) to the one of OpenGL
+cv::Mat cvToGl() {
+	cv::Mat cv_to_gl = cv::Mat::eye(4, 4, CV_64F);
+	cv_to_gl.at<double>(1, 1) = -1.0;
+	cv_to_gl.at<double>(2, 2) = -1.0;
+	return cv_to_gl;
+}
+
+// The largest distance between the corners of a marker and where
+// "projected_corners" (4 per marker, from "first_corner") puts them
+double reprojectionError(
+	const std::vector<cv::Point2f>& marker_corners,
+	const std::vector<cv::Point2f>& projected_corners,
+	size_t first_corner) {
+	double max_error = 0.0;
+	for (size_t k = 0; k < 4; k++) {
+		max_error = std::max(max_error, static_cast<double>(
+			cv::norm(marker_corners[k] - projected_corners[first_corner + k])));
+	}
+	return max_error;
+}
+
+} // namespace
+
+MarkerMap::MarkerMap(const MarkerMapSettings& settings) :
+	settings_(settings) {
+}
+
+// Put a marker into the map, and its corners with it
+void MarkerMap::placeMarker(
+	MappedMarker& marker,
+	const cv::Mat& marker_to_map,
+	float marker_length) {
+	marker.marker_to_map = marker_to_map;
+	// The poses for OpenGL flip the y-axis and z-axis of the corners
+	// which "solvePnP" is given (see "estimateMarkerPose")
+	marker.corners_in_map.clear();
+	for (const cv::Point3f& corner : canonical_marker_corners_3d) {
+		cv::Mat corner_in_marker = (cv::Mat_<double>(4, 1) <<
+			marker_length * corner.x, -marker_length * corner.y, 0.0, 1.0);
+		cv::Mat corner_in_map = marker_to_map * corner_in_marker;
+		marker.corners_in_map.push_back(cv::Point3f(
+			static_cast<float>(corner_in_map.at<double>(0)),
+			static_cast<float>(corner_in_map.at<double>(1)),
+			static_cast<float>(corner_in_map.at<double>(2))));
+	}
+}
+
+// One solvePnP over the corners of all the given markers
+bool MarkerMap::localizeCamera(
+	const std::vector<std::vector<cv::Point2f>>& marker_corners,
+	const std::vector<int>& marker_ids,
+	const std::vector<size_t>& detections,
+	const CameraCalibration& calibration,
+	cv::Mat& output_map_to_camera) const {
+	std::vector<cv::Point3f> object_points;
+	std::vector<cv::Point2f> image_points;
+	for (size_t i : detections) {
+		const MappedMarker& marker = markers_.at(marker_ids[i]);
+		object_points.insert(object_points.end(),
+			marker.corners_in_map.begin(), marker.corners_in_map.end());
+		image_points.insert(image_points.end(),
+			marker_corners[i].begin(), marker_corners[i].end());
+	}
+	if (object_points.empty()) {
+		return false;
+	}
+
+	cv::Mat mat_intrinsic_parameters(3, 3, CV_32F,
+		const_cast<float*>(calibration.intrinsic_parameters));
+	cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
+		const_cast<float*>(calibration.distortion_coefficients));
+	cv::Vec3d rotation_vector, translation_vector;
+	if (!cv::solvePnP(object_points, image_points,
+		mat_intrinsic_parameters, mat_distortion_coefficients,
+		rotation_vector, translation_vector)) {
+		return false;
+	}
+
+	cv::Mat rotation_matrix;
+	cv::Rodrigues(rotation_vector, rotation_matrix);
+	cv::Mat map_to_camera = cv::Mat::eye(4, 4, CV_64F);
+	rotation_matrix.copyTo(map_to_camera(cv::Rect(0, 0, 3, 3)));
+	for (int row = 0; row < 3; row++) {
+		map_to_camera.at<double>(row, 3) = translation_vector[row];
+	}
+	output_map_to_camera = cvToGl() * map_to_camera;
+	return true;
+}
+
+// Localize the camera, learn from the detected markers,
+// and add the placed ones which are missing
+bool MarkerMap::update(
+	const std::vector<std::vector<cv::Point2f>>& marker_corners,
+	const MarkerSet& marker_set,
+	const CameraCalibration& calibration,
+	std::vector<int>& marker_ids,
+	std::vector<cv::Mat>& output_marker_poses) {
+	frame_index_++;
+	output_marker_poses.clear();
+
+	// Only the markers in use have a length
+	std::vector<std::vector<cv::Point2f>> corners;
+	std::vector<int> ids;
+	for (size_t i = 0; i < marker_ids.size(); i++) {
+		if (marker_set.contains(marker_ids[i])) {
+			corners.push_back(marker_corners[i]);
+			ids.push_back(marker_ids[i]);
+		}
+	}
+
+	// A marker which was never placed and is not seen any more is noise,
+	// or was taken away
+	for (auto marker = markers_.begin(); marker != markers_.end();) {
+		if (!isPlaced(marker->second) &&
+			frame_index_ - marker->second.last_seen_frame >
+				static_cast<std::uint64_t>(settings_.unplaced_marker_lifetime)) {
+			marker = markers_.erase(marker);
+		} else {
+			++marker;
+		}
+	}
+
+	// The first marker which is seen is the origin of the map,
+	// and it is where the map says it is
+	if (markers_.empty() && !ids.empty()) {
+		MappedMarker& origin = markers_[ids.front()];
+		placeMarker(origin, cv::Mat::eye(4, 4, CV_64F),
+			marker_set.markerLength(ids.front()));
+		origin.num_of_observation = settings_.max_num_of_observation;
+	}
+
+	// The detected markers which are placed localize the camera together
+	std::vector<size_t> placed_detections;
+	for (size_t i = 0; i < ids.size(); i++) {
+		auto marker = markers_.find(ids[i]);
+		if (marker != markers_.end() && isPlaced(marker->second)) {
+			placed_detections.push_back(i);
+		}
+	}
+	cv::Mat map_to_camera;
+	bool is_localized = localizeCamera(
+		corners, ids, placed_detections, calibration, map_to_camera);
+
+	// A marker which was moved does not fit the others, so it is left
+	// out, and the camera is localized again without it
+	std::vector<bool> is_moved(ids.size(), false);
+	if (is_localized && placed_detections.size() > 1) {
+		cv::Mat mat_intrinsic_parameters(3, 3, CV_32F,
+			const_cast<float*>(calibration.intrinsic_parameters));
+		cv::Mat mat_distortion_coefficients(1, 5, CV_32F,
+			const_cast<float*>(calibration.distortion_coefficients));
+		cv::Mat map_to_camera_cv = cvToGl() * map_to_camera;
+		cv::Mat rotation_vector;
+		cv::Rodrigues(rotationOf(map_to_camera_cv), rotation_vector);
+		std::vector<cv::Point3f> object_points;
+		for (size_t i : placed_detections) {
+			const MappedMarker& marker = markers_.at(ids[i]);
+			object_points.insert(object_points.end(),
+				marker.corners_in_map.begin(), marker.corners_in_map.end());
+		}
+		std::vector<cv::Point2f> projected_corners;
+		cv::projectPoints(object_points, rotation_vector,
+			translationOf(map_to_camera_cv), mat_intrinsic_parameters,
+			mat_distortion_coefficients, projected_corners);
+
+		std::vector<size_t> fitting_detections;
+		for (size_t k = 0; k < placed_detections.size(); k++) {
+			size_t i = placed_detections[k];
+			if (reprojectionError(corners[i], projected_corners, 4 * k) >
+				settings_.max_reprojection_error) {
+				is_moved[i] = true;
+			} else {
+				fitting_detections.push_back(i);
+			}
+		}
+		// If they all disagree, trust the largest marker on screen
+		if (fitting_detections.empty()) {
+			size_t largest = placed_detections.front();
+			for (size_t i : placed_detections) {
+				if (cv::arcLength(corners[i], true) >
+					cv::arcLength(corners[largest], true)) {
+					largest = i;
+				}
+			}
+			is_moved[largest] = false;
+			fitting_detections.push_back(largest);
+		}
+		if (fitting_detections.size() < placed_detections.size()) {
+			is_localized = localizeCamera(
+				corners, ids, fitting_detections, calibration, map_to_camera);
+		}
+	}
+
+	// Without a camera pose, each marker has its own, and nothing is learned
+	if (!is_localized) {
+		for (size_t i = 0; i < ids.size(); i++) {
+			cv::Mat marker_pose;
+			estimateMarkerPose(corners[i], marker_set.markerLength(ids[i]),
+				calibration, marker_pose);
+			output_marker_poses.push_back(marker_pose);
+			auto marker = markers_.find(ids[i]);
+			if (marker != markers_.end()) {
+				marker->second.last_seen_frame = frame_index_;
+			}
+		}
+		marker_ids = ids;
+		return false;
+	}
+	cv::Mat camera_to_map = map_to_camera.inv();
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		auto found = markers_.find(ids[i]);
+		// A settled marker is drawn where the map puts it
+		if (found != markers_.end() && isSettled(found->second) &&
+			!is_moved[i]) {
+			found->second.last_seen_frame = frame_index_;
+			output_marker_poses.push_back(
+				poseOfView(map_to_camera * found->second.marker_to_map));
+			continue;
+		}
+
+		// The others have a pose of their own, which places them
+		cv::Mat marker_pose;
+		float marker_length = marker_set.markerLength(ids[i]);
+		estimateMarkerPose(corners[i], marker_length, calibration,
+			marker_pose);
+		output_marker_poses.push_back(marker_pose);
+		cv::Mat observation = camera_to_map * viewOfPose(marker_pose);
+
+		if (found == markers_.end()) {
+			if (markers_.size() >= settings_.max_num_of_marker) {
+				continue;
+			}
+			MappedMarker& marker = markers_[ids[i]];
+			placeMarker(marker, observation, marker_length);
+			marker.num_of_observation = 1;
+			marker.last_seen_frame = frame_index_;
+			continue;
+		}
+
+		MappedMarker& marker = found->second;
+		marker.last_seen_frame = frame_index_;
+		if (is_moved[i] || cv::norm(translationOf(observation) -
+			translationOf(marker.marker_to_map)) >
+			settings_.max_observation_distance) {
+			placeMarker(marker, observation, marker_length);
+			marker.num_of_observation = 1;
+			continue;
+		}
+		marker.num_of_observation = std::min(
+			marker.num_of_observation + 1, settings_.max_num_of_observation);
+		placeMarker(marker, blendTransformations(marker.marker_to_map,
+			observation, 1.0 / marker.num_of_observation), marker_length);
+	}
+
+	// The placed markers which are not detected are seen from the camera
+	marker_ids = ids;
+	for (const std::pair<const int, MappedMarker>& marker : markers_) {
+		if (!isPlaced(marker.second) ||
+			std::find(ids.begin(), ids.end(), marker.first) != ids.end()) {
+			continue;
+		}
+		marker_ids.push_back(marker.first);
+		output_marker_poses.push_back(
+			poseOfView(map_to_camera * marker.second.marker_to_map));
+	}
+	return true;
+}
+
+// The markers which are placed in the map
+size_t MarkerMap::numOfPlacedMarker() const {
+	size_t num_of_placed_marker = 0;
+	for (const std::pair<const int, MappedMarker>& marker : markers_) {
+		if (isPlaced(marker.second)) {
+			num_of_placed_marker++;
+		}
+	}
+	return num_of_placed_marker;
+}
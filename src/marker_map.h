@@ -0,0 +1,110 @@
+#pragma once
+
+#ifndef MARKER_MAP
+#define MARKER_MAP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+class MarkerSet;
+struct CameraCalibration;
+
+struct MarkerMapSettings {
+	// A placed marker whose corners are farther than this from where
+	// the camera pose puts them (in pixels) is taken as moved, and it is
+	// left out of the camera pose and placed again
+	double max_reprojection_error = 4.0;
+	// A marker is placed in the map after it was seen this many times
+	// together with a placed marker
+	int min_num_of_observation = 3;
+	// The place of a marker averages this many observations, after that
+	// it is settled and has no pose of its own any more
+	int max_num_of_observation = 30;
+	// An observation which is farther than this from the place of its
+	// marker means that the marker was moved, and it is placed again
+	double max_observation_distance = 0.05;
+	// A marker which is not placed yet is forgotten if it is not seen
+	// for this many frames
+	int unplaced_marker_lifetime = 30;
+	// The markers in the map at most, a new marker is not added to a
+	// full map until an unplaced one is forgotten
+	size_t max_num_of_marker = 64;
+};
+
+// A map of the markers in the scene, learned while they are detected
+// The first marker which is seen is the origin of the map, and every
+// other marker is placed relative to it from the frames where it is
+// seen together with a placed marker
+// In each frame, the camera is localized by a single solvePnP over the
+// corners of all detected markers which are placed, and every placed
+// marker, detected or not (occluded, or partly outside the frame),
+// gets its pose from it
+// Only the markers which are still being placed, or were moved, have a
+// solvePnP of their own, so the cost of a frame does not grow with the
+// markers which are settled in the map
+class MarkerMap {
+public:
+	explicit MarkerMap(const MarkerMapSettings& settings = MarkerMapSettings());
+
+	// Give the poses of the detected markers (the 4x4 matrices of
+	// "detectMarkersAndEstimatePose"), and add the ids and poses of the
+	// placed markers which were not detected
+	// The markers which are not in "marker_set" are dropped
+	// If the camera cannot be localized, only the detected markers are
+	// given, each with its own pose, and return false
+	bool update(
+		const std::vector<std::vector<cv::Point2f>>& marker_corners,
+		const MarkerSet& marker_set,
+		const CameraCalibration& calibration,
+		std::vector<int>& marker_ids,
+		std::vector<cv::Mat>& output_marker_poses);
+
+	// The markers which are placed in the map
+	size_t numOfPlacedMarker() const;
+
+	// Forget every marker, e.g. when the markers are rearranged
+	void clear() { markers_.clear(); }
+
+private:
+	struct MappedMarker {
+		// From the marker to the map (4x4, CV_64F)
+		cv::Mat marker_to_map;
+		int num_of_observation = 0;
+		// The corners in the map, for the camera pose
+		std::vector<cv::Point3f> corners_in_map;
+		// The frame where it was seen last
+		std::uint64_t last_seen_frame = 0;
+	};
+
+	bool isPlaced(const MappedMarker& marker) const {
+		return marker.num_of_observation >= settings_.min_num_of_observation;
+	}
+	bool isSettled(const MappedMarker& marker) const {
+		return marker.num_of_observation >= settings_.max_num_of_observation;
+	}
+
+	// Put a marker at "marker_to_map", whose length is "marker_length"
+	void placeMarker(
+		MappedMarker& marker,
+		const cv::Mat& marker_to_map,
+		float marker_length);
+
+	// Give the transformation from the map to the camera (for OpenGL)
+	// from the corners of the detected markers "detections"
+	bool localizeCamera(
+		const std::vector<std::vector<cv::Point2f>>& marker_corners,
+		const std::vector<int>& marker_ids,
+		const std::vector<size_t>& detections,
+		const CameraCalibration& calibration,
+		cv::Mat& output_map_to_camera) const;
+
+	MarkerMapSettings settings_;
+	std::map<int, MappedMarker> markers_;
+	std::uint64_t frame_index_ = 0;
+};
+
+#endif // !MARKER_MAP
@@ -0,0 +1,86 @@
+// Implement the functions in marker_set.h
+#include "marker_set.h"
+#include "parameters.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+// The markers in parameters.h
+MarkerSet defaultMarkerSet() {
+	MarkerSet marker_set;
+	for (const ActiveMarker& marker : active_markers) {
+		marker_set.addMarker(marker.id, marker.length);
+	}
+	return marker_set;
+}
+
+MarkerSet& mutableActiveMarkerSet() {
+	static MarkerSet marker_set = defaultMarkerSet();
+	return marker_set;
+}
+
+} // namespace
+
+// No marker is in use
+MarkerSet::MarkerSet() {
+	std::fill(lengths_, lengths_ + num_of_dictionary_marker, 0.0f);
+}
+
+// Use a marker and rebuild the prefix filter
+bool MarkerSet::addMarker(int id, float length) {
+	if (id < 0 || id >= num_of_dictionary_marker || !(length > 0.0f)) {
+		return false;
+	}
+	if (!contains(id)) {
+		ids_.push_back(id);
+	}
+	lengths_[id] = length;
+	buildMarkerPrefixFilter(ids_, prefix_filter_);
+	return true;
+}
+
+// The markers which are detected
+const MarkerSet& activeMarkerSet() {
+	return mutableActiveMarkerSet();
+}
+
+// Detect only these markers
+void setActiveMarkerSet(const MarkerSet& marker_set) {
+	mutableActiveMarkerSet() = marker_set;
+}
+
+// Read the ids and their lengths
+bool loadMarkerSet(
+	const std::string& input_filename,
+	MarkerSet& output_marker_set) {
+	cv::FileStorage file(input_filename, cv::FileStorage::READ);
+	if (!file.isOpened()) {
+		std::fprintf(stderr, "Failed to open %s.\n", input_filename.c_str());
+		return false;
+	}
+	std::vector<int> ids;
+	std::vector<float> lengths;
+	file["ids"] >> ids;
+	file["lengths"] >> lengths;
+	if (ids.empty() ||
+		(lengths.size() != 1 && lengths.size() != ids.size())) {
+		std::fprintf(stderr, "%s is not a valid marker set.\n",
+			input_filename.c_str());
+		return false;
+	}
+
+	output_marker_set = MarkerSet();
+	for (size_t i = 0; i < ids.size(); i++) {
+		float length = lengths.size() == 1 ? lengths[0] : lengths[i];
+		if (!output_marker_set.addMarker(ids[i], length)) {
+			std::fprintf(stderr, "%s: marker %d of length %f is not valid.\n",
+				input_filename.c_str(), ids[i], length);
+			return false;
+		}
+	}
+	return true;
+}
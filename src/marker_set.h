@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef MARKER_SET
+#define MARKER_SET
+
+#include "marker_decoder.h"
+
+#include <string>
+#include <vector>
+
+// The markers of DICT_6X6_250 which are in use, and their lengths
+// The other markers are rejected while their bits are read,
+// so printed material in the scene costs neither a decode nor a pose
+class MarkerSet {
+public:
+	// No marker is in use
+	MarkerSet();
+
+	// Use a marker, whose length is "length" meters
+	// If the id is not in the dictionary or the length is not positive,
+	// return false
+	bool addMarker(int id, float length);
+
+	bool contains(int id) const {
+		return id >= 0 && id < num_of_dictionary_marker &&
+			lengths_[id] > 0.0f;
+	}
+
+	// The length of a marker in meters, 0 if it is not in use
+	float markerLength(int id) const {
+		return contains(id) ? lengths_[id] : 0.0f;
+	}
+
+	const std::vector<int>& ids() const { return ids_; }
+
+	// The first two rows of the markers in use (see marker_decoder.h)
+	const MarkerPrefixFilter& prefixFilter() const { return prefix_filter_; }
+
+private:
+	static const int num_of_dictionary_marker = 250;
+
+	float lengths_[num_of_dictionary_marker];
+	std::vector<int> ids_;
+	MarkerPrefixFilter prefix_filter_;
+};
+
+// The markers which are detected, the ones in parameters.h
+// unless "setActiveMarkerSet" was called
+const MarkerSet& activeMarkerSet();
+
+// Detect only these markers
+// It must be called before any detection starts
+void setActiveMarkerSet(const MarkerSet& marker_set);
+
+// Read "ids" and "lengths" (in meters) from a file written by
+// "cv::FileStorage", e.g.
+//   ids: [ 0, 1, 7 ]
+//   lengths: [ 0.05, 0.05, 0.1 ]
+// A single length is used for every id
+// If fail, return false
+bool loadMarkerSet(
+	const std::string& input_filename,
+	MarkerSet& output_marker_set);
+
+#endif // !MARKER_SET
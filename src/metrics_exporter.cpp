@@ -0,0 +1,552 @@
+// Implement the classes in metrics_exporter.h
+#include "metrics_exporter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef COUNT_OPERATOR_NEW
+// Constant-initialized, so it counts from the first call
+std::atomic<std::uint64_t> num_of_operator_new_call{ 0 };
+#endif
+
+// A scrape waits for a slow client at most this long
+const int socket_timeout_ms = 1000;
+
+void appendFormat(std::string& text, const char* format, ...) {
+	char buffer[256];
+	va_list arguments;
+	va_start(arguments, format);
+	int length = std::vsnprintf(buffer, sizeof(buffer), format, arguments);
+	va_end(arguments);
+	if (length > 0) {
+		text.append(buffer,
+			std::min(static_cast<size_t>(length), sizeof(buffer) - 1));
+	}
+}
+
+// "name{labels}" or "name" without labels
+std::string seriesName(
+	const std::string& name,
+	const std::string& suffix,
+	const std::string& labels,
+	const std::string& extra_label = "") {
+	std::string all_labels = labels;
+	if (!extra_label.empty()) {
+		all_labels += (all_labels.empty() ? "" : ",") + extra_label;
+	}
+	return all_labels.empty() ?
+		name + suffix : name + suffix + "{" + all_labels + "}";
+}
+
+#ifndef _WIN32
+void setSocketTimeout(int socket_handle) {
+	timeval timeout;
+	timeout.tv_sec = socket_timeout_ms / 1000;
+	timeout.tv_usec = (socket_timeout_ms % 1000) * 1000;
+	setsockopt(socket_handle, SOL_SOCKET, SO_RCVTIMEO,
+		&timeout, sizeof(timeout));
+	setsockopt(socket_handle, SOL_SOCKET, SO_SNDTIMEO,
+		&timeout, sizeof(timeout));
+}
+
+bool sendAll(int socket_handle, const std::string& data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t result = ::send(socket_handle, data.data() + sent,
+			data.size() - sent, MSG_NOSIGNAL);
+		if (result <= 0) {
+			return false;
+		}
+		sent += static_cast<size_t>(result);
+	}
+	return true;
+}
+
+// "GET <path>" from 127.0.0.1:<port>, the status and body of the response
+bool httpGet(
+	int port,
+	const std::string& path,
+	int& output_status,
+	std::string& output_body) {
+	output_status = 0;
+	output_body.clear();
+	int socket_handle = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (socket_handle < 0) {
+		return false;
+	}
+	setSocketTimeout(socket_handle);
+	sockaddr_in socket_address;
+	std::memset(&socket_address, 0, sizeof(socket_address));
+	socket_address.sin_family = AF_INET;
+	socket_address.sin_port = htons(static_cast<uint16_t>(port));
+	socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::connect(socket_handle, reinterpret_cast<sockaddr*>(&socket_address),
+		sizeof(socket_address)) != 0 ||
+		!sendAll(socket_handle,
+			"GET " + path + " HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n")) {
+		::close(socket_handle);
+		return false;
+	}
+
+	std::string response;
+	char buffer[4096];
+	ssize_t received;
+	while ((received = ::recv(socket_handle, buffer, sizeof(buffer), 0)) > 0) {
+		response.append(buffer, static_cast<size_t>(received));
+	}
+	::close(socket_handle);
+
+	size_t body_start = response.find("\r\n\r\n");
+	if (response.compare(0, 9, "HTTP/1.0 ") != 0 ||
+		body_start == std::string::npos) {
+		return false;
+	}
+	output_status = std::atoi(response.c_str() + 9);
+	output_body = response.substr(body_start + 4);
+	return true;
+}
+#else
+bool httpGet(
+	int port,
+	const std::string& path,
+	int& output_status,
+	std::string& output_body) {
+	(void)port;
+	(void)path;
+	output_status = 0;
+	output_body.clear();
+	std::fprintf(stderr, "Scraping the metrics needs POSIX sockets.\n");
+	return false;
+}
+#endif
+
+} // namespace
+
+#ifdef COUNT_OPERATOR_NEW
+// Count the calls of the global "operator new" (the other forms of it
+// and malloc, e.g. the buffers of cv::Mat, are not counted)
+void* operator new(std::size_t size) {
+	num_of_operator_new_call.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0) {
+		size = 1;
+	}
+	while (true) {
+		void* memory = std::malloc(size);
+		if (memory != nullptr) {
+			return memory;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr) {
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+std::uint64_t numOfOperatorNewCall() {
+	return num_of_operator_new_call.load(std::memory_order_relaxed);
+}
+#endif
+
+MetricHistogram::MetricHistogram(const std::vector<double>& upper_bounds) :
+	upper_bounds_(upper_bounds),
+	bucket_counts_(new std::atomic<std::uint64_t>[upper_bounds.size() + 1]) {
+	for (size_t i = 0; i <= upper_bounds_.size(); i++) {
+		bucket_counts_[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+// Count the value in its bucket, and add it to the sum
+void MetricHistogram::observe(double value) {
+	size_t bucket = 0;
+	while (bucket < upper_bounds_.size() && value > upper_bounds_[bucket]) {
+		bucket++;
+	}
+	bucket_counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+	double sum = sum_.load(std::memory_order_relaxed);
+	while (!sum_.compare_exchange_weak(sum, sum + value,
+		std::memory_order_relaxed)) {
+	}
+}
+
+// Copy the buckets and the sum
+void MetricHistogram::read(
+	std::vector<std::uint64_t>& output_bucket_counts,
+	double& output_sum) const {
+	output_bucket_counts.resize(upper_bounds_.size() + 1);
+	for (size_t i = 0; i <= upper_bounds_.size(); i++) {
+		output_bucket_counts[i] =
+			bucket_counts_[i].load(std::memory_order_relaxed);
+	}
+	output_sum = sum_.load(std::memory_order_relaxed);
+}
+
+// Find the series, or add it (and its family)
+MetricsRegistry::Series& MetricsRegistry::findSeries(
+	const std::string& name,
+	const std::string& help,
+	MetricType type,
+	const std::string& labels) {
+	Family* family = nullptr;
+	for (Family& existing : families_) {
+		if (existing.name == name) {
+			family = &existing;
+			break;
+		}
+	}
+	if (family == nullptr) {
+		families_.push_back(Family{ name, help, type, {} });
+		family = &families_.back();
+	}
+	for (Series& series : family->series) {
+		if (series.labels == labels) {
+			return series;
+		}
+	}
+	family->series.emplace_back();
+	family->series.back().labels = labels;
+	return family->series.back();
+}
+
+MetricCounter& MetricsRegistry::counter(
+	const std::string& name,
+	const std::string& help,
+	const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Series& series = findSeries(name, help, MetricType::Counter, labels);
+	if (!series.counter) {
+		series.counter.reset(new MetricCounter());
+	}
+	return *series.counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(
+	const std::string& name,
+	const std::string& help,
+	const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Series& series = findSeries(name, help, MetricType::Gauge, labels);
+	if (!series.gauge) {
+		series.gauge.reset(new MetricGauge());
+	}
+	return *series.gauge;
+}
+
+MetricHistogram& MetricsRegistry::histogram(
+	const std::string& name,
+	const std::string& help,
+	const std::vector<double>& upper_bounds,
+	const std::string& labels) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Series& series = findSeries(name, help, MetricType::Histogram, labels);
+	if (!series.histogram) {
+		series.histogram.reset(new MetricHistogram(upper_bounds));
+	}
+	return *series.histogram;
+}
+
+// Write "# HELP", "# TYPE" and the samples of every family
+void MetricsRegistry::writeText(std::string& output_text) const {
+	output_text.clear();
+	// The families and series are never removed and a deque keeps their
+	// addresses, so the lock is only held to list them, and registering
+	// a metric does not wait for the formatting
+	std::vector<std::pair<const Family*, std::vector<const Series*>>> families;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		families.reserve(families_.size());
+		for (const Family& family : families_) {
+			families.emplace_back(&family, std::vector<const Series*>());
+			for (const Series& series : family.series) {
+				families.back().second.push_back(&series);
+			}
+		}
+	}
+
+	std::vector<std::uint64_t> bucket_counts;
+	for (const auto& listed_family : families) {
+		const Family& family = *listed_family.first;
+		const char* type_name = family.type == MetricType::Counter ?
+			"counter" : (family.type == MetricType::Gauge ?
+				"gauge" : "histogram");
+		output_text += "# HELP " + family.name + " " + family.help + "\n";
+		output_text += "# TYPE " + family.name + " " + type_name + "\n";
+
+		for (const Series* listed_series : listed_family.second) {
+			const Series& series = *listed_series;
+			if (series.counter) {
+				appendFormat(output_text, "%s %" PRIu64 "\n",
+					seriesName(family.name, "", series.labels).c_str(),
+					series.counter->value());
+			} else if (series.gauge) {
+				appendFormat(output_text, "%s %.9g\n",
+					seriesName(family.name, "", series.labels).c_str(),
+					series.gauge->value());
+			} else if (series.histogram) {
+				double sum = 0.0;
+				series.histogram->read(bucket_counts, sum);
+				const std::vector<double>& upper_bounds =
+					series.histogram->upperBounds();
+				// The buckets of the exposition format are cumulative
+				std::uint64_t cumulative_count = 0;
+				for (size_t i = 0; i < bucket_counts.size(); i++) {
+					cumulative_count += bucket_counts[i];
+					char bound[64];
+					if (i < upper_bounds.size()) {
+						std::snprintf(bound, sizeof(bound), "le=\"%g\"",
+							upper_bounds[i]);
+					} else {
+						std::snprintf(bound, sizeof(bound), "le=\"+Inf\"");
+					}
+					appendFormat(output_text, "%s %" PRIu64 "\n",
+						seriesName(family.name, "_bucket",
+							series.labels, bound).c_str(),
+						cumulative_count);
+				}
+				appendFormat(output_text, "%s %.9g\n",
+					seriesName(family.name, "_sum", series.labels).c_str(),
+					sum);
+				appendFormat(output_text, "%s %" PRIu64 "\n",
+					seriesName(family.name, "_count", series.labels).c_str(),
+					cumulative_count);
+			}
+		}
+	}
+}
+
+MetricsServer::~MetricsServer() {
+	stop();
+}
+
+// Listen on the address, and serve on a thread
+bool MetricsServer::start(
+	const MetricsRegistry& registry,
+	int port,
+	const std::string& address) {
+#ifdef _WIN32
+	(void)registry;
+	(void)port;
+	(void)address;
+	std::fprintf(stderr, "The metrics server needs POSIX sockets.\n");
+	return false;
+#else
+	stop();
+	registry_ = &registry;
+	listen_socket_ = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_socket_ < 0) {
+		std::fprintf(stderr, "Failed to create the metrics socket.\n");
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR,
+		&reuse, sizeof(reuse));
+
+	sockaddr_in socket_address;
+	std::memset(&socket_address, 0, sizeof(socket_address));
+	socket_address.sin_family = AF_INET;
+	socket_address.sin_port = htons(static_cast<uint16_t>(port));
+	if (inet_pton(AF_INET, address.c_str(), &socket_address.sin_addr) != 1 ||
+		::bind(listen_socket_, reinterpret_cast<sockaddr*>(&socket_address),
+			sizeof(socket_address)) != 0 ||
+		::listen(listen_socket_, 4) != 0) {
+		std::fprintf(stderr, "Failed to listen on %s:%d: %s.\n",
+			address.c_str(), port, std::strerror(errno));
+		::close(listen_socket_);
+		listen_socket_ = -1;
+		return false;
+	}
+
+	is_running_.store(true);
+	thread_ = std::thread(&MetricsServer::serveLoop, this);
+	return true;
+#endif
+}
+
+void MetricsServer::stop() {
+	is_running_.store(false);
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+#ifndef _WIN32
+	if (listen_socket_ >= 0) {
+		::close(listen_socket_);
+		listen_socket_ = -1;
+	}
+#endif
+}
+
+// Answer one request per connection
+void MetricsServer::serveLoop() {
+#ifndef _WIN32
+	std::string request;
+	std::string body;
+	char buffer[1024];
+	while (is_running_.load()) {
+		// Wake up now and then to see if the server is stopped
+		pollfd listen_poll = { listen_socket_, POLLIN, 0 };
+		if (::poll(&listen_poll, 1, 200) <= 0) {
+			continue;
+		}
+		int client = ::accept(listen_socket_, nullptr, nullptr);
+		if (client < 0) {
+			continue;
+		}
+		setSocketTimeout(client);
+
+		// Only the request line matters, the headers are skipped
+		request.clear();
+		while (request.find("\r\n\r\n") == std::string::npos &&
+			request.size() < 8192) {
+			ssize_t received = ::recv(client, buffer, sizeof(buffer), 0);
+			if (received <= 0) {
+				break;
+			}
+			request.append(buffer, static_cast<size_t>(received));
+		}
+
+		std::string response;
+		if (request.compare(0, 13, "GET /metrics ") == 0 ||
+			request.compare(0, 14, "GET /metrics\r\n") == 0) {
+			registry_->writeText(body);
+			response = "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\n"
+				"Connection: close\r\n\r\n" + body;
+		} else {
+			response = "HTTP/1.0 404 Not Found\r\n"
+				"Content-Length: 0\r\nConnection: close\r\n\r\n";
+		}
+		sendAll(client, response);
+		::close(client);
+	}
+#endif
+}
+
+// Fetch the metrics like a local scraper
+bool scrapeMetrics(int port, std::string& output_text) {
+	int status = 0;
+	return httpGet(port, "/metrics", status, output_text) && status == 200;
+}
+
+// Serve a registry whose values are known, scrape it and compare the text
+bool runMetricsSelfCheck(int port) {
+	MetricsRegistry registry;
+	MetricCounter& frames = registry.counter(
+		"ar_check_frames_total", "Frames of the check");
+	MetricCounter& dropped = registry.counter(
+		"ar_check_dropped_total", "Dropped frames of the check",
+		"reason=\"pool_full\"");
+	MetricGauge& in_use = registry.gauge(
+		"ar_check_in_use", "Frames in use in the check");
+	MetricHistogram& durations = registry.histogram(
+		"ar_check_duration_ms", "Durations of the check", { 1.0, 4.0 },
+		"stage=\"detect\"");
+	frames.add(3);
+	dropped.store(7);
+	in_use.set(2.5);
+	durations.observe(0.5);
+	durations.observe(2.0);
+	durations.observe(2.0);
+	durations.observe(10.0);
+
+	MetricsServer server;
+	if (!server.start(registry, port)) {
+		return false;
+	}
+	bool is_passed = true;
+	auto expect = [&is_passed](bool condition, const char* description) {
+		if (!condition) {
+			std::fprintf(stderr, "Metrics check failed: %s.\n", description);
+			is_passed = false;
+		}
+	};
+	// Every line of "expected_lines" must be a whole line of the text
+	auto hasLines = [](const std::string& text,
+		const std::vector<std::string>& expected_lines) {
+		for (const std::string& line : expected_lines) {
+			size_t found = ("\n" + text).find("\n" + line + "\n");
+			if (found == std::string::npos) {
+				std::fprintf(stderr, "Missing line: %s\n", line.c_str());
+				return false;
+			}
+		}
+		return true;
+	};
+
+	std::string text;
+	expect(scrapeMetrics(port, text), "the first scrape");
+	expect(hasLines(text, {
+		"# HELP ar_check_frames_total Frames of the check",
+		"# TYPE ar_check_frames_total counter",
+		"ar_check_frames_total 3",
+		"# TYPE ar_check_dropped_total counter",
+		"ar_check_dropped_total{reason=\"pool_full\"} 7",
+		"# TYPE ar_check_in_use gauge",
+		"ar_check_in_use 2.5",
+		"# TYPE ar_check_duration_ms histogram",
+		"ar_check_duration_ms_bucket{stage=\"detect\",le=\"1\"} 1",
+		"ar_check_duration_ms_bucket{stage=\"detect\",le=\"4\"} 3",
+		"ar_check_duration_ms_bucket{stage=\"detect\",le=\"+Inf\"} 4",
+		"ar_check_duration_ms_sum{stage=\"detect\"} 14.5",
+		"ar_check_duration_ms_count{stage=\"detect\"} 4" }),
+		"the text of the first scrape");
+
+	// Scrape while another thread updates, and register a metric,
+	// the totals must still add up
+	const int num_of_update = 20000;
+	std::thread updater([&]() {
+		for (int i = 0; i < num_of_update; i++) {
+			frames.add();
+			durations.observe(0.5);
+		}
+		registry.counter("ar_check_late_total", "Registered during a scrape")
+			.add();
+	});
+	for (int i = 0; i < 20; i++) {
+		expect(scrapeMetrics(port, text), "a scrape during updates");
+	}
+	updater.join();
+	expect(scrapeMetrics(port, text), "the last scrape");
+	expect(hasLines(text, {
+		"ar_check_frames_total " + std::to_string(3 + num_of_update),
+		"ar_check_duration_ms_count{stage=\"detect\"} " +
+			std::to_string(4 + num_of_update),
+		"# TYPE ar_check_late_total counter",
+		"ar_check_late_total 1" }),
+		"the text after the updates");
+
+	int status = 0;
+	std::string body;
+	expect(httpGet(port, "/other", status, body) && status == 404,
+		"another path is not found");
+
+	server.stop();
+	std::printf("Metrics check %s\n", is_passed ? "passed" : "failed");
+	return is_passed;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#ifndef METRICS_EXPORTER
+#define METRICS_EXPORTER
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Metrics of the pipeline in the text format of Prometheus
+// The pipeline only updates atomics (relaxed), so it never waits for
+// a scrape; the values are read and formatted on the server thread
+// The metrics are registered at startup and live as long as the registry
+
+// A value which only grows (e.g. frames captured)
+class MetricCounter {
+public:
+	void add(std::uint64_t amount = 1) {
+		value_.fetch_add(amount, std::memory_order_relaxed);
+	}
+
+	// Mirror a counter which is kept elsewhere (it must only grow)
+	void store(std::uint64_t value) {
+		value_.store(value, std::memory_order_relaxed);
+	}
+
+	std::uint64_t value() const {
+		return value_.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<std::uint64_t> value_{ 0 };
+};
+
+// A value which goes up and down (e.g. frames in use)
+class MetricGauge {
+public:
+	void set(double value) {
+		value_.store(value, std::memory_order_relaxed);
+	}
+
+	double value() const {
+		return value_.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<double> value_{ 0.0 };
+};
+
+// The distribution of a value in fixed buckets
+class MetricHistogram {
+public:
+	// The upper bounds of the buckets in increasing order,
+	// the last bucket (+Inf) is added
+	explicit MetricHistogram(const std::vector<double>& upper_bounds);
+
+	void observe(double value);
+
+	// A consistent enough copy for a scrape: the count is the sum
+	// of the buckets, which are not cumulative here
+	void read(
+		std::vector<std::uint64_t>& output_bucket_counts,
+		double& output_sum) const;
+
+	const std::vector<double>& upperBounds() const { return upper_bounds_; }
+
+private:
+	std::vector<double> upper_bounds_;
+	std::unique_ptr<std::atomic<std::uint64_t>[]> bucket_counts_;
+	std::atomic<double> sum_{ 0.0 };
+};
+
+// The metrics of the process, each with a name, a help text and labels
+// such as "stage=\"detect\"" (the same name can be registered with
+// different labels)
+class MetricsRegistry {
+public:
+	MetricCounter& counter(
+		const std::string& name,
+		const std::string& help,
+		const std::string& labels = "");
+	MetricGauge& gauge(
+		const std::string& name,
+		const std::string& help,
+		const std::string& labels = "");
+	MetricHistogram& histogram(
+		const std::string& name,
+		const std::string& help,
+		const std::vector<double>& upper_bounds,
+		const std::string& labels = "");
+
+	// Write every metric in the text exposition format (version 0.0.4)
+	void writeText(std::string& output_text) const;
+
+private:
+	enum class MetricType { Counter, Gauge, Histogram };
+
+	struct Series {
+		std::string labels;
+		std::unique_ptr<MetricCounter> counter;
+		std::unique_ptr<MetricGauge> gauge;
+		std::unique_ptr<MetricHistogram> histogram;
+	};
+
+	struct Family {
+		std::string name;
+		std::string help;
+		MetricType type;
+		std::deque<Series> series;
+	};
+
+	// Find or add the series of a metric
+	Series& findSeries(
+		const std::string& name,
+		const std::string& help,
+		MetricType type,
+		const std::string& labels);
+
+	// Only taken to register metrics and to list them for a scrape
+	mutable std::mutex mutex_;
+	std::deque<Family> families_;
+};
+
+// Serve "GET /metrics" on a local port, one connection at a time
+class MetricsServer {
+public:
+	MetricsServer() = default;
+	~MetricsServer();
+
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+
+	// Listen on "address:port" (the loopback by default, since the
+	// metrics are scraped on the same host)
+	// If fail, return false
+	bool start(
+		const MetricsRegistry& registry,
+		int port,
+		const std::string& address = "127.0.0.1");
+	void stop();
+
+private:
+	void serveLoop();
+
+	const MetricsRegistry* registry_ = nullptr;
+	int listen_socket_ = -1;
+	std::atomic<bool> is_running_{ false };
+	std::thread thread_;
+};
+
+// Fetch "http://127.0.0.1:<port>/metrics", like a local scraper
+// If fail, return false
+bool scrapeMetrics(int port, std::string& output_text);
+
+// Serve metrics with known values on 127.0.0.1:<port>, scrape them
+// (also while they are updated) and compare the text with the expected
+// exposition format
+// If the text differs or the server fails, return false
+bool runMetricsSelfCheck(int port);
+
+#ifdef COUNT_OPERATOR_NEW
+// The calls of the global "operator new" since the process started
+// Only built with COUNT_OPERATOR_NEW, since it replaces "operator new"
+// and adds an atomic shared by every thread to each call
+// cv::Mat buffers (cv::fastMalloc) and malloc are not counted
+std::uint64_t numOfOperatorNewCall();
+#endif
+
+#endif // !METRICS_EXPORTER
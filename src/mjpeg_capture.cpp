@@ -0,0 +1,409 @@
+// Implement the class in mjpeg_capture.h
+#include "mjpeg_capture.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Bytes read from a file at once
+const size_t file_chunk_size = 1 << 20;
+
+enum class JpegScan { Complete, Incomplete, Corrupt };
+
+// Find the end of the JPEG image which starts at "data" (with SOI)
+// The segments are skipped by their lengths, and the entropy-coded data
+// is searched for the next marker, so EOI bytes inside a segment
+// (e.g. a thumbnail) do not end the image
+JpegScan findJpegEnd(const uchar* data, size_t size, size_t& output_size) {
+	size_t i = 2;
+	while (true) {
+		if (i + 2 > size) {
+			return JpegScan::Incomplete;
+		}
+		if (data[i] != 0xFF) {
+			return JpegScan::Corrupt;
+		}
+		uchar marker = data[i + 1];
+		// Fill bytes
+		if (marker == 0xFF) {
+			i++;
+			continue;
+		}
+		// End of image
+		if (marker == 0xD9) {
+			output_size = i + 2;
+			return JpegScan::Complete;
+		}
+		// Markers without length
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+			i += 2;
+			continue;
+		}
+		// Another image starts before this one has ended
+		if (marker == 0xD8 || marker == 0x00) {
+			return JpegScan::Corrupt;
+		}
+
+		if (i + 4 > size) {
+			return JpegScan::Incomplete;
+		}
+		size_t length = (static_cast<size_t>(data[i + 2]) << 8) | data[i + 3];
+		if (length < 2) {
+			return JpegScan::Corrupt;
+		}
+		i += 2 + length;
+		if (marker != 0xDA) {
+			continue;
+		}
+
+		// After the start of scan, 0xFF is followed by 0x00 (a stuffed byte),
+		// a restart marker, or the next marker
+		while (true) {
+			if (i + 2 > size) {
+				return JpegScan::Incomplete;
+			}
+			const void* next_ff = std::memchr(data + i, 0xFF, size - i - 1);
+			if (next_ff == nullptr) {
+				i = size - 1;
+				continue;
+			}
+			i = static_cast<const uchar*>(next_ff) - data;
+			uchar next = data[i + 1];
+			if (next == 0x00 || (next >= 0xD0 && next <= 0xD7)) {
+				i += 2;
+			} else if (next == 0xFF) {
+				i++;
+			} else {
+				break;
+			}
+		}
+	}
+}
+
+} // namespace
+
+MjpegCapture::MjpegCapture(const MjpegCaptureSettings& settings)
+	: settings_(settings) {
+}
+
+MjpegCapture::~MjpegCapture() {
+	close();
+}
+
+// If the camera cannot give compressed MJPEG frames, return false
+bool MjpegCapture::openCamera(
+	int camera_index, cv::Size frame_size, double fps) {
+	close();
+	if (!camera_.open(camera_index)) {
+		std::fprintf(stderr, "Failed to open camera %d.\n", camera_index);
+		return false;
+	}
+	camera_.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'));
+	camera_.set(cv::CAP_PROP_FRAME_WIDTH, frame_size.width);
+	camera_.set(cv::CAP_PROP_FRAME_HEIGHT, frame_size.height);
+	camera_.set(cv::CAP_PROP_FPS, fps);
+	// Keep the frames as they come from the camera
+	camera_.set(cv::CAP_PROP_CONVERT_RGB, 0);
+
+	// A compressed frame is one row of bytes
+	if (!camera_.read(camera_buffer_) ||
+		camera_buffer_.rows != 1 || camera_buffer_.type() != CV_8UC1) {
+		std::fprintf(stderr,
+			"Camera %d does not give compressed MJPEG frames.\n", camera_index);
+		camera_.release();
+		return false;
+	}
+	is_camera_ = true;
+	start();
+	return true;
+}
+
+// If the file cannot be opened, return false
+bool MjpegCapture::openFile(const std::string& filename) {
+	close();
+	file_.open(filename, std::ios::binary);
+	if (!file_.is_open()) {
+		std::fprintf(stderr, "Failed to open %s.\n", filename.c_str());
+		return false;
+	}
+	is_camera_ = false;
+	start();
+	return true;
+}
+
+void MjpegCapture::start() {
+	slots_ = std::vector<Slot>(std::max<size_t>(settings_.num_of_slot, 1));
+	next_write_index_ = 0;
+	next_read_index_ = 0;
+	queued_indices_.clear();
+	is_end_of_stream_ = false;
+	is_stopping_ = false;
+	num_of_dropped_frame_ = 0;
+
+	reader_ = std::thread(&MjpegCapture::readerLoop, this);
+	unsigned int num_of_decoder = std::max(settings_.num_of_decoder, 1u);
+	for (unsigned int i = 0; i < num_of_decoder; i++) {
+		decoders_.emplace_back(&MjpegCapture::decoderLoop, this);
+	}
+}
+
+void MjpegCapture::close() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = true;
+	}
+	slot_freed_.notify_all();
+	frame_queued_.notify_all();
+	frame_decoded_.notify_all();
+	if (reader_.joinable()) {
+		reader_.join();
+	}
+	for (std::thread& decoder : decoders_) {
+		decoder.join();
+	}
+	decoders_.clear();
+
+	camera_.release();
+	if (file_.is_open()) {
+		file_.close();
+	}
+	file_buffer_.clear();
+	file_buffer_offset_ = 0;
+	slots_.clear();
+	queued_indices_.clear();
+}
+
+// Take the next compressed frame from the camera or the file
+bool MjpegCapture::readCompressed(std::vector<uchar>& output_compressed) {
+	if (!is_camera_) {
+		return readCompressedFromFile(output_compressed);
+	}
+	if (!camera_.read(camera_buffer_) || camera_buffer_.empty()) {
+		return false;
+	}
+	output_compressed.assign(camera_buffer_.data,
+		camera_buffer_.data + camera_buffer_.total());
+	return true;
+}
+
+// Split the next JPEG image off the file
+// Bytes before an image, and broken images, are skipped
+bool MjpegCapture::readCompressedFromFile(
+	std::vector<uchar>& output_compressed) {
+	while (true) {
+		const uchar* data = file_buffer_.data() + file_buffer_offset_;
+		size_t available = file_buffer_.size() - file_buffer_offset_;
+
+		// Start of image
+		size_t start = 0;
+		while (start + 1 < available &&
+			!(data[start] == 0xFF && data[start + 1] == 0xD8)) {
+			start++;
+		}
+		file_buffer_offset_ += start;
+		if (start + 1 < available) {
+			size_t image_size = 0;
+			JpegScan scan = findJpegEnd(
+				data + start, available - start, image_size);
+			if (scan == JpegScan::Complete) {
+				output_compressed.assign(
+					data + start, data + start + image_size);
+				file_buffer_offset_ += image_size;
+				return true;
+			}
+			if (scan == JpegScan::Corrupt) {
+				file_buffer_offset_ += 2;
+				continue;
+			}
+		}
+
+		// Read more of the file behind the bytes which are left
+		file_buffer_.erase(file_buffer_.begin(),
+			file_buffer_.begin() + file_buffer_offset_);
+		file_buffer_offset_ = 0;
+		size_t old_size = file_buffer_.size();
+		file_buffer_.resize(old_size + file_chunk_size);
+		file_.read(reinterpret_cast<char*>(file_buffer_.data() + old_size),
+			file_chunk_size);
+		size_t num_of_read_byte = static_cast<size_t>(file_.gcount());
+		file_buffer_.resize(old_size + num_of_read_byte);
+		// An unfinished image at the end of the file is dropped
+		if (num_of_read_byte == 0) {
+			return false;
+		}
+	}
+}
+
+// Read compressed frames into free slots, and queue them for the decoders
+void MjpegCapture::readerLoop() {
+	placeCurrentThread(PipelineStage::Capture, "mjpeg-reader");
+	std::vector<uchar> compressed;
+	std::chrono::steady_clock::time_point start_time =
+		std::chrono::steady_clock::now();
+	std::uint64_t num_of_read_frame = 0;
+	while (true) {
+		bool has_frame = readCompressed(compressed);
+		// Recorded frames come at their rate
+		if (!is_camera_ && settings_.playback_fps > 0.0) {
+			std::this_thread::sleep_until(start_time +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(
+						num_of_read_frame / settings_.playback_fps)));
+		}
+		num_of_read_frame++;
+		std::int64_t capture_time_ns =
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (is_stopping_) {
+			return;
+		}
+		if (!has_frame) {
+			is_end_of_stream_ = true;
+			frame_decoded_.notify_all();
+			return;
+		}
+
+		// The slots are used in order, so this one is free
+		// when the consumer has taken the frame of the previous round
+		// A camera does not wait, otherwise its frames queue up in the driver
+		size_t slot_index = next_write_index_ % slots_.size();
+		if (is_camera_) {
+			if (slots_[slot_index].state != SlotState::Free) {
+				num_of_dropped_frame_++;
+				continue;
+			}
+		} else {
+			slot_freed_.wait(lock, [&]() {
+				return is_stopping_ ||
+					slots_[slot_index].state == SlotState::Free;
+			});
+			if (is_stopping_) {
+				return;
+			}
+		}
+
+		// Swap, so the buffers of both sides are reused
+		Slot& slot = slots_[slot_index];
+		slot.compressed.swap(compressed);
+		slot.frame.frame_index = next_write_index_;
+		slot.frame.capture_time_ns = capture_time_ns;
+		slot.state = SlotState::Queued;
+		queued_indices_.push_back(next_write_index_++);
+		frame_queued_.notify_one();
+	}
+}
+
+void MjpegCapture::decoderLoop() {
+	placeCurrentThread(PipelineStage::Capture, "mjpeg-decoder");
+	while (true) {
+		Slot* slot = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			frame_queued_.wait(lock, [&]() {
+				return is_stopping_ || !queued_indices_.empty();
+			});
+			if (is_stopping_) {
+				return;
+			}
+			slot = &slots_[queued_indices_.front() % slots_.size()];
+			queued_indices_.pop_front();
+		}
+
+		// Only this decoder touches the slot until it is marked decoded
+		decode(*slot);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			slot->state = SlotState::Decoded;
+		}
+		frame_decoded_.notify_all();
+	}
+}
+
+// Decode into the images of the slot, which keep their memory
+void MjpegCapture::decode(Slot& slot) {
+	// "cv::imdecode" leaves the image as it is if the data is not
+	// recognized at all, so check the start of image first
+	slot.is_valid = slot.compressed.size() > 2 &&
+		slot.compressed[0] == 0xFF && slot.compressed[1] == 0xD8;
+	if (!slot.is_valid) {
+		return;
+	}
+
+	// Without the luminance, the decoder scales the color in the DCT
+	if (!settings_.decode_grayscale) {
+		int color_flag = cv::IMREAD_COLOR;
+		if (settings_.color_reduction == 2) {
+			color_flag = cv::IMREAD_REDUCED_COLOR_2;
+		} else if (settings_.color_reduction == 4) {
+			color_flag = cv::IMREAD_REDUCED_COLOR_4;
+		} else if (settings_.color_reduction == 8) {
+			color_flag = cv::IMREAD_REDUCED_COLOR_8;
+		}
+		cv::imdecode(slot.compressed, color_flag, &slot.frame.color);
+		slot.is_valid = !slot.frame.color.empty();
+		return;
+	}
+
+	// Otherwise the entropy decoding, which is most of the time,
+	// is done once at full size, and both images are made from it
+	cv::Mat& full_color = settings_.color_reduction > 1 ?
+		slot.full_color : slot.frame.color;
+	cv::imdecode(slot.compressed, cv::IMREAD_COLOR, &full_color);
+	slot.is_valid = !full_color.empty();
+	if (!slot.is_valid) {
+		return;
+	}
+	cv::cvtColor(full_color, slot.frame.grayscale, cv::COLOR_BGR2GRAY);
+	if (settings_.color_reduction > 1) {
+		cv::resize(full_color, slot.frame.color,
+			cv::Size(full_color.cols / settings_.color_reduction,
+				full_color.rows / settings_.color_reduction),
+			0.0, 0.0, cv::INTER_AREA);
+	}
+}
+
+// Wait for the next frame in capture order
+bool MjpegCapture::read(MjpegFrame& output_frame) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (slots_.empty()) {
+		return false;
+	}
+	while (true) {
+		Slot& slot = slots_[next_read_index_ % slots_.size()];
+		frame_decoded_.wait(lock, [&]() {
+			return slot.state == SlotState::Decoded || is_stopping_ ||
+				(is_end_of_stream_ && next_read_index_ == next_write_index_);
+		});
+		if (slot.state != SlotState::Decoded) {
+			return false;
+		}
+
+		bool is_valid = slot.is_valid;
+		if (is_valid) {
+			output_frame.frame_index = slot.frame.frame_index;
+			output_frame.capture_time_ns = slot.frame.capture_time_ns;
+			std::swap(output_frame.color, slot.frame.color);
+			std::swap(output_frame.grayscale, slot.frame.grayscale);
+		} else {
+			num_of_dropped_frame_++;
+		}
+		slot.state = SlotState::Free;
+		next_read_index_++;
+		slot_freed_.notify_one();
+		if (is_valid) {
+			return true;
+		}
+	}
+}
+
+size_t MjpegCapture::numOfDroppedFrame() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return num_of_dropped_frame_;
+}
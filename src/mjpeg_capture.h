@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef MJPEG_CAPTURE
+#define MJPEG_CAPTURE
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+struct MjpegCaptureSettings {
+	// The threads which decode frames in parallel
+	unsigned int num_of_decoder = 3;
+	// Frames read ahead of the consumer, being decoded or waiting
+	// A camera frame which finds all of them in use is dropped
+	size_t num_of_slot = 4;
+	// The color image is given at 1/n of the size (1, 2, 4 or 8)
+	// Without the luminance, the JPEG decoder scales in the DCT,
+	// otherwise the full-size image is shrunk
+	int color_reduction = 2;
+	// Also give the full-size luminance for detection
+	// Each frame is still decoded once, at full size
+	bool decode_grayscale = true;
+	// Recorded files are played at this rate (0 is as fast as they are read)
+	double playback_fps = 0.0;
+};
+
+// One decoded frame
+struct MjpegFrame {
+	std::uint64_t frame_index = 0;
+	// std::chrono::steady_clock time the compressed frame was read,
+	// in nanoseconds
+	std::int64_t capture_time_ns = 0;
+	// BGR at 1/"color_reduction" of the size, for display
+	cv::Mat color;
+	// Full size, for detection (empty if it is not decoded)
+	cv::Mat grayscale;
+};
+
+// Capture compressed MJPEG frames and decode them on a pool of threads
+// The frames come from a USB camera in MJPEG mode, or from a recorded
+// stream of concatenated JPEG images (e.g. "ffmpeg -c:v copy -f mjpeg"),
+// so the pipeline can be run without a camera
+// A reader thread takes the compressed frames, the decoders work on
+// several of them at once, and "read" gives them out in capture order
+class MjpegCapture {
+public:
+	explicit MjpegCapture(
+		const MjpegCaptureSettings& settings = MjpegCaptureSettings());
+	~MjpegCapture();
+
+	MjpegCapture(const MjpegCapture&) = delete;
+	MjpegCapture& operator=(const MjpegCapture&) = delete;
+
+	// If the camera cannot give compressed MJPEG frames, return false
+	bool openCamera(int camera_index, cv::Size frame_size, double fps);
+	// If the file cannot be opened, return false
+	bool openFile(const std::string& filename);
+	void close();
+
+	// Wait for the next frame in capture order
+	// The images of "output_frame" are swapped with buffers of the capture
+	// and reused, so copy them if they are kept after the next call
+	// At the end of the file, or if the camera fails, return false
+	bool read(MjpegFrame& output_frame);
+
+	// Camera frames dropped because all slots were in use,
+	// and frames which could not be decoded
+	size_t numOfDroppedFrame() const;
+
+	const MjpegCaptureSettings& settings() const { return settings_; }
+
+private:
+	enum class SlotState { Free, Queued, Decoded };
+
+	struct Slot {
+		std::vector<uchar> compressed;
+		MjpegFrame frame;
+		// The full-size image which the reduced color is made from
+		cv::Mat full_color;
+		SlotState state = SlotState::Free;
+		bool is_valid = false;
+	};
+
+	void start();
+	// Take the next compressed frame from the camera or the file
+	// At the end, or on failure, return false
+	bool readCompressed(std::vector<uchar>& output_compressed);
+	bool readCompressedFromFile(std::vector<uchar>& output_compressed);
+	void readerLoop();
+	void decoderLoop();
+	void decode(Slot& slot);
+
+	MjpegCaptureSettings settings_;
+
+	// Only one of them is open
+	cv::VideoCapture camera_;
+	cv::Mat camera_buffer_;
+	std::ifstream file_;
+	// Bytes of the file which have been read but not given out yet
+	std::vector<uchar> file_buffer_;
+	size_t file_buffer_offset_ = 0;
+	bool is_camera_ = false;
+
+	std::vector<Slot> slots_;
+	// The frame written next by the reader, and read next by "read"
+	std::uint64_t next_write_index_ = 0;
+	std::uint64_t next_read_index_ = 0;
+	// Frames which wait for a decoder
+	std::deque<std::uint64_t> queued_indices_;
+	bool is_end_of_stream_ = false;
+	bool is_stopping_ = false;
+	size_t num_of_dropped_frame_ = 0;
+
+	mutable std::mutex mutex_;
+	std::condition_variable slot_freed_;
+	std::condition_variable frame_queued_;
+	std::condition_variable frame_decoded_;
+	std::thread reader_;
+	std::vector<std::thread> decoders_;
+};
+
+#endif // !MJPEG_CAPTURE
@@ -0,0 +1,449 @@
+// Implement the functions and the class in multi_camera.h
+#include "multi_camera.h"
+#include "asset_manager.h"
+#include "camera_calibration.h"
+#include "draw_graphics.h"
+#include "graphics_utility.h"
+#include "marker_detection.h"
+#include "thread_placement.h"
+#include "visibility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+
+// The capture thread of one camera
+// Frames are converted to RGB into its own pool, and submitted to
+// the shared detection workers
+class CameraCapture {
+public:
+	CameraCapture() = default;
+	~CameraCapture() { stop(); }
+
+	CameraCapture(const CameraCapture&) = delete;
+	CameraCapture& operator=(const CameraCapture&) = delete;
+
+	// A source of only digits is a camera index, otherwise a video file
+	// A camera is asked for "requested_size", which it may not support
+	bool open(const std::string& source, cv::Size requested_size) {
+		is_file_ = source.empty() ||
+			!std::all_of(source.begin(), source.end(), [](char c) {
+				return std::isdigit(static_cast<unsigned char>(c)) != 0;
+			});
+		if (is_file_) {
+			camera_.open(source);
+		} else {
+			camera_.open(std::atoi(source.c_str()));
+			camera_.set(cv::CAP_PROP_FRAME_WIDTH, requested_size.width);
+			camera_.set(cv::CAP_PROP_FRAME_HEIGHT, requested_size.height);
+		}
+		if (!camera_.isOpened()) {
+			std::fprintf(stderr, "Failed to open %s.\n", source.c_str());
+			return false;
+		}
+		// A video file is played at its own rate
+		double fps = is_file_ ? camera_.get(cv::CAP_PROP_FPS) : 0.0;
+		frame_interval_s_ = fps > 0.0 ? 1.0 / fps : 1.0 / 30.0;
+		return true;
+	}
+
+	// The size of the frames the camera or the video gives
+	cv::Size frameSize() {
+		return cv::Size(
+			static_cast<int>(camera_.get(cv::CAP_PROP_FRAME_WIDTH)),
+			static_cast<int>(camera_.get(cv::CAP_PROP_FRAME_HEIGHT)));
+	}
+
+	void start(size_t stream_index, StreamDetectionScheduler& scheduler) {
+		is_running_.store(true);
+		thread_ = std::thread([this, stream_index, &scheduler]() {
+			captureLoop(stream_index, scheduler);
+		});
+	}
+
+	void stop() {
+		is_running_.store(false);
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+private:
+	void captureLoop(size_t stream_index, StreamDetectionScheduler& scheduler) {
+		placeCurrentThread(PipelineStage::Capture, "camera-capture");
+		cv::Mat camera_frame;
+		std::uint64_t frame_index = 0;
+		std::chrono::steady_clock::time_point start_time =
+			std::chrono::steady_clock::now();
+		while (is_running_.load()) {
+			// The last frame stays on screen at the end of a file
+			if (!camera_.read(camera_frame)) {
+				break;
+			}
+			if (is_file_) {
+				std::this_thread::sleep_until(start_time +
+					std::chrono::duration_cast<
+						std::chrono::steady_clock::duration>(
+							std::chrono::duration<double>(
+								frame_index * frame_interval_s_)));
+			}
+			std::int64_t capture_time_ns =
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count();
+
+			if (!frame_pool_) {
+				frame_pool_.reset(
+					new FramePool(4, camera_frame.size(), CV_8UC3));
+			}
+			if (camera_frame.size() != frame_pool_->frameSize()) {
+				cv::resize(camera_frame, camera_frame,
+					frame_pool_->frameSize());
+			}
+			// All frames are waiting, being detected or shown
+			FrameRef frame = frame_pool_->acquire();
+			if (!frame) {
+				frame_index++;
+				continue;
+			}
+			frame->frame_index = frame_index++;
+			frame->capture_time_ns = capture_time_ns;
+			cv::cvtColor(camera_frame, frame->image, cv::COLOR_BGR2RGB);
+			scheduler.submit(stream_index, frame);
+		}
+	}
+
+	cv::VideoCapture camera_;
+	bool is_file_ = false;
+	double frame_interval_s_ = 0.0;
+	// Kept after the thread has stopped,
+	// since its frames may still be referenced
+	std::unique_ptr<FramePool> frame_pool_;
+	std::atomic<bool> is_running_{ false };
+	std::thread thread_;
+};
+
+} // namespace
+
+// Parse "<source>[@<calibration file>]"
+CameraStreamSettings parseCameraStream(const std::string& argument) {
+	CameraStreamSettings settings;
+	size_t separator = argument.rfind('@');
+	if (separator == std::string::npos) {
+		settings.source = argument;
+	} else {
+		settings.source = argument.substr(0, separator);
+		settings.calibration_filename = argument.substr(separator + 1);
+	}
+	return settings;
+}
+
+StreamDetectionScheduler::StreamDetectionScheduler(
+	size_t num_of_stream,
+	const StreamDetector& detector,
+	unsigned int num_of_worker)
+	: detector_(detector) {
+	for (size_t i = 0; i < num_of_stream; i++) {
+		streams_.emplace_back(new Stream());
+	}
+	if (num_of_worker == 0) {
+		unsigned int num_of_core = std::thread::hardware_concurrency();
+		num_of_worker = num_of_core > 1 ? num_of_core - 1 : 1;
+	}
+	for (unsigned int i = 0; i < num_of_worker; i++) {
+		workers_.emplace_back(&StreamDetectionScheduler::workerLoop, this);
+	}
+}
+
+StreamDetectionScheduler::~StreamDetectionScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = true;
+	}
+	frame_submitted_.notify_all();
+	for (std::thread& worker : workers_) {
+		worker.join();
+	}
+}
+
+// Queue the newest frame of a stream
+void StreamDetectionScheduler::submit(
+	size_t stream_index, const FrameRef& frame) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Stream& stream = *streams_[stream_index];
+		if (stream.waiting_frame) {
+			stream.num_of_dropped_frame++;
+		}
+		stream.waiting_frame = frame;
+	}
+	frame_submitted_.notify_one();
+}
+
+size_t StreamDetectionScheduler::numOfDroppedFrame(
+	size_t stream_index) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return streams_[stream_index]->num_of_dropped_frame;
+}
+
+void StreamDetectionScheduler::workerLoop() {
+	placeCurrentThread(PipelineStage::Detection, "stream-detect");
+	// Kept by the worker, so they keep their memory
+	std::vector<cv::Mat> marker_poses;
+	std::vector<int> marker_ids;
+	while (true) {
+		size_t stream_index = 0;
+		FrameRef frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (true) {
+				if (is_stopping_) {
+					return;
+				}
+				// The first waiting stream after the one taken last
+				bool is_found = false;
+				for (size_t k = 0; k < streams_.size() && !is_found; k++) {
+					stream_index = (next_stream_ + k) % streams_.size();
+					const Stream& stream = *streams_[stream_index];
+					is_found = stream.waiting_frame && !stream.is_detecting;
+				}
+				if (is_found) {
+					break;
+				}
+				frame_submitted_.wait(lock);
+			}
+			Stream& stream = *streams_[stream_index];
+			frame = stream.waiting_frame;
+			stream.waiting_frame.reset();
+			stream.is_detecting = true;
+			next_stream_ = (stream_index + 1) % streams_.size();
+		}
+
+		marker_poses.clear();
+		marker_ids.clear();
+		detector_(stream_index, frame->image, marker_poses, marker_ids);
+
+		Stream& stream = *streams_[stream_index];
+		stream.result.publish(frame, marker_poses, marker_ids);
+		frame.reset();
+		// A frame which came meanwhile is taken by this worker or another
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stream.is_detecting = false;
+		}
+		frame_submitted_.notify_one();
+	}
+}
+
+// Show several cameras tiled in one window
+bool runMultiCamera(
+	const std::vector<CameraStreamSettings>& stream_settings,
+	bool use_chessboard) {
+	size_t num_of_stream = stream_settings.size();
+	if (num_of_stream == 0) {
+		return false;
+	}
+
+	// Each camera has its own calibration
+	std::vector<CameraCalibration> calibrations(
+		num_of_stream, defaultCameraCalibration());
+	for (size_t i = 0; i < num_of_stream; i++) {
+		if (!stream_settings[i].calibration_filename.empty() &&
+			!loadCameraCalibration(
+				stream_settings[i].calibration_filename, calibrations[i])) {
+			return false;
+		}
+	}
+
+	// Declared before the scheduler, so the frames are released
+	// before their pools
+	std::vector<std::unique_ptr<CameraCapture>> captures;
+	for (size_t i = 0; i < num_of_stream; i++) {
+		captures.emplace_back(new CameraCapture());
+		// A camera is asked for the size it was calibrated at
+		cv::Size calibrated_size(
+			calibrations[i].image_width > 0 ?
+				calibrations[i].image_width : 1280,
+			calibrations[i].image_height > 0 ?
+				calibrations[i].image_height : 720);
+		if (!captures[i]->open(stream_settings[i].source, calibrated_size)) {
+			return false;
+		}
+		cv::Size frame_size = captures[i]->frameSize();
+		if (!fitCameraCalibration(frame_size.width, frame_size.height,
+			calibrations[i])) {
+			std::fprintf(stderr, "Failed to use the calibration of %s.\n",
+				stream_settings[i].source.c_str());
+			return false;
+		}
+	}
+
+	GLFWwindow* window = nullptr;
+	if (!initializeGL(window)) {
+		return false;
+	}
+
+	std::vector<GLuint> program_ids;
+	loadShaderPrograms({
+		{ "background_vertex_shader.vert",
+			"background_fragment_shader.frag" },
+		{ "shading_vertex_shader.vert",
+			"shading_fragment_shader.frag",
+			shadingShaderDefines() } },
+		"shader_cache", program_ids);
+	GLuint background_shader_id = program_ids[0];
+	GLuint shading_shader_id = program_ids[1];
+
+	// Released before the context is destroyed
+	std::unique_ptr<AssetManager> asset_manager(new AssetManager());
+	asset_manager->setVertexFormat(VertexFormat::Compact16);
+	asset_manager->loadModelAsync("bunny", "../model/bun_zipper.obj");
+	asset_manager->setDefaultModel("bunny");
+
+	// Every tile has its own texture and pose buffer,
+	// so drawing one does not wait for the GPU to finish another
+	std::vector<BackgroundTexture> background_textures(num_of_stream);
+	std::vector<PoseUniformBuffer> pose_buffers(num_of_stream);
+	for (PoseUniformBuffer& pose_buffer : pose_buffers) {
+		createPoseUniformBuffer({ shading_shader_id }, pose_buffer);
+	}
+
+	std::unique_ptr<StreamDetectionScheduler> scheduler(
+		new StreamDetectionScheduler(num_of_stream, [&](
+			size_t stream_index,
+			const cv::Mat& image,
+			std::vector<cv::Mat>& output_marker_poses,
+			std::vector<int>& output_marker_ids) {
+			if (use_chessboard) {
+				detctChessboardAndEstimatePose(
+					image, calibrations[stream_index], output_marker_poses);
+				output_marker_ids.assign(output_marker_poses.size(), -1);
+				return;
+			}
+			DetectionOptions options;
+			options.calibration = &calibrations[stream_index];
+			detectMarkersAndEstimatePose(
+				image, options, output_marker_poses, output_marker_ids);
+		}));
+	for (size_t i = 0; i < num_of_stream; i++) {
+		captures[i]->start(i, *scheduler);
+	}
+
+	// The newest result of each stream, shown until a newer one comes
+	std::vector<std::uint64_t> last_sequences(num_of_stream, 0);
+	std::vector<FrameRef> shown_frames(num_of_stream);
+	std::vector<std::vector<cv::Mat>> shown_marker_poses(num_of_stream);
+	std::vector<std::vector<int>> shown_marker_ids(num_of_stream);
+
+	// The same model transformation as the single camera
+	glm::mat4 model =
+		glm::rotate(glm::mat4(), glm::radians(89.0f),
+			glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::scale(glm::mat4(), glm::vec3(0.5f, 0.5f, 0.5f));
+	CullingSettings culling_settings;
+
+	// The tiles are as square as possible, filled row by row from the top
+	size_t num_of_column = static_cast<size_t>(
+		std::ceil(std::sqrt(static_cast<double>(num_of_stream))));
+	size_t num_of_row = (num_of_stream + num_of_column - 1) / num_of_column;
+
+	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
+		!glfwWindowShouldClose(window)) {
+		int window_width = 0, window_height = 0;
+		glfwGetFramebufferSize(window, &window_width, &window_height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		asset_manager->uploadReadyModels();
+
+		glEnable(GL_SCISSOR_TEST);
+		for (size_t i = 0; i < num_of_stream; i++) {
+			int column = static_cast<int>(i % num_of_column);
+			int row = static_cast<int>(i / num_of_column);
+			int left = column * window_width / static_cast<int>(num_of_column);
+			int right =
+				(column + 1) * window_width / static_cast<int>(num_of_column);
+			int top = row * window_height / static_cast<int>(num_of_row);
+			int bottom =
+				(row + 1) * window_height / static_cast<int>(num_of_row);
+
+			scheduler->result(i).takeNewer(last_sequences[i],
+				shown_frames[i], shown_marker_poses[i], shown_marker_ids[i]);
+			if (!shown_frames[i]) {
+				continue;
+			}
+			const cv::Mat& current_frame = shown_frames[i]->image;
+
+			// The frame keeps its aspect ratio inside the tile,
+			// with black bars on the sides or at the top and bottom
+			int tile_width = right - left;
+			int tile_height = bottom - top;
+			int viewport_width = tile_width;
+			int viewport_height =
+				tile_width * current_frame.rows / current_frame.cols;
+			if (viewport_height > tile_height) {
+				viewport_height = tile_height;
+				viewport_width =
+					tile_height * current_frame.cols / current_frame.rows;
+			}
+			int viewport_x = left + (tile_width - viewport_width) / 2;
+			// OpenGL counts from the bottom
+			int viewport_y = window_height - bottom +
+				(tile_height - viewport_height) / 2;
+			glViewport(viewport_x, viewport_y, viewport_width, viewport_height);
+			glScissor(viewport_x, viewport_y, viewport_width, viewport_height);
+
+			drawBackground(current_frame, background_shader_id,
+				background_textures[i]);
+			// Only the depth of this tile, since the scissor test is on
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			glm::mat4 projection;
+			buildProjection(calibrations[i], current_frame.size(), projection);
+			latchMarkerPoses(shown_marker_poses[i], pose_buffers[i]);
+			// The pixel sizes of the culling are the ones on screen
+			drawVisibleMarkerModels(
+				*asset_manager, model,
+				shown_marker_poses[i], shown_marker_ids[i],
+				projection, viewport_height,
+				culling_settings,
+				shading_shader_id);
+			finishMarkerPoses(pose_buffers[i]);
+		}
+		glDisable(GL_SCISSOR_TEST);
+		glViewport(0, 0, window_width, window_height);
+
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+	}
+
+	for (std::unique_ptr<CameraCapture>& capture : captures) {
+		capture->stop();
+	}
+	for (size_t i = 0; i < num_of_stream; i++) {
+		std::printf("camera %zu (%s): %zu frames dropped\n", i,
+			stream_settings[i].source.c_str(), scheduler->numOfDroppedFrame(i));
+	}
+	scheduler.reset();
+	shown_frames.clear();
+
+	for (size_t i = 0; i < num_of_stream; i++) {
+		deleteBackgroundTexture(background_textures[i]);
+		deletePoseUniformBuffer(pose_buffers[i]);
+	}
+	asset_manager.reset();
+	glDeleteProgram(background_shader_id);
+	glDeleteProgram(shading_shader_id);
+	glfwTerminate();
+	return true;
+}
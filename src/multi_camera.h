@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef MULTI_CAMERA
+#define MULTI_CAMERA
+
+#include "frame_pacing.h"
+#include "frame_pool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+struct CameraStreamSettings {
+	// A camera index, or a video file
+	std::string source;
+	// A calibration file (see camera_calibration.h),
+	// empty for the calibration in parameters.h
+	std::string calibration_filename;
+};
+
+// Parse "<source>[@<calibration file>]"
+CameraStreamSettings parseCameraStream(const std::string& argument);
+
+// Detect the markers in a frame of the stream "stream_index"
+typedef std::function<void(
+	size_t stream_index,
+	const cv::Mat& image,
+	std::vector<cv::Mat>& output_marker_poses,
+	std::vector<int>& output_marker_ids)> StreamDetector;
+
+// One pool of detection workers shared by all camera streams
+// Each stream has at most one frame waiting, a newer frame replaces it,
+// so a slow stream never builds a queue
+// A stream is detected by one worker at a time, so its results stay in
+// order, and the workers take the waiting streams in turn, so a camera
+// with a higher frame rate cannot starve the others
+class StreamDetectionScheduler {
+public:
+	// One worker per core except the render thread if "num_of_worker" is 0
+	StreamDetectionScheduler(
+		size_t num_of_stream,
+		const StreamDetector& detector,
+		unsigned int num_of_worker = 0);
+	~StreamDetectionScheduler();
+
+	StreamDetectionScheduler(const StreamDetectionScheduler&) = delete;
+	StreamDetectionScheduler& operator=(
+		const StreamDetectionScheduler&) = delete;
+
+	// Queue the newest frame of a stream (it can be called from any thread)
+	void submit(size_t stream_index, const FrameRef& frame);
+
+	// The newest detected frame of a stream and its poses
+	LatestDetection& result(size_t stream_index) {
+		return streams_[stream_index]->result;
+	}
+
+	// Frames replaced by a newer one before they were detected
+	size_t numOfDroppedFrame(size_t stream_index) const;
+
+private:
+	struct Stream {
+		FrameRef waiting_frame;
+		bool is_detecting = false;
+		size_t num_of_dropped_frame = 0;
+		LatestDetection result;
+	};
+
+	void workerLoop();
+
+	StreamDetector detector_;
+	std::vector<std::unique_ptr<Stream>> streams_;
+	// The stream which is looked at first by the next worker
+	size_t next_stream_ = 0;
+	bool is_stopping_ = false;
+	mutable std::mutex mutex_;
+	std::condition_variable frame_submitted_;
+	std::vector<std::thread> workers_;
+};
+
+// Show several cameras tiled in one window, each with its own capture
+// thread and calibration, detected by one shared pool of workers
+// If a camera cannot be opened, return false
+bool runMultiCamera(
+	const std::vector<CameraStreamSettings>& stream_settings,
+	bool use_chessboard);
+
+#endif // !MULTI_CAMERA
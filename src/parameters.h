@@ -8,8 +8,20 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
 
-// The length of marker is 0.05 meters
-#define MARKER_LENGTH 0.05f
+// The markers in use and their lengths in meters
+// The other markers of the dictionary are ignored (see marker_set.h)
+struct ActiveMarker {
+	int id;
+	float length;
+};
+static const ActiveMarker active_markers[] = {
+	{ 0, 0.05f }, { 1, 0.05f }, { 2, 0.05f }, { 3, 0.05f },
+	{ 4, 0.05f }, { 5, 0.05f }, { 6, 0.05f }, { 7, 0.05f },
+	{ 8, 0.05f }, { 9, 0.05f }, { 10, 0.05f }, { 11, 0.05f }
+};
+
+// The length of one square of the chessboard is 0.026 meters
+#define CHESSBOARD_SQUARE_LENGTH 0.026f
 
 // The intrinsic parameters of my PC's internal camera (3x3 matrix)
 static const float intrinsic_parameters[9] = {
@@ -35,4 +47,10 @@ static const std::vector<cv::Point3f> canonical_marker_corners_3d = {
 static const cv::Ptr<cv::aruco::Dictionary> marker_dictionary =
 	cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
 
+// The number of wrong bits that are still corrected
+// when decoding a marker with the hash table (0, 1 or 2)
+// Note that 2 needs a higher constexpr limit of the compiler, and that
+// cv::aruco::detectMarkers corrects 3, so this is stricter
+#define MAX_DECODE_ERROR_BITS 1
+
 #endif // !PARAMETERS
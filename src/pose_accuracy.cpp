@@ -0,0 +1,506 @@
+// Implement the functions in pose_accuracy.h
+#include "pose_accuracy.h"
+#include "parameters.h"
+#include "camera_calibration.h"
+#include "marker_detection.h"
+#include "marker_set.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+namespace {
+
+// The frames have the size the camera is calibrated for
+const cv::Size frame_size(1280, 720);
+// The size of a bit of a marker, and of a square of the chessboard,
+// in the textures (in pixels)
+const int marker_bit_pixels = 20;
+const int chessboard_square_pixels = 30;
+// The inner corners of the chessboard of "detctChessboardAndEstimatePose"
+const int chessboard_width = 6;
+const int chessboard_height = 4;
+// The gray around the targets
+const double background_gray = 150.0;
+
+// Noise and blur applied to every rendered scene
+struct ImageCondition {
+	const char* name;
+	// Standard deviation of the noise in gray levels
+	double noise_sigma;
+	// Standard deviation of the Gaussian blur in pixels
+	double blur_sigma;
+};
+
+const ImageCondition image_conditions[] = {
+	{ "clean", 0.0, 0.0 },
+	{ "noise", 6.0, 0.0 },
+	{ "blur", 0.0, 1.5 },
+	{ "noise+blur", 6.0, 1.5 }
+};
+
+// A detector variant, which gives the poses (and ids, if it has them)
+struct DetectorVariant {
+	const char* name;
+	bool uses_chessboard;
+	bool gives_ids;
+	std::function<void(
+		const cv::Mat& image,
+		std::vector<cv::Mat>& output_marker_poses,
+		std::vector<int>& output_marker_ids)> detect;
+};
+
+// A target at a known pose
+struct Scene {
+	// The 4x4 view matrix the detectors should give (CV_64F, row-major)
+	cv::Mat view;
+	// The chessboard looks the same from both ends, so its corners
+	// can also be found the other way round
+	cv::Mat alternative_view;
+	int marker_id = -1;
+};
+
+cv::Mat rotationOf(double x, double y, double z) {
+	cv::Mat rotation;
+	cv::Rodrigues(cv::Vec3d(x, y, z), rotation);
+	return rotation;
+}
+
+cv::Mat viewOf(const cv::Mat& rotation, const cv::Vec3d& translation) {
+	cv::Mat view = cv::Mat::eye(4, 4, CV_64F);
+	rotation.copyTo(view(cv::Rect(0, 0, 3, 3)));
+	for (int row = 0; row < 3; row++) {
+		view.at<double>(row, 3) = translation(row);
+	}
+	return view;
+}
+
+// A random rotation out of the image plane, up to "max_tilt" radians
+cv::Mat randomTilt(cv::RNG& rng, double max_tilt) {
+	double axis_angle = rng.uniform(0.0, 2.0 * CV_PI);
+	double tilt = rng.uniform(0.0, max_tilt);
+	return rotationOf(
+		tilt * std::cos(axis_angle), tilt * std::sin(axis_angle), 0.0);
+}
+
+// Render planar targets through the calibrated camera
+// A pixel of the frame is traced back through the lens distortion and
+// the homography of the target plane to its texture, so there is only
+// one interpolation
+class PlanarTargetRenderer {
+public:
+	PlanarTargetRenderer() {
+		const CameraCalibration& calibration = defaultCameraCalibration();
+		cv::Mat(3, 3, CV_32F, const_cast<float*>(
+			calibration.intrinsic_parameters)).convertTo(
+				camera_matrix_, CV_64F);
+		cv::Mat distortion(1, 5, CV_32F,
+			const_cast<float*>(calibration.distortion_coefficients));
+
+		// Where every pixel would be without the distortion
+		std::vector<cv::Point2f> pixels;
+		pixels.reserve(frame_size.area());
+		for (int y = 0; y < frame_size.height; y++) {
+			for (int x = 0; x < frame_size.width; x++) {
+				pixels.push_back(cv::Point2f(
+					static_cast<float>(x), static_cast<float>(y)));
+			}
+		}
+		std::vector<cv::Point2f> ideal_pixels;
+		cv::undistortPoints(pixels, ideal_pixels, camera_matrix_, distortion,
+			cv::noArray(), camera_matrix_);
+		ideal_pixels_ = cv::Mat(ideal_pixels, true).reshape(
+			2, frame_size.height);
+	}
+
+	// "texture_to_target" maps a pixel of the texture to the target plane
+	// (in meters, z = 0), and "view" places the target in front of the
+	// camera (OpenGL convention)
+	void render(
+		const cv::Mat& texture,
+		const cv::Mat& texture_to_target,
+		const cv::Mat& view,
+		cv::Mat& output_image) {
+		// The target plane in the OpenCV camera, which has y and z inverted
+		cv::Mat plane_to_camera(3, 3, CV_64F);
+		for (int row = 0; row < 3; row++) {
+			double flip = row == 0 ? 1.0 : -1.0;
+			plane_to_camera.at<double>(row, 0) = flip * view.at<double>(row, 0);
+			plane_to_camera.at<double>(row, 1) = flip * view.at<double>(row, 1);
+			plane_to_camera.at<double>(row, 2) = flip * view.at<double>(row, 3);
+		}
+		cv::Mat texture_to_pixel =
+			camera_matrix_ * plane_to_camera * texture_to_target;
+		cv::perspectiveTransform(
+			ideal_pixels_, texture_coordinates_, texture_to_pixel.inv());
+		cv::remap(texture, output_image, texture_coordinates_, cv::noArray(),
+			cv::INTER_LINEAR, cv::BORDER_CONSTANT,
+			cv::Scalar::all(background_gray));
+	}
+
+private:
+	cv::Mat camera_matrix_;
+	cv::Mat ideal_pixels_;
+	cv::Mat texture_coordinates_;
+};
+
+// Blur (the optics) and then noise (the sensor), and give RGB like
+// the frames of the camera
+void degradeImage(
+	const cv::Mat& input_image,
+	const ImageCondition& condition,
+	cv::RNG& rng,
+	cv::Mat& output_image) {
+	cv::Mat image = input_image.clone();
+	if (condition.blur_sigma > 0.0) {
+		cv::GaussianBlur(image, image, cv::Size(), condition.blur_sigma);
+	}
+	if (condition.noise_sigma > 0.0) {
+		cv::Mat noise(image.size(), CV_32F);
+		rng.fill(noise, cv::RNG::NORMAL, 0.0, condition.noise_sigma);
+		cv::Mat noisy_image;
+		image.convertTo(noisy_image, CV_32F);
+		noisy_image += noise;
+		noisy_image.convertTo(image, CV_8U);
+	}
+	cv::cvtColor(image, output_image, cv::COLOR_GRAY2RGB);
+}
+
+// The view matrix of a pose given by a detector,
+// which is stored transposed (column-major for OpenGL)
+cv::Mat viewOfPose(const cv::Mat& marker_pose) {
+	cv::Mat view;
+	marker_pose.t().convertTo(view, CV_64F);
+	return view;
+}
+
+// The angle between the rotations in degrees,
+// and the distance between the translations in millimeters
+void measurePoseError(
+	const cv::Mat& truth,
+	const cv::Mat& estimate,
+	double& output_rotation_error_deg,
+	double& output_translation_error_mm) {
+	cv::Mat difference =
+		truth(cv::Rect(0, 0, 3, 3)).t() * estimate(cv::Rect(0, 0, 3, 3));
+	double cos_angle = (cv::trace(difference)[0] - 1.0) / 2.0;
+	cos_angle = std::min(std::max(cos_angle, -1.0), 1.0);
+	output_rotation_error_deg = std::acos(cos_angle) * 180.0 / CV_PI;
+	output_translation_error_mm = 1000.0 * cv::norm(
+		estimate(cv::Rect(3, 0, 1, 3)) - truth(cv::Rect(3, 0, 1, 3)));
+}
+
+} // namespace
+
+// Sort the errors and give their distribution
+void computePoseAccuracyStatistics(
+	std::vector<double>& rotation_errors_deg,
+	std::vector<double>& translation_errors_mm,
+	size_t num_of_scene,
+	size_t num_of_false_pose,
+	PoseAccuracyStatistics& output_statistics) {
+	output_statistics = PoseAccuracyStatistics();
+	output_statistics.num_of_scene = num_of_scene;
+	output_statistics.num_of_detected = rotation_errors_deg.size();
+	output_statistics.num_of_false_pose = num_of_false_pose;
+	if (num_of_scene > 0) {
+		output_statistics.recall =
+			static_cast<double>(rotation_errors_deg.size()) / num_of_scene;
+	}
+	if (rotation_errors_deg.empty()) {
+		return;
+	}
+
+	// Nearest rank
+	auto distribution = [](std::vector<double>& errors,
+		double& output_mean, double& output_p95, double& output_max) {
+		std::sort(errors.begin(), errors.end());
+		double sum = 0.0;
+		for (double error : errors) {
+			sum += error;
+		}
+		output_mean = sum / errors.size();
+		size_t rank = static_cast<size_t>(0.95 * errors.size());
+		output_p95 = errors[std::min(rank, errors.size() - 1)];
+		output_max = errors.back();
+	};
+	distribution(rotation_errors_deg,
+		output_statistics.mean_rotation_error_deg,
+		output_statistics.p95_rotation_error_deg,
+		output_statistics.max_rotation_error_deg);
+	distribution(translation_errors_mm,
+		output_statistics.mean_translation_error_mm,
+		output_statistics.p95_translation_error_mm,
+		output_statistics.max_translation_error_mm);
+}
+
+// Check every detector against synthetic ground truth
+bool runPoseAccuracySuite(
+	const PoseAccuracySettings& settings,
+	const std::string& csv_filename) {
+	std::ofstream csv_file;
+	if (!csv_filename.empty()) {
+		csv_file.open(csv_filename);
+		if (!csv_file.is_open()) {
+			std::fprintf(stderr, "Failed to open %s.\n", csv_filename.c_str());
+			return false;
+		}
+		csv_file << "detector,condition,scene,distance_m,detected,"
+			"rotation_error_deg,translation_error_mm\n";
+	}
+
+	WorkStealingPool pool;
+	std::vector<DetectorVariant> variants = {
+		{ "hash", false, true,
+			[](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				detectMarkersAndEstimatePose(image, poses, ids);
+			} },
+		{ "hash refined", false, true,
+			[](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				DetectionOptions options;
+				options.corner_refinement_iterations = 10;
+				detectMarkersAndEstimatePose(image, options, poses, ids);
+			} },
+		{ "hash half scale", false, true,
+			[](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				DetectionOptions options;
+				options.scale = 0.5;
+				detectMarkersAndEstimatePose(image, options, poses, ids);
+			} },
+		{ "hash tiled", false, true,
+			[&pool](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				detectMarkersAndEstimatePoseParallel(image, pool, poses, ids);
+			} },
+		{ "aruco module", false, false,
+			[](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				detectArucoMarkers(image, poses);
+				ids.clear();
+			} },
+		{ "chessboard", true, false,
+			[](const cv::Mat& image, std::vector<cv::Mat>& poses,
+				std::vector<int>& ids) {
+				detctChessboardAndEstimatePose(image, poses);
+				ids.clear();
+			} }
+	};
+
+	// The marker texture has a white border of one bit, like a print,
+	// and its outer corners are the edges of the black border
+	// (at -0.5 in pixel-center coordinates)
+	const int marker_pixels = 8 * marker_bit_pixels;
+	double marker_center = marker_bit_pixels + marker_pixels / 2 - 0.5;
+	// The markers in use, each with its own length
+	const MarkerSet& marker_set = activeMarkerSet();
+	if (marker_set.ids().empty()) {
+		std::fprintf(stderr, "No marker is in use.\n");
+		return false;
+	}
+
+	// The chessboard has one more square than inner corners on each side,
+	// and a white margin of one square
+	const int square = chessboard_square_pixels;
+	cv::Mat chessboard_texture(
+		(chessboard_height + 3) * square, (chessboard_width + 3) * square,
+		CV_8UC1, cv::Scalar(255));
+	for (int row = 0; row <= chessboard_height; row++) {
+		for (int column = 0; column <= chessboard_width; column++) {
+			if ((row + column) % 2 == 0) {
+				chessboard_texture(cv::Rect((column + 1) * square,
+					(row + 1) * square, square, square)).setTo(0);
+			}
+		}
+	}
+	// The inner corner (i, j) of row i and column j is at (i, j, 0) squares,
+	// and at the pixel ((j + 2) * square - 0.5, (i + 2) * square - 0.5)
+	double square_scale = CHESSBOARD_SQUARE_LENGTH / square;
+	double corner_offset = -(2.0 * square - 0.5) * square_scale;
+	cv::Mat chessboard_texture_to_target = (cv::Mat_<double>(3, 3) <<
+		0.0, square_scale, corner_offset,
+		square_scale, 0.0, corner_offset,
+		0.0, 0.0, 1.0);
+	// Rows go down and columns go right in an upright chessboard
+	cv::Mat upright_chessboard = (cv::Mat_<double>(3, 3) <<
+		0.0, 1.0, 0.0,
+		-1.0, 0.0, 0.0,
+		0.0, 0.0, 1.0);
+	// The inner corner (i, j) seen as (height - 1 - i, width - 1 - j)
+	cv::Mat reversed_chessboard = viewOf(rotationOf(0.0, 0.0, CV_PI),
+		cv::Vec3d((chessboard_height - 1) * CHESSBOARD_SQUARE_LENGTH,
+			(chessboard_width - 1) * CHESSBOARD_SQUARE_LENGTH, 0.0));
+
+	PlanarTargetRenderer renderer;
+	double max_tilt = settings.max_tilt_deg * CV_PI / 180.0;
+
+	std::printf("%zu scenes per condition, thresholds: p95 rotation %.1f deg,"
+		" p95 translation %.1f mm, recall %.2f\n", settings.num_of_scene,
+		settings.max_rotation_error_deg, settings.max_translation_error_mm,
+		settings.min_recall);
+	std::printf("%-16s %-11s %6s %7s %6s %8s %8s %8s %8s %8s %8s\n",
+		"detector", "condition", "scenes", "recall", "false",
+		"rot mean", "rot p95", "rot max", "mm mean", "mm p95", "mm max");
+
+	bool is_passed = true;
+	cv::Mat marker_texture, rendered_image, image;
+	std::vector<cv::Mat> marker_poses;
+	std::vector<int> marker_ids;
+	for (const ImageCondition& condition : image_conditions) {
+		std::vector<std::vector<double>> rotation_errors(variants.size());
+		std::vector<std::vector<double>> translation_errors(variants.size());
+		std::vector<size_t> num_of_false_poses(variants.size(), 0);
+		size_t num_of_scene[2] = { 0, 0 };
+
+		// The same scenes under every condition
+		cv::RNG rng(settings.seed);
+		for (size_t scene_index = 0; scene_index < 2 * settings.num_of_scene;
+			scene_index++) {
+			bool is_chessboard = scene_index >= settings.num_of_scene;
+			Scene scene;
+			double distance = 0.0;
+			if (!is_chessboard) {
+				// A random marker, spun and tilted anywhere in the frame
+				scene.marker_id = marker_set.ids()[rng.uniform(0,
+					static_cast<int>(marker_set.ids().size()))];
+				cv::aruco::drawMarker(marker_dictionary, scene.marker_id,
+					marker_pixels, marker_texture);
+				cv::copyMakeBorder(marker_texture, marker_texture,
+					marker_bit_pixels, marker_bit_pixels,
+					marker_bit_pixels, marker_bit_pixels,
+					cv::BORDER_CONSTANT, cv::Scalar(255));
+				cv::Mat rotation = randomTilt(rng, max_tilt) *
+					rotationOf(0.0, 0.0, rng.uniform(-CV_PI, CV_PI));
+				distance = rng.uniform(settings.min_marker_distance,
+					settings.max_marker_distance);
+				scene.view = viewOf(rotation, cv::Vec3d(
+					rng.uniform(-0.3, 0.3) * distance,
+					rng.uniform(-0.2, 0.2) * distance, -distance));
+				// x right, y up
+				double marker_scale =
+					marker_set.markerLength(scene.marker_id) / marker_pixels;
+				cv::Mat marker_texture_to_target = (cv::Mat_<double>(3, 3) <<
+					marker_scale, 0.0, -marker_center * marker_scale,
+					0.0, -marker_scale, marker_center * marker_scale,
+					0.0, 0.0, 1.0);
+				renderer.render(marker_texture, marker_texture_to_target,
+					scene.view, rendered_image);
+			} else {
+				// The chessboard near the middle, turned a little
+				cv::Mat rotation = randomTilt(rng, max_tilt) *
+					rotationOf(0.0, 0.0, rng.uniform(-CV_PI / 6, CV_PI / 6)) *
+					upright_chessboard;
+				distance = rng.uniform(settings.min_chessboard_distance,
+					settings.max_chessboard_distance);
+				cv::Mat center = (cv::Mat_<double>(3, 1) <<
+					0.5 * (chessboard_height - 1) * CHESSBOARD_SQUARE_LENGTH,
+					0.5 * (chessboard_width - 1) * CHESSBOARD_SQUARE_LENGTH,
+					0.0);
+				cv::Mat origin = (cv::Mat_<double>(3, 1) <<
+					rng.uniform(-0.15, 0.15) * distance,
+					rng.uniform(-0.1, 0.1) * distance, -distance);
+				origin -= rotation * center;
+				scene.view = viewOf(rotation, cv::Vec3d(origin.at<double>(0),
+					origin.at<double>(1), origin.at<double>(2)));
+				scene.alternative_view = scene.view * reversed_chessboard;
+				renderer.render(chessboard_texture,
+					chessboard_texture_to_target, scene.view, rendered_image);
+			}
+			degradeImage(rendered_image, condition, rng, image);
+			num_of_scene[is_chessboard ? 1 : 0]++;
+
+			for (size_t v = 0; v < variants.size(); v++) {
+				const DetectorVariant& variant = variants[v];
+				if (variant.uses_chessboard != is_chessboard) {
+					continue;
+				}
+				marker_poses.clear();
+				marker_ids.clear();
+				variant.detect(image, marker_poses, marker_ids);
+
+				// The pose closest to the truth among those with the id
+				// of the target, the others are false
+				bool is_detected = false;
+				double rotation_error = 0.0, translation_error = 0.0;
+				for (size_t k = 0; k < marker_poses.size(); k++) {
+					if (variant.gives_ids && k < marker_ids.size() &&
+						marker_ids[k] != scene.marker_id) {
+						num_of_false_poses[v]++;
+						continue;
+					}
+					cv::Mat view = viewOfPose(marker_poses[k]);
+					double rotation_deg = 0.0, translation_mm = 0.0;
+					measurePoseError(
+						scene.view, view, rotation_deg, translation_mm);
+					if (!scene.alternative_view.empty()) {
+						double alternative_rotation_deg = 0.0;
+						double alternative_translation_mm = 0.0;
+						measurePoseError(scene.alternative_view, view,
+							alternative_rotation_deg,
+							alternative_translation_mm);
+						if (alternative_translation_mm < translation_mm) {
+							rotation_deg = alternative_rotation_deg;
+							translation_mm = alternative_translation_mm;
+						}
+					}
+					if (is_detected) {
+						num_of_false_poses[v]++;
+						if (translation_mm >= translation_error) {
+							continue;
+						}
+					}
+					is_detected = true;
+					rotation_error = rotation_deg;
+					translation_error = translation_mm;
+				}
+				if (is_detected) {
+					rotation_errors[v].push_back(rotation_error);
+					translation_errors[v].push_back(translation_error);
+				}
+				if (csv_file.is_open()) {
+					csv_file << variant.name << "," << condition.name << "," <<
+						scene_index << "," << distance << "," <<
+						(is_detected ? 1 : 0) << "," << rotation_error <<
+						"," << translation_error << "\n";
+				}
+			}
+		}
+
+		for (size_t v = 0; v < variants.size(); v++) {
+			const DetectorVariant& variant = variants[v];
+			PoseAccuracyStatistics statistics;
+			computePoseAccuracyStatistics(
+				rotation_errors[v], translation_errors[v],
+				num_of_scene[variant.uses_chessboard ? 1 : 0],
+				num_of_false_poses[v], statistics);
+			bool is_variant_passed =
+				statistics.recall >= settings.min_recall &&
+				statistics.p95_rotation_error_deg <=
+					settings.max_rotation_error_deg &&
+				statistics.p95_translation_error_mm <=
+					settings.max_translation_error_mm;
+			std::printf("%-16s %-11s %6zu %7.3f %6zu %8.2f %8.2f %8.2f"
+				" %8.2f %8.2f %8.2f%s\n",
+				variant.name, condition.name,
+				statistics.num_of_scene, statistics.recall,
+				statistics.num_of_false_pose,
+				statistics.mean_rotation_error_deg,
+				statistics.p95_rotation_error_deg,
+				statistics.max_rotation_error_deg,
+				statistics.mean_translation_error_mm,
+				statistics.p95_translation_error_mm,
+				statistics.max_translation_error_mm,
+				is_variant_passed ? "" : "  FAILED");
+			is_passed &= is_variant_passed;
+		}
+	}
+	return is_passed;
+}
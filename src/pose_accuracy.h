@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef POSE_ACCURACY
+#define POSE_ACCURACY
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct PoseAccuracySettings {
+	// Scenes rendered for each image condition
+	size_t num_of_scene = 60;
+	unsigned int seed = 42;
+	// The range of distances of the target from the camera, in meters
+	double min_marker_distance = 0.2;
+	double max_marker_distance = 0.6;
+	double min_chessboard_distance = 0.35;
+	double max_chessboard_distance = 0.7;
+	// The largest angle between the target and the image plane
+	double max_tilt_deg = 45.0;
+
+	// A detector fails if the 95th percentile of an error is over these,
+	// or if it finds fewer of the targets than "min_recall"
+	double max_rotation_error_deg = 5.0;
+	double max_translation_error_mm = 20.0;
+	double min_recall = 0.9;
+};
+
+// The errors of one detector under one image condition
+struct PoseAccuracyStatistics {
+	size_t num_of_scene = 0;
+	// Scenes where the target was found
+	size_t num_of_detected = 0;
+	// Poses which do not belong to the target (wrong id, or extra ones)
+	size_t num_of_false_pose = 0;
+	double recall = 0.0;
+	double mean_rotation_error_deg = 0.0;
+	double p95_rotation_error_deg = 0.0;
+	double max_rotation_error_deg = 0.0;
+	double mean_translation_error_mm = 0.0;
+	double p95_translation_error_mm = 0.0;
+	double max_translation_error_mm = 0.0;
+};
+
+// Sort the errors and give their distribution
+void computePoseAccuracyStatistics(
+	std::vector<double>& rotation_errors_deg,
+	std::vector<double>& translation_errors_mm,
+	size_t num_of_scene,
+	size_t num_of_false_pose,
+	PoseAccuracyStatistics& output_statistics);
+
+// Check every detector against synthetic ground truth
+// ArUco markers and chessboards are rendered at random known poses
+// through the calibrated camera (with its lens distortion), clean and
+// with noise and blur, and the poses of every detector variant are
+// compared with the truth in the OpenGL convention of the output:
+// the view matrix from the target (x right, y up, z out of the target
+// for markers; x along rows, y along columns for the chessboard)
+// to the camera, in meters
+// The error of every scene is written to "csv_filename" if not empty
+// If a detector is over a threshold, return false
+bool runPoseAccuracySuite(
+	const PoseAccuracySettings& settings,
+	const std::string& csv_filename);
+
+#endif // !POSE_ACCURACY
@@ -0,0 +1,90 @@
+// Implement the functions in pose_log.h
+#include "pose_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+// Write all records into a pose log file
+// If fail, return false
+bool writePoseLog(
+	const std::string& output_filename,
+	const std::vector<PoseRecord>& records) {
+	std::ofstream write_file(output_filename,
+		std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!write_file.is_open()) {
+		return false;
+	}
+
+	PoseLogHeader header;
+	header.magic = POSE_LOG_MAGIC;
+	header.version = POSE_LOG_VERSION;
+	header.record_size = sizeof(PoseRecord);
+	header.record_count = records.size();
+
+	write_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	write_file.write(reinterpret_cast<const char*>(records.data()),
+		records.size() * sizeof(PoseRecord));
+	return static_cast<bool>(write_file);
+}
+
+PoseLogReader::~PoseLogReader() {
+	close();
+}
+
+// If the file is not a valid pose log, return false
+bool PoseLogReader::open(const std::string& input_filename) {
+	close();
+	if (!file_.open(input_filename)) {
+		return false;
+	}
+
+	// Check the header before trusting any record
+	if (file_.size() < sizeof(PoseLogHeader)) {
+		close();
+		return false;
+	}
+	const PoseLogHeader* header =
+		static_cast<const PoseLogHeader*>(file_.data());
+	if (header->magic != POSE_LOG_MAGIC ||
+		header->version != POSE_LOG_VERSION ||
+		header->record_size != sizeof(PoseRecord) ||
+		header->record_count > (file_.size() - sizeof(PoseLogHeader)) /
+			sizeof(PoseRecord)) {
+		std::fprintf(stderr, "%s is not a valid pose log.\n",
+			input_filename.c_str());
+		close();
+		return false;
+	}
+
+	records_ = reinterpret_cast<const PoseRecord*>(
+		static_cast<const char*>(file_.data()) + sizeof(PoseLogHeader));
+	record_count_ = static_cast<size_t>(header->record_count);
+	return true;
+}
+
+void PoseLogReader::close() {
+	file_.close();
+	records_ = nullptr;
+	record_count_ = 0;
+}
+
+// The records of one frame, found by binary search
+bool PoseLogReader::findFrame(
+	std::uint64_t frame_index,
+	size_t& output_first,
+	size_t& output_last) const {
+	const PoseRecord* begin = records_;
+	const PoseRecord* end = records_ + record_count_;
+	const PoseRecord* first = std::lower_bound(begin, end, frame_index,
+		[](const PoseRecord& record, std::uint64_t index) {
+			return record.frame_index < index;
+		});
+	const PoseRecord* last = std::upper_bound(first, end, frame_index,
+		[](std::uint64_t index, const PoseRecord& record) {
+			return index < record.frame_index;
+		});
+	output_first = static_cast<size_t>(first - begin);
+	output_last = static_cast<size_t>(last - begin);
+	return first != last;
+}
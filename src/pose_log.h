@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef POSE_LOG
+#define POSE_LOG
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A pose log is a header followed by fixed-size records sorted by frame
+// All values are little-endian, so the file can be mapped and read directly
+
+// "MBARPOSE" in the first 8 bytes of a pose log
+#define POSE_LOG_MAGIC 0x45534F505241424DULL
+#define POSE_LOG_VERSION 1u
+
+struct PoseLogHeader {
+	std::uint64_t magic;
+	std::uint32_t version;
+	// sizeof(PoseRecord) when the log was written
+	std::uint32_t record_size;
+	std::uint64_t record_count;
+};
+
+// One detected marker in one frame
+struct PoseRecord {
+	std::uint64_t frame_index;
+	// Position of the frame in the video, in milliseconds
+	double timestamp_ms;
+	// -1 for the chessboard
+	std::int32_t marker_id;
+	std::uint32_t reserved;
+	// 4x4 pose in the same column-major order as OpenGL
+	float pose[16];
+};
+
+static_assert(sizeof(PoseLogHeader) == 24, "unexpected pose log header size");
+static_assert(sizeof(PoseRecord) == 88, "unexpected pose record size");
+
+// Write all records into a pose log file
+// If fail, return false
+bool writePoseLog(
+	const std::string& output_filename,
+	const std::vector<PoseRecord>& records);
+
+// Map a pose log into memory and read its records without copying
+class PoseLogReader {
+public:
+	PoseLogReader() = default;
+	~PoseLogReader();
+
+	PoseLogReader(const PoseLogReader&) = delete;
+	PoseLogReader& operator=(const PoseLogReader&) = delete;
+
+	// If the file is not a valid pose log, return false
+	bool open(const std::string& input_filename);
+	void close();
+
+	size_t size() const { return record_count_; }
+	const PoseRecord* records() const { return records_; }
+	const PoseRecord& operator[](size_t index) const {
+		return records_[index];
+	}
+
+	// The records of one frame, found by binary search
+	// Give the range [output_first, output_last), and return false
+	// if the frame has no record
+	bool findFrame(
+		std::uint64_t frame_index,
+		size_t& output_first,
+		size_t& output_last) const;
+
+private:
+	MappedFile file_;
+	const PoseRecord* records_ = nullptr;
+	size_t record_count_ = 0;
+};
+
+#endif // !POSE_LOG
@@ -0,0 +1,215 @@
+// Implement the classes in pose_publisher.h
+#include "pose_publisher.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// A reader gives up after this many torn reads of the same slot
+const int max_read_attempts = 8;
+
+// Map a shared memory object, create it if "create" is true
+void* mapSharedMemory(const std::string& name, bool create) {
+#ifdef _WIN32
+	std::fprintf(stderr, "Shared memory publishing needs POSIX.\n");
+	return nullptr;
+#else
+	int flags = create ? (O_CREAT | O_RDWR) : O_RDONLY;
+	int file = shm_open(name.c_str(), flags, 0644);
+	if (file < 0) {
+		return nullptr;
+	}
+	if (create && ftruncate(file, sizeof(PoseSharedMemory)) != 0) {
+		::close(file);
+		return nullptr;
+	}
+
+	struct stat file_status;
+	if (fstat(file, &file_status) != 0 ||
+		static_cast<size_t>(file_status.st_size) < sizeof(PoseSharedMemory)) {
+		::close(file);
+		return nullptr;
+	}
+
+	int protection = create ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	void* mapping = mmap(NULL, sizeof(PoseSharedMemory), protection,
+		MAP_SHARED, file, 0);
+	::close(file);
+	return mapping == MAP_FAILED ? nullptr : mapping;
+#endif
+}
+
+void unmapSharedMemory(const void* mapping) {
+#ifndef _WIN32
+	munmap(const_cast<void*>(mapping), sizeof(PoseSharedMemory));
+#endif
+}
+
+// Copy one slot with the sequence lock
+// Return false if the slot is being written, or was written while copying
+bool readSlot(const PoseRingSlot& slot, PoseFrame& output_frame) {
+	std::uint32_t sequence_before =
+		slot.sequence.load(std::memory_order_acquire);
+	if (sequence_before & 1u) {
+		return false;
+	}
+	std::memcpy(&output_frame, &slot.frame, sizeof(PoseFrame));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	std::uint32_t sequence_after =
+		slot.sequence.load(std::memory_order_relaxed);
+	return sequence_before == sequence_after &&
+		output_frame.marker_count <= MAX_PUBLISHED_MARKERS;
+}
+
+} // namespace
+
+PosePublisher::~PosePublisher() {
+	close();
+}
+
+// Create (or reuse) the shared memory object
+bool PosePublisher::open(const std::string& name) {
+	close();
+
+	void* mapping = mapSharedMemory(name, true);
+	if (mapping == nullptr) {
+		std::fprintf(stderr, "Failed to create shared memory %s.\n",
+			name.c_str());
+		return false;
+	}
+	name_ = name;
+
+	// Start from a clean ring every time the publisher starts
+	memory_ = new (mapping) PoseSharedMemory;
+	memory_->magic = POSE_SHARED_MEMORY_MAGIC;
+	memory_->version = POSE_SHARED_MEMORY_VERSION;
+	memory_->ring_size = POSE_RING_SIZE;
+	for (PoseRingSlot& slot : memory_->slots) {
+		slot.sequence.store(0, std::memory_order_relaxed);
+	}
+	memory_->published_count.store(0, std::memory_order_release);
+	return true;
+}
+
+void PosePublisher::close() {
+	if (memory_ != nullptr) {
+		unmapSharedMemory(memory_);
+	}
+	memory_ = nullptr;
+}
+
+// Publish the poses of one frame, it never blocks
+void PosePublisher::publish(
+	std::uint64_t frame_index,
+	std::int64_t capture_time_ns,
+	const std::vector<int>& marker_ids,
+	const std::vector<cv::Mat>& marker_poses) {
+	if (memory_ == nullptr) {
+		return;
+	}
+
+	PoseRingSlot& slot = memory_->slots[frame_index % POSE_RING_SIZE];
+
+	// Odd sequence: readers know the slot is being written
+	std::uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.frame.frame_index = frame_index;
+	slot.frame.capture_time_ns = capture_time_ns;
+	size_t marker_count = std::min(marker_poses.size(),
+		static_cast<size_t>(MAX_PUBLISHED_MARKERS));
+	slot.frame.marker_count = static_cast<std::uint32_t>(marker_count);
+	for (size_t i = 0; i < marker_count; i++) {
+		slot.frame.markers[i].id =
+			i < marker_ids.size() ? marker_ids[i] : -1;
+		std::memcpy(slot.frame.markers[i].pose,
+			marker_poses[i].ptr<float>(0), sizeof(float) * 16);
+	}
+
+	// Even sequence: the slot is complete
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	memory_->published_count.store(frame_index + 1,
+		std::memory_order_release);
+}
+
+PoseSubscriber::~PoseSubscriber() {
+	close();
+}
+
+// Map the shared memory object of a running publisher
+bool PoseSubscriber::open(const std::string& name) {
+	close();
+
+	void* mapping = mapSharedMemory(name, false);
+	if (mapping == nullptr) {
+		return false;
+	}
+	const PoseSharedMemory* memory =
+		static_cast<const PoseSharedMemory*>(mapping);
+	if (memory->magic != POSE_SHARED_MEMORY_MAGIC ||
+		memory->version != POSE_SHARED_MEMORY_VERSION ||
+		memory->ring_size != POSE_RING_SIZE) {
+		unmapSharedMemory(mapping);
+		return false;
+	}
+	memory_ = memory;
+	return true;
+}
+
+void PoseSubscriber::close() {
+	if (memory_ != nullptr) {
+		unmapSharedMemory(memory_);
+	}
+	memory_ = nullptr;
+}
+
+// The number of frames published so far
+std::uint64_t PoseSubscriber::publishedCount() const {
+	if (memory_ == nullptr) {
+		return 0;
+	}
+	return memory_->published_count.load(std::memory_order_acquire);
+}
+
+// Copy the newest frame
+bool PoseSubscriber::readLatest(PoseFrame& output_frame) const {
+	for (int attempt = 0; attempt < max_read_attempts; attempt++) {
+		std::uint64_t published_count = publishedCount();
+		if (published_count == 0) {
+			return false;
+		}
+		// A newer frame may have replaced it, then try the newest again
+		if (readFrame(published_count - 1, output_frame)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copy a given frame, if it is still in the ring buffer
+bool PoseSubscriber::readFrame(
+	std::uint64_t frame_index,
+	PoseFrame& output_frame) const {
+	if (memory_ == nullptr) {
+		return false;
+	}
+	const PoseRingSlot& slot = memory_->slots[frame_index % POSE_RING_SIZE];
+	for (int attempt = 0; attempt < max_read_attempts; attempt++) {
+		if (readSlot(slot, output_frame)) {
+			// The slot may already hold a newer frame
+			return output_frame.frame_index == frame_index;
+		}
+	}
+	return false;
+}
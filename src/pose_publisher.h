@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef POSE_PUBLISHER
+#define POSE_PUBLISHER
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Poses of every frame are published to other processes on the same host
+// through a ring buffer in POSIX shared memory
+// Each slot is protected by a sequence lock: the publisher never waits,
+// and a reader simply retries if a slot is being written
+
+// The default name of the shared memory object
+#define POSE_SHARED_MEMORY_NAME "/marker_based_ar_poses"
+// The number of frames kept in the ring buffer
+#define POSE_RING_SIZE 16
+// Markers after this number are not published
+#define MAX_PUBLISHED_MARKERS 64
+
+#define POSE_SHARED_MEMORY_MAGIC 0x5241424D50534F50ULL
+#define POSE_SHARED_MEMORY_VERSION 1u
+
+struct PublishedMarker {
+	// -1 for the chessboard
+	std::int32_t id;
+	// 4x4 pose in the same column-major order as OpenGL
+	float pose[16];
+};
+
+// The poses of one frame
+struct PoseFrame {
+	std::uint64_t frame_index;
+	// std::chrono::steady_clock time of capture, in nanoseconds
+	std::int64_t capture_time_ns;
+	std::uint32_t marker_count;
+	PublishedMarker markers[MAX_PUBLISHED_MARKERS];
+};
+
+struct PoseRingSlot {
+	// Odd while the publisher is writing this slot
+	std::atomic<std::uint32_t> sequence;
+	PoseFrame frame;
+};
+
+struct PoseSharedMemory {
+	std::uint64_t magic;
+	std::uint32_t version;
+	std::uint32_t ring_size;
+	// The number of frames published so far
+	std::atomic<std::uint64_t> published_count;
+	PoseRingSlot slots[POSE_RING_SIZE];
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free &&
+	std::atomic<std::uint64_t>::is_always_lock_free,
+	"atomics in shared memory must be lock-free");
+
+// Write the poses of each frame into shared memory
+class PosePublisher {
+public:
+	PosePublisher() = default;
+	~PosePublisher();
+
+	PosePublisher(const PosePublisher&) = delete;
+	PosePublisher& operator=(const PosePublisher&) = delete;
+
+	// Create (or reuse) the shared memory object
+	// If fail, return false
+	bool open(const std::string& name = POSE_SHARED_MEMORY_NAME);
+	void close();
+	bool isOpen() const { return memory_ != nullptr; }
+
+	// Publish the poses of one frame, it never blocks
+	void publish(
+		std::uint64_t frame_index,
+		std::int64_t capture_time_ns,
+		const std::vector<int>& marker_ids,
+		const std::vector<cv::Mat>& marker_poses);
+
+private:
+	PoseSharedMemory* memory_ = nullptr;
+	std::string name_;
+};
+
+// Read the poses published by another process
+class PoseSubscriber {
+public:
+	PoseSubscriber() = default;
+	~PoseSubscriber();
+
+	PoseSubscriber(const PoseSubscriber&) = delete;
+	PoseSubscriber& operator=(const PoseSubscriber&) = delete;
+
+	// Map the shared memory object of a running publisher
+	// If fail, return false
+	bool open(const std::string& name = POSE_SHARED_MEMORY_NAME);
+	void close();
+
+	// The number of frames published so far
+	std::uint64_t publishedCount() const;
+
+	// Copy the newest frame
+	// If nothing is published, or the slot is always being rewritten
+	// while it is copied, return false
+	bool readLatest(PoseFrame& output_frame) const;
+
+	// Copy a given frame, if it is still in the ring buffer
+	bool readFrame(std::uint64_t frame_index, PoseFrame& output_frame) const;
+
+private:
+	const PoseSharedMemory* memory_ = nullptr;
+};
+
+#endif // !POSE_PUBLISHER
@@ -0,0 +1,85 @@
+// Implement the class in quality_controller.h
+#include "quality_controller.h"
+
+#include <cstdio>
+
+namespace {
+
+// Frames over the budget before stepping down
+const int slow_frames_to_step_down = 10;
+// Frames under "fast_ratio" of the budget before stepping up
+const int fast_frames_to_step_up = 90;
+const double fast_ratio = 0.7;
+// Frames to wait after a step, so its effect reaches the averages
+const int cooldown_frames = 30;
+
+} // namespace
+
+QualityController::QualityController(double frame_budget_ms)
+	: frame_budget_ms_(frame_budget_ms) {
+	// From the best quality to the cheapest one,
+	// each step gives up as little accuracy as possible
+	levels_ = {
+		{ 1.0, 1, 10, 0 },
+		{ 1.0, 1, 0, 0 },
+		{ 0.75, 1, 0, 1 },
+		{ 0.5, 1, 0, 1 },
+		{ 0.5, 2, 0, 2 },
+		{ 0.5, 3, 0, 3 }
+	};
+}
+
+// Call once per frame with the averages of the stages
+void QualityController::update(double detection_ms, double render_ms) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (cooldown_ > 0) {
+		cooldown_--;
+		return;
+	}
+
+	double frame_ms = detection_ms + render_ms;
+	if (frame_ms > frame_budget_ms_) {
+		num_of_slow_frame_++;
+		num_of_fast_frame_ = 0;
+	} else if (frame_ms < fast_ratio * frame_budget_ms_) {
+		num_of_fast_frame_++;
+		num_of_slow_frame_ = 0;
+	} else {
+		num_of_slow_frame_ = 0;
+		num_of_fast_frame_ = 0;
+	}
+
+	size_t next_index = level_index_;
+	if (num_of_slow_frame_ >= slow_frames_to_step_down &&
+		level_index_ + 1 < levels_.size()) {
+		next_index = level_index_ + 1;
+	}
+	if (num_of_fast_frame_ >= fast_frames_to_step_up && level_index_ > 0) {
+		next_index = level_index_ - 1;
+	}
+	if (next_index == level_index_) {
+		return;
+	}
+
+	const QualityLevel& next = levels_[next_index];
+	std::printf("quality: level %zu -> %zu (detection %.2f ms + render %.2f ms,"
+		" budget %.2f ms): scale %.2f, interval %d, refinement %d, lod %d\n",
+		level_index_, next_index, detection_ms, render_ms, frame_budget_ms_,
+		next.detection_scale, next.detection_interval,
+		next.corner_refinement_iterations, next.lod_bias);
+	level_index_ = next_index;
+	num_of_slow_frame_ = 0;
+	num_of_fast_frame_ = 0;
+	cooldown_ = cooldown_frames;
+}
+
+// The current knobs (it can be read from any thread)
+QualityLevel QualityController::level() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return levels_[level_index_];
+}
+
+size_t QualityController::levelIndex() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return level_index_;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef QUALITY_CONTROLLER
+#define QUALITY_CONTROLLER
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// The knobs which trade accuracy for time
+struct QualityLevel {
+	// The scale of the image the markers are searched in
+	double detection_scale;
+	// Detect every n-th frame, the others reuse the last poses
+	int detection_interval;
+	// Iterations of sub-pixel corner refinement (0 is none)
+	int corner_refinement_iterations;
+	// Each step doubles the pixel sizes under which models
+	// are dropped or drawn as boxes
+	int lod_bias;
+};
+
+// Step the quality up and down to hold a frame-time budget
+// The time of a frame is its detection plus its render time
+// It steps down when the average is over the budget for a while, and up
+// only when it has been well under the budget for much longer, and
+// waits after every step, so it does not oscillate
+// Every step is printed with the times which caused it
+class QualityController {
+public:
+	explicit QualityController(double frame_budget_ms = 16.6);
+
+	// Call once per frame with the averages of the stages
+	void update(double detection_ms, double render_ms);
+
+	// The current knobs (it can be read from any thread)
+	QualityLevel level() const;
+	size_t levelIndex() const;
+
+private:
+	double frame_budget_ms_;
+	std::vector<QualityLevel> levels_;
+	size_t level_index_ = 0;
+	// Frames in a row over the budget, and well under it
+	int num_of_slow_frame_ = 0;
+	int num_of_fast_frame_ = 0;
+	// Frames to wait after a step
+	int cooldown_ = 0;
+	mutable std::mutex mutex_;
+};
+
+#endif // !QUALITY_CONTROLLER
@@ -0,0 +1,338 @@
+// Implement the functions in replay_benchmark.h
+#include "replay_benchmark.h"
+#include "async_detector.h"
+#include "frame_cache.h"
+#include "latency_harness.h"
+#include "marker_detection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Detect in every frame of the cache, several times
+bool runReplayBenchmark(
+	const std::string& cache_filename,
+	const ReplayBenchmarkSettings& settings,
+	const std::string& csv_filename) {
+	FrameCacheReader reader;
+	if (!reader.open(cache_filename)) {
+		std::fprintf(stderr, "Failed to open %s.\n", cache_filename.c_str());
+		return false;
+	}
+	if (reader.size() == 0) {
+		std::fprintf(stderr, "%s has no frame.\n", cache_filename.c_str());
+		return false;
+	}
+
+	std::ofstream csv_file;
+	if (!csv_filename.empty()) {
+		csv_file.open(csv_filename);
+		if (!csv_file.is_open()) {
+			std::fprintf(stderr, "Failed to open %s.\n", csv_filename.c_str());
+			return false;
+		}
+		csv_file << "pass,frame_index,detection_ms,markers\n";
+	}
+
+	// Every page is in memory before anything is measured
+	reader.prefault();
+	std::printf("%zu frames of %dx%d (%.1f MB mapped), %s\n",
+		reader.size(), reader.frameSize().width, reader.frameSize().height,
+		reader.mappedSize() / 1e6,
+		settings.use_chessboard ? "chessboard" : "markers");
+	std::printf("%-6s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+		"pass", "frames", "markers", "fps",
+		"mean", "p50", "p90", "p99", "max");
+
+	FrameCacheView view;
+	std::vector<cv::Mat> marker_poses;
+	std::vector<int> marker_ids;
+	std::vector<double> detection_ms(reader.size());
+	std::vector<size_t> num_of_marker(reader.size());
+	// The markers of each frame in the first pass, which every later
+	// pass must detect again
+	std::vector<size_t> expected_num_of_marker;
+	bool is_repeatable = true;
+
+	// Pass 0 warms up the caches and the allocations of the detector
+	for (size_t pass = 0; pass <= settings.num_of_pass; pass++) {
+		size_t total_num_of_marker = 0;
+		auto pass_start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < reader.size(); i++) {
+			reader.frame(i, view);
+			auto start = std::chrono::steady_clock::now();
+			if (settings.use_chessboard) {
+				detctChessboardAndEstimatePose(view.grayscale, marker_poses);
+			} else {
+				detectMarkersAndEstimatePose(
+					view.grayscale, marker_poses, marker_ids);
+			}
+			detection_ms[i] = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count();
+			num_of_marker[i] = marker_poses.size();
+			total_num_of_marker += marker_poses.size();
+		}
+		double pass_seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - pass_start).count();
+
+		if (pass == 0) {
+			expected_num_of_marker = num_of_marker;
+			continue;
+		}
+		if (num_of_marker != expected_num_of_marker) {
+			is_repeatable = false;
+		}
+		if (csv_file.is_open()) {
+			for (size_t i = 0; i < reader.size(); i++) {
+				csv_file << pass << "," << i << "," << detection_ms[i] <<
+					"," << num_of_marker[i] << "\n";
+			}
+		}
+
+		std::vector<double> sorted_ms = detection_ms;
+		LatencyStatistics statistics;
+		computeLatencyStatistics(sorted_ms, statistics);
+		std::printf("%-6zu %8zu %8zu %8.1f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+			pass, reader.size(), total_num_of_marker,
+			pass_seconds > 0.0 ? reader.size() / pass_seconds : 0.0,
+			statistics.mean_ms, statistics.p50_ms, statistics.p90_ms,
+			statistics.p99_ms, statistics.max_ms);
+	}
+
+	// The same frames must give the same markers, otherwise the times
+	// of the passes do not compare
+	if (!is_repeatable) {
+		std::fprintf(stderr,
+			"The passes did not detect the same markers in every frame.\n");
+		return false;
+	}
+	return true;
+}
+
+namespace {
+
+#ifdef ASYNC_DETECTOR_COROUTINE
+// A coroutine which starts at once and is not awaited by anyone
+struct DetachedCoroutine {
+	struct promise_type {
+		DetachedCoroutine get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// Await the result of "ticket", and note the thread it was resumed on
+DetachedCoroutine awaitDetection(
+	AsyncMarkerDetector& detector,
+	std::uint64_t ticket,
+	std::function<void(std::function<void()>)> executor,
+	DetectionResult& output_result,
+	std::thread::id& output_thread,
+	bool& output_is_done) {
+	output_result = co_await detector.detect(ticket, std::move(executor));
+	output_thread = std::this_thread::get_id();
+	output_is_done = true;
+}
+#endif
+
+} // namespace
+
+// Compare the results of the async detector with the synchronous one
+bool runAsyncDetectorCheck(
+	const std::string& cache_filename,
+	bool use_chessboard) {
+	FrameCacheReader reader;
+	if (!reader.open(cache_filename)) {
+		std::fprintf(stderr, "Failed to open %s.\n", cache_filename.c_str());
+		return false;
+	}
+	if (reader.size() == 0) {
+		std::fprintf(stderr, "%s has no frame.\n", cache_filename.c_str());
+		return false;
+	}
+	reader.prefault();
+
+	AsyncDetectorSettings detector_settings;
+	detector_settings.use_chessboard = use_chessboard;
+	detector_settings.num_of_worker = 4;
+	detector_settings.max_in_flight = 8;
+
+	// The results of the synchronous detector with the same configuration
+	FrameCacheView view;
+	std::vector<std::vector<cv::Mat>> expected_poses(reader.size());
+	std::vector<std::vector<int>> expected_ids(reader.size());
+	DetectionOptions options;
+	options.calibration = &detector_settings.calibration;
+	options.marker_set = &detector_settings.marker_set;
+	for (size_t i = 0; i < reader.size(); i++) {
+		reader.frame(i, view);
+		if (use_chessboard) {
+			detctChessboardAndEstimatePose(view.grayscale,
+				detector_settings.calibration, expected_poses[i]);
+		} else {
+			detectMarkersAndEstimatePose(view.grayscale, options,
+				expected_poses[i], expected_ids[i]);
+		}
+	}
+
+	bool is_passed = true;
+	auto expect = [&is_passed](bool condition, const char* description) {
+		if (!condition) {
+			std::fprintf(stderr, "Async detector check failed: %s.\n",
+				description);
+			is_passed = false;
+		}
+	};
+
+	AsyncMarkerDetector detector(detector_settings);
+	// The frame of each ticket, and the tickets in flight by submission
+	std::map<std::uint64_t, size_t> frame_of_ticket;
+	std::deque<std::uint64_t> tickets_in_flight;
+	size_t next_frame = 0;
+	auto submitNext = [&]() {
+		size_t frame_index = next_frame % reader.size();
+		reader.frame(frame_index, view);
+		std::uint64_t ticket = detector.submit(view.grayscale);
+		if (ticket != INVALID_DETECTION_TICKET) {
+			frame_of_ticket[ticket] = frame_index;
+			tickets_in_flight.push_back(ticket);
+			next_frame++;
+		}
+		return ticket;
+	};
+	// The result must be the one of the synchronous detector
+	auto matches = [&](const DetectionResult& result) {
+		auto found = frame_of_ticket.find(result.ticket);
+		if (found == frame_of_ticket.end()) {
+			return false;
+		}
+		size_t frame_index = found->second;
+		frame_of_ticket.erase(found);
+		if (result.marker_ids != expected_ids[frame_index] ||
+			result.marker_poses.size() != expected_poses[frame_index].size()) {
+			return false;
+		}
+		for (size_t i = 0; i < result.marker_poses.size(); i++) {
+			if (cv::norm(result.marker_poses[i],
+				expected_poses[frame_index][i], cv::NORM_INF) > 1e-5) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// Fill the detector, one more submit is rejected
+	for (size_t i = 0; i < detector_settings.max_in_flight; i++) {
+		expect(submitNext() != INVALID_DETECTION_TICKET,
+			"a submit below max_in_flight is accepted");
+	}
+	expect(submitNext() == INVALID_DETECTION_TICKET,
+		"a submit at max_in_flight is rejected");
+	expect(detector.numInFlight() == detector_settings.max_in_flight,
+		"the tickets in flight are counted");
+
+	// "wait" collects the oldest, which makes room for one more
+	DetectionResult result;
+	expect(detector.wait(tickets_in_flight.front(), result) &&
+		result.ticket == tickets_in_flight.front() && matches(result),
+		"wait gives the result of its ticket");
+	tickets_in_flight.pop_front();
+	expect(!detector.wait(result.ticket, result),
+		"wait fails for a collected ticket");
+	expect(submitNext() != INVALID_DETECTION_TICKET,
+		"a submit is accepted after a result is collected");
+
+	// "pollNext" gives the results in the order of submission
+	while (next_frame < reader.size() + detector_settings.max_in_flight ||
+		!tickets_in_flight.empty()) {
+		while (next_frame < reader.size() + detector_settings.max_in_flight &&
+			submitNext() != INVALID_DETECTION_TICKET) {
+		}
+		if (!detector.pollNext(result)) {
+			std::this_thread::yield();
+			continue;
+		}
+		expect(result.ticket == tickets_in_flight.front(),
+			"pollNext gives the oldest ticket");
+		expect(matches(result), "pollNext gives the synchronous result");
+		tickets_in_flight.pop_front();
+	}
+
+	// "pollAny" gives every result once, in the order they were ready
+	size_t num_of_out_of_order = 0;
+	std::chrono::steady_clock::time_point last_ready_time;
+	size_t last_frame = next_frame + reader.size();
+	while (next_frame < last_frame || !tickets_in_flight.empty()) {
+		while (next_frame < last_frame &&
+			submitNext() != INVALID_DETECTION_TICKET) {
+		}
+		if (!detector.pollAny(result)) {
+			std::this_thread::yield();
+			continue;
+		}
+		expect(result.ready_time >= last_ready_time,
+			"pollAny gives the result which was ready first");
+		last_ready_time = result.ready_time;
+		auto found = std::find(tickets_in_flight.begin(),
+			tickets_in_flight.end(), result.ticket);
+		expect(found != tickets_in_flight.end(),
+			"pollAny gives a ticket in flight");
+		if (found != tickets_in_flight.end()) {
+			num_of_out_of_order += found != tickets_in_flight.begin();
+			tickets_in_flight.erase(found);
+		}
+		expect(matches(result), "pollAny gives the synchronous result");
+	}
+	expect(detector.numInFlight() == 0 && frame_of_ticket.empty(),
+		"every ticket is collected once");
+
+#ifdef ASYNC_DETECTOR_COROUTINE
+	// The executor runs the resumption on this thread
+	std::mutex resumption_mutex;
+	std::deque<std::function<void()>> resumptions;
+	auto executor = [&](std::function<void()> resumption) {
+		std::lock_guard<std::mutex> lock(resumption_mutex);
+		resumptions.push_back(std::move(resumption));
+	};
+	std::thread::id resumed_thread;
+	bool is_done = false;
+	std::uint64_t ticket = submitNext();
+	awaitDetection(detector, ticket, executor, result,
+		resumed_thread, is_done);
+	while (!is_done) {
+		std::function<void()> resumption;
+		{
+			std::lock_guard<std::mutex> lock(resumption_mutex);
+			if (!resumptions.empty()) {
+				resumption = std::move(resumptions.front());
+				resumptions.pop_front();
+			}
+		}
+		if (resumption) {
+			resumption();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	expect(resumed_thread == std::this_thread::get_id(),
+		"the awaiter resumes on the thread of the executor");
+	expect(result.ticket == ticket && matches(result),
+		"the awaiter gives the synchronous result");
+#endif
+
+	std::printf("Async detector check %s: %zu frames submitted, "
+		"%zu results collected out of submission order by pollAny\n",
+		is_passed ? "passed" : "failed", next_frame, num_of_out_of_order);
+	return is_passed;
+}
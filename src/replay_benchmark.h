@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef REPLAY_BENCHMARK
+#define REPLAY_BENCHMARK
+
+#include <cstddef>
+#include <string>
+
+struct ReplayBenchmarkSettings {
+	// Detect the chessboard instead of the markers
+	bool use_chessboard = false;
+	// Passes over the whole cache, after one pass which is not measured
+	size_t num_of_pass = 3;
+};
+
+// Detect in every frame of a frame cache (see frame_cache.h), straight
+// from the mapped grayscale planes, and print the distribution of the
+// detection time of each pass
+// The cache is read into memory first, so the passes do no I/O and
+// do not decode, and every pass sees the same frames
+// The time of every frame is written to "csv_filename" if not empty
+// If the cache cannot be read, or the passes do not detect the same
+// markers, return false
+bool runReplayBenchmark(
+	const std::string& cache_filename,
+	const ReplayBenchmarkSettings& settings,
+	const std::string& csv_filename);
+
+// Detect every frame of a frame cache with an AsyncMarkerDetector
+// (see async_detector.h) and check it against the synchronous detector:
+// - a submit beyond "max_in_flight" is rejected, and accepted again
+//   once a result is collected
+// - "wait" and "pollNext" give the results in the order of submission
+// - "pollAny" gives them in the order they were ready
+// - an awaiter with an executor resumes on the thread of the executor
+// - every result is the one of the synchronous detector for its frame
+// If the cache cannot be read or a check fails, return false
+bool runAsyncDetectorCheck(
+	const std::string& cache_filename,
+	bool use_chessboard);
+
+#endif // !REPLAY_BENCHMARK
@@ -0,0 +1,54 @@
+// Implement the class in scene_change.h
+#include "scene_change.h"
+
+#include <algorithm>
+
+SceneChangeDetector::SceneChangeDetector(const SceneChangeSettings& settings)
+	: settings_(settings) {
+}
+
+// If the frame has to be detected, return true
+bool SceneChangeDetector::hasChanged(const cv::Mat& frame) {
+	// The means of all blocks (and channels) in one pass
+	int block_size = std::max(settings_.block_size, 1);
+	cv::Size signature_size(
+		std::max(frame.cols / block_size, 1),
+		std::max(frame.rows / block_size, 1));
+	cv::resize(frame, signature_, signature_size, 0, 0, cv::INTER_AREA);
+	has_signature_ = true;
+
+	bool has_changed = !has_reference_ ||
+		signature_.size() != reference_signature_.size() ||
+		signature_.type() != reference_signature_.type() ||
+		num_of_reused_frame_ >= settings_.max_reuse_frames;
+	if (!has_changed) {
+		// The largest change of any block in any channel
+		cv::absdiff(signature_, reference_signature_, difference_);
+		double max_difference = 0.0;
+		cv::minMaxLoc(difference_.reshape(1), nullptr, &max_difference);
+		has_changed = max_difference > settings_.sensitivity;
+	}
+	if (!has_changed) {
+		num_of_reused_frame_++;
+	}
+	return has_changed;
+}
+
+// Make the last compared frame the reference
+void SceneChangeDetector::commitReference() {
+	if (!has_signature_) {
+		return;
+	}
+	// Keep the buffers, so nothing is allocated for the next frame
+	std::swap(signature_, reference_signature_);
+	has_signature_ = false;
+	has_reference_ = true;
+	num_of_reused_frame_ = 0;
+}
+
+// Detect the next frame in any case
+void SceneChangeDetector::reset() {
+	has_reference_ = false;
+	has_signature_ = false;
+	num_of_reused_frame_ = 0;
+}
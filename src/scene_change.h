@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef SCENE_CHANGE
+#define SCENE_CHANGE
+
+#include <opencv2/opencv.hpp>
+
+struct SceneChangeSettings {
+	// The side of the blocks a frame is averaged over, in pixels
+	int block_size = 16;
+	// A block has changed if its mean moves by more than this (0-255)
+	// Smaller is more sensitive, the averaging hides the sensor noise
+	double sensitivity = 4.0;
+	// Detect anyway after this many reused frames
+	int max_reuse_frames = 30;
+};
+
+// Tell whether a frame differs from the last frame that was detected
+// A frame is reduced to the means of its blocks (one pass of "cv::resize"
+// with INTER_AREA), and compared block by block with the reference
+// The reference is only replaced by "commitReference" once a frame is
+// detected, so a slow drift is still noticed, and a frame which is
+// dropped or not detected for another reason is never the reference
+class SceneChangeDetector {
+public:
+	explicit SceneChangeDetector(
+		const SceneChangeSettings& settings = SceneChangeSettings());
+
+	// If the frame has to be detected, return true
+	// If the poses of the reference can be reused, return false
+	// The reference is not changed, only the frames compared with it
+	// are counted (for "max_reuse_frames")
+	bool hasChanged(const cv::Mat& frame);
+
+	// Make the last frame given to "hasChanged" the reference,
+	// after it has been detected
+	void commitReference();
+
+	// Detect the next frame in any case
+	void reset();
+
+	int numOfReusedFrame() const { return num_of_reused_frame_; }
+
+private:
+	SceneChangeSettings settings_;
+	cv::Mat signature_;
+	cv::Mat reference_signature_;
+	cv::Mat difference_;
+	bool has_reference_ = false;
+	// "signature_" is of a frame which has not been committed
+	bool has_signature_ = false;
+	int num_of_reused_frame_ = 0;
+};
+
+#endif // !SCENE_CHANGE
@@ -0,0 +1,361 @@
+// Implement the class in scene_renderer.h
+#include "scene_renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+namespace {
+
+// Position (3x16 bits) and octahedral normal (2x16 bits)
+const size_t vertex_stride = 12;
+
+// The 12 bytes of a vertex, to find the same vertex again
+struct VertexKey {
+	std::uint64_t low;
+	std::uint32_t high;
+
+	bool operator==(const VertexKey& other) const {
+		return low == other.low && high == other.high;
+	}
+};
+
+struct VertexKeyHash {
+	size_t operator()(const VertexKey& key) const {
+		return std::hash<std::uint64_t>()(key.low ^
+			(static_cast<std::uint64_t>(key.high) * 0x9E3779B97F4A7C15ULL));
+	}
+};
+
+// The vertices of a compact mesh in the Compact16 layout
+void toCompact16(
+	const CompactMeshData& compact_mesh,
+	std::vector<unsigned char>& output_vertex_data) {
+	if (compact_mesh.format == VertexFormat::Compact16) {
+		output_vertex_data = compact_mesh.vertex_data;
+		return;
+	}
+	// Compact8: the same position, and the normal widened to 16 bits
+	output_vertex_data.resize(compact_mesh.vertex_count * vertex_stride);
+	for (size_t i = 0; i < compact_mesh.vertex_count; i++) {
+		const unsigned char* source =
+			&compact_mesh.vertex_data[i * compact_mesh.stride];
+		unsigned char* destination = &output_vertex_data[i * vertex_stride];
+		std::memcpy(destination, source, 6);
+		std::int8_t normal8[2];
+		std::memcpy(normal8, source + 6, sizeof(normal8));
+		std::int16_t normal16[2];
+		for (int k = 0; k < 2; k++) {
+			normal16[k] = static_cast<std::int16_t>(
+				std::lround(normal8[k] * (32767.0f / 127.0f)));
+		}
+		std::memcpy(destination + 6, normal16, sizeof(normal16));
+	}
+}
+
+} // namespace
+
+SceneRenderer::~SceneRenderer() {
+	destroy();
+}
+
+// Create the vertex array and the buffers of the draws
+bool SceneRenderer::create(const std::vector<GLuint>& program_ids) {
+	destroy();
+	if (!GLEW_VERSION_3_3) {
+		std::fprintf(stderr, "The scene renderer needs OpenGL 3.3.\n");
+		return false;
+	}
+	// The draw index is read through the base instance,
+	// which needs GL_ARB_base_instance before OpenGL 4.3
+	use_multi_draw_indirect_ = GLEW_VERSION_4_3 ||
+		(GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+
+	glGenVertexArrays(1, &vertex_array_id_);
+
+	GLuint draw_indices[MAX_DRAWN_MARKERS];
+	for (GLuint i = 0; i < MAX_DRAWN_MARKERS; i++) {
+		draw_indices[i] = i;
+	}
+	glGenBuffers(1, &draw_index_buffer_);
+	glBindBuffer(GL_ARRAY_BUFFER, draw_index_buffer_);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(draw_indices), draw_indices,
+		GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &parameter_buffer_);
+	glBindBuffer(GL_UNIFORM_BUFFER, parameter_buffer_);
+	glBufferData(GL_UNIFORM_BUFFER,
+		MAX_DRAWN_MARKERS * sizeof(DrawParameters), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if (use_multi_draw_indirect_) {
+		glGenBuffers(1, &command_buffer_);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER,
+			MAX_DRAWN_MARKERS * sizeof(DrawCommand), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	for (GLuint program_id : program_ids) {
+		GLuint block_index =
+			glGetUniformBlockIndex(program_id, "DrawParameters");
+		if (block_index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program_id, block_index,
+				DRAW_PARAMETERS_BINDING);
+		}
+	}
+
+	bindVertexLayout();
+	return true;
+}
+
+void SceneRenderer::destroy() {
+	GLuint* buffers[] = { &vertex_buffer_, &index_buffer_,
+		&draw_index_buffer_, &parameter_buffer_, &command_buffer_ };
+	for (GLuint* buffer : buffers) {
+		if (*buffer != 0) {
+			glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+	}
+	if (vertex_array_id_ != 0) {
+		glDeleteVertexArrays(1, &vertex_array_id_);
+		vertex_array_id_ = 0;
+	}
+	use_multi_draw_indirect_ = false;
+	vertex_bytes_ = 0;
+	vertex_capacity_bytes_ = 0;
+	index_bytes_ = 0;
+	index_capacity_bytes_ = 0;
+	meshes_.clear();
+	draws_.clear();
+}
+
+// Replace a buffer by a larger one, keeping its contents
+void SceneRenderer::reserve(
+	GLuint& buffer,
+	size_t used_bytes,
+	size_t needed_bytes,
+	size_t& capacity_bytes) {
+	if (needed_bytes <= capacity_bytes) {
+		return;
+	}
+	size_t new_capacity_bytes = std::max(needed_bytes, 2 * capacity_bytes);
+	GLuint new_buffer = 0;
+	glGenBuffers(1, &new_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_capacity_bytes, NULL,
+		GL_STATIC_DRAW);
+	if (buffer != 0) {
+		if (used_bytes > 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				0, 0, used_bytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	buffer = new_buffer;
+	capacity_bytes = new_capacity_bytes;
+}
+
+// Point the vertex array at the current buffers
+void SceneRenderer::bindVertexLayout() {
+	glBindVertexArray(vertex_array_id_);
+
+	if (vertex_buffer_ != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
+		// 1st attribute : 16-bit unsigned normalized positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+			vertex_stride, (void*)0);
+		// 3rd attribute : octahedral normals in 16 bits
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE,
+			vertex_stride, (void*)6);
+	}
+
+	// 4th attribute : the draw index, one per instance, so the base
+	// instance of a command selects it
+	// Without multi-draw, it is set before each draw instead
+	if (use_multi_draw_indirect_) {
+		glBindBuffer(GL_ARRAY_BUFFER, draw_index_buffer_);
+		glEnableVertexAttribArray(3);
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, 0, (void*)0);
+		glVertexAttribDivisor(3, 1);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Index the vertices of a mesh, and append them to the shared buffers
+bool SceneRenderer::addMesh(
+	const CompactMeshData& compact_mesh,
+	GpuMesh& output_mesh) {
+	if (compact_mesh.vertex_count == 0 || vertex_array_id_ == 0) {
+		return false;
+	}
+	std::vector<unsigned char> vertex_data;
+	toCompact16(compact_mesh, vertex_data);
+
+	// The obj files give every triangle its own vertices,
+	// most of which are the same after quantization
+	std::vector<unsigned char> unique_vertex_data;
+	std::vector<GLuint> indices;
+	indices.reserve(compact_mesh.vertex_count);
+	std::unordered_map<VertexKey, GLuint, VertexKeyHash> vertex_indices;
+	for (size_t i = 0; i < compact_mesh.vertex_count; i++) {
+		const unsigned char* vertex = &vertex_data[i * vertex_stride];
+		VertexKey key;
+		std::memcpy(&key.low, vertex, sizeof(key.low));
+		std::memcpy(&key.high, vertex + sizeof(key.low), sizeof(key.high));
+		GLuint index = static_cast<GLuint>(
+			unique_vertex_data.size() / vertex_stride);
+		auto inserted = vertex_indices.emplace(key, index);
+		if (inserted.second) {
+			unique_vertex_data.insert(unique_vertex_data.end(),
+				vertex, vertex + vertex_stride);
+		}
+		indices.push_back(inserted.first->second);
+	}
+
+	size_t index_data_bytes = indices.size() * sizeof(GLuint);
+	reserve(vertex_buffer_, vertex_bytes_,
+		vertex_bytes_ + unique_vertex_data.size(), vertex_capacity_bytes_);
+	reserve(index_buffer_, index_bytes_,
+		index_bytes_ + index_data_bytes, index_capacity_bytes_);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer_);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_bytes_,
+		unique_vertex_data.size(), unique_vertex_data.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, index_bytes_,
+		index_data_bytes, indices.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	// The buffers may have been replaced
+	bindVertexLayout();
+
+	SharedMesh mesh;
+	mesh.first_index = static_cast<GLuint>(index_bytes_ / sizeof(GLuint));
+	mesh.index_count = static_cast<GLuint>(indices.size());
+	mesh.base_vertex = static_cast<GLint>(vertex_bytes_ / vertex_stride);
+	mesh.position_offset = compact_mesh.bounds_min;
+	mesh.position_scale = compact_mesh.bounds_extent;
+	meshes_.push_back(mesh);
+	vertex_bytes_ += unique_vertex_data.size();
+	index_bytes_ += index_data_bytes;
+
+	output_mesh = GpuMesh();
+	output_mesh.vertex_count = static_cast<GLsizei>(indices.size());
+	output_mesh.has_compact_normals = true;
+	output_mesh.position_offset = compact_mesh.bounds_min;
+	output_mesh.position_scale = compact_mesh.bounds_extent;
+	output_mesh.bounds_min = compact_mesh.bounds_min;
+	output_mesh.bounds_max =
+		compact_mesh.bounds_min + compact_mesh.bounds_extent;
+	output_mesh.scene_mesh = static_cast<int>(meshes_.size() - 1);
+	return true;
+}
+
+// Compress the vertices, and add them to the shared buffers
+bool SceneRenderer::addMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<glm::vec3>& normals,
+	GpuMesh& output_mesh) {
+	CompactMeshData compact_mesh;
+	compressMesh(vertices, normals, VertexFormat::Compact16, compact_mesh);
+	return addMesh(compact_mesh, output_mesh);
+}
+
+// Keep a draw of this frame
+void SceneRenderer::addDraw(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	size_t marker_index) {
+	if (mesh.scene_mesh < 0 ||
+		static_cast<size_t>(mesh.scene_mesh) >= meshes_.size() ||
+		marker_index >= MAX_DRAWN_MARKERS ||
+		draws_.size() >= MAX_DRAWN_MARKERS) {
+		return;
+	}
+	draws_.push_back({ mesh.scene_mesh, model_matrix, marker_index });
+}
+
+// Write the draws into the buffers, and draw them with one call
+// (or one call per draw without multi-draw)
+void SceneRenderer::submit(
+	const glm::mat4& projection_matrix,
+	GLuint program_id) {
+	if (draws_.empty()) {
+		return;
+	}
+
+	// The draws of a mesh next to each other, so its vertices
+	// stay in the cache
+	std::stable_sort(draws_.begin(), draws_.end(),
+		[](const Draw& a, const Draw& b) { return a.mesh < b.mesh; });
+	parameters_.clear();
+	commands_.clear();
+	for (size_t i = 0; i < draws_.size(); i++) {
+		const SharedMesh& mesh = meshes_[draws_[i].mesh];
+		parameters_.push_back({ draws_[i].model_matrix,
+			glm::vec4(mesh.position_offset,
+				static_cast<float>(draws_[i].marker_index)),
+			glm::vec4(mesh.position_scale, 0.0f) });
+		commands_.push_back({ mesh.index_count, 1, mesh.first_index,
+			mesh.base_vertex, static_cast<GLuint>(i) });
+	}
+
+	// Orphan the buffer, so the draws of the last frame are not waited for
+	glBindBuffer(GL_UNIFORM_BUFFER, parameter_buffer_);
+	glBufferData(GL_UNIFORM_BUFFER,
+		MAX_DRAWN_MARKERS * sizeof(DrawParameters), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0,
+		parameters_.size() * sizeof(DrawParameters), parameters_.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, DRAW_PARAMETERS_BINDING,
+		parameter_buffer_);
+
+	glUseProgram(program_id);
+	glUniformMatrix4fv(glGetUniformLocation(program_id, "P"), 1, GL_FALSE,
+		&projection_matrix[0][0]);
+	glm::vec3 lightPos = glm::vec3(-3, -4, 1);
+	glUniform3f(glGetUniformLocation(program_id, "LightPosition_worldspace"),
+		lightPos.x, lightPos.y, lightPos.z);
+	GLint use_draw_parameters_id =
+		glGetUniformLocation(program_id, "UseDrawParameters");
+	glUniform1i(use_draw_parameters_id, 1);
+
+	glBindVertexArray(vertex_array_id_);
+	if (use_multi_draw_indirect_) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER,
+			MAX_DRAWN_MARKERS * sizeof(DrawCommand), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+			commands_.size() * sizeof(DrawCommand), commands_.data());
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0,
+			static_cast<GLsizei>(commands_.size()), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	} else {
+		// Only the draw index changes between the draws
+		for (const DrawCommand& command : commands_) {
+			glVertexAttribI4ui(3, command.base_instance, 0, 0, 0);
+			glDrawElementsBaseVertex(GL_TRIANGLES,
+				static_cast<GLsizei>(command.index_count), GL_UNSIGNED_INT,
+				(void*)(command.first_index * sizeof(GLuint)),
+				command.base_vertex);
+		}
+	}
+	glBindVertexArray(0);
+
+	// The other draws of the program use their own uniforms
+	glUniform1i(use_draw_parameters_id, 0);
+	draws_.clear();
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#ifndef SCENE_RENDERER
+#define SCENE_RENDERER
+
+#include "draw_graphics.h"
+#include "graphics_utility.h"
+
+#include <cstddef>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// The binding point of the "DrawParameters" uniform block
+#define DRAW_PARAMETERS_BINDING 1
+
+// Draw the models of all markers with a few calls
+// Every mesh is packed into one vertex buffer and one index buffer
+// (Compact16 vertices, shared by all meshes), so the models need only
+// one vertex array, and the draws of a frame are collected and submitted
+// by one glMultiDrawElementsIndirect (OpenGL 4.3 or
+// GL_ARB_multi_draw_indirect)
+// Without it, the vertex array and the program are still bound once,
+// and each draw is one glDrawElementsBaseVertex
+// The per-draw values (model matrix, marker, position decoding) are in
+// the "DrawParameters" uniform block, indexed by the draw
+class SceneRenderer {
+public:
+	SceneRenderer() = default;
+	~SceneRenderer();
+
+	SceneRenderer(const SceneRenderer&) = delete;
+	SceneRenderer& operator=(const SceneRenderer&) = delete;
+
+	// Create the buffers, and bind the "DrawParameters" block of the programs
+	// It must be called on the thread which owns the OpenGL context
+	// If the shared buffers cannot be drawn (no OpenGL 3.3), return false
+	bool create(const std::vector<GLuint>& program_ids);
+	void destroy();
+
+	// Add a mesh to the shared buffers, the vertices are indexed here
+	// "output_mesh" gets its index, bounds and decoding, but no buffers
+	// The shared buffers only grow, a mesh is never removed
+	// If the mesh is empty, return false
+	bool addMesh(
+		const CompactMeshData& compact_mesh,
+		GpuMesh& output_mesh);
+	// The vertices are compressed to Compact16 first
+	bool addMesh(
+		const std::vector<glm::vec3>& vertices,
+		const std::vector<glm::vec3>& normals,
+		GpuMesh& output_mesh);
+
+	// Draw a mesh of the shared buffers on the marker with the latched
+	// pose "marker_index" (see "latchMarkerPoses") in this frame
+	// At most MAX_DRAWN_MARKERS draws are kept, the others are ignored
+	void addDraw(
+		const GpuMesh& mesh,
+		const glm::mat4& model_matrix,
+		size_t marker_index);
+
+	// Submit the draws which have been added, and start a new frame
+	void submit(const glm::mat4& projection_matrix, GLuint program_id);
+
+	bool usesMultiDrawIndirect() const { return use_multi_draw_indirect_; }
+	size_t numOfMesh() const { return meshes_.size(); }
+
+private:
+	// The layout of glMultiDrawElementsIndirect
+	struct DrawCommand {
+		GLuint index_count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	// The layout of "SceneDraw" in std140
+	struct DrawParameters {
+		glm::mat4 model;
+		// The w is the marker index
+		glm::vec4 position_offset;
+		glm::vec4 position_scale;
+	};
+
+	struct SharedMesh {
+		GLuint first_index;
+		GLuint index_count;
+		GLint base_vertex;
+		glm::vec3 position_offset;
+		glm::vec3 position_scale;
+	};
+
+	struct Draw {
+		int mesh;
+		glm::mat4 model_matrix;
+		size_t marker_index;
+	};
+
+	// Make room for "needed_bytes" in a buffer, keeping its first
+	// "used_bytes" (the buffer is replaced by a larger one)
+	void reserve(
+		GLuint& buffer,
+		size_t used_bytes,
+		size_t needed_bytes,
+		size_t& capacity_bytes);
+	void bindVertexLayout();
+
+	GLuint vertex_array_id_ = 0;
+	GLuint vertex_buffer_ = 0;
+	GLuint index_buffer_ = 0;
+	// 0, 1, 2, ... read once per draw through the base instance
+	GLuint draw_index_buffer_ = 0;
+	GLuint parameter_buffer_ = 0;
+	GLuint command_buffer_ = 0;
+	bool use_multi_draw_indirect_ = false;
+
+	size_t vertex_bytes_ = 0;
+	size_t vertex_capacity_bytes_ = 0;
+	size_t index_bytes_ = 0;
+	size_t index_capacity_bytes_ = 0;
+	std::vector<SharedMesh> meshes_;
+
+	// The draws of the current frame, and buffers kept across frames
+	std::vector<Draw> draws_;
+	std::vector<DrawParameters> parameters_;
+	std::vector<DrawCommand> commands_;
+};
+
+#endif // !SCENE_RENDERER
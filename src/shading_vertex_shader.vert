@@ -1,8 +1,12 @@
 #version 330 core
 
 // Input vertex data, different for all executions of this shader.
-layout(location = 0) in vec3 vertexPosition_modelspace;
+layout(location = 0) in vec3 vertexPosition_stored;
 layout(location = 1) in vec3 vertexNormal_modelspace;
+// Octahedral normal, only used by compact vertices
+layout(location = 2) in vec2 vertexNormal_octahedral;
+// The draw in "Draws", only used by meshes in the shared buffers
+layout(location = 3) in uint drawIndex;
 
 // Output data ; will be interpolated for each fragment.
 out vec3 Position_worldspace;
@@ -15,31 +19,95 @@ uniform mat4 MVP;
 uniform mat4 V;
 uniform mat4 M;
 uniform vec3 LightPosition_worldspace;
+// Compact positions are stored relative to the bounds of the mesh
+// (for float positions: offset is 0 and scale is 1)
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
+// True if the normal is octahedral-encoded
+uniform bool CompactNormals;
+
+// MAX_DRAWN_MARKERS is defined by the program when it loads the shader
+// (see shadingShaderDefines in draw_graphics.h)
+
+// The view matrices of all markers, written right before drawing
+layout(std140) uniform MarkerPoses {
+	mat4 MarkerView[MAX_DRAWN_MARKERS];
+};
+// The marker to draw on, or -1 to use "V" and "MVP"
+uniform int MarkerIndex;
+uniform mat4 P;
+
+// The values of each draw of the scene renderer, which replace
+// "M", "MarkerIndex" and the decoding of the positions
+// (the marker index is in the w of the offset)
+struct SceneDraw {
+	mat4 Model;
+	vec4 PositionOffset;
+	vec4 PositionScale;
+};
+layout(std140) uniform DrawParameters {
+	SceneDraw Draws[MAX_DRAWN_MARKERS];
+};
+// True if the mesh is drawn from the shared buffers
+uniform bool UseDrawParameters;
+
+// Unfold an octahedral-encoded normal
+vec3 decodeOctahedral(vec2 encoded) {
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	if (normal.z < 0.0) {
+		vec2 signs = vec2(
+			normal.x >= 0.0 ? 1.0 : -1.0,
+			normal.y >= 0.0 ? 1.0 : -1.0);
+		normal.xy = (1.0 - abs(normal.yx)) * signs;
+	}
+	return normalize(normal);
+}
 
 void main() {
+	mat4 model = M;
+	vec3 position_offset = PositionOffset;
+	vec3 position_scale = PositionScale;
+	bool compact_normals = CompactNormals;
+	int marker_index = MarkerIndex;
+	if (UseDrawParameters) {
+		// The shared buffers only hold compact vertices
+		model = Draws[drawIndex].Model;
+		position_offset = Draws[drawIndex].PositionOffset.xyz;
+		position_scale = Draws[drawIndex].PositionScale.xyz;
+		compact_normals = true;
+		marker_index = int(Draws[drawIndex].PositionOffset.w);
+	}
+
+	vec3 vertexPosition_modelspace =
+		position_offset + position_scale * vertexPosition_stored;
+	vec3 vertexNormal = compact_normals ?
+		decodeOctahedral(vertexNormal_octahedral) : vertexNormal_modelspace;
+
+	mat4 view = marker_index >= 0 ? MarkerView[marker_index] : V;
+	mat4 mvp = marker_index >= 0 ? P * view * model : MVP;
 
 	// Output position of the vertex, in clip space : MVP * position
-	gl_Position =  MVP * vec4(vertexPosition_modelspace,1);
+	gl_Position =  mvp * vec4(vertexPosition_modelspace,1);
 	
 	// Position of the vertex, in worldspace : M * position
-	Position_worldspace = (M * vec4(vertexPosition_modelspace,1)).xyz;
+	Position_worldspace = (model * vec4(vertexPosition_modelspace,1)).xyz;
 	
 	// Vector that goes from the vertex to the camera, in camera space.
 	// In camera space, the camera is at the origin (0,0,0).
 	vec3 vertexPosition_cameraspace =
-		(V * M * vec4(vertexPosition_modelspace,1)).xyz;
+		(view * model * vec4(vertexPosition_modelspace,1)).xyz;
 	EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;
 
 	// Vector that goes from the vertex to the light,
 	// in camera space. M is ommited because it's identity.
 	vec3 LightPosition_cameraspace =
-		(V * vec4(LightPosition_worldspace,1)).xyz;
+		(view * vec4(LightPosition_worldspace,1)).xyz;
 	LightDirection_cameraspace =
 		LightPosition_cameraspace + EyeDirection_cameraspace;
 	
 	// Normal of the the vertex, in camera space
 	// Only correct if ModelMatrix does not scale the model !
 	// Use its inverse transpose if not.
-	Normal_cameraspace = (V * M * vec4(vertexNormal_modelspace,0)).xyz; 
+	Normal_cameraspace = (view * model * vec4(vertexNormal,0)).xyz; 
 }
 
@@ -0,0 +1,131 @@
+// Implement the functions in synthetic_camera.h
+#include "synthetic_camera.h"
+#include "parameters.h"
+
+#include <cmath>
+#include <thread>
+
+#include <opencv2/aruco.hpp>
+
+namespace {
+
+// The side of the marker in the frame, in pixels
+const int marker_size = 200;
+// The white border around the marker
+const int quiet_zone = 40;
+
+} // namespace
+
+// Write the frame index and capture time into an 8-bit image
+void writeFrameStamp(
+	cv::Mat& image,
+	std::uint32_t frame_index,
+	std::uint32_t capture_time_us) {
+	std::uint64_t stamp_bits =
+		(static_cast<std::uint64_t>(frame_index) << 32) | capture_time_us;
+	for (int i = 0; i < FRAME_STAMP_NUM_OF_CELL; i++) {
+		bool bit = (stamp_bits >> (FRAME_STAMP_NUM_OF_CELL - 1 - i)) & 1;
+		cv::Scalar white = cv::Scalar::all(255);
+		cv::Scalar black = cv::Scalar::all(0);
+		cv::Rect cell(i * FRAME_STAMP_CELL_SIZE, 0,
+			FRAME_STAMP_CELL_SIZE, FRAME_STAMP_CELL_SIZE);
+		image(cell).setTo(bit ? white : black);
+		// The second row is inverted
+		cell.y = FRAME_STAMP_CELL_SIZE;
+		image(cell).setTo(bit ? black : white);
+	}
+}
+
+// Read the stamp back from an image
+bool readFrameStamp(
+	const cv::Mat& image,
+	std::uint32_t& output_frame_index,
+	std::uint32_t& output_capture_time_us) {
+	if (image.depth() != CV_8U ||
+		image.cols < FRAME_STAMP_NUM_OF_CELL * FRAME_STAMP_CELL_SIZE ||
+		image.rows < 2 * FRAME_STAMP_CELL_SIZE) {
+		return false;
+	}
+
+	// Sample the center of each cell (first channel only,
+	// since the stamp is black and white)
+	int center = FRAME_STAMP_CELL_SIZE / 2;
+	int channels = image.channels();
+	const unsigned char* first_row = image.ptr<unsigned char>(center);
+	const unsigned char* second_row =
+		image.ptr<unsigned char>(FRAME_STAMP_CELL_SIZE + center);
+	std::uint64_t stamp_bits = 0;
+	for (int i = 0; i < FRAME_STAMP_NUM_OF_CELL; i++) {
+		int x = (i * FRAME_STAMP_CELL_SIZE + center) * channels;
+		bool bit = first_row[x] > 127;
+		bool inverted_bit = second_row[x] > 127;
+		if (bit == inverted_bit) {
+			return false;
+		}
+		stamp_bits = (stamp_bits << 1) | (bit ? 1 : 0);
+	}
+
+	output_frame_index = static_cast<std::uint32_t>(stamp_bits >> 32);
+	output_capture_time_us = static_cast<std::uint32_t>(stamp_bits);
+	return true;
+}
+
+SyntheticCamera::SyntheticCamera(
+	cv::Size frame_size, double frame_rate, int marker_id)
+	: frame_size_(frame_size),
+	frame_interval_(std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(1.0 / frame_rate))) {
+	cv::aruco::drawMarker(
+		marker_dictionary, marker_id, marker_size, marker_image_);
+	cv::cvtColor(marker_image_, marker_image_, cv::COLOR_GRAY2BGR);
+}
+
+// Wait for the time of the next frame and generate it
+bool SyntheticCamera::read(
+	cv::Mat& output_frame,
+	std::uint32_t& output_frame_index,
+	std::int64_t& output_capture_time_ns) {
+	if (!has_started_) {
+		next_frame_time_ = Clock::now();
+		has_started_ = true;
+	}
+	// Like a real camera, a frame is not given before it is exposed,
+	// and frames which are not read in time are skipped
+	Clock::time_point now = Clock::now();
+	if (now < next_frame_time_) {
+		std::this_thread::sleep_until(next_frame_time_);
+	} else {
+		while (next_frame_time_ + frame_interval_ <= now) {
+			next_frame_time_ += frame_interval_;
+			frame_index_++;
+		}
+	}
+	Clock::time_point capture_time = next_frame_time_;
+	next_frame_time_ += frame_interval_;
+
+	output_frame.create(frame_size_, CV_8UC3);
+	output_frame.setTo(cv::Scalar::all(255));
+
+	// Move the marker around a circle, one round every 120 frames,
+	// in the lower part, so the model drawn on it never covers the stamp
+	int top = frame_size_.height / 3;
+	int range_x = frame_size_.width - marker_size - 2 * quiet_zone;
+	int range_y = frame_size_.height - top - marker_size - 2 * quiet_zone;
+	double angle = 2.0 * CV_PI * (frame_index_ % 120) / 120.0;
+	int x = quiet_zone +
+		static_cast<int>(0.5 * range_x * (1.0 + std::cos(angle)));
+	int y = top + quiet_zone +
+		static_cast<int>(0.5 * range_y * (1.0 + std::sin(angle)));
+	cv::Mat marker_area =
+		output_frame(cv::Rect(x, y, marker_size, marker_size));
+	marker_image_.copyTo(marker_area);
+
+	output_capture_time_ns =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			capture_time.time_since_epoch()).count();
+	writeFrameStamp(output_frame, frame_index_,
+		static_cast<std::uint32_t>(output_capture_time_ns / 1000));
+
+	output_frame_index = frame_index_++;
+	return true;
+}
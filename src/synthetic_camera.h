@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef SYNTHETIC_CAMERA
+#define SYNTHETIC_CAMERA
+
+#include <chrono>
+#include <cstdint>
+
+#include <opencv2/opencv.hpp>
+
+// The stamp is 2 rows of 64 cells in the top-left corner of a frame
+// The first row holds the frame index (32 bits) and the capture time
+// in microseconds (lower 32 bits), the second row holds the inverted bits
+#define FRAME_STAMP_CELL_SIZE 8
+#define FRAME_STAMP_NUM_OF_CELL 64
+
+// Write the frame index and capture time into an 8-bit image
+// (any number of channels)
+void writeFrameStamp(
+	cv::Mat& image,
+	std::uint32_t frame_index,
+	std::uint32_t capture_time_us);
+
+// Read the stamp back from an image (8-bit, 1 or 3 channels)
+// If the two rows do not match, return false
+bool readFrameStamp(
+	const cv::Mat& image,
+	std::uint32_t& output_frame_index,
+	std::uint32_t& output_capture_time_us);
+
+// A camera without camera
+// It gives BGR frames at a fixed rate, like cv::VideoCapture, with an
+// ArUco marker moving on a white background and the stamp of each frame
+class SyntheticCamera {
+public:
+	SyntheticCamera(
+		cv::Size frame_size, double frame_rate, int marker_id = 0);
+
+	// Wait for the time of the next frame and generate it
+	// The capture time is in std::chrono::steady_clock nanoseconds
+	bool read(
+		cv::Mat& output_frame,
+		std::uint32_t& output_frame_index,
+		std::int64_t& output_capture_time_ns);
+
+	cv::Size frameSize() const { return frame_size_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	cv::Size frame_size_;
+	Clock::duration frame_interval_;
+	cv::Mat marker_image_;
+	std::uint32_t frame_index_ = 0;
+	Clock::time_point next_frame_time_;
+	bool has_started_ = false;
+};
+
+#endif // !SYNTHETIC_CAMERA
@@ -0,0 +1,301 @@
+// Implement the functions in thread_placement.h
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+ThreadPlacement& mutableThreadPlacement() {
+	static ThreadPlacement placement;
+	return placement;
+}
+
+#ifdef __linux__
+// The CPUs of the process before anything was placed, for the stages
+// which may run anywhere (a new thread keeps the CPUs of its creator)
+cpu_set_t initial_cpu_set;
+bool has_initial_cpu_set = false;
+#endif
+
+const char* stageName(PipelineStage stage) {
+	switch (stage) {
+	case PipelineStage::Capture:
+		return "capture";
+	case PipelineStage::Detection:
+		return "detection";
+	default:
+		return "render";
+	}
+}
+
+// "2-5,7" for the CPUs 2, 3, 4, 5 and 7, "any" if empty
+std::string formatCpuList(const std::vector<int>& cpus) {
+	if (cpus.empty()) {
+		return "any";
+	}
+	std::vector<int> sorted_cpus = cpus;
+	std::sort(sorted_cpus.begin(), sorted_cpus.end());
+	std::string text;
+	for (size_t i = 0; i < sorted_cpus.size(); i++) {
+		size_t last = i;
+		while (last + 1 < sorted_cpus.size() &&
+			sorted_cpus[last + 1] == sorted_cpus[last] + 1) {
+			last++;
+		}
+		if (!text.empty()) {
+			text += ",";
+		}
+		text += std::to_string(sorted_cpus[i]);
+		if (last > i) {
+			text += "-" + std::to_string(sorted_cpus[last]);
+		}
+		i = last;
+	}
+	return text;
+}
+
+bool hasAnyPinnedStage(const ThreadPlacement& placement) {
+	return !placement.capture.cpus.empty() ||
+		!placement.detection.cpus.empty() ||
+		!placement.render.cpus.empty() ||
+		!placement.opencv_cpus.empty();
+}
+
+bool hasAnyFifoStage(const ThreadPlacement& placement) {
+	return placement.capture.use_fifo || placement.detection.use_fifo ||
+		placement.render.use_fifo;
+}
+
+#ifdef __linux__
+bool setCurrentThreadCpuSet(const cpu_set_t& cpu_set, const char* name) {
+	int error =
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+	if (error != 0) {
+		std::fprintf(stderr, "Failed to pin the %s thread: %s.\n",
+			name, std::strerror(error));
+		return false;
+	}
+	return true;
+}
+#endif
+
+// Run the calling thread only on the CPUs
+bool setCurrentThreadCpus(const std::vector<int>& cpus, const char* name) {
+#ifdef __linux__
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (int cpu : cpus) {
+		if (cpu < 0 || cpu >= CPU_SETSIZE) {
+			std::fprintf(stderr, "CPU %d of the %s thread is not valid.\n",
+				cpu, name);
+			return false;
+		}
+		CPU_SET(cpu, &cpu_set);
+	}
+	return setCurrentThreadCpuSet(cpu_set, name);
+#else
+	(void)cpus;
+	std::fprintf(stderr, "Pinning the %s thread needs Linux.\n", name);
+	return false;
+#endif
+}
+
+// Apply a placement to the calling thread
+bool applyStagePlacement(
+	const StagePlacement& stage_placement, const char* thread_name) {
+	const ThreadPlacement& placement = mutableThreadPlacement();
+#ifdef __linux__
+	// The kernel keeps 15 characters
+	pthread_setname_np(pthread_self(),
+		std::string(thread_name).substr(0, 15).c_str());
+#endif
+
+	bool is_placed = true;
+	if (!stage_placement.cpus.empty()) {
+		is_placed &= setCurrentThreadCpus(stage_placement.cpus, thread_name);
+	} else if (hasAnyPinnedStage(placement)) {
+		// Not the CPUs of the (pinned) thread which created this one
+#ifdef __linux__
+		if (has_initial_cpu_set) {
+			is_placed &= setCurrentThreadCpuSet(initial_cpu_set, thread_name);
+		}
+#endif
+	}
+
+	// A new thread also keeps the policy of its creator,
+	// so the other stages go back to the normal one
+	if (hasAnyFifoStage(placement)) {
+#ifdef __linux__
+		sched_param parameter;
+		parameter.sched_priority =
+			stage_placement.use_fifo ? stage_placement.fifo_priority : 0;
+		int error = pthread_setschedparam(pthread_self(),
+			stage_placement.use_fifo ? SCHED_FIFO : SCHED_OTHER, &parameter);
+		if (error != 0) {
+			std::fprintf(stderr,
+				"Failed to use SCHED_FIFO for the %s thread: %s.\n",
+				thread_name, std::strerror(error));
+			is_placed = false;
+		}
+#else
+		if (stage_placement.use_fifo) {
+			std::fprintf(stderr, "SCHED_FIFO for the %s thread needs Linux.\n",
+				thread_name);
+			is_placed = false;
+		}
+#endif
+	}
+	return is_placed;
+}
+
+} // namespace
+
+const StagePlacement& ThreadPlacement::stage(PipelineStage stage) const {
+	switch (stage) {
+	case PipelineStage::Capture:
+		return capture;
+	case PipelineStage::Detection:
+		return detection;
+	default:
+		return render;
+	}
+}
+
+StagePlacement& ThreadPlacement::stage(PipelineStage stage) {
+	return const_cast<StagePlacement&>(
+		static_cast<const ThreadPlacement&>(*this).stage(stage));
+}
+
+// Parse a CPU list such as "2-5,7"
+bool parseCpuList(const std::string& text, std::vector<int>& output_cpus) {
+	output_cpus.clear();
+	size_t start = 0;
+	while (start <= text.size()) {
+		size_t end = text.find(',', start);
+		if (end == std::string::npos) {
+			end = text.size();
+		}
+		std::string range = text.substr(start, end - start);
+		char* first_end = nullptr;
+		long first = std::strtol(range.c_str(), &first_end, 10);
+		long last = first;
+		if (first_end == range.c_str()) {
+			return false;
+		}
+		if (*first_end == '-') {
+			char* last_end = nullptr;
+			last = std::strtol(first_end + 1, &last_end, 10);
+			if (last_end == first_end + 1 || *last_end != '\0') {
+				return false;
+			}
+		} else if (*first_end != '\0') {
+			return false;
+		}
+		if (first < 0 || last < first) {
+			return false;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			output_cpus.push_back(static_cast<int>(cpu));
+		}
+		start = end + 1;
+	}
+	return !output_cpus.empty();
+}
+
+// Parse "<stage>=<CPU list>"
+bool parseStagePin(const std::string& argument, ThreadPlacement& placement) {
+	size_t separator = argument.find('=');
+	if (separator == std::string::npos) {
+		return false;
+	}
+	std::string stage = argument.substr(0, separator);
+	std::vector<int> cpus;
+	if (!parseCpuList(argument.substr(separator + 1), cpus)) {
+		return false;
+	}
+	if (stage == "capture") {
+		placement.capture.cpus = cpus;
+	} else if (stage == "detect") {
+		placement.detection.cpus = cpus;
+	} else if (stage == "render") {
+		placement.render.cpus = cpus;
+	} else if (stage == "opencv") {
+		placement.opencv_cpus = cpus;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Use this placement, and start OpenCV's threads on their CPUs
+void setThreadPlacement(const ThreadPlacement& placement) {
+	mutableThreadPlacement() = placement;
+#ifdef __linux__
+	if (!has_initial_cpu_set) {
+		has_initial_cpu_set = pthread_getaffinity_np(pthread_self(),
+			sizeof(initial_cpu_set), &initial_cpu_set) == 0;
+	}
+#endif
+
+	// The pool of OpenCV is stopped, and started again by the next call
+	if (placement.num_of_opencv_thread >= 0) {
+		cv::setNumThreads(placement.num_of_opencv_thread);
+	}
+	if (!placement.opencv_cpus.empty() && cv::getNumThreads() > 1) {
+#ifdef __linux__
+		if (has_initial_cpu_set &&
+			setCurrentThreadCpus(placement.opencv_cpus, "opencv")) {
+			cv::parallel_for_(cv::Range(0, cv::getNumThreads()),
+				[](const cv::Range&) {});
+			setCurrentThreadCpuSet(initial_cpu_set, "main");
+		}
+#else
+		std::fprintf(stderr, "Pinning the opencv threads needs Linux.\n");
+#endif
+	}
+}
+
+// The placement in use
+const ThreadPlacement& threadPlacement() {
+	return mutableThreadPlacement();
+}
+
+// Place the calling thread as a thread of the stage
+bool placeCurrentThread(PipelineStage stage, const char* thread_name) {
+	return applyStagePlacement(threadPlacement().stage(stage), thread_name);
+}
+
+// Run the calling thread on any CPU with the normal policy
+void unplaceCurrentThread(const char* thread_name) {
+	applyStagePlacement(StagePlacement(), thread_name);
+}
+
+// Print the placement of every stage and of OpenCV's threads
+void printThreadPlacement() {
+	const ThreadPlacement& placement = threadPlacement();
+	std::printf("Thread placement:\n");
+	for (PipelineStage stage : { PipelineStage::Capture,
+		PipelineStage::Detection, PipelineStage::Render }) {
+		const StagePlacement& stage_placement = placement.stage(stage);
+		std::string policy = stage_placement.use_fifo ?
+			"SCHED_FIFO " + std::to_string(stage_placement.fifo_priority) :
+			"SCHED_OTHER";
+		std::printf("  %-10s CPUs %-12s %s\n", stageName(stage),
+			formatCpuList(stage_placement.cpus).c_str(), policy.c_str());
+	}
+	const char* framework = cv::currentParallelFramework();
+	std::printf("  %-10s CPUs %-12s %d threads (%s)\n", "opencv",
+		formatCpuList(placement.opencv_cpus).c_str(), cv::getNumThreads(),
+		framework != nullptr ? framework : "no framework");
+}
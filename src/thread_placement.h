@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef THREAD_PLACEMENT
+#define THREAD_PLACEMENT
+
+#include <string>
+#include <vector>
+
+// The stages of the pipeline whose threads can be placed
+enum class PipelineStage {
+	// Camera readers and MJPEG decoders
+	Capture,
+	// The detection thread and the detection workers
+	Detection,
+	// The main thread, which draws and swaps
+	Render
+};
+
+// Where the threads of one stage run
+struct StagePlacement {
+	// The CPUs the threads may run on, empty for any CPU
+	std::vector<int> cpus;
+	// Run with SCHED_FIFO at "fifo_priority" (1 to 99), so the threads
+	// are not preempted by the other workloads of the machine
+	// It needs CAP_SYS_NICE (or a RLIMIT_RTPRIO), otherwise the thread
+	// keeps the normal policy and a warning is printed
+	bool use_fifo = false;
+	int fifo_priority = 10;
+};
+
+struct ThreadPlacement {
+	StagePlacement capture;
+	StagePlacement detection;
+	StagePlacement render;
+	// The threads of OpenCV's own parallel_for (e.g. in "cvtColor" and
+	// "findChessboardCorners"), 0 runs them on the calling thread,
+	// and a negative number keeps the default of OpenCV
+	int num_of_opencv_thread = -1;
+	// The CPUs OpenCV's threads run on, empty for any CPU
+	std::vector<int> opencv_cpus;
+
+	const StagePlacement& stage(PipelineStage stage) const;
+	StagePlacement& stage(PipelineStage stage);
+};
+
+// Parse a CPU list such as "2-5,7"
+// If it is not valid, return false
+bool parseCpuList(const std::string& text, std::vector<int>& output_cpus);
+
+// Parse one "--pin" argument "<stage>=<CPU list>",
+// where the stage is capture, detect, render or opencv
+// If it is not valid, return false
+bool parseStagePin(const std::string& argument, ThreadPlacement& placement);
+
+// Use this placement, and apply it to OpenCV's threads
+// OpenCV starts its workers on the first parallel call and they keep
+// the CPUs of the thread which started them, so they are started here
+// from a thread with "opencv_cpus"
+// It must be called before the threads of the pipeline start
+void setThreadPlacement(const ThreadPlacement& placement);
+
+// The placement in use (by default nothing is placed)
+const ThreadPlacement& threadPlacement();
+
+// Place the calling thread as a thread of the stage, and name it
+// (at most 15 characters are shown by tools such as top)
+// If a part cannot be applied, it is printed and return false
+bool placeCurrentThread(PipelineStage stage, const char* thread_name);
+
+// Run the calling thread on any CPU with the normal policy
+// A new thread keeps the placement of the thread which created it,
+// so a helper thread which is not a stage (e.g. a model loader
+// created by the render thread) calls it first
+void unplaceCurrentThread(const char* thread_name);
+
+// Print the placement of every stage and of OpenCV's threads
+void printThreadPlacement();
+
+#endif // !THREAD_PLACEMENT
@@ -0,0 +1,138 @@
+// Implement the functions in visibility.h
+#include "visibility.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_access.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+
+// Place a box mesh on the bounding box of another mesh
+glm::mat4 impostorTransform(const GpuMesh& mesh, const GpuMesh& box_mesh) {
+	glm::vec3 box_extent = glm::max(
+		box_mesh.bounds_max - box_mesh.bounds_min, glm::vec3(1e-6f));
+	glm::vec3 box_center = 0.5f * (box_mesh.bounds_min + box_mesh.bounds_max);
+	glm::vec3 mesh_center = 0.5f * (mesh.bounds_min + mesh.bounds_max);
+	return glm::translate(glm::mat4(), mesh_center) *
+		glm::scale(glm::mat4(),
+			(mesh.bounds_max - mesh.bounds_min) / box_extent) *
+		glm::translate(glm::mat4(), -box_center);
+}
+
+} // namespace
+
+// Test the bounding sphere of a mesh against the view frustum,
+// and measure its radius on screen
+DrawLevel classifyDraw(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	const glm::mat4& view_matrix,
+	const glm::mat4& projection_matrix,
+	int frame_height,
+	const CullingSettings& settings) {
+	// The bounding sphere in view space
+	glm::mat4 model_view = view_matrix * model_matrix;
+	glm::vec3 center = glm::vec3(model_view *
+		glm::vec4(0.5f * (mesh.bounds_min + mesh.bounds_max), 1.0f));
+	// Scaling makes the sphere larger by the longest axis
+	float scale = std::max(glm::length(glm::vec3(model_view[0])),
+		std::max(glm::length(glm::vec3(model_view[1])),
+			glm::length(glm::vec3(model_view[2]))));
+	float radius =
+		0.5f * glm::length(mesh.bounds_max - mesh.bounds_min) * scale;
+
+	// The 6 planes of the frustum, from the rows of the projection
+	// (left, right, bottom, top, near, far)
+	glm::vec4 rows[4] = {
+		glm::row(projection_matrix, 0), glm::row(projection_matrix, 1),
+		glm::row(projection_matrix, 2), glm::row(projection_matrix, 3)
+	};
+	for (int i = 0; i < 6; i++) {
+		glm::vec4 plane = (i % 2 == 0) ?
+			rows[3] + rows[i / 2] : rows[3] - rows[i / 2];
+		float length = glm::length(glm::vec3(plane));
+		float distance = (glm::dot(glm::vec3(plane), center) + plane.w) /
+			length;
+		if (distance < -radius) {
+			return DrawLevel::Culled;
+		}
+	}
+
+	// The camera looks down -z, a sphere which reaches the camera
+	// is large on screen anyway
+	float depth = -center.z;
+	if (depth <= radius) {
+		return DrawLevel::Full;
+	}
+	float pixel_radius = radius * projection_matrix[1][1] *
+		0.5f * frame_height / depth;
+	if (pixel_radius < settings.min_pixel_radius) {
+		return DrawLevel::Culled;
+	}
+	if (pixel_radius < settings.impostor_pixel_radius) {
+		return DrawLevel::Impostor;
+	}
+	return DrawLevel::Full;
+}
+
+// Draw the model of each marker, except the ones which cannot be seen
+void drawVisibleMarkerModels(
+	AssetManager& asset_manager,
+	const glm::mat4& model_matrix,
+	const std::vector<cv::Mat>& marker_poses,
+	const std::vector<int>& marker_ids,
+	const glm::mat4& projection_matrix,
+	int frame_height,
+	const CullingSettings& settings,
+	const GLuint& program_id,
+	CullingStatistics* output_statistics,
+	SceneRenderer* scene_renderer) {
+	// A mesh of the shared buffers is only collected here
+	auto drawOnMarker = [&](const GpuMesh& mesh,
+		const glm::mat4& mesh_model_matrix, size_t marker_index) {
+		if (scene_renderer != nullptr && mesh.scene_mesh >= 0) {
+			scene_renderer->addDraw(mesh, mesh_model_matrix, marker_index);
+		} else {
+			drawShadingMeshOnMarker(mesh, mesh_model_matrix, marker_index,
+				projection_matrix, program_id);
+		}
+	};
+
+	size_t num_of_marker = marker_poses.size();
+	for (size_t i = 0; i < num_of_marker; i++) {
+		const GpuMesh& mesh = asset_manager.meshForMarker(marker_ids[i]);
+		// The poses are already column-major for OpenGL
+		glm::mat4 view_matrix = glm::make_mat4(
+			reinterpret_cast<const GLfloat*>(marker_poses[i].data));
+
+		DrawLevel level = classifyDraw(mesh, model_matrix, view_matrix,
+			projection_matrix, frame_height, settings);
+		if (level == DrawLevel::Culled) {
+			if (output_statistics != nullptr) {
+				output_statistics->num_of_culled++;
+			}
+			continue;
+		}
+		if (level == DrawLevel::Impostor) {
+			const GpuMesh& box_mesh = asset_manager.placeholderMesh();
+			drawOnMarker(box_mesh,
+				model_matrix * impostorTransform(mesh, box_mesh), i);
+			if (output_statistics != nullptr) {
+				output_statistics->num_of_impostor++;
+			}
+			continue;
+		}
+
+		drawOnMarker(mesh, model_matrix, i);
+		if (output_statistics != nullptr) {
+			output_statistics->num_of_full++;
+		}
+	}
+
+	if (scene_renderer != nullptr) {
+		scene_renderer->submit(projection_matrix, program_id);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef VISIBILITY
+#define VISIBILITY
+
+#include "asset_manager.h"
+#include "draw_graphics.h"
+#include "scene_renderer.h"
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <opencv2/opencv.hpp>
+
+// How the model on a marker is drawn
+enum class DrawLevel {
+	// Outside the view frustum, or too small to see
+	Culled,
+	// Small on screen, its bounding box is drawn instead
+	Impostor,
+	Full
+};
+
+struct CullingSettings {
+	// Models whose bounding sphere is smaller than this radius
+	// on screen (in pixels of the frame) are not drawn
+	float min_pixel_radius = 2.0f;
+	// Models smaller than this are drawn as their bounding box
+	float impostor_pixel_radius = 8.0f;
+};
+
+// The number of draws of each level in a frame
+struct CullingStatistics {
+	size_t num_of_culled = 0;
+	size_t num_of_impostor = 0;
+	size_t num_of_full = 0;
+};
+
+// Test the bounding sphere of a mesh against the view frustum
+// (including the near plane), and measure its radius on screen
+// The view matrix is a marker pose, "frame_height" is in pixels
+DrawLevel classifyDraw(
+	const GpuMesh& mesh,
+	const glm::mat4& model_matrix,
+	const glm::mat4& view_matrix,
+	const glm::mat4& projection_matrix,
+	int frame_height,
+	const CullingSettings& settings);
+
+// Draw the model of each marker with the latched poses
+// (see "latchMarkerPoses"), except the ones which cannot be seen
+// The statistics are counted if "output_statistics" is not nullptr
+// The meshes in the shared buffers of "scene_renderer" (see
+// "AssetManager::setSceneRenderer") are submitted together at the end
+void drawVisibleMarkerModels(
+	AssetManager& asset_manager,
+	const glm::mat4& model_matrix,
+	const std::vector<cv::Mat>& marker_poses,
+	const std::vector<int>& marker_ids,
+	const glm::mat4& projection_matrix,
+	int frame_height,
+	const CullingSettings& settings,
+	const GLuint& program_id,
+	CullingStatistics* output_statistics = nullptr,
+	SceneRenderer* scene_renderer = nullptr);
+
+#endif // !VISIBILITY
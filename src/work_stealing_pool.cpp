@@ -0,0 +1,143 @@
+// Implement the class in work_stealing_pool.h
+#include "work_stealing_pool.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace {
+
+// The queue of the current thread in its pool, the others use the last one
+thread_local size_t current_queue_index = static_cast<size_t>(-1);
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned int num_of_worker) {
+	if (num_of_worker == 0) {
+		unsigned int num_of_core = std::thread::hardware_concurrency();
+		num_of_worker = num_of_core > 1 ? num_of_core - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i <= num_of_worker; i++) {
+		queues_.emplace_back(new TaskQueue());
+	}
+	for (unsigned int i = 0; i < num_of_worker; i++) {
+		workers_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		is_stopping_ = true;
+	}
+	wake_condition_.notify_all();
+	for (std::thread& worker : workers_) {
+		worker.join();
+	}
+}
+
+// Run "task(i)" for every i in [0, count), and return when all are done
+void WorkStealingPool::parallelFor(
+	size_t count,
+	const std::function<void(size_t)>& task) {
+	if (count == 0) {
+		return;
+	}
+	if (count == 1) {
+		task(0);
+		return;
+	}
+
+	std::atomic<size_t> num_of_remaining(count);
+	// The first exception of a task, thrown again on this thread
+	std::mutex exception_mutex;
+	std::exception_ptr first_exception;
+	// Counted before any task is visible, so a worker which takes one
+	// never decrements below zero
+	num_of_queued_task_.fetch_add(count);
+	// Spread the tasks over the queues, starting at a different one
+	// for every loop
+	size_t first_queue = next_queue_.fetch_add(1);
+	for (size_t i = 0; i < count; i++) {
+		TaskQueue& queue = *queues_[(first_queue + i) % queues_.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.emplace_back([&, i]() {
+			try {
+				task(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> exception_lock(exception_mutex);
+				if (!first_exception) {
+					first_exception = std::current_exception();
+				}
+			}
+			num_of_remaining.fetch_sub(1);
+		});
+	}
+	{
+		// Taking the lock keeps a worker from missing the wake-up
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+	}
+	wake_condition_.notify_all();
+
+	// Help instead of waiting, a task of this loop may still be queued
+	// The loop waits for every task even if one has thrown, since the
+	// others refer to this frame
+	size_t queue_index = current_queue_index < workers_.size() ?
+		current_queue_index : workers_.size();
+	while (num_of_remaining.load() > 0) {
+		if (!runOneTask(queue_index)) {
+			// The rest are running on other threads
+			std::this_thread::yield();
+		}
+	}
+	if (first_exception) {
+		std::rethrow_exception(first_exception);
+	}
+}
+
+// Run one task from the queue "queue_index", or steal one
+bool WorkStealingPool::runOneTask(size_t queue_index) {
+	std::function<void()> task;
+	size_t num_of_queue = queues_.size();
+	for (size_t i = 0; i < num_of_queue && !task; i++) {
+		TaskQueue& queue = *queues_[(queue_index + i) % num_of_queue];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+		// The own queue is used from the front, the others from the back
+		if (i == 0) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		} else {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+	}
+	if (!task) {
+		return false;
+	}
+
+	num_of_queued_task_.fetch_sub(1);
+	task();
+	return true;
+}
+
+void WorkStealingPool::workerLoop(size_t queue_index) {
+	current_queue_index = queue_index;
+	placeCurrentThread(PipelineStage::Detection, "detect-worker");
+	while (true) {
+		if (runOneTask(queue_index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_condition_.wait(lock, [this]() {
+			return is_stopping_ || num_of_queued_task_.load() > 0;
+		});
+		if (is_stopping_) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef WORK_STEALING_POOL
+#define WORK_STEALING_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A thread pool where every worker has its own queue of tasks
+// A worker takes tasks from the front of its own queue, and when it is
+// empty, steals from the back of the others, so uneven tasks (tiles with
+// many contours, markers which need more iterations) are balanced
+// The thread which waits for a parallel loop also runs tasks
+// Only one thread may run a loop on a pool at a time, and a task must
+// not start another loop on its pool: the waiting thread may run tasks
+// of the other loop, which would overwrite its thread_local detection
+// scratch buffers while it still uses them (the loops of
+// "detectMarkersAndEstimatePoseParallel" run one after the other)
+class WorkStealingPool {
+public:
+	// One worker per core except the calling thread if "num_of_worker" is 0
+	explicit WorkStealingPool(unsigned int num_of_worker = 0);
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	// Run "task(i)" for every i in [0, count), and return when all are done
+	// Not from a task of this pool, and not from two threads at once
+	// If a task throws, the others still run, and the first exception
+	// is thrown again on the calling thread
+	void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+	size_t numOfWorker() const { return workers_.size(); }
+
+private:
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	// Run one task from the queue "queue_index", or steal one
+	// If there is no task at all, return false
+	bool runOneTask(size_t queue_index);
+	void workerLoop(size_t queue_index);
+
+	// One queue per worker, and the last one for the other threads
+	std::vector<std::unique_ptr<TaskQueue>> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<size_t> next_queue_{ 0 };
+
+	std::atomic<size_t> num_of_queued_task_{ 0 };
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_condition_;
+	bool is_stopping_ = false;
+};
+
+#endif // !WORK_STEALING_POOL